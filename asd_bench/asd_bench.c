@@ -0,0 +1,1219 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "asd_bench.h"
+
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+// clang-format off
+#include <safe_mem_lib.h>
+#include <safe_str_lib.h>
+// clang-format on
+
+// JTAG byte-codes and TAP states used to build the scans, as the plugin
+// sends them.
+#define TAP_STATE_CMD 0x20
+#define TAP_STATE_RTI 0x01
+#define TAP_STATE_SHIFT_DR 0x04
+#define RW_SCAN_CMD 0xc0
+#define SCAN_LENGTH_MASK 0x3f
+#define I2C_BUS_SELECT_CMD 0x01
+#define I2C_READ_CMD 0x20
+#define I2C_FORCE_STOP 0x01
+#define AUTH_HDR_VERSION 0x30
+#define AUTH_HANDSHAKE_SUCCESS 0x30
+
+static const ASD_LogStream stream = ASD_LogStream_Test;
+static const ASD_LogOption option = ASD_LogOption_None;
+static const char* class_names[BENCH_CLASS_COUNT] = {"jtag", "i2c", "agent",
+                                                     "loopback"};
+// AGENT_CONTROL queries sent in turn, none of them carries data
+static const uint8_t agent_queries[] = {
+    NUM_IN_FLIGHT_MESSAGES_SUPPORTED_CMD, OBTAIN_DOWNSTREAM_VERSION_CMD,
+    MAX_DATA_SIZE_CMD, SUPPORTED_JTAG_CHAINS_CMD, SUPPORTED_I2C_BUSES_CMD};
+
+static bool continue_loop = true;
+
+#ifndef UNIT_TEST_MAIN
+int main(int argc, char** argv)
+{
+    return asd_bench_main(argc, argv);
+}
+#endif
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// interrupt handler for ctrl-c, outstanding responses are still collected
+static void interrupt_handler(int dummy)
+{
+    (void)dummy;
+    continue_loop = false;
+}
+
+uint16_t message_size(const struct message_header* header)
+{
+    return (uint16_t)(header->size_lsb | (header->size_msb << 8));
+}
+
+void set_message_size(struct message_header* header, uint16_t size)
+{
+    header->size_lsb = (uint8_t)(size & 0xff);
+    header->size_msb = (uint8_t)((size >> 8) & 0x1f);
+}
+
+//
+// Parse "<class>:<weight>[,...]" into a weight per message class.
+//
+bool parse_mix(const char* mix, unsigned int* weights)
+{
+    const char* pos = mix;
+    unsigned int total = 0;
+
+    if (mix == NULL || weights == NULL)
+        return false;
+
+    for (int i = 0; i < BENCH_CLASS_COUNT; i++)
+        weights[i] = 0;
+
+    while (*pos != '\0')
+    {
+        const char* colon = strchr(pos, ':');
+        char* end = NULL;
+        unsigned long weight;
+        int type;
+
+        if (colon == NULL)
+            return false;
+        for (type = 0; type < BENCH_CLASS_COUNT; type++)
+        {
+            size_t len = strlen(class_names[type]);
+            if ((size_t)(colon - pos) == len &&
+                strncmp(pos, class_names[type], len) == 0)
+                break;
+        }
+        if (type == BENCH_CLASS_COUNT)
+            return false;
+
+        weight = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || weight > MAX_MIX_WEIGHT ||
+            (*end != ',' && *end != '\0'))
+            return false;
+        weights[type] = (unsigned int)weight;
+        total += (unsigned int)weight;
+        pos = end;
+        if (*pos == ',')
+        {
+            pos++;
+            if (*pos == '\0')
+                return false;
+        }
+    }
+    return total != 0;
+}
+
+//
+// Lay out one round of the mix, every class weight times, interleaved so
+// that no class is sent in a burst (smooth weighted round robin). Returns
+// the length of the round.
+//
+unsigned int build_schedule(const unsigned int* weights,
+                            bench_class* schedule)
+{
+    int current[BENCH_CLASS_COUNT] = {0};
+    unsigned int total = 0;
+
+    for (int i = 0; i < BENCH_CLASS_COUNT; i++)
+        total += weights[i];
+    if (total > MAX_SCHEDULE_LENGTH)
+        return 0;
+
+    for (unsigned int slot = 0; slot < total; slot++)
+    {
+        int best = -1;
+        for (int i = 0; i < BENCH_CLASS_COUNT; i++)
+        {
+            if (weights[i] == 0)
+                continue;
+            current[i] += (int)weights[i];
+            if (best == -1 || current[i] > current[best])
+                best = i;
+        }
+        current[best] -= (int)total;
+        schedule[slot] = (bench_class)best;
+    }
+    return total;
+}
+
+//
+// Scan scan_bits through the DR in 64 bit read/write scans, from and back
+// to Run-Test/Idle.
+//
+bool build_jtag_message(struct asd_message* msg, unsigned int scan_bits)
+{
+    unsigned int size = 0;
+    uint8_t pattern = 0xa5;
+
+    if (msg == NULL || scan_bits == 0)
+        return false;
+
+    explicit_bzero(&msg->header, sizeof(msg->header));
+    msg->header.type = JTAG_TYPE;
+    msg->buffer[size++] = TAP_STATE_CMD | TAP_STATE_SHIFT_DR;
+    while (scan_bits)
+    {
+        unsigned int bits = scan_bits > MAX_SCAN_CHUNK_BITS
+                                ? MAX_SCAN_CHUNK_BITS
+                                : scan_bits;
+        unsigned int bytes = (bits + 7) / 8;
+        // the final TAP state byte still has to fit
+        if (size + 1 + bytes + 1 > MAX_DATA_SIZE)
+            return false;
+        msg->buffer[size++] = (unsigned char)(RW_SCAN_CMD |
+                                              (bits & SCAN_LENGTH_MASK));
+        for (unsigned int i = 0; i < bytes; i++)
+        {
+            msg->buffer[size++] = pattern;
+            pattern = (uint8_t)((pattern << 1) | (pattern >> 7));
+        }
+        scan_bits -= bits;
+    }
+    msg->buffer[size++] = TAP_STATE_CMD | TAP_STATE_RTI;
+    set_message_size(&msg->header, (uint16_t)size);
+    return true;
+}
+
+//
+// Select the bus and read one byte from address, the smallest transaction
+// that reaches the adapter.
+//
+bool build_i2c_message(struct asd_message* msg, uint8_t bus, uint8_t address)
+{
+    if (msg == NULL)
+        return false;
+
+    explicit_bzero(&msg->header, sizeof(msg->header));
+    msg->header.type = I2C_TYPE;
+    msg->buffer[0] = I2C_BUS_SELECT_CMD;
+    msg->buffer[1] = bus;
+    msg->buffer[2] = I2C_READ_CMD | 1;
+    msg->buffer[3] = (uint8_t)((address & 0xfe) | I2C_FORCE_STOP);
+    set_message_size(&msg->header, 4);
+    return true;
+}
+
+bool build_agent_message(struct asd_message* msg, uint64_t sequence)
+{
+    if (msg == NULL)
+        return false;
+
+    explicit_bzero(&msg->header, sizeof(msg->header));
+    msg->header.type = AGENT_CONTROL_TYPE;
+    msg->header.cmd_stat =
+        agent_queries[sequence % (sizeof(agent_queries) /
+                                  sizeof(agent_queries[0]))];
+    set_message_size(&msg->header, 0);
+    return true;
+}
+
+//
+// No delay, then the CRC the server checks: the XOR of the payload that
+// follows it, most significant byte first.
+//
+bool build_loopback_message(struct asd_message* msg, unsigned int size)
+{
+    uint32_t crc = 0;
+
+    if (msg == NULL || size < MIN_LOOPBACK_SIZE || size > MAX_DATA_SIZE)
+        return false;
+
+    explicit_bzero(&msg->header, sizeof(msg->header));
+    msg->header.type = AGENT_CONTROL_TYPE;
+    msg->header.cmd_stat = LOOPBACK_CMD;
+    msg->buffer[0] = 0;
+    for (unsigned int i = MIN_LOOPBACK_SIZE; i < size; i++)
+    {
+        msg->buffer[i] = (unsigned char)(i * 7);
+        crc ^= msg->buffer[i];
+    }
+    msg->buffer[1] = (unsigned char)(crc >> 24);
+    msg->buffer[2] = (unsigned char)(crc >> 16);
+    msg->buffer[3] = (unsigned char)(crc >> 8);
+    msg->buffer[4] = (unsigned char)crc;
+    set_message_size(&msg->header, (uint16_t)size);
+    return true;
+}
+
+bool stats_add(bench_stats* stats, uint64_t latency_ns)
+{
+    if (stats->count == stats->capacity)
+    {
+        uint64_t capacity = stats->capacity ? stats->capacity * 2 : 1024;
+        uint64_t* samples = (uint64_t*)realloc(stats->latency_ns,
+                                               capacity * sizeof(uint64_t));
+        if (samples == NULL)
+            return false;
+        stats->latency_ns = samples;
+        stats->capacity = capacity;
+    }
+    stats->latency_ns[stats->count++] = latency_ns;
+    return true;
+}
+
+static int compare_latency(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+//
+// Nearest-rank percentile, per_10k of 5000 is the median. Sorts the
+// samples in place.
+//
+uint64_t stats_percentile(bench_stats* stats, unsigned int per_10k)
+{
+    uint64_t rank;
+
+    if (stats->count == 0)
+        return 0;
+    qsort(stats->latency_ns, stats->count, sizeof(uint64_t), compare_latency);
+    rank = (stats->count * per_10k + 9999) / 10000;
+    if (rank == 0)
+        rank = 1;
+    if (rank > stats->count)
+        rank = stats->count;
+    return stats->latency_ns[rank - 1];
+}
+
+void stats_free(bench_stats* stats)
+{
+    free(stats->latency_ns);
+    stats->latency_ns = NULL;
+    stats->count = 0;
+    stats->capacity = 0;
+}
+
+static bool bench_write(bench_connection* conn, const void* data, size_t len)
+{
+    const unsigned char* pos = (const unsigned char*)data;
+
+    while (len)
+    {
+        ssize_t cnt;
+        if (conn->ssl)
+            cnt = SSL_write(conn->ssl, pos, (int)len);
+        else
+            cnt = send(conn->fd, pos, len, MSG_NOSIGNAL);
+        if (cnt <= 0)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "Failed to send to the server");
+            return false;
+        }
+        pos += cnt;
+        len -= (size_t)cnt;
+    }
+    return true;
+}
+
+static bool bench_read(bench_connection* conn, void* data, size_t len)
+{
+    unsigned char* pos = (unsigned char*)data;
+
+    while (len)
+    {
+        ssize_t cnt;
+        if (conn->ssl)
+            cnt = SSL_read(conn->ssl, pos, (int)len);
+        else
+            cnt = recv(conn->fd, pos, len, 0);
+        if (cnt <= 0)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "Connection closed by the server");
+            return false;
+        }
+        pos += cnt;
+        len -= (size_t)cnt;
+    }
+    return true;
+}
+
+static void bench_disconnect(bench_connection* conn)
+{
+    if (conn->ssl)
+    {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+    if (conn->ctx)
+    {
+        SSL_CTX_free(conn->ctx);
+        conn->ctx = NULL;
+    }
+    if (conn->fd != -1)
+    {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+static bool bench_connect(bench_connection* conn, asd_bench_args* args)
+{
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    struct addrinfo* ai;
+    char port[8];
+    int one = 1;
+
+    conn->fd = -1;
+    conn->ctx = NULL;
+    conn->ssl = NULL;
+    conn->log_capture = NULL;
+    conn->log_events = 0;
+    conn->log_bytes = 0;
+
+    explicit_bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", args->port);
+    if (getaddrinfo(args->host, port, &hints, &res) != 0)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option, "Can't resolve %s",
+                args->host);
+        return false;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        conn->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (conn->fd == -1)
+            continue;
+        if (connect(conn->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    freeaddrinfo(res);
+    if (conn->fd == -1)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Can't connect to %s:%u", args->host, args->port);
+        return false;
+    }
+    // latency is the point, don't let Nagle hold small messages back
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (args->use_tls)
+    {
+        // asd presents a self-signed certificate, it is not verified
+        conn->ctx = SSL_CTX_new(TLS_client_method());
+        if (conn->ctx)
+            conn->ssl = SSL_new(conn->ctx);
+        if (conn->ssl == NULL || SSL_set_fd(conn->ssl, conn->fd) != 1 ||
+            SSL_connect(conn->ssl) != 1)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "TLS handshake with %s:%u failed", args->host,
+                    args->port);
+            ERR_clear_error();
+            bench_disconnect(conn);
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+// The PAM handshake: header version and password out, header version and
+// result back.
+//
+static bool bench_handshake(bench_connection* conn, const char* password,
+                            unsigned char* result)
+{
+    unsigned char request[1 + MAX_PASSWORD_LEN];
+    unsigned char response[2];
+    size_t len;
+
+    len = strnlen(password, MAX_PASSWORD_LEN);
+    explicit_bzero(request, sizeof(request));
+    request[0] = AUTH_HDR_VERSION;
+    if (memcpy_s(&request[1], MAX_PASSWORD_LEN, password, len))
+        return false;
+    if (!bench_write(conn, request, 1 + len) ||
+        !bench_read(conn, response, sizeof(response)))
+    {
+        explicit_bzero(request, sizeof(request));
+        return false;
+    }
+    explicit_bzero(request, sizeof(request));
+    *result = response[1];
+    return true;
+}
+
+// auth_none exchanges nothing.
+static bool bench_authenticate(bench_connection* conn, asd_bench_args* args)
+{
+    unsigned char result;
+
+    if (args->password == NULL)
+        return true;
+
+    if (!bench_handshake(conn, args->password, &result))
+        return false;
+    if (result != AUTH_HANDSHAKE_SUCCESS)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Authentication refused by the server (0x%02x)", result);
+        return false;
+    }
+    return true;
+}
+
+//
+// The second client: connect, authenticate and hang up until the bench is
+// done. The session is taken, so the answer is busy, observer or failure,
+// any answer counts as a handshake.
+//
+static void* auth_load_thread(void* arg)
+{
+    bench_auth_load* load = (bench_auth_load*)arg;
+    bench_connection conn;
+
+    while (load->running)
+    {
+        unsigned char result;
+        uint64_t start = now_ns();
+        bool answered = false;
+
+        if (!bench_connect(&conn, load->args))
+        {
+            load->failures++;
+            break;
+        }
+        answered = bench_handshake(&conn, load->args->auth_load_password,
+                                   &result);
+        bench_disconnect(&conn);
+        if (!answered)
+        {
+            load->failures++;
+            continue;
+        }
+        load->handshakes++;
+        load->total_ns += now_ns() - start;
+    }
+    return NULL;
+}
+
+static bool start_auth_load(bench_auth_load* load, asd_bench_args* args)
+{
+    explicit_bzero(load, sizeof(*load));
+    load->args = args;
+    if (args->auth_load_password == NULL)
+        return true;
+    load->running = true;
+    if (pthread_create(&load->thread, NULL, auth_load_thread, load) != 0)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Can't start the authentication load");
+        load->running = false;
+        return false;
+    }
+    return true;
+}
+
+static void stop_auth_load(bench_auth_load* load)
+{
+    if (!load->running)
+        return;
+    load->running = false;
+    pthread_join(load->thread, NULL);
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "auth load: %llu handshakes, %.1f us average, %llu failed",
+            (unsigned long long)load->handshakes,
+            load->handshakes ? (double)load->total_ns / 1e3 /
+                                   (double)load->handshakes
+                             : 0,
+            (unsigned long long)load->failures);
+}
+
+//
+// Count the remote logs, so text and binary logging can be compared, and
+// save the binary records as a 2 byte length followed by the record.
+//
+static void bench_log_event(bench_connection* conn,
+                            const struct asd_message* msg, uint16_t size)
+{
+    remote_logging_config config;
+    unsigned char length[2];
+
+    conn->log_events++;
+    conn->log_bytes += sizeof(msg->header) + size;
+    if (conn->log_capture == NULL || size < 2)
+        return;
+    config.value = msg->buffer[1];
+    if (!config.binary)
+        return;
+    size -= 2;
+    length[0] = size & 0xff;
+    length[1] = size >> 8;
+    if (fwrite(length, sizeof(length), 1, conn->log_capture) != 1 ||
+        fwrite(&msg->buffer[2], size, 1, conn->log_capture) != 1)
+    {
+        ASD_log(ASD_LogLevel_Warning, stream, option,
+                "Failed to save a log record, capture stopped");
+        fclose(conn->log_capture);
+        conn->log_capture = NULL;
+    }
+}
+
+//
+// Read the next response to one of our messages. Events and remote log
+// messages the server pushes on its own are skipped, a response split with
+// ASD_PACKET_CONTINUATION is read up to its last part.
+//
+static bool bench_receive(bench_connection* conn, struct asd_message* msg,
+                          uint64_t* bytes)
+{
+    while (true)
+    {
+        uint16_t size;
+        if (!bench_read(conn, &msg->header, sizeof(msg->header)))
+            return false;
+        size = message_size(&msg->header);
+        if (size > MAX_DATA_SIZE)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "Response of %u bytes is too large", size);
+            return false;
+        }
+        if (size && !bench_read(conn, msg->buffer, size))
+            return false;
+        *bytes += sizeof(msg->header) + size;
+        if (msg->header.type == HARDWARE_LOG_EVENT)
+        {
+            bench_log_event(conn, msg, size);
+            continue;
+        }
+        if (msg->header.origin_id == BROADCAST_MESSAGE_ORIGIN_ID)
+            continue;
+        if (msg->header.cmd_stat & ASD_PACKET_CONTINUATION)
+            continue;
+        return true;
+    }
+}
+
+static bool bench_build(asd_bench_args* args, bench_class type,
+                        uint64_t sequence, struct asd_message* msg)
+{
+    switch (type)
+    {
+        case BENCH_JTAG:
+            return build_jtag_message(msg, args->scan_bits);
+        case BENCH_I2C:
+            return build_i2c_message(msg, args->i2c_bus, args->i2c_address);
+        case BENCH_AGENT:
+            return build_agent_message(msg, sequence);
+        case BENCH_LOOPBACK:
+            return build_loopback_message(msg, args->loopback_size);
+        default:
+            return false;
+    }
+}
+
+//
+// Ask the server how many messages it takes in flight and narrow the window
+// to it.
+//
+static bool negotiate_in_flight(bench_connection* conn, asd_bench_args* args)
+{
+    struct asd_message msg;
+    uint64_t bytes = 0;
+
+    build_agent_message(&msg, 0);
+    if (!bench_write(conn, &msg, sizeof(msg.header)) ||
+        !bench_receive(conn, &msg, &bytes))
+        return false;
+    if (msg.header.cmd_stat != ASD_SUCCESS || message_size(&msg.header) < 2)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Unexpected response to the in-flight query (0x%02x)",
+                msg.header.cmd_stat);
+        return false;
+    }
+    if (msg.buffer[1] && args->in_flight > msg.buffer[1])
+    {
+        ASD_log(ASD_LogLevel_Warning, stream, option,
+                "Server supports %u messages in flight, not %u",
+                msg.buffer[1], args->in_flight);
+        args->in_flight = msg.buffer[1];
+    }
+    return true;
+}
+
+//
+// Turn on remote logging for the session. Asking for binary records is only
+// a request, the server sets the bit in its log events when it honors it.
+//
+static bool configure_remote_log(bench_connection* conn, asd_bench_args* args)
+{
+    struct asd_message msg;
+    remote_logging_config config;
+    uint64_t bytes = 0;
+
+    if (!args->remote_log)
+        return true;
+    if (args->log_capture)
+    {
+        conn->log_capture = fopen(args->log_capture, "wb");
+        if (conn->log_capture == NULL)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option, "Can't create %s",
+                    args->log_capture);
+            return false;
+        }
+    }
+    // asd's remote levels are numbered like ours
+    config.value = 0;
+    config.logging_level = args->remote_log_level;
+    config.binary = args->binary_log;
+
+    explicit_bzero(&msg.header, sizeof(msg.header));
+    msg.header.type = AGENT_CONTROL_TYPE;
+    msg.header.cmd_stat = AGENT_CONFIGURATION_CMD;
+    msg.buffer[0] = AGENT_CONFIG_TYPE_LOGGING;
+    msg.buffer[1] = config.value;
+    set_message_size(&msg.header, 2);
+    if (!bench_write(conn, &msg, sizeof(msg.header) + 2) ||
+        !bench_receive(conn, &msg, &bytes))
+        return false;
+    if (msg.header.cmd_stat != ASD_SUCCESS)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Remote logging was refused (0x%02x)", msg.header.cmd_stat);
+        return false;
+    }
+    return true;
+}
+
+static void close_remote_log(bench_connection* conn, asd_bench_args* args)
+{
+    if (conn->log_capture)
+    {
+        fclose(conn->log_capture);
+        conn->log_capture = NULL;
+    }
+    if (args->remote_log)
+        ASD_log(ASD_LogLevel_Info, stream, option,
+                "remote log: %llu events, %llu bytes",
+                (unsigned long long)conn->log_events,
+                (unsigned long long)conn->log_bytes);
+}
+
+static bool check_response(const struct asd_message* sent,
+                           const struct asd_message* received,
+                           const bench_pending* pending)
+{
+    if (received->header.tag != pending->tag)
+        return false;
+    if (pending->type == BENCH_LOOPBACK)
+    {
+        // the whole message comes back, header included
+        uint16_t size = message_size(&sent->header);
+        int diff = 1;
+        if (received->header.cmd_stat != LOOPBACK_CMD ||
+            message_size(&received->header) != size ||
+            memcmp_s(received->buffer, size, sent->buffer, size, &diff) ||
+            diff != 0)
+            return false;
+        return true;
+    }
+    return received->header.cmd_stat == ASD_SUCCESS;
+}
+
+static void print_results(asd_bench_args* args, bench_stats* stats,
+                          uint64_t elapsed_ns)
+{
+    bench_stats total;
+    double seconds = (double)elapsed_ns / 1e9;
+
+    explicit_bzero(&total, sizeof(total));
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "%-9s %10s %8s %10s %10s %10s %10s %12s", "class", "count",
+            "errors", "p50_us", "p99_us", "p999_us", "max_us", "msg/s");
+    for (int i = 0; i <= BENCH_CLASS_COUNT; i++)
+    {
+        bench_stats* s = i < BENCH_CLASS_COUNT ? &stats[i] : &total;
+        if (s->count == 0 && s->errors == 0)
+            continue;
+        ASD_log(ASD_LogLevel_Info, stream, option,
+                "%-9s %10llu %8llu %10.1f %10.1f %10.1f %10.1f %12.0f",
+                i < BENCH_CLASS_COUNT ? class_names[i] : "total",
+                (unsigned long long)s->count, (unsigned long long)s->errors,
+                (double)stats_percentile(s, 5000) / 1e3,
+                (double)stats_percentile(s, 9900) / 1e3,
+                (double)stats_percentile(s, 9990) / 1e3,
+                (double)stats_percentile(s, 10000) / 1e3,
+                seconds > 0 ? (double)s->count / seconds : 0);
+        if (i == BENCH_CLASS_COUNT)
+            break;
+        for (uint64_t n = 0; n < s->count; n++)
+            stats_add(&total, s->latency_ns[n]);
+        total.errors += s->errors;
+        total.bytes_sent += s->bytes_sent;
+        total.bytes_received += s->bytes_received;
+    }
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "%.3f s with %u in flight over %s: sent %llu bytes, received "
+            "%llu bytes, %.0f bytes/s",
+            seconds, args->in_flight, args->use_tls ? "TLS" : "TCP",
+            (unsigned long long)total.bytes_sent,
+            (unsigned long long)total.bytes_received,
+            seconds > 0 ? (double)(total.bytes_sent + total.bytes_received) /
+                              seconds
+                        : 0);
+    stats_free(&total);
+}
+
+//
+// Keep the window full: send until in_flight messages are outstanding, then
+// wait for the oldest response before sending the next message.
+//
+static bool run_bench(bench_connection* conn, asd_bench_args* args,
+                      bench_stats* stats, uint64_t* elapsed_ns)
+{
+    bench_pending pending[MAX_BENCH_IN_FLIGHT];
+    struct asd_message* sent;
+    struct asd_message received;
+    unsigned int head = 0;
+    unsigned int outstanding = 0;
+    uint64_t sequence = 0;
+    uint64_t completed = 0;
+    uint64_t start = now_ns();
+    uint64_t stop = start + (uint64_t)args->duration * 1000000000ULL;
+    bool result = true;
+
+    // keep what was sent for the loopback payload check
+    sent = (struct asd_message*)calloc(MAX_BENCH_IN_FLIGHT,
+                                       sizeof(struct asd_message));
+    if (sent == NULL)
+        return false;
+
+    while (result)
+    {
+        bool sending = continue_loop &&
+                       (args->duration ? now_ns() < stop
+                                       : sequence < args->count);
+        if (sending && outstanding < args->in_flight)
+        {
+            unsigned int slot = (head + outstanding) % MAX_BENCH_IN_FLIGHT;
+            bench_class type =
+                args->schedule[sequence % args->schedule_length];
+            struct asd_message* msg = &sent[slot];
+            uint16_t size;
+
+            if (!bench_build(args, type, sequence, msg))
+            {
+                ASD_log(ASD_LogLevel_Error, stream, option,
+                        "Failed to build a %s message", class_names[type]);
+                result = false;
+                break;
+            }
+            msg->header.tag = (uint8_t)(sequence & BENCH_TAG_MASK);
+            size = message_size(&msg->header);
+            pending[slot].type = type;
+            pending[slot].tag = msg->header.tag;
+            pending[slot].sent_ns = now_ns();
+            if (!bench_write(conn, msg, sizeof(msg->header) + size))
+            {
+                result = false;
+                break;
+            }
+            stats[type].bytes_sent += sizeof(msg->header) + size;
+            outstanding++;
+            sequence++;
+            continue;
+        }
+        if (outstanding == 0)
+            break;
+
+        bench_pending* oldest = &pending[head];
+        uint64_t bytes = 0;
+        if (!bench_receive(conn, &received, &bytes))
+        {
+            result = false;
+            break;
+        }
+        stats[oldest->type].bytes_received += bytes;
+        if (check_response(&sent[head], &received, oldest))
+        {
+            if (!stats_add(&stats[oldest->type], now_ns() - oldest->sent_ns))
+                result = false;
+        }
+        else
+        {
+            stats[oldest->type].errors++;
+            ASD_log(ASD_LogLevel_Debug, stream, option,
+                    "%s message %llu failed: tag %u/%u status 0x%02x",
+                    class_names[oldest->type],
+                    (unsigned long long)(completed), received.header.tag,
+                    oldest->tag, received.header.cmd_stat);
+        }
+        completed++;
+        head = (head + 1) % MAX_BENCH_IN_FLIGHT;
+        outstanding--;
+    }
+
+    *elapsed_ns = now_ns() - start;
+    free(sent);
+    return result;
+}
+
+bool parse_arguments(int argc, char** argv, asd_bench_args* args)
+{
+    int c = 0;
+    unsigned long value;
+    opterr = 0; // prevent getopt_long from printing shell messages
+
+    // Set Default argument values.
+    args->host = DEFAULT_BENCH_HOST;
+    args->port = DEFAULT_BENCH_PORT;
+    args->use_tls = true;
+    args->password = NULL;
+    args->auth_load_password = NULL;
+    args->in_flight = DEFAULT_BENCH_IN_FLIGHT;
+    args->count = DEFAULT_BENCH_COUNT;
+    args->duration = 0;
+    args->scan_bits = DEFAULT_BENCH_SCAN_BITS;
+    args->loopback_size = DEFAULT_BENCH_LOOPBACK_SIZE;
+    args->i2c_bus = DEFAULT_BENCH_I2C_BUS;
+    args->i2c_address = DEFAULT_BENCH_I2C_ADDRESS;
+    args->log_level = DEFAULT_LOG_LEVEL;
+    args->log_streams = DEFAULT_LOG_STREAMS;
+    args->remote_log = false;
+    args->remote_log_level = ASD_LogLevel_Off;
+    args->binary_log = false;
+    args->log_capture = NULL;
+    parse_mix(DEFAULT_BENCH_MIX, args->mix);
+    args->schedule_length = 0;
+
+    enum
+    {
+        ARG_PASSWORD = 256,
+        ARG_MIX,
+        ARG_DURATION,
+        ARG_SCAN_BITS,
+        ARG_LOOPBACK_SIZE,
+        ARG_I2C_BUS,
+        ARG_I2C_ADDRESS,
+        ARG_LOG_LEVEL,
+        ARG_LOG_STREAMS,
+        ARG_AUTH_LOAD,
+        ARG_REMOTE_LOG,
+        ARG_BINARY_LOG,
+        ARG_LOG_CAPTURE,
+        ARG_HELP
+    };
+
+    struct option opts[] = {
+        {"password", 1, NULL, ARG_PASSWORD},
+        {"mix", 1, NULL, ARG_MIX},
+        {"duration", 1, NULL, ARG_DURATION},
+        {"scan-bits", 1, NULL, ARG_SCAN_BITS},
+        {"loopback-size", 1, NULL, ARG_LOOPBACK_SIZE},
+        {"i2c-bus", 1, NULL, ARG_I2C_BUS},
+        {"i2c-address", 1, NULL, ARG_I2C_ADDRESS},
+        {"log-level", 1, NULL, ARG_LOG_LEVEL},
+        {"log-streams", 1, NULL, ARG_LOG_STREAMS},
+        {"auth-load", 1, NULL, ARG_AUTH_LOAD},
+        {"remote-log", 1, NULL, ARG_REMOTE_LOG},
+        {"binary-log", 0, NULL, ARG_BINARY_LOG},
+        {"log-capture", 1, NULL, ARG_LOG_CAPTURE},
+        {"help", 0, NULL, ARG_HELP},
+        {NULL, 0, NULL, 0},
+    };
+
+    while ((c = getopt_long(argc, argv, "p:un:c:?", opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'p':
+                value = strtoul(optarg, NULL, 10);
+                if (value == 0 || value > UINT16_MAX)
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                args->port = (uint16_t)value;
+                break;
+            case 'u':
+                args->use_tls = false;
+                break;
+            case 'n':
+                value = strtoul(optarg, NULL, 10);
+                if (value == 0 || value > MAX_BENCH_IN_FLIGHT)
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                args->in_flight = (unsigned int)value;
+                break;
+            case 'c':
+                args->count = strtoull(optarg, NULL, 10);
+                args->duration = 0;
+                if (args->count == 0)
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                break;
+            case ARG_PASSWORD:
+                args->password = optarg;
+                break;
+            case ARG_AUTH_LOAD:
+                args->auth_load_password = optarg;
+                break;
+            case ARG_MIX:
+                if (!parse_mix(optarg, args->mix))
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                break;
+            case ARG_DURATION:
+                args->duration = (unsigned int)strtoul(optarg, NULL, 10);
+                if (args->duration == 0)
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                break;
+            case ARG_SCAN_BITS:
+                args->scan_bits = (unsigned int)strtoul(optarg, NULL, 10);
+                if (args->scan_bits == 0)
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                break;
+            case ARG_LOOPBACK_SIZE:
+                args->loopback_size = (unsigned int)strtoul(optarg, NULL, 10);
+                if (args->loopback_size < MIN_LOOPBACK_SIZE ||
+                    args->loopback_size > MAX_DATA_SIZE)
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                break;
+            case ARG_I2C_BUS:
+                args->i2c_bus = (uint8_t)strtoul(optarg, NULL, 10);
+                break;
+            case ARG_I2C_ADDRESS:
+                args->i2c_address = (uint8_t)strtoul(optarg, NULL, 16);
+                break;
+            case ARG_LOG_LEVEL:
+                if (!strtolevel(optarg, &args->log_level))
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                break;
+            case ARG_LOG_STREAMS:
+                if (!strtostreams(optarg, &args->log_streams))
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                break;
+            case ARG_REMOTE_LOG:
+                if (!strtolevel(optarg, &args->remote_log_level))
+                {
+                    showUsage(argv);
+                    return false;
+                }
+                args->remote_log = true;
+                break;
+            case ARG_BINARY_LOG:
+                args->binary_log = true;
+                break;
+            case ARG_LOG_CAPTURE:
+                args->log_capture = optarg;
+                break;
+            case '?':
+            case ARG_HELP:
+            default:
+                showUsage(argv);
+                return false;
+        }
+    }
+    if (optind < argc)
+        args->host = argv[optind];
+
+    // records are only captured from a binary remote log
+    if (args->log_capture && !(args->remote_log && args->binary_log))
+    {
+        showUsage(argv);
+        return false;
+    }
+
+    args->schedule_length = build_schedule(args->mix, args->schedule);
+    if (args->schedule_length == 0)
+    {
+        showUsage(argv);
+        return false;
+    }
+
+    if (args->mix[BENCH_JTAG])
+    {
+        struct asd_message msg;
+        if (!build_jtag_message(&msg, args->scan_bits))
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "%u bits of scan don't fit in one message",
+                    args->scan_bits);
+            return false;
+        }
+    }
+    return true;
+}
+
+void showUsage(char** argv)
+{
+    ASD_log(ASD_LogLevel_Error, stream, option,
+            "\nVersion: %s \n"
+            "Usage: %s [option] [host]\n\n"
+            "  -p <port>   Port of the asd server (default: %d)\n"
+            "  -u          Plain TCP instead of TLS (asd -u)\n"
+            "  -n <number> Messages kept in flight (default: %d) (max: %d)\n"
+            "  -c <number> Number of messages to send (default: %d)\n"
+            "\n"
+            "  --password=<password>   Authenticate with PAM (default: "
+            "auth_none)\n"
+            "  --mix=<class>:<weight>[,...]\n"
+            "                          Relative weight of each message "
+            "class:\n"
+            "                          jtag, i2c, agent, loopback (default: "
+            "%s)\n"
+            "  --duration=<seconds>    Run for a time instead of a count\n"
+            "  --scan-bits=<bits>      DR bits scanned per JTAG message "
+            "(default: %d)\n"
+            "  --loopback-size=<bytes> Size of LOOPBACK_CMD messages "
+            "(default: %d)\n"
+            "  --i2c-bus=<bus>         I2C bus read from (default: %d)\n"
+            "  --i2c-address=<hex>     8 bit I2C address read from (default: "
+            "0x%x)\n"
+            "  --log-level=<level>     Specify Logging Level (default: %s)\n"
+            "  --log-streams=<streams> Specify Logging Streams (default: "
+            "%s)\n"
+            "  --auth-load=<password>  Meanwhile authenticate a second "
+            "client\n"
+            "                          over and over with this password\n"
+            "  --remote-log=<level>    Have asd send its logs from this level\n"
+            "  --binary-log            As binary records rather than text\n"
+            "  --log-capture=<file>    Save the records for asd_log_decode\n"
+            "  --help                  Show this list\n"
+            "\n"
+            "Examples:\n"
+            "\n"
+            "Measure the daemon itself, against its simulated TAP chain.\n"
+            "     asd -u --jtag-sim &\n"
+            "     asd_bench -u -n 8 --mix=jtag:8,agent:1,loopback:1\n"
+            "Compare the latency while another client authenticates.\n"
+            "     asd_bench --password=<pw> --auth-load=<pw> --duration=10\n"
+            "Compare text and binary remote logs, then read the records.\n"
+            "     asd_bench --remote-log=Debug --binary-log --log-capture=log\n"
+            "     asd_log_decode /usr/bin/asd log\n"
+            "\n",
+            asd_version, argv[0], DEFAULT_BENCH_PORT, DEFAULT_BENCH_IN_FLIGHT,
+            MAX_BENCH_IN_FLIGHT, DEFAULT_BENCH_COUNT, DEFAULT_BENCH_MIX,
+            DEFAULT_BENCH_SCAN_BITS, DEFAULT_BENCH_LOOPBACK_SIZE,
+            DEFAULT_BENCH_I2C_BUS, DEFAULT_BENCH_I2C_ADDRESS,
+            ASD_LogLevelString[DEFAULT_LOG_LEVEL],
+            streamtostring(DEFAULT_LOG_STREAMS));
+}
+
+int asd_bench_main(int argc, char** argv)
+{
+    bench_stats stats[BENCH_CLASS_COUNT];
+    bench_auth_load load;
+    bench_connection conn;
+    asd_bench_args args;
+    uint64_t elapsed_ns = 0;
+    bool result;
+
+    signal(SIGINT, interrupt_handler); // catch ctrl-c
+    signal(SIGPIPE, SIG_IGN);
+
+    ASD_initialize_log_settings(DEFAULT_LOG_LEVEL, DEFAULT_LOG_STREAMS, false,
+                                false, NULL, NULL);
+
+    result = parse_arguments(argc, argv, &args);
+
+    ASD_initialize_log_settings(args.log_level, args.log_streams, false, false,
+                                NULL, NULL);
+
+    if (!result)
+        return -1;
+
+    if (!bench_connect(&conn, &args))
+        return -1;
+
+    explicit_bzero(stats, sizeof(stats));
+    explicit_bzero(&load, sizeof(load));
+    result = bench_authenticate(&conn, &args) &&
+             negotiate_in_flight(&conn, &args) &&
+             configure_remote_log(&conn, &args) &&
+             start_auth_load(&load, &args) &&
+             run_bench(&conn, &args, stats, &elapsed_ns);
+
+    stop_auth_load(&load);
+    close_remote_log(&conn, &args);
+    bench_disconnect(&conn);
+    print_results(&args, stats, elapsed_ns);
+    for (int i = 0; i < BENCH_CLASS_COUNT; i++)
+    {
+        if (stats[i].errors)
+            result = false;
+        stats_free(&stats[i]);
+    }
+    return result ? 0 : -1;
+}
@@ -0,0 +1,185 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _ASD_BENCH_H_
+#define _ASD_BENCH_H_
+
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "asd_common.h"
+#include "logging.h"
+
+// Load generator for the ASD network protocol. It connects to a running asd
+// the way the debugger host does, keeps a window of messages in flight and
+// measures the round trip of every one of them.
+
+#define DEFAULT_BENCH_HOST "127.0.0.1"
+#define DEFAULT_BENCH_PORT 5123
+#define DEFAULT_BENCH_IN_FLIGHT 1
+#define DEFAULT_BENCH_COUNT 10000
+#define DEFAULT_BENCH_SCAN_BITS 256
+#define DEFAULT_BENCH_LOOPBACK_SIZE 64
+#define DEFAULT_BENCH_I2C_BUS 0
+#define DEFAULT_BENCH_I2C_ADDRESS 0xa0
+#define DEFAULT_BENCH_MIX "jtag:1"
+#define DEFAULT_LOG_LEVEL ASD_LogLevel_Info
+#define DEFAULT_LOG_STREAMS ASD_LogStream_Test
+
+// The server answers in order, so responses are matched first in first out
+// and the 3 bit tag only catches a lost or duplicated response. The window
+// is further limited to what NUM_IN_FLIGHT_MESSAGES_SUPPORTED_CMD reports.
+#define MAX_BENCH_IN_FLIGHT 64
+#define BENCH_TAG_MASK 0x7
+// smallest loopback message: delay and CRC
+#define MIN_LOOPBACK_SIZE 5
+#define MAX_SCAN_CHUNK_BITS 64
+#define MAX_PASSWORD_LEN 128
+#define MAX_MIX_WEIGHT 100
+#define MAX_SCHEDULE_LENGTH (MAX_MIX_WEIGHT * BENCH_CLASS_COUNT)
+
+typedef enum
+{
+    BENCH_JTAG = 0,
+    BENCH_I2C,
+    BENCH_AGENT,
+    BENCH_LOOPBACK,
+    BENCH_CLASS_COUNT
+} bench_class;
+
+typedef struct asd_bench_args
+{
+    char* host;
+    uint16_t port;
+    bool use_tls;
+    // PAM handshake when set, auth_none otherwise
+    char* password;
+    // a second client authenticating over and over with this password
+    // while the bench runs
+    char* auth_load_password;
+    unsigned int in_flight;
+    // run until count messages completed, or for duration seconds
+    uint64_t count;
+    unsigned int duration;
+    // relative weight of each message class, and the order one round of
+    // the mix sends them in
+    unsigned int mix[BENCH_CLASS_COUNT];
+    bench_class schedule[MAX_SCHEDULE_LENGTH];
+    unsigned int schedule_length;
+    unsigned int scan_bits;
+    unsigned int loopback_size;
+    uint8_t i2c_bus;
+    uint8_t i2c_address;
+    ASD_LogLevel log_level;
+    ASD_LogStream log_streams;
+    // remote logs asked of the server, as text or as binary records, and
+    // where the binary records are saved for asd_log_decode
+    bool remote_log;
+    ASD_LogLevel remote_log_level;
+    bool binary_log;
+    char* log_capture;
+} asd_bench_args;
+
+typedef struct bench_connection
+{
+    int fd;
+    SSL_CTX* ctx;
+    SSL* ssl;
+    FILE* log_capture;
+    uint64_t log_events;
+    uint64_t log_bytes;
+} bench_connection;
+
+typedef struct bench_stats
+{
+    uint64_t* latency_ns;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t errors;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+} bench_stats;
+
+// A message waiting for its response.
+typedef struct bench_pending
+{
+    bench_class type;
+    uint8_t tag;
+    uint64_t sent_ns;
+} bench_pending;
+
+// Handshakes of the second client, to see whether authenticating it holds
+// up the session being measured.
+typedef struct bench_auth_load
+{
+    asd_bench_args* args;
+    pthread_t thread;
+    volatile bool running;
+    uint64_t handshakes;
+    uint64_t failures;
+    uint64_t total_ns;
+} bench_auth_load;
+
+#ifndef UNIT_TEST_MAIN
+int main(int argc, char** argv);
+#endif
+
+int asd_bench_main(int argc, char** argv);
+
+bool parse_arguments(int argc, char** argv, asd_bench_args* args);
+
+bool parse_mix(const char* mix, unsigned int* weights);
+
+void showUsage(char** argv);
+
+uint16_t message_size(const struct message_header* header);
+
+void set_message_size(struct message_header* header, uint16_t size);
+
+bool build_jtag_message(struct asd_message* msg, unsigned int scan_bits);
+
+bool build_i2c_message(struct asd_message* msg, uint8_t bus,
+                       uint8_t address);
+
+bool build_agent_message(struct asd_message* msg, uint64_t sequence);
+
+bool build_loopback_message(struct asd_message* msg, unsigned int size);
+
+unsigned int build_schedule(const unsigned int* weights,
+                            bench_class* schedule);
+
+bool stats_add(bench_stats* stats, uint64_t latency_ns);
+
+uint64_t stats_percentile(bench_stats* stats, unsigned int per_10k);
+
+void stats_free(bench_stats* stats);
+
+#endif // _ASD_BENCH_H_
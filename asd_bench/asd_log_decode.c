@@ -0,0 +1,438 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Prints the binary remote log records asd_bench saved with --log-capture.
+// The records carry a hash of their format string rather than the string,
+// the strings are found by hashing every string in the asd binary that sent
+// them.
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+// shortest string taken for a format from the binary
+#define MIN_FORMAT_LENGTH 4
+#define MAX_SPEC_LENGTH 32
+
+typedef struct log_format
+{
+    uint32_t id;
+    const char* format;
+} log_format;
+
+typedef struct log_formats
+{
+    char* image;
+    log_format* formats;
+    size_t count;
+} log_formats;
+
+typedef struct record_cursor
+{
+    const unsigned char* data;
+    size_t left;
+} record_cursor;
+
+static unsigned char* read_file(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    unsigned char* data = NULL;
+    long length;
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "Can't open %s\n", path);
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 &&
+        fseek(file, 0, SEEK_SET) == 0)
+    {
+        // one more byte so the last string is always terminated
+        data = (unsigned char*)calloc((size_t)length + 1, 1);
+        if (data && fread(data, 1, (size_t)length, file) != (size_t)length)
+        {
+            free(data);
+            data = NULL;
+        }
+        *size = (size_t)length;
+    }
+    fclose(file);
+    if (data == NULL)
+        fprintf(stderr, "Can't read %s\n", path);
+    return data;
+}
+
+static int compare_formats(const void* a, const void* b)
+{
+    uint32_t x = ((const log_format*)a)->id;
+    uint32_t y = ((const log_format*)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+//
+// Every NUL terminated run of printable characters in the binary could be a
+// format string, hash them all.
+//
+static bool load_formats(const char* path, log_formats* formats)
+{
+    size_t size = 0;
+    size_t start = 0;
+
+    formats->image = (char*)read_file(path, &size);
+    formats->formats = NULL;
+    formats->count = 0;
+    if (formats->image == NULL)
+        return false;
+    for (size_t i = 0; i <= size; i++)
+    {
+        unsigned char c = (unsigned char)formats->image[i];
+        if (isprint(c) || c == '\n' || c == '\t')
+            continue;
+        if (c == '\0' && i - start >= MIN_FORMAT_LENGTH)
+        {
+            log_format* grown = (log_format*)realloc(
+                formats->formats, (formats->count + 1) * sizeof(log_format));
+            if (grown == NULL)
+                return false;
+            formats->formats = grown;
+            formats->formats[formats->count].format = &formats->image[start];
+            formats->formats[formats->count].id =
+                ASD_log_format_id(&formats->image[start]);
+            formats->count++;
+        }
+        start = i + 1;
+    }
+    qsort(formats->formats, formats->count, sizeof(log_format),
+          compare_formats);
+    return true;
+}
+
+static const char* find_format(const log_formats* formats, uint32_t id)
+{
+    log_format key = {id, NULL};
+    log_format* found =
+        (log_format*)bsearch(&key, formats->formats, formats->count,
+                             sizeof(log_format), compare_formats);
+    return found ? found->format : NULL;
+}
+
+static bool get_number(record_cursor* cursor, size_t width, uint64_t* value)
+{
+    if (cursor->left < width)
+        return false;
+    *value = 0;
+    for (size_t i = 0; i < width; i++)
+        *value |= (uint64_t)cursor->data[i] << (8 * i);
+    cursor->data += width;
+    cursor->left -= width;
+    return true;
+}
+
+static bool get_bytes(record_cursor* cursor, size_t count,
+                      const unsigned char** bytes)
+{
+    if (cursor->left < count)
+        return false;
+    *bytes = cursor->data;
+    cursor->data += count;
+    cursor->left -= count;
+    return true;
+}
+
+//
+// The next value of a message. Strings are left in the record, value is
+// their length then.
+//
+static bool get_arg(record_cursor* cursor, uint64_t* type, uint64_t* value,
+                    const unsigned char** string)
+{
+    if (!get_number(cursor, 1, type))
+        return false;
+    switch (*type)
+    {
+        case LOG_ARG_INT32:
+            if (!get_number(cursor, 4, value))
+                return false;
+            // sign extended, the conversion decides what is printed
+            *value = (uint64_t)(int64_t)(int32_t)*value;
+            return true;
+        case LOG_ARG_INT64:
+        case LOG_ARG_DOUBLE:
+            return get_number(cursor, 8, value);
+        case LOG_ARG_STRING:
+            return get_number(cursor, 2, value) &&
+                   get_bytes(cursor, (size_t)*value, string);
+        default:
+            return false;
+    }
+}
+
+static bool get_int_arg(record_cursor* cursor, int* value)
+{
+    uint64_t type;
+    uint64_t number;
+    const unsigned char* string;
+    if (!get_arg(cursor, &type, &number, &string) || type != LOG_ARG_INT32)
+        return false;
+    *value = (int)(int64_t)number;
+    return true;
+}
+
+//
+// printf the format again, one conversion at a time, with the values read
+// back from the record.
+//
+static void print_message(const char* format, record_cursor* cursor)
+{
+    for (const char* p = format; *p; p++)
+    {
+        char spec[MAX_SPEC_LENGTH];
+        size_t len = 0;
+        int precision = -1;
+        uint64_t type;
+        uint64_t value;
+        const unsigned char* string = NULL;
+        double real;
+
+        if (*p != '%')
+        {
+            putchar(*p);
+            continue;
+        }
+        p++;
+        if (*p == '%')
+        {
+            putchar('%');
+            continue;
+        }
+        spec[len++] = '%';
+        while (*p && strchr("-+ #0'", *p) && len < MAX_SPEC_LENGTH / 2)
+            spec[len++] = *p++;
+        if (*p == '*')
+        {
+            int width;
+            if (!get_int_arg(cursor, &width))
+                break;
+            len += (size_t)snprintf(&spec[len], MAX_SPEC_LENGTH - len, "%d",
+                                    width);
+            p++;
+        }
+        while (isdigit((unsigned char)*p) && len < MAX_SPEC_LENGTH / 2)
+            spec[len++] = *p++;
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                if (!get_int_arg(cursor, &precision))
+                    break;
+                p++;
+            }
+            else
+            {
+                precision = atoi(p);
+                while (isdigit((unsigned char)*p))
+                    p++;
+            }
+        }
+        while (*p && strchr("hlzjtL", *p))
+            p++;
+        if (*p == 'n')
+            continue;
+        if (*p == '\0' || !strchr("diuoxXcpsfFeEgGaA", *p) ||
+            !get_arg(cursor, &type, &value, &string))
+        {
+            printf(" <undecodable>");
+            break;
+        }
+        if (*p == 's')
+        {
+            if (type != LOG_ARG_STRING)
+                break;
+            if (precision >= 0 && (uint64_t)precision < value)
+                value = (uint64_t)precision;
+            snprintf(&spec[len], MAX_SPEC_LENGTH - len, ".*s");
+            printf(spec, (int)value, (const char*)string);
+            continue;
+        }
+        if (precision >= 0)
+            len += (size_t)snprintf(&spec[len], MAX_SPEC_LENGTH - len, ".%d",
+                                    precision);
+        if (type == LOG_ARG_DOUBLE)
+        {
+            memcpy(&real, &value, sizeof(real));
+            snprintf(&spec[len], MAX_SPEC_LENGTH - len, "%c", *p);
+            printf(spec, real);
+        }
+        else if (*p == 'p')
+        {
+            printf("0x%llx", (unsigned long long)value);
+        }
+        else if (*p == 'c')
+        {
+            snprintf(&spec[len], MAX_SPEC_LENGTH - len, "c");
+            printf(spec, (int)value);
+        }
+        else
+        {
+            if (type == LOG_ARG_INT32 && strchr("uoxX", *p))
+                value &= UINT32_MAX;
+            snprintf(&spec[len], MAX_SPEC_LENGTH - len, "ll%c", *p);
+            printf(spec, (long long)value);
+        }
+    }
+    putchar('\n');
+}
+
+static bool get_prefix(record_cursor* cursor, const unsigned char** prefix,
+                       uint64_t* prefix_len)
+{
+    return get_number(cursor, 1, prefix_len) &&
+           get_bytes(cursor, (size_t)*prefix_len, prefix);
+}
+
+static bool print_buffer(record_cursor* cursor)
+{
+    const unsigned char* prefix;
+    const unsigned char* bytes;
+    uint64_t prefix_len;
+    uint64_t count;
+
+    if (!get_prefix(cursor, &prefix, &prefix_len) ||
+        !get_number(cursor, 2, &count) ||
+        !get_bytes(cursor, (size_t)count, &bytes))
+        return false;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (i % 16 == 0)
+            printf("%s%.*s", i ? "\n" : "", (int)prefix_len, prefix);
+        printf(" %02x", bytes[i]);
+    }
+    putchar('\n');
+    return true;
+}
+
+static bool print_shift(record_cursor* cursor)
+{
+    const unsigned char* prefix;
+    const unsigned char* bytes;
+    uint64_t prefix_len;
+    uint64_t bits;
+
+    if (!get_prefix(cursor, &prefix, &prefix_len) ||
+        !get_number(cursor, 2, &bits) ||
+        !get_bytes(cursor, (size_t)(bits + 7) / 8, &bytes))
+        return false;
+    // most significant byte first, like ASD_log_shift
+    printf("%.*s: [%llub] 0x", (int)prefix_len, prefix,
+           (unsigned long long)bits);
+    for (uint64_t i = (bits + 7) / 8; i > 0; i--)
+        printf("%02x", bytes[i - 1]);
+    putchar('\n');
+    return true;
+}
+
+static bool print_record(const log_formats* formats,
+                         const unsigned char* record, size_t size)
+{
+    record_cursor cursor = {record, size};
+    const char* format;
+    uint64_t kind;
+    uint64_t id;
+
+    if (!get_number(&cursor, 1, &kind))
+        return false;
+    switch (kind)
+    {
+        case LOG_RECORD_MESSAGE:
+            if (!get_number(&cursor, 4, &id))
+                return false;
+            format = find_format(formats, (uint32_t)id);
+            if (format == NULL)
+            {
+                printf("<unknown format 0x%08x>\n", (uint32_t)id);
+                return true;
+            }
+            print_message(format, &cursor);
+            return true;
+        case LOG_RECORD_BUFFER:
+            return print_buffer(&cursor);
+        case LOG_RECORD_SHIFT:
+            return print_shift(&cursor);
+        default:
+            return false;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    log_formats formats;
+    unsigned char* capture;
+    size_t size = 0;
+    size_t pos = 0;
+    int result = 0;
+
+    if (argc != 3)
+    {
+        fprintf(stderr,
+                "Usage: %s <asd binary> <capture>\n\n"
+                "Prints the records saved by asd_bench --log-capture, with "
+                "the format\nstrings of the asd binary that sent them.\n",
+                argv[0]);
+        return -1;
+    }
+    if (!load_formats(argv[1], &formats))
+        return -1;
+    capture = read_file(argv[2], &size);
+    if (capture == NULL)
+        result = -1;
+
+    // each record follows its 2 byte length
+    while (capture && pos + 2 <= size)
+    {
+        size_t len = capture[pos] | (size_t)capture[pos + 1] << 8;
+        pos += 2;
+        if (len > size - pos || !print_record(&formats, &capture[pos], len))
+        {
+            fprintf(stderr, "Bad record at offset %zu\n", pos - 2);
+            result = -1;
+            break;
+        }
+        pos += len;
+    }
+
+    free(capture);
+    free(formats.formats);
+    free(formats.image);
+    return result;
+}
@@ -0,0 +1,323 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <getopt.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../asd_bench.h"
+#include "cmocka.h"
+#include "logging.h"
+
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)format;
+}
+
+void __wrap_ASD_initialize_log_settings(ASD_LogLevel level,
+                                        ASD_LogStream stream,
+                                        bool write_to_syslog,
+                                        bool log_timestamp_enable,
+                                        ShouldLogFunctionPtr should_log_ptr,
+                                        LogFunctionPtr log_ptr)
+{
+    (void)level;
+    (void)stream;
+    (void)write_to_syslog;
+    (void)log_timestamp_enable;
+    (void)should_log_ptr;
+    (void)log_ptr;
+}
+
+bool __wrap_strtolevel(char* input, ASD_LogLevel* output)
+{
+    (void)input;
+    *output = ASD_LogLevel_Trace;
+    return true;
+}
+
+bool __wrap_strtostreams(char* input, ASD_LogStream* output)
+{
+    (void)input;
+    *output = ASD_LogStream_All;
+    return true;
+}
+
+static bool parse(asd_bench_args* args, int argc, char** argv)
+{
+    optind = 1;
+    return parse_arguments(argc, argv, args);
+}
+
+void parse_arguments_defaults_test(void** state)
+{
+    asd_bench_args args;
+    char* argv[] = {"asd_bench"};
+    (void)state;
+
+    assert_true(parse(&args, 1, argv));
+    assert_string_equal(DEFAULT_BENCH_HOST, args.host);
+    assert_int_equal(DEFAULT_BENCH_PORT, args.port);
+    assert_true(args.use_tls);
+    assert_null(args.password);
+    assert_null(args.auth_load_password);
+    assert_int_equal(DEFAULT_BENCH_IN_FLIGHT, args.in_flight);
+    assert_int_equal(DEFAULT_BENCH_COUNT, args.count);
+    assert_int_equal(1, args.mix[BENCH_JTAG]);
+    assert_int_equal(1, args.schedule_length);
+}
+
+void parse_arguments_options_test(void** state)
+{
+    asd_bench_args args;
+    char* argv[] = {"asd_bench",         "-u",
+                    "-p",                "5124",
+                    "-n",                "8",
+                    "--password=secret", "--mix=jtag:3,loopback:1",
+                    "--duration=5",      "--auth-load=wrong",
+                    "bmc.local"};
+    (void)state;
+
+    assert_true(parse(&args, 11, argv));
+    assert_string_equal("bmc.local", args.host);
+    assert_int_equal(5124, args.port);
+    assert_false(args.use_tls);
+    assert_string_equal("secret", args.password);
+    assert_string_equal("wrong", args.auth_load_password);
+    assert_int_equal(8, args.in_flight);
+    assert_int_equal(5, args.duration);
+    assert_int_equal(3, args.mix[BENCH_JTAG]);
+    assert_int_equal(1, args.mix[BENCH_LOOPBACK]);
+    assert_int_equal(4, args.schedule_length);
+}
+
+void parse_arguments_remote_log_test(void** state)
+{
+    asd_bench_args args;
+    char* defaults[] = {"asd_bench"};
+    char* argv[] = {"asd_bench", "--remote-log=debug", "--binary-log",
+                    "--log-capture=log.bin"};
+    char* text[] = {"asd_bench", "--remote-log=trace"};
+    (void)state;
+
+    assert_true(parse(&args, 1, defaults));
+    assert_false(args.remote_log);
+    assert_false(args.binary_log);
+    assert_null(args.log_capture);
+
+    assert_true(parse(&args, 4, argv));
+    assert_true(args.remote_log);
+    // the level is parsed by the wrapped strtolevel
+    assert_int_equal(ASD_LogLevel_Trace, args.remote_log_level);
+    assert_true(args.binary_log);
+    assert_string_equal("log.bin", args.log_capture);
+
+    assert_true(parse(&args, 2, text));
+    assert_true(args.remote_log);
+    assert_false(args.binary_log);
+    assert_null(args.log_capture);
+}
+
+void parse_arguments_rejects_invalid_values_test(void** state)
+{
+    asd_bench_args args;
+    char* in_flight[] = {"asd_bench", "-n", "0"};
+    char* port[] = {"asd_bench", "-p", "70000"};
+    char* loopback[] = {"asd_bench", "--loopback-size=4"};
+    char* scan[] = {"asd_bench", "--scan-bits=30000"};
+    char* capture[] = {"asd_bench", "--remote-log=debug",
+                       "--log-capture=log.bin"};
+    (void)state;
+
+    assert_false(parse(&args, 3, in_flight));
+    assert_false(parse(&args, 3, port));
+    assert_false(parse(&args, 2, loopback));
+    assert_false(parse(&args, 2, scan));
+    // records are only saved from a binary remote log
+    assert_false(parse(&args, 3, capture));
+}
+
+void parse_mix_test(void** state)
+{
+    unsigned int weights[BENCH_CLASS_COUNT];
+    (void)state;
+
+    assert_true(parse_mix("agent:2,i2c:1", weights));
+    assert_int_equal(0, weights[BENCH_JTAG]);
+    assert_int_equal(1, weights[BENCH_I2C]);
+    assert_int_equal(2, weights[BENCH_AGENT]);
+    assert_int_equal(0, weights[BENCH_LOOPBACK]);
+
+    assert_false(parse_mix("", weights));
+    assert_false(parse_mix("jtag", weights));
+    assert_false(parse_mix("jtag:", weights));
+    assert_false(parse_mix("jtag:0", weights));
+    assert_false(parse_mix("jtag:1,", weights));
+    assert_false(parse_mix("jtags:1", weights));
+    assert_false(parse_mix("jtag:1x", weights));
+    assert_false(parse_mix("jtag:1000", weights));
+}
+
+void build_schedule_interleaves_classes_test(void** state)
+{
+    unsigned int weights[BENCH_CLASS_COUNT] = {2, 0, 1, 1};
+    bench_class schedule[MAX_SCHEDULE_LENGTH];
+    unsigned int count[BENCH_CLASS_COUNT] = {0};
+    unsigned int length;
+    (void)state;
+
+    length = build_schedule(weights, schedule);
+    assert_int_equal(4, length);
+    for (unsigned int i = 0; i < length; i++)
+        count[schedule[i]]++;
+    assert_int_equal(2, count[BENCH_JTAG]);
+    assert_int_equal(0, count[BENCH_I2C]);
+    assert_int_equal(1, count[BENCH_AGENT]);
+    assert_int_equal(1, count[BENCH_LOOPBACK]);
+    // the heaviest class leads but is not sent back to back
+    assert_int_equal(BENCH_JTAG, schedule[0]);
+    assert_int_not_equal(BENCH_JTAG, schedule[1]);
+}
+
+void build_jtag_message_test(void** state)
+{
+    struct asd_message msg;
+    (void)state;
+
+    // shift DR, 64 bit scan, 36 bit scan, back to RTI
+    assert_true(build_jtag_message(&msg, 100));
+    assert_int_equal(JTAG_TYPE, msg.header.type);
+    assert_int_equal(1 + 1 + 8 + 1 + 5 + 1, message_size(&msg.header));
+    assert_int_equal(0x24, msg.buffer[0]);
+    assert_int_equal(0xc0, msg.buffer[1]);
+    assert_int_equal(0xc0 | 36, msg.buffer[10]);
+    assert_int_equal(0x21, msg.buffer[16]);
+
+    assert_false(build_jtag_message(&msg, 0));
+    assert_false(build_jtag_message(&msg, MAX_DATA_SIZE * 8));
+}
+
+void build_i2c_message_test(void** state)
+{
+    struct asd_message msg;
+    (void)state;
+
+    assert_true(build_i2c_message(&msg, 3, 0xa0));
+    assert_int_equal(I2C_TYPE, msg.header.type);
+    assert_int_equal(4, message_size(&msg.header));
+    assert_int_equal(1, msg.buffer[0]);
+    assert_int_equal(3, msg.buffer[1]);
+    assert_int_equal(0x21, msg.buffer[2]);
+    assert_int_equal(0xa1, msg.buffer[3]);
+}
+
+void build_agent_message_rotates_queries_test(void** state)
+{
+    struct asd_message msg;
+    (void)state;
+
+    assert_true(build_agent_message(&msg, 0));
+    assert_int_equal(AGENT_CONTROL_TYPE, msg.header.type);
+    assert_int_equal(NUM_IN_FLIGHT_MESSAGES_SUPPORTED_CMD,
+                     msg.header.cmd_stat);
+    assert_int_equal(0, message_size(&msg.header));
+    assert_true(build_agent_message(&msg, 1));
+    assert_int_equal(OBTAIN_DOWNSTREAM_VERSION_CMD, msg.header.cmd_stat);
+}
+
+void build_loopback_message_test(void** state)
+{
+    struct asd_message msg;
+    uint32_t crc = 0;
+    (void)state;
+
+    assert_true(build_loopback_message(&msg, 300));
+    assert_int_equal(AGENT_CONTROL_TYPE, msg.header.type);
+    assert_int_equal(LOOPBACK_CMD, msg.header.cmd_stat);
+    assert_int_equal(300, message_size(&msg.header));
+    assert_int_equal(1, msg.header.size_msb);
+    assert_int_equal(0, msg.buffer[0]);
+    for (int i = 5; i < 300; i++)
+        crc ^= msg.buffer[i];
+    assert_int_equal(crc, ((uint32_t)msg.buffer[1] << 24) |
+                              ((uint32_t)msg.buffer[2] << 16) |
+                              ((uint32_t)msg.buffer[3] << 8) | msg.buffer[4]);
+
+    assert_false(build_loopback_message(&msg, MIN_LOOPBACK_SIZE - 1));
+    assert_false(build_loopback_message(&msg, MAX_DATA_SIZE + 1));
+}
+
+void stats_percentile_test(void** state)
+{
+    bench_stats stats;
+    (void)state;
+
+    memset(&stats, 0, sizeof(stats));
+    assert_int_equal(0, stats_percentile(&stats, 5000));
+
+    // 1000..1 so the samples have to be sorted
+    for (uint64_t i = 1000; i > 0; i--)
+        assert_true(stats_add(&stats, i));
+    assert_int_equal(1000, stats.count);
+    assert_int_equal(500, stats_percentile(&stats, 5000));
+    assert_int_equal(990, stats_percentile(&stats, 9900));
+    assert_int_equal(999, stats_percentile(&stats, 9990));
+    assert_int_equal(1000, stats_percentile(&stats, 10000));
+    assert_int_equal(1, stats_percentile(&stats, 0));
+
+    stats_free(&stats);
+    assert_null(stats.latency_ns);
+    assert_int_equal(0, stats.count);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(parse_arguments_defaults_test),
+        cmocka_unit_test(parse_arguments_options_test),
+        cmocka_unit_test(parse_arguments_remote_log_test),
+        cmocka_unit_test(parse_arguments_rejects_invalid_values_test),
+        cmocka_unit_test(parse_mix_test),
+        cmocka_unit_test(build_schedule_interleaves_classes_test),
+        cmocka_unit_test(build_jtag_message_test),
+        cmocka_unit_test(build_i2c_message_test),
+        cmocka_unit_test(build_agent_message_rotates_queries_test),
+        cmocka_unit_test(build_loopback_message_test),
+        cmocka_unit_test(stats_percentile_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -32,6 +32,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stddef.h>
 #include <stdint.h>
 #include <poll.h>
+#include <sys/uio.h>
 
 #define MAX_DATA_SIZE 3000
 #define SUPPORTED_JTAG_CHAINS 1
@@ -137,6 +138,7 @@ typedef enum
 #define LOOPBACK_CMD 18
 #define REMOTE_SPP_CONFIG_CMD 19
 #define SUPPORTED_SPP_BULK_MODE_CMD 20
+#define LATENCY_STATS_CMD 21
 
 // AGENT_CONFIGURATION_CMD types
 #define AGENT_CONFIG_TYPE_LOGGING 1
@@ -210,6 +212,14 @@ struct asd_message
     unsigned char buffer[MAX_DATA_SIZE];
 } __attribute__((packed));
 
+// Scatter list handed to the server with IOCTL_SERVER_QUEUE_MSG. All the
+// segments go out back to back as a single message.
+typedef struct asd_msg_iov
+{
+    const struct iovec* iov;
+    int iovcnt;
+} asd_msg_iov;
+
 typedef enum
 {
     IPC_LogType_MIN = -1,
@@ -230,6 +240,9 @@ typedef struct remote_logging_config
         {
             uint8_t logging_level : 3;
             uint8_t logging_stream : 3;
+            // Set by a client that decodes binary log records, see
+            // logging.h. Echoed in the HARDWARE_LOG_EVENT carrying them.
+            uint8_t binary : 1;
         };
         unsigned char value;
     };
@@ -316,6 +329,25 @@ typedef struct timeout_config // stack memory
 //  TapReset        00010100
 #define TAP_RESET 0x14
 
+//  ExtScan         000101tt        t is 01 for write, 10 for read and 11
+//                                  for read write. A 4 byte bit count
+//                                  follows LSB first, then the TDI bytes of
+//                                  the write variants. TDI that does not fit
+//                                  continues at the start of the next JTAG
+//                                  message, the message is then sent with
+//                                  ASD_PACKET_CONTINUATION set.
+#define EXT_WRITE_SCAN 0x15
+#define EXT_READ_SCAN 0x16
+#define EXT_READ_WRITE_SCAN 0x17
+#define EXT_SCAN_LENGTH_BYTES 4
+#define EXT_SCAN_MAX_BITS 0x20000
+
+// Longest padding the target shifts around a scan, and so the longest
+// shift a single JTAG xfer carries: an extended scan padded on both sides.
+#define DRMAXPADSIZE 250
+#define IRMAXPADSIZE 2000
+#define JTAG_XFER_MAX_BITS (2 * IRMAXPADSIZE + EXT_SCAN_MAX_BITS)
+
 //  WaitSync        00011001
 #define WAIT_SYNC 0x19
 #define WAIT_SYNC_CMD_LENGTH 4
@@ -40,6 +40,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define IOCTL_SERVER_GET_INTERFACE_VERSION     1
 #define IOCTL_SERVER_IS_INTERFACE_SUPPORTED    2
 #define IOCTL_SERVER_IS_DATA_PENDING           3
+#define IOCTL_SERVER_QUEUE_MSG                 4
+#define IOCTL_SERVER_FLUSH_MSGS                5
+#define IOCTL_SERVER_QUEUE_EVENT               6
 
 size_t asd_server_read(unsigned char* buffer, size_t length, void* opt);
 size_t asd_server_write(void* buffer, size_t length, void* opt);
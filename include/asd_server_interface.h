@@ -40,6 +40,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define IOCTL_SERVER_GET_INTERFACE_VERSION     1
 #define IOCTL_SERVER_IS_INTERFACE_SUPPORTED    2
 #define IOCTL_SERVER_IS_DATA_PENDING           3
+#define IOCTL_SERVER_QUEUE_MSG                 4
+#define IOCTL_SERVER_FLUSH_MSGS                5
+#define IOCTL_SERVER_QUEUE_EVENT               6
 
 
 #define MAX_LOG_SIZE                           120
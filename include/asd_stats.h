@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _ASD_STATS_H_
+#define _ASD_STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Latency histograms of the stages a message goes through, always on.
+//
+// Buckets are log-linear like HDR histograms: values below
+// 2^ASD_STATS_SUB_BITS ns get a bucket each, above that every power of two
+// is split in 2^ASD_STATS_SUB_BITS buckets, so a bucket is never wider than
+// 1/8th of the values it holds. Recording is a handful of relaxed atomic
+// adds on the caller's thread, no lock is taken.
+
+#define ASD_STATS_SUB_BITS 3
+// values from 2^ASD_STATS_MAX_BITS ns (about 18 minutes) on share the last
+// bucket
+#define ASD_STATS_MAX_BITS 40
+#define ASD_STATS_BUCKETS                                                      \
+    ((ASD_STATS_MAX_BITS - ASD_STATS_SUB_BITS + 1) << ASD_STATS_SUB_BITS)
+
+// LATENCY_STATS_CMD request flag: clear the stage once it has been read.
+#define ASD_STATS_RESET 0x01
+
+typedef enum
+{
+    ASD_Stage_SocketRead = 0,
+    // decoding and running one message of each type, driver calls
+    // included
+    ASD_Stage_DecodeAgent,
+    ASD_Stage_DecodeJtag,
+    ASD_Stage_DecodeI2c,
+    ASD_Stage_DecodeSpp,
+    ASD_Stage_JtagXfer,
+    ASD_Stage_JtagBitbang,
+    ASD_Stage_JtagState,
+    ASD_Stage_JtagFreq,
+    ASD_Stage_I2cRdwr,
+    ASD_Stage_I3cPrivXfer,
+    ASD_Stage_SppWrite,
+    ASD_Stage_SppRead,
+    ASD_Stage_PrdyWait,
+    ASD_Stage_ResponseSend,
+    // TLS handshakes in exttls_on_accept, from the ClientHello wait on
+    ASD_Stage_TlsHandshake,
+    ASD_Stage_TlsResume,
+    ASD_Stage_Count
+} ASD_Stage;
+
+typedef struct ASD_Histogram
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[ASD_STATS_BUCKETS];
+} ASD_Histogram;
+
+extern ASD_Histogram asd_stats[ASD_Stage_Count];
+
+static inline uint64_t ASD_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline unsigned int ASD_stats_bucket(uint64_t ns)
+{
+    unsigned int msb;
+
+    if (ns < (1ULL << ASD_STATS_SUB_BITS))
+        return (unsigned int)ns;
+    if (ns >= (1ULL << ASD_STATS_MAX_BITS))
+        return ASD_STATS_BUCKETS - 1;
+    msb = 63 - (unsigned int)__builtin_clzll(ns);
+    return ((msb - ASD_STATS_SUB_BITS + 1) << ASD_STATS_SUB_BITS) +
+           (unsigned int)((ns >> (msb - ASD_STATS_SUB_BITS)) &
+                          ((1U << ASD_STATS_SUB_BITS) - 1));
+}
+
+//
+// Account the time elapsed since start_ns (from ASD_stats_now) to stage.
+//
+static inline void ASD_stats_record(ASD_Stage stage, uint64_t start_ns)
+{
+    ASD_Histogram* histogram = &asd_stats[stage];
+    uint64_t ns = ASD_stats_now() - start_ns;
+    uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[ASD_stats_bucket(ns)], 1,
+                       __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&histogram->max_ns, &max, ns, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+const char* ASD_stats_stage_name(ASD_Stage stage);
+uint64_t ASD_stats_bucket_floor(unsigned int bucket);
+void ASD_stats_snapshot(ASD_Stage stage, ASD_Histogram* snapshot, bool reset);
+uint64_t ASD_stats_percentile(const ASD_Histogram* histogram,
+                              unsigned int per_10k);
+int ASD_stats_encode(const unsigned char* request, int request_size,
+                     unsigned char* buffer, size_t size);
+void ASD_stats_dump(void);
+
+#endif // _ASD_STATS_H_
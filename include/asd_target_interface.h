@@ -46,6 +46,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define IOCTL_TARGET_PROCESS_PIN_EVENT         6
 #define IOCTL_TARGET_SEND_REMOTE_LOG_MSG       7
 #define IOCTL_TARGET_GET_I2C_I3C_BUS_CONFIG    8
+#define IOCTL_TARGET_SEND_REMOTE_LOG_RECORD    9
 
 #define MAX_LOG_SIZE                           120
 
@@ -65,6 +66,13 @@ typedef struct asd_target_interface_remote_log {
     const char* msg;
 } asd_target_interface_remote_log;
 
+typedef struct asd_target_interface_remote_log_record {
+    ASD_LogLevel level;
+    ASD_LogStream stream;
+    const unsigned char* record;
+    size_t len;
+} asd_target_interface_remote_log_record;
+
 STATUS asd_api_target_init(config* asd_cfg);
 STATUS asd_api_target_deinit(void);
 size_t asd_api_target_read(unsigned char* buffer, size_t length, void* opt);   /* unused */
@@ -42,6 +42,12 @@ typedef struct jtag_config
     JTAG_DRIVER_MODE mode;
     JTAG_CHAIN_SELECT_MODE chain_mode;
     bool xdp_fail_enable;
+    // record every JTAG operation to this file, NULL when disabled
+    char* trace_file;
+    // drive the simulated TAP chain instead of /dev/jtag0, sim_chain is
+    // NULL for the simulator's default chain
+    bool simulate;
+    char* sim_chain;
 } jtag_config;
 
 typedef struct spp_config
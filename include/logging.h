@@ -28,6 +28,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -39,6 +40,29 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define LOG_TIME_LINE_LENGTH 180
 #define CALLBACK_LOG_MESSAGE_LENGTH 256
 
+// Binary remote log records, sent instead of text once the client asks for
+// them. All numbers are little endian.
+//
+// LOG_RECORD_MESSAGE: kind, u32 FNV-1a hash of the format string, then one
+//                     typed value per conversion (and per '*' width or
+//                     precision). The format strings are resolved by the
+//                     client, or by asd_log_decode from the asd binary.
+// LOG_RECORD_BUFFER:  kind, u8 prefix length, prefix, u16 length, bytes.
+// LOG_RECORD_SHIFT:   kind, u8 prefix length, prefix, u16 bit count,
+//                     (bits + 7) / 8 bytes.
+#define LOG_RECORD_MESSAGE 1
+#define LOG_RECORD_BUFFER 2
+#define LOG_RECORD_SHIFT 3
+
+// value types in a LOG_RECORD_MESSAGE
+#define LOG_ARG_INT32 1  // 4 bytes
+#define LOG_ARG_INT64 2  // 8 bytes
+#define LOG_ARG_DOUBLE 3 // 8 bytes, IEEE 754
+#define LOG_ARG_STRING 4 // u16 length, bytes without the NUL
+
+#define LOG_RECORD_LENGTH 1024
+#define LOG_RECORD_MAX_PREFIX 32
+
 typedef enum
 {
     ASD_LogLevel_Trace = 0,
@@ -77,6 +101,10 @@ extern ASD_LogStream asd_log_streams;
 
 typedef bool (*ShouldLogFunctionPtr)(ASD_LogLevel, ASD_LogStream);
 typedef void (*LogFunctionPtr)(ASD_LogLevel, ASD_LogStream, const char*);
+typedef void (*LogRecordFunctionPtr)(ASD_LogLevel, ASD_LogStream,
+                                     const unsigned char* record, size_t len);
+typedef void (*LogWriteFunctionPtr)(ASD_LogLevel, const char* line,
+                                    size_t len);
 
 void ASD_log(ASD_LogLevel level, ASD_LogStream stream, ASD_LogOption options,
              const char* format, ...);
@@ -103,6 +131,25 @@ void ASD_initialize_log_settings(ASD_LogLevel level, ASD_LogStream stream,
 
 void ASD_update_log_settings(ASD_LogLevel level, ASD_LogStream stream);
 
+// Remote logs for which should_log_binary returns true are encoded as
+// records and handed to log_record rather than formatted as text.
+void ASD_set_binary_logging(ShouldLogFunctionPtr should_log_binary,
+                            LogRecordFunctionPtr log_record);
+
+// Local logs are formatted once, timestamp included, and handed to log_write
+// as a line without its newline instead of being written to stderr or
+// syslog. NULL writes them out directly again.
+void ASD_set_log_writer(LogWriteFunctionPtr log_write);
+
+uint32_t ASD_log_format_id(const char* format);
+
+size_t ASD_log_encode_message(unsigned char* record, size_t size,
+                              const char* format, va_list args);
+
+size_t ASD_log_encode_data(unsigned char* record, size_t size, uint8_t kind,
+                           const char* prefix, const unsigned char* data,
+                           size_t count);
+
 ASD_LogLevel convert_remote_log_level(uint8_t remote_level);
 
 ASD_LogStream convert_remote_log_stream(uint8_t remote_stream);
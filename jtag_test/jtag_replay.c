@@ -0,0 +1,275 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Replays a JTAG trace recorded by the daemon (asd --jtag-trace=<file>)
+// through the JTAG handler, against the simulated TAP chain of jtag_sim.h
+// unless the real driver is asked for. It reports how the recorded session
+// spent its time per operation class, how fast the handler itself gets
+// through the same operations and how long the TCK cycles would have taken.
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+// clang-format off
+#include <safe_mem_lib.h>
+// clang-format on
+
+#include "jtag_handler.h"
+#include "jtag_trace.h"
+#include "logging.h"
+
+#define DEFAULT_REPLAY_LOOPS 1
+
+static const ASD_LogStream stream = ASD_LogStream_Test;
+static const ASD_LogOption option = ASD_LogOption_None;
+static const char* op_names[JTAG_Trace_Op_Count] = {"shift", "tap_state",
+                                                    "wait_cycles", "tck"};
+
+typedef struct replay_stats
+{
+    uint64_t count;
+    uint64_t bits;
+    uint64_t failed;
+    uint64_t recorded_ns;
+    uint64_t replay_ns;
+} replay_stats;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static STATUS replay_record(JTAG_Handler* jtag,
+                            const JTAG_Trace_Record* record,
+                            unsigned char* tdo)
+{
+    STATUS status = ST_OK;
+
+    // The trace may start anywhere in a session, put the TAP where the
+    // operation found it.
+    jtag->active_chain->tap_state = (enum jtag_states)record->start_state;
+
+    switch (record->op)
+    {
+        case JTAG_Trace_Op_Shift:
+            // TDO depends on the chain replayed against, it is not compared
+            // with the recording
+            status = JTAG_shift(
+                jtag, record->value, record->tdi_bytes,
+                record->tdi_bytes ? JTAG_trace_tdi(record) : NULL,
+                record->tdo_bytes, record->tdo_bytes ? tdo : NULL,
+                (enum jtag_states)record->end_state);
+            break;
+        case JTAG_Trace_Op_TapState:
+            status = JTAG_set_tap_state(jtag,
+                                        (enum jtag_states)record->end_state);
+            break;
+        case JTAG_Trace_Op_WaitCycles:
+            status = JTAG_wait_cycles(jtag, record->value);
+            break;
+        case JTAG_Trace_Op_Tck:
+            status = JTAG_set_jtag_tck(jtag, record->value);
+            break;
+        default:
+            break;
+    }
+    return status;
+}
+
+static void print_stats(const replay_stats* stats, unsigned int loops)
+{
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "%-12s %10s %12s %8s %14s %12s %12s %10s", "op", "count", "bits",
+            "failed", "recorded_us", "replay_ns/op", "replay_op/s",
+            "Mbit/s");
+    for (int op = 0; op < JTAG_Trace_Op_Count; op++)
+    {
+        const replay_stats* s = &stats[op];
+        double ns_per_op = 0;
+        double ops_per_sec = 0;
+        double mbps = 0;
+
+        if (s->count == 0)
+            continue;
+        if (s->replay_ns)
+        {
+            ns_per_op = (double)s->replay_ns / (double)(s->count * loops);
+            ops_per_sec = 1e9 / ns_per_op;
+            mbps = (double)(s->bits * loops) * 1e3 / (double)s->replay_ns;
+        }
+        ASD_log(ASD_LogLevel_Info, stream, option,
+                "%-12s %10llu %12llu %8llu %14.1f %12.1f %12.0f %10.2f",
+                op_names[op], (unsigned long long)s->count,
+                (unsigned long long)s->bits, (unsigned long long)s->failed,
+                (double)s->recorded_ns / 1e3, ns_per_op, ops_per_sec, mbps);
+    }
+}
+
+static void showUsage(char** argv)
+{
+    ASD_log(ASD_LogLevel_Error, stream, option,
+            "\nUsage: %s [option] <trace file>\n\n"
+            "  -h          Replay in hardware mode (default: software mode)\n"
+            "  -n <loops>  Replay the trace this many times (default: %d)\n"
+            "  -c <chain>  Simulated TAP chain, <idcode>-<ir length>[,...]\n"
+            "              (default: %s)\n"
+            "  -d          Replay on /dev/jtag0 instead of the simulator\n"
+            "\n"
+            "Record a trace with: asd --jtag-trace=<file>\n",
+            argv[0], DEFAULT_REPLAY_LOOPS, JTAG_SIM_DEFAULT_CHAIN);
+}
+
+int main(int argc, char** argv)
+{
+    replay_stats stats[JTAG_Trace_Op_Count];
+    const JTAG_Trace_Record* record;
+    unsigned char tdo[MAX_DATA_SIZE * 2];
+    uint64_t replay_errors = 0;
+    uint64_t replay_ns = 0;
+    unsigned int loops = DEFAULT_REPLAY_LOOPS;
+    bool sw_mode = true;
+    JTAG_Backend backend = JTAG_Backend_Simulator;
+    const char* sim_chain = NULL;
+    JTAG_Handler* jtag;
+    JTAG_Trace* trace;
+    int c;
+
+    ASD_initialize_log_settings(ASD_LogLevel_Info, stream, false, false, NULL,
+                                NULL);
+
+    while ((c = getopt(argc, argv, "hn:c:d")) != -1)
+    {
+        switch (c)
+        {
+            case 'h':
+                sw_mode = false;
+                break;
+            case 'c':
+                sim_chain = optarg;
+                break;
+            case 'd':
+                backend = JTAG_Backend_Driver;
+                break;
+            case 'n':
+                loops = (unsigned int)strtoul(optarg, NULL, 10);
+                if (loops == 0)
+                {
+                    showUsage(argv);
+                    return -1;
+                }
+                break;
+            default:
+                showUsage(argv);
+                return -1;
+        }
+    }
+    if (optind >= argc)
+    {
+        showUsage(argv);
+        return -1;
+    }
+
+    trace = JTAG_trace_map(argv[optind]);
+    if (trace == NULL)
+        return -1;
+
+    jtag = JTAGHandler();
+    if (jtag == NULL ||
+        JTAG_set_backend(jtag, backend, sim_chain) != ST_OK ||
+        JTAG_initialize(jtag, sw_mode) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Failed to initialize the JTAG handler.");
+        free(jtag);
+        JTAG_trace_close(trace);
+        return -1;
+    }
+
+    explicit_bzero(stats, sizeof(stats));
+    while ((record = JTAG_trace_next(trace)) != NULL)
+    {
+        if (record->op >= JTAG_Trace_Op_Count)
+            continue;
+        stats[record->op].count++;
+        if (record->op == JTAG_Trace_Op_Shift)
+            stats[record->op].bits += record->value;
+        if (record->flags & JTAG_TRACE_FLAG_FAILED)
+            stats[record->op].failed++;
+        stats[record->op].recorded_ns += record->duration_ns;
+    }
+
+    for (unsigned int loop = 0; loop < loops; loop++)
+    {
+        JTAG_trace_rewind(trace);
+        while ((record = JTAG_trace_next(trace)) != NULL)
+        {
+            if (record->op >= JTAG_Trace_Op_Count ||
+                record->tdo_bytes > sizeof(tdo))
+                continue;
+            uint64_t start = now_ns();
+            if (replay_record(jtag, record, tdo) != ST_OK)
+                replay_errors++;
+            start = now_ns() - start;
+            stats[record->op].replay_ns += start;
+            replay_ns += start;
+        }
+    }
+
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "Trace %s: %llu operations dropped by the ring, replayed %u "
+            "time%s in %s mode on %s",
+            argv[optind], (unsigned long long)trace->header->dropped, loops,
+            loops > 1 ? "s" : "", sw_mode ? "software" : "hardware",
+            jtag->sim ? "the simulator" : "/dev/jtag0");
+    print_stats(stats, loops);
+    if (jtag->sim)
+    {
+        // the simulator clocks nothing, what the handler took is host time
+        ASD_log(ASD_LogLevel_Info, stream, option,
+                "host time %.1f us, TCK time %.1f us at %u Hz for %llu "
+                "cycles",
+                (double)replay_ns / 1e3,
+                (double)JTAG_sim_tck_ns(jtag->sim) / 1e3,
+                jtag->sim->frequency,
+                (unsigned long long)jtag->sim->tck_cycles);
+    }
+    if (replay_errors)
+        ASD_log(ASD_LogLevel_Info, stream, option,
+                "%llu operations failed to replay",
+                (unsigned long long)replay_errors);
+
+    JTAG_deinitialize(jtag);
+    free(jtag);
+    JTAG_trace_close(trace);
+    return replay_errors ? -1 : 0;
+}
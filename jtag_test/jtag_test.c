@@ -183,6 +183,8 @@ bool parse_arguments(int argc, char** argv, jtag_test_args* args)
     args->log_level = DEFAULT_LOG_LEVEL;
     args->log_streams = DEFAULT_LOG_STREAMS;
     args->inject_error_byte = DEFAULT_ERROR_INJECTION_POS;
+    args->simulate = false;
+    args->sim_chain = NULL;
 
     enum
     {
@@ -196,6 +198,7 @@ bool parse_arguments(int argc, char** argv, jtag_test_args* args)
         ARG_PATTERN,
         ARG_RUNTIME,
         ARG_INJECT,
+        ARG_SIM,
         ARG_HELP
     };
 
@@ -210,6 +213,7 @@ bool parse_arguments(int argc, char** argv, jtag_test_args* args)
         {"pattern", 1, NULL, ARG_PATTERN},
         {"runtime", 1, NULL, ARG_RUNTIME},
         {"injecterror", 1, NULL, ARG_INJECT},
+        {"sim", 2, NULL, ARG_SIM},
         {"help", 0, NULL, ARG_HELP},
         {NULL, 0, NULL, 0},
     };
@@ -312,6 +316,10 @@ bool parse_arguments(int argc, char** argv, jtag_test_args* args)
                 args->inject_error = true;
                 args->inject_error_byte = (unsigned int)strtol(optarg, NULL, 10);
                 break;
+            case ARG_SIM:
+                args->simulate = true;
+                args->sim_chain = optarg;
+                break;
             case '?':
             case ARG_HELP:
             default:
@@ -423,6 +431,8 @@ void showUsage(char** argv)
         "                             Checkerboard (CB),Walkingzero (WZ) , Walkingone (WO))\n"
         "  --runtime=<number>         Specify time in seconds jtag_test will run. (disables iterations) (Default: 1s)\n"
         "  --injecterror=<byte>       Inject Error to test bit flip at position byte (Default: byte = 0)\n"
+        "  --sim[=<chain>]            Run against a simulated TAP chain instead of /dev/jtag0,\n"
+        "                             <chain> is <idcode>-<ir length>[,...] (Default: %s)\n"
         "  --help                     Show this list\n"
         "\n"
         "Examples:\n"
@@ -448,7 +458,7 @@ void showUsage(char** argv)
         streamtostring(DEFAULT_LOG_STREAMS), streamtostring(ASD_LogStream_All),
         streamtostring(ASD_LogStream_Test), streamtostring(ASD_LogStream_I2C),
         streamtostring(ASD_LogStream_Pins), streamtostring(ASD_LogStream_JTAG),
-        streamtostring(ASD_LogStream_Network));
+        streamtostring(ASD_LogStream_Network), JTAG_SIM_DEFAULT_CHAIN);
 }
 
 JTAG_Handler* init_jtag(jtag_test_args* args)
@@ -459,6 +469,15 @@ JTAG_Handler* init_jtag(jtag_test_args* args)
         ASD_log(ASD_LogLevel_Error, stream, option,
                 "Failed to initialize the driver.");
     }
+    else if (args->simulate &&
+             JTAG_set_backend(jtag, JTAG_Backend_Simulator,
+                              args->sim_chain) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Failed to select the JTAG simulator.");
+        free(jtag);
+        jtag = NULL;
+    }
     else if (JTAG_initialize(jtag, args->mode == SW_MODE) != ST_OK)
     {
         ASD_log(ASD_LogLevel_Error, stream, option,
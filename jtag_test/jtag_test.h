@@ -81,6 +81,9 @@ typedef struct jtag_test_args
     unsigned int runTime;
     ASD_LogLevel log_level;
     ASD_LogStream log_streams;
+    // run against the software TAP chain instead of /dev/jtag0
+    bool simulate;
+    char* sim_chain;
 } jtag_test_args;
 
 typedef struct uncore_info
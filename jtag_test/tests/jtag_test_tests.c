@@ -151,6 +151,15 @@ STATUS __wrap_JTAG_initialize(JTAG_Handler* state, bool sw_mode)
     return JTAG_INITIALIZE_RESULT;
 }
 
+STATUS __wrap_JTAG_set_backend(JTAG_Handler* state, JTAG_Backend backend,
+                               const char* sim_chain)
+{
+    (void)state;
+    (void)backend;
+    (void)sim_chain;
+    return ST_OK;
+}
+
 STATUS __wrap_JTAG_deinitialize(JTAG_Handler* state)
 {
     check_expected_ptr(state);
@@ -28,29 +28,45 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "asd_main.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <safe_mem_lib.h>
 #include <safe_str_lib.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <systemd/sd-journal.h>
 #include <unistd.h>
 
+#include "asd_stats.h"
 #include "asd_target_interface.h"
+#include "log_async.h"
 asd_state main_state = {};
 extnet_conn_t* p_extconn = NULL;
 bool b_data_pending = false;
 bool is_connected = false;
+// The target side runs messages on its own worker thread. Its responses
+// reach the client through this queue, written out by the socket thread
+// which is the only one using extnet.
+static out_queue response_queue;
+static observer_backlog observer_backlogs[MAX_OBSERVERS];
+// set by SIGUSR1, the latency histograms are dumped from the socket thread
+static volatile sig_atomic_t stats_dump_requested = 0;
 
 static void send_remote_log_message(ASD_LogLevel asd_level,
                                     ASD_LogStream asd_stream,
                                     const char* message);
+static void send_remote_log_record(ASD_LogLevel asd_level,
+                                   ASD_LogStream asd_stream,
+                                   const unsigned char* record, size_t len);
 
 bool is_auto_sync_remote_logging_enabled(void)
 {
@@ -158,6 +174,8 @@ bool process_command_line(int argc, char** argv, asd_args* args)
     args->use_syslog = DEFAULT_LOG_TO_SYSLOG;
     args->log_level = DEFAULT_LOG_LEVEL;
     args->log_streams = DEFAULT_LOG_STREAMS;
+    args->log_async = false;
+    args->log_file = NULL;
     args->auto_sync_remote_logging = false;
     args->auto_sync_remote_logging_streams = ASD_LogStream_All;
     args->session.n_port_number = DEFAULT_PORT;
@@ -165,8 +183,16 @@ bool process_command_line(int argc, char** argv, asd_args* args)
     args->session.cp_net_bind_device = NULL;
     args->session.e_extnet_type = EXTNET_HDLR_TLS;
     args->session.e_auth_type = AUTH_HDLR_PAM;
+    args->session.tls.ticket_lifetime = DEFAULT_TLS_TICKET_LIFETIME;
+    args->session.tls.ticket_key_rotation = DEFAULT_TLS_TICKET_KEY_ROTATION;
+    args->session.tls.cheap_crypto = false;
+    args->session.n_max_observers = DEFAULT_MAX_OBSERVERS;
+    args->session.n_auth_workers = DEFAULT_AUTH_WORKERS;
     args->xdp_fail_enable = DEFAULT_XDP_FAIL_ENABLE;
     main_state.config.jtag.xdp_fail_enable = DEFAULT_XDP_FAIL_ENABLE;
+    main_state.config.jtag.trace_file = NULL;
+    main_state.config.jtag.simulate = false;
+    main_state.config.jtag.sim_chain = NULL;
     args->timeout.is_timeout_enabled = IDLE_TIMEOUT_ENABLED;
     args->timeout.idle_timeout = IDLE_TIMEOUT_MS;
 
@@ -175,10 +201,18 @@ bool process_command_line(int argc, char** argv, asd_args* args)
         ARG_LOG_LEVEL = 256,
         ARG_LOG_STREAMS,
         ARG_LOG_TIMESTAMP,
+        ARG_LOG_ASYNC,
         ARG_HELP,
         ARG_XDP,
         ARG_TIMEOUT,
-        ARG_AUTO_SYNC_REMOTE_LOG
+        ARG_AUTO_SYNC_REMOTE_LOG,
+        ARG_JTAG_TRACE,
+        ARG_JTAG_SIM,
+        ARG_TLS_TICKET_LIFETIME,
+        ARG_TLS_TICKET_ROTATION,
+        ARG_TLS_CHEAP_CRYPTO,
+        ARG_OBSERVERS,
+        ARG_AUTH_WORKERS
     };
 
     struct option opts[] = {
@@ -186,8 +220,16 @@ bool process_command_line(int argc, char** argv, asd_args* args)
         {"log-level", 1, NULL, ARG_LOG_LEVEL},
         {"log-streams", 1, NULL, ARG_LOG_STREAMS},
         {"log-time", 0, NULL, ARG_LOG_TIMESTAMP},
+        {"log-async", 2, NULL, ARG_LOG_ASYNC},
         {"idle-timeout", 1, NULL, ARG_TIMEOUT},
         {"auto-sync-log", 1, NULL, ARG_AUTO_SYNC_REMOTE_LOG},
+        {"jtag-trace", 1, NULL, ARG_JTAG_TRACE},
+        {"jtag-sim", 2, NULL, ARG_JTAG_SIM},
+        {"tls-ticket-lifetime", 1, NULL, ARG_TLS_TICKET_LIFETIME},
+        {"tls-ticket-rotation", 1, NULL, ARG_TLS_TICKET_ROTATION},
+        {"tls-cheap-crypto", 0, NULL, ARG_TLS_CHEAP_CRYPTO},
+        {"observers", 1, NULL, ARG_OBSERVERS},
+        {"auth-workers", 1, NULL, ARG_AUTH_WORKERS},
         {"help", 0, NULL, ARG_HELP},
         {NULL, 0, NULL, 0},
     };
@@ -460,6 +502,22 @@ bool process_command_line(int argc, char** argv, asd_args* args)
                 fprintf(stderr, "Logging timestamp\n");
                 break;
             }
+            case ARG_LOG_ASYNC:
+            {
+                char ch = 0;
+                if (optarg != NULL &&
+                    !validateCharInputs(optarg, &ch, true, true, true, true,
+                                        false, true))
+                {
+                    fprintf(stderr, "Invalid character in log file: %c.\n",
+                            ch);
+                    showUsage(argv);
+                    return false;
+                }
+                args->log_async = true;
+                args->log_file = optarg;
+                break;
+            }
             case ARG_AUTO_SYNC_REMOTE_LOG:
             {
                 args->auto_sync_remote_logging = true;
@@ -475,6 +533,126 @@ bool process_command_line(int argc, char** argv, asd_args* args)
                 }
                 break;
             }
+            case ARG_JTAG_TRACE:
+            {
+                char ch = 0;
+                if (!validateCharInputs(optarg, &ch, true, true, true, true,
+                                        false, true))
+                {
+                    fprintf(stderr,
+                            "Invalid character in JTAG trace file: %c.\n",
+                            ch);
+                    showUsage(argv);
+                    return false;
+                }
+                main_state.config.jtag.trace_file = optarg;
+                fprintf(stderr, "Recording JTAG trace to %s\n", optarg);
+                break;
+            }
+            case ARG_JTAG_SIM:
+            {
+                char ch = 0;
+                if (optarg != NULL &&
+                    !validateCharInputs(optarg, &ch, true, true, true, false,
+                                        true, true))
+                {
+                    fprintf(stderr,
+                            "Invalid character in JTAG simulator chain: %c.\n",
+                            ch);
+                    showUsage(argv);
+                    return false;
+                }
+                main_state.config.jtag.simulate = true;
+                main_state.config.jtag.sim_chain = optarg;
+                fprintf(stderr, "Simulating the %s JTAG chain\n",
+                        optarg ? optarg : "default");
+                break;
+            }
+            case ARG_TLS_TICKET_LIFETIME:
+            case ARG_TLS_TICKET_ROTATION:
+            {
+                char ch = 0;
+                long input_val;
+                if (!validateCharInputs(optarg, &ch, false, false, true, false,
+                                        false, false))
+                {
+                    fprintf(stderr, "Invalid character in TLS ticket time: "
+                                    "%c.\n",
+                            ch);
+                    showUsage(argv);
+                    return false;
+                }
+                input_val = strtol(optarg, NULL, 10);
+                // a ticket lifetime of 0 turns resumption off, keys need to
+                // live at least a second
+                if (input_val > MAX_TLS_TICKET_LIFETIME ||
+                    (c == ARG_TLS_TICKET_ROTATION && input_val == 0))
+                {
+                    fprintf(stderr, "Error value in TLS ticket time: %ld\n",
+                            input_val);
+                    showUsage(argv);
+                    return false;
+                }
+                if (c == ARG_TLS_TICKET_LIFETIME)
+                    args->session.tls.ticket_lifetime =
+                        (unsigned int)input_val;
+                else
+                    args->session.tls.ticket_key_rotation =
+                        (unsigned int)input_val;
+                break;
+            }
+            case ARG_TLS_CHEAP_CRYPTO:
+            {
+                args->session.tls.cheap_crypto = true;
+                fprintf(stderr, "Preferring ChaCha20 and X25519 for TLS\n");
+                break;
+            }
+            case ARG_OBSERVERS:
+            {
+                char ch = 0;
+                long input_val;
+                if (!validateCharInputs(optarg, &ch, false, false, true, false,
+                                        false, false))
+                {
+                    fprintf(stderr, "Invalid character in observers: %c.\n",
+                            ch);
+                    showUsage(argv);
+                    return false;
+                }
+                input_val = strtol(optarg, NULL, 10);
+                if (input_val > MAX_OBSERVERS)
+                {
+                    fprintf(stderr, "Error value in observers: %ld\n",
+                            input_val);
+                    showUsage(argv);
+                    return false;
+                }
+                args->session.n_max_observers = (int)input_val;
+                break;
+            }
+            case ARG_AUTH_WORKERS:
+            {
+                char ch = 0;
+                long input_val;
+                if (!validateCharInputs(optarg, &ch, false, false, true, false,
+                                        false, false))
+                {
+                    fprintf(stderr,
+                            "Invalid character in auth-workers: %c.\n", ch);
+                    showUsage(argv);
+                    return false;
+                }
+                input_val = strtol(optarg, NULL, 10);
+                if (input_val > MAX_AUTH_WORKERS)
+                {
+                    fprintf(stderr, "Error value in auth-workers: %ld\n",
+                            input_val);
+                    showUsage(argv);
+                    return false;
+                }
+                args->session.n_auth_workers = (int)input_val;
+                break;
+            }
             case ARG_TIMEOUT:
             {
                 char ch = 0;
@@ -566,11 +744,33 @@ void showUsage(char** argv)
         "                               %s\n"
         "                               %s\n"
         "  --log-time                 Include timestamps on logs.\n"
+        "  --log-async[=<file>]       Write the logs from a background thread,\n"
+        "                             to <file> when given. Messages are\n"
+        "                             dropped and counted if it falls behind.\n"
         "  --auto-sync-log=STREAMS    Auto-sync local logging with remote logging\n"
         "                             settings for specified streams.\n"
         "                             STREAMS is a comma-separated list.\n"
         "                             Available: network,jtag,pins,i2c,test,daemon,\n"
         "                             sdk,i3c_dbg,all\n"
+        "  --jtag-trace=<file>        Record every JTAG operation to a binary\n"
+        "                             ring file, see jtag_replay.\n"
+        "  --jtag-sim[=<chain>]       Run JTAG against a simulated TAP chain\n"
+        "                             instead of /dev/jtag0. <chain> is a\n"
+        "                             comma-separated list of\n"
+        "                             <idcode>-<ir length>, TDO side first.\n"
+        "  --tls-ticket-lifetime=<s>  Lifetime of TLS session tickets, 0 turns\n"
+        "                             resumption off (default: %d)\n"
+        "  --tls-ticket-rotation=<s>  Replace the ticket key this often\n"
+        "                             (default: %d)\n"
+        "  --tls-cheap-crypto         Prefer ChaCha20-Poly1305 and X25519,\n"
+        "                             cheaper on cores without AES\n"
+        "                             instructions.\n"
+        "  --observers=<n>            Let up to n more clients follow the\n"
+        "                             session read-only, they get its events\n"
+        "                             and remote logs (default: %d, max: %d)\n"
+        "  --auth-workers=<n>         Threads checking client passwords with\n"
+        "                             PAM, 0 checks them on the network\n"
+        "                             thread (default: %d, max: %d)\n"
         "  --help                     Show this list\n"
         "\n"
         "Examples:\n"
@@ -585,6 +785,9 @@ void showUsage(char** argv)
         "\n"
         "Default logging, only listen on eth0.\n"
         "     asd -n eth0\n"
+        "\n"
+        "Send SIGUSR1 to log the per stage latency histograms.\n"
+        "     kill -USR1 $(pidof asd)\n"
         "\n",
         asd_version, argv[0], DEFAULT_PORT, DEFAULT_CERT_FILE,
         MAX_IxC_BUSES, MAX_IxC_BUSES,
@@ -601,7 +804,9 @@ void showUsage(char** argv)
         streamtostring(ASD_LogStream_Network),
         streamtostring(ASD_LogStream_Daemon),
         streamtostring(ASD_LogStream_SDK),
-        streamtostring(ASD_LogStream_SPP));
+        streamtostring(ASD_LogStream_SPP), DEFAULT_TLS_TICKET_LIFETIME,
+        DEFAULT_TLS_TICKET_KEY_ROTATION, DEFAULT_MAX_OBSERVERS, MAX_OBSERVERS,
+        DEFAULT_AUTH_WORKERS, MAX_AUTH_WORKERS);
 }
 
 // This function maps the open ipc log levels to the levels
@@ -629,8 +834,35 @@ bool main_should_remote_log(ASD_LogLevel asd_level, ASD_LogStream asd_stream)
     return result;
 }
 
+// the client asked for log records rather than text
+bool main_should_log_binary(ASD_LogLevel asd_level, ASD_LogStream asd_stream)
+{
+    return main_state.config.remote_logging.binary &&
+           main_should_remote_log(asd_level, asd_stream);
+}
+
+static void on_stats_signal(int signum)
+{
+    (void)signum;
+    stats_dump_requested = 1;
+}
+
 STATUS init_asd_state(void)
 {
+    if (init_out_queue() != ST_OK)
+        return ST_ERR;
+
+    struct sigaction stats_action = {0};
+    stats_action.sa_handler = on_stats_signal;
+    stats_action.sa_flags = SA_RESTART;
+    sigemptyset(&stats_action.sa_mask);
+    if (sigaction(SIGUSR1, &stats_action, NULL) != 0)
+    {
+        ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+                ASD_LogOption_None,
+                "Could not install the SIGUSR1 handler, latency histograms "
+                "will not be dumped");
+    }
 
     STATUS result = set_config_defaults(&main_state.config,
                                         &main_state.args.busopt,
@@ -643,7 +875,15 @@ STATUS init_asd_state(void)
                                     main_state.args.use_syslog,
                                     main_state.args.log_timestamp_enable,
                                     NULL, NULL);
+        if (main_state.args.log_async)
+            result = log_async_start(main_state.args.log_file,
+                                     main_state.args.use_syslog);
+    }
 
+    if (result == ST_OK)
+    {
+        if (main_state.args.session.e_extnet_type == EXTNET_HDLR_TLS)
+            exttls_set_options(&main_state.args.session.tls);
         main_state.extnet =
             extnet_init(main_state.args.session.e_extnet_type,
                         main_state.args.session.cp_certkeyfile, MAX_SESSIONS);
@@ -655,7 +895,8 @@ STATUS init_asd_state(void)
 
     if (result == ST_OK)
     {
-        result = auth_init(main_state.args.session.e_auth_type, NULL);
+        result = auth_init(main_state.args.session.e_auth_type,
+                           &main_state.args.session.n_auth_workers);
     }
 
     if (result == ST_OK)
@@ -663,6 +904,10 @@ STATUS init_asd_state(void)
         main_state.session = session_init(main_state.extnet);
         if (!main_state.session)
             result = ST_ERR;
+        else if (session_set_max_observers(
+                     main_state.session,
+                     main_state.args.session.n_max_observers) != ST_OK)
+            result = ST_ERR;
         else
         {
             main_state.event_fd = eventfd(0, O_NONBLOCK);
@@ -686,20 +931,48 @@ STATUS init_asd_state(void)
         }
     }
 
+    if (result == ST_OK)
+    {
+        main_state.loop.num_watched = 0;
+        main_state.loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (main_state.loop.epoll_fd == -1)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_None, "Could not create the event loop.");
+            result = ST_ERR;
+        }
+    }
+
+    if (result == ST_OK)
+    {
+        result = timer_queue_init(&main_state.timers);
+        if (result == ST_OK)
+        {
+            timer_init(&main_state.idle_timer, on_idle_timer, &main_state);
+            session_set_timer_queue(main_state.session, &main_state.timers);
+        }
+    }
+
     return result;
 }
 
 void deinit_asd_state(asd_state* state)
 {
     session_close_all(state->session);
+    auth_deinit();
     if (state->host_fd != 0)
         close(state->host_fd);
+    if (state->loop.epoll_fd > 0)
+        close(state->loop.epoll_fd);
+    if (state->timers.fd > 0)
+        timer_queue_deinit(&state->timers);
 
     if (asd_api_target_deinit() != ST_OK)
     {
         ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
                 ASD_LogOption_None, "Failed to de-initialize the asd_msg");
     }
+    log_async_stop();
 }
 
 STATUS send_out_msg_on_socket(unsigned char* buffer, size_t length)
@@ -720,8 +993,10 @@ STATUS send_out_msg_on_socket(unsigned char* buffer, size_t length)
 
         if (result == ST_OK)
         {
+            uint64_t start = ASD_stats_now();
             cnt = extnet_send(main_state.extnet, &authd_conn, buffer,
                               length);
+            ASD_stats_record(ASD_Stage_ResponseSend, start);
             if (cnt != length)
             {
                 ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
@@ -735,6 +1010,464 @@ STATUS send_out_msg_on_socket(unsigned char* buffer, size_t length)
     return result;
 }
 
+STATUS init_out_queue(void)
+{
+    response_queue.head = 0;
+    response_queue.tail = 0;
+    response_queue.ring[0].used = 0;
+    response_queue.sending = false;
+    response_queue.send_failed = false;
+    response_queue.events[0].used = 0;
+    response_queue.events[1].used = 0;
+    response_queue.events_fill = 0;
+    response_queue.observing = false;
+    response_queue.events_dropped = false;
+    response_queue.network_thread = pthread_self();
+    pthread_mutex_init(&response_queue.lock, NULL);
+    pthread_cond_init(&response_queue.sent, NULL);
+    // the buffer at head is always being filled
+    if (sem_init(&response_queue.free_buffers, 0, NUM_OUT_BUFFERS - 1) != 0)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                ASD_LogOption_No_Remote,
+                "Could not create the response queue: %d", errno);
+        return ST_ERR;
+    }
+    return ST_OK;
+}
+
+static bool on_network_thread(void)
+{
+    return pthread_equal(pthread_self(), response_queue.network_thread);
+}
+
+//
+// Hand the buffer at head over to the socket thread. Called with the lock
+// held and a free buffer taken from free_buffers.
+//
+static void seal_out_buffer(void)
+{
+    uint64_t wake = 1;
+    unsigned int head = response_queue.head + 1;
+
+    response_queue.ring[head % NUM_OUT_BUFFERS].used = 0;
+    __atomic_store_n(&response_queue.head, head, __ATOMIC_RELEASE);
+    if (!on_network_thread() &&
+        write(main_state.event_fd, &wake, sizeof(wake)) != sizeof(wake))
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                ASD_LogOption_No_Remote,
+                "Could not wake the socket thread: %d", errno);
+    }
+}
+
+//
+// Seal the buffer at head until it has room for length more bytes, or at
+// least until it is empty when length is 0. Called and returns with the
+// lock held. A producer that finds every buffer waiting to be sent stalls
+// until the socket thread catches up; on the socket thread itself that
+// means sending them first.
+//
+static STATUS make_room_out_msgs(size_t length)
+{
+    STATUS result = ST_OK;
+    bool have_buffer = false;
+
+    while (result == ST_OK)
+    {
+        out_buffer* buffer =
+            &response_queue.ring[response_queue.head % NUM_OUT_BUFFERS];
+        if (length ? buffer->used + length <= OUT_QUEUE_SIZE
+                   : buffer->used == 0)
+            break;
+        if (have_buffer || sem_trywait(&response_queue.free_buffers) == 0)
+        {
+            seal_out_buffer();
+            have_buffer = false;
+            continue;
+        }
+        pthread_mutex_unlock(&response_queue.lock);
+        if (on_network_thread())
+        {
+            // Nothing can be sent while a send is already in progress,
+            // only a remote log raised by that send can get here.
+            if (response_queue.sending)
+                result = ST_ERR;
+            else
+                result = send_sealed_out_msgs();
+        }
+        else
+        {
+            while (sem_wait(&response_queue.free_buffers) != 0)
+            {
+                if (errno != EINTR)
+                {
+                    result = ST_ERR;
+                    break;
+                }
+            }
+            have_buffer = (result == ST_OK);
+        }
+        pthread_mutex_lock(&response_queue.lock);
+    }
+    // someone else sealed the buffer in the meantime
+    if (have_buffer)
+        sem_post(&response_queue.free_buffers);
+    return result;
+}
+
+static STATUS copy_out_msg(out_buffer* buffer, const struct iovec* iov,
+                           int iovcnt)
+{
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (memcpy_s(&buffer->buffer[buffer->used],
+                     OUT_QUEUE_SIZE - buffer->used, iov[i].iov_base,
+                     iov[i].iov_len))
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_No_Remote,
+                    "memcpy_s: response to out queue copy failed.");
+            return ST_ERR;
+        }
+        buffer->used += iov[i].iov_len;
+    }
+    return ST_OK;
+}
+
+static STATUS append_out_msg(const struct iovec* iov, int iovcnt,
+                             bool event)
+{
+    STATUS result;
+    size_t length = 0;
+    bool dropped = false;
+
+    if (!iov || iovcnt <= 0)
+        return ST_ERR;
+
+    for (int i = 0; i < iovcnt; i++)
+        length += iov[i].iov_len;
+    if (length > OUT_QUEUE_SIZE)
+        return ST_ERR;
+
+    pthread_mutex_lock(&response_queue.lock);
+    result = make_room_out_msgs(length);
+    if (result == ST_OK)
+        result = copy_out_msg(
+            &response_queue.ring[response_queue.head % NUM_OUT_BUFFERS], iov,
+            iovcnt);
+    if (result == ST_OK && event && response_queue.observing)
+    {
+        // Observers must not hold up the controlling session, an event
+        // that does not fit before the next swap is lost for them.
+        out_buffer* events =
+            &response_queue.events[response_queue.events_fill];
+        if (events->used + length <= OUT_QUEUE_SIZE)
+            copy_out_msg(events, iov, iovcnt);
+        else if (!response_queue.events_dropped)
+            dropped = response_queue.events_dropped = true;
+    }
+    pthread_mutex_unlock(&response_queue.lock);
+    if (dropped)
+        ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+                ASD_LogOption_No_Remote,
+                "Observers fell behind, events were not sent to them");
+    return result;
+}
+
+STATUS queue_out_msg(const struct iovec* iov, int iovcnt)
+{
+    return append_out_msg(iov, iovcnt, false);
+}
+
+//
+// Queue a message the target did not send in reply to a request (pin and
+// BPK events, remote logs). The controlling session gets it like any
+// response, the observers get it too.
+//
+STATUS queue_out_event(const struct iovec* iov, int iovcnt)
+{
+    return append_out_msg(iov, iovcnt, true);
+}
+
+//
+// Release the backlogs of observers that left, their connection and file
+// descriptor may be reused by the next one.
+//
+static void forget_gone_observers(extnet_conn_t* const* observers,
+                                  int n_observers)
+{
+    for (int i = 0; i < MAX_OBSERVERS; i++)
+    {
+        observer_backlog* backlog = &observer_backlogs[i];
+        bool found = false;
+
+        for (int j = 0; j < n_observers && !found; j++)
+            found = observers[j] == backlog->conn &&
+                    observers[j]->sockfd == backlog->sockfd;
+        if (!found)
+            backlog->conn = NULL;
+    }
+}
+
+static observer_backlog* get_observer_backlog(extnet_conn_t* conn)
+{
+    observer_backlog* free_backlog = NULL;
+
+    for (int i = 0; i < MAX_OBSERVERS; i++)
+    {
+        observer_backlog* backlog = &observer_backlogs[i];
+        if (backlog->conn == conn && backlog->sockfd == conn->sockfd)
+            return backlog;
+        if (!backlog->conn && !free_backlog)
+            free_backlog = backlog;
+    }
+    if (free_backlog)
+    {
+        free_backlog->conn = conn;
+        free_backlog->sockfd = conn->sockfd;
+        free_backlog->pending.used = 0;
+        free_backlog->sent = 0;
+        free_backlog->behind_since_ms = 0;
+    }
+    return free_backlog;
+}
+
+//
+// Write what the observer takes without blocking, -1 when it cannot be
+// written to anymore.
+//
+static int send_to_observer(extnet_conn_t* conn, unsigned char* buffer,
+                            size_t length)
+{
+    size_t sent = 0;
+
+    while (sent < length)
+    {
+        uint64_t start = ASD_stats_now();
+        int cnt = extnet_send_nowait(main_state.extnet, conn, &buffer[sent],
+                                     length - sent);
+        ASD_stats_record(ASD_Stage_ResponseSend, start);
+        if (cnt < 0)
+            return -1;
+        if (cnt == 0)
+            break;
+        sent += (size_t)cnt;
+    }
+    return (int)sent;
+}
+
+//
+// Continue with the backlog, then send the new events if the observer took
+// all of it. A message is never cut short, what the socket does not take is
+// kept for the next call; only whole event buffers are skipped.
+//
+static STATUS send_observer(observer_backlog* backlog, out_buffer* events)
+{
+    int cnt;
+
+    if (backlog->sent < backlog->pending.used)
+    {
+        cnt = send_to_observer(backlog->conn,
+                               &backlog->pending.buffer[backlog->sent],
+                               backlog->pending.used - backlog->sent);
+        if (cnt < 0)
+            return ST_ERR;
+        backlog->sent += (size_t)cnt;
+        if (backlog->sent < backlog->pending.used)
+            return ST_OK;
+        backlog->pending.used = 0;
+        backlog->sent = 0;
+    }
+    backlog->behind_since_ms = 0;
+    if (events->used == 0)
+        return ST_OK;
+
+    cnt = send_to_observer(backlog->conn, events->buffer, events->used);
+    if (cnt < 0)
+        return ST_ERR;
+    if ((size_t)cnt < events->used)
+    {
+        // OpenSSL may hold part of it already, it must be sent as is
+        backlog->pending.used = events->used - (size_t)cnt;
+        backlog->sent = 0;
+        if (memcpy_s(backlog->pending.buffer, OUT_QUEUE_SIZE,
+                     &events->buffer[cnt], backlog->pending.used))
+            return ST_ERR;
+        backlog->behind_since_ms = timer_now_ms();
+        ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+                ASD_LogOption_No_Remote,
+                "Observer on fd %d fell behind, it misses events until it "
+                "catches up",
+                backlog->conn->sockfd);
+    }
+    return ST_OK;
+}
+
+//
+// Socket thread only: start or stop copying events for observers as they
+// come and go.
+//
+void update_observing(void)
+{
+    extnet_conn_t* observers[MAX_OBSERVERS];
+    int n_observers = session_get_observer_conns(main_state.session, observers);
+
+    forget_gone_observers(observers, n_observers);
+    pthread_mutex_lock(&response_queue.lock);
+    response_queue.observing = n_observers > 0;
+    pthread_mutex_unlock(&response_queue.lock);
+}
+
+//
+// Socket thread only: write the events gathered since the last call to
+// every observer. The buffer is encoded once and shared by all of them.
+// Observers never hold up the controlling session, one that cannot be
+// written to or stays behind for OBSERVER_MAX_BEHIND_MS is disconnected.
+//
+void send_observer_events(void)
+{
+    extnet_conn_t* observers[MAX_OBSERVERS];
+    int n_observers = session_get_observer_conns(main_state.session, observers);
+    bool closed = false;
+    out_buffer* events;
+
+    pthread_mutex_lock(&response_queue.lock);
+    events = &response_queue.events[response_queue.events_fill];
+    response_queue.events_fill ^= 1;
+    response_queue.events_dropped = false;
+    pthread_mutex_unlock(&response_queue.lock);
+
+    forget_gone_observers(observers, n_observers);
+    for (int i = 0; i < n_observers; i++)
+    {
+        observer_backlog* backlog = get_observer_backlog(observers[i]);
+        STATUS result = backlog ? send_observer(backlog, events) : ST_ERR;
+
+        if (result != ST_OK)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_No_Remote,
+                    "Failed to write to observer on fd %d, closing",
+                    observers[i]->sockfd);
+        }
+        else if (backlog->behind_since_ms != 0 &&
+                 timer_now_ms() - backlog->behind_since_ms >=
+                     OBSERVER_MAX_BEHIND_MS)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_No_Remote,
+                    "Observer on fd %d stopped reading, closing",
+                    observers[i]->sockfd);
+            result = ST_ERR;
+        }
+        if (result != ST_OK)
+        {
+            session_close(main_state.session, observers[i]);
+            closed = true;
+        }
+    }
+    // producers only fill the other buffer until the next swap
+    events->used = 0;
+    if (closed)
+        update_observing();
+}
+
+//
+// Seal what is queued so far. The socket thread sends it right away and
+// fails when the client could not be written to, any other thread leaves
+// it to the socket thread.
+//
+STATUS flush_out_msgs(void)
+{
+    STATUS result;
+
+    pthread_mutex_lock(&response_queue.lock);
+    result = make_room_out_msgs(0);
+    pthread_mutex_unlock(&response_queue.lock);
+    if (result == ST_OK && on_network_thread())
+        result = send_sealed_out_msgs();
+    return result;
+}
+
+//
+// Seal what is queued so far and wait until the socket thread wrote it,
+// for callers that need to know it reached the client.
+//
+STATUS flush_out_msgs_sync(void)
+{
+    STATUS result;
+    unsigned int sealed;
+
+    if (on_network_thread())
+        return flush_out_msgs();
+
+    pthread_mutex_lock(&response_queue.lock);
+    result = make_room_out_msgs(0);
+    sealed = response_queue.head;
+    // tail may move past sealed before this thread runs again
+    while (result == ST_OK && (int)(sealed - response_queue.tail) > 0)
+        pthread_cond_wait(&response_queue.sent, &response_queue.lock);
+    if (result == ST_OK && response_queue.send_failed)
+        result = ST_ERR;
+    pthread_mutex_unlock(&response_queue.lock);
+    return result;
+}
+
+//
+// Socket thread only: write every sealed buffer to the client. Once a
+// write failed the connection is gone, later buffers are only released
+// and every call fails until the client is dropped.
+//
+STATUS send_sealed_out_msgs(void)
+{
+    unsigned int head =
+        __atomic_load_n(&response_queue.head, __ATOMIC_ACQUIRE);
+
+    if (response_queue.sending)
+        return response_queue.send_failed ? ST_ERR : ST_OK;
+    response_queue.sending = true;
+    while (response_queue.tail != head)
+    {
+        out_buffer* buffer =
+            &response_queue.ring[response_queue.tail % NUM_OUT_BUFFERS];
+        bool failed =
+            !response_queue.send_failed &&
+            send_out_msg_on_socket(buffer->buffer, buffer->used) != ST_OK;
+
+        pthread_mutex_lock(&response_queue.lock);
+        if (failed)
+            response_queue.send_failed = true;
+        __atomic_store_n(&response_queue.tail, response_queue.tail + 1,
+                         __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&response_queue.sent);
+        pthread_mutex_unlock(&response_queue.lock);
+        sem_post(&response_queue.free_buffers);
+    }
+    send_observer_events();
+    response_queue.sending = false;
+    return response_queue.send_failed ? ST_ERR : ST_OK;
+}
+
+//
+// Socket thread only, with the worker stopped: drop what was meant for a
+// client that left.
+//
+void discard_out_msgs(void)
+{
+    pthread_mutex_lock(&response_queue.lock);
+    while (response_queue.tail != response_queue.head)
+    {
+        response_queue.tail++;
+        sem_post(&response_queue.free_buffers);
+    }
+    response_queue.ring[response_queue.head % NUM_OUT_BUFFERS].used = 0;
+    response_queue.events[0].used = 0;
+    response_queue.events[1].used = 0;
+    response_queue.send_failed = false;
+    pthread_mutex_unlock(&response_queue.lock);
+}
+
 void send_warning_message(long idle_timeout_ms, long warning_time_ms) {
     long remaining_time_ms = idle_timeout_ms - warning_time_ms;
     long hours = remaining_time_ms / (HOURSTOMS);
@@ -762,67 +1495,203 @@ void send_warning_message(long idle_timeout_ms, long warning_time_ms) {
 }
 
 
-bool check_idle_timeout(struct timeval* last_activity_time,
-                        bool* send_idle_warning_message, long idle_timeout_ms,
-                        long warning_time_ms)
+//
+// The idle timer is not moved on every message, only when it fires: it is
+// then pushed back to the warning or the disconnect deadline counted from
+// the last activity, or acts on it.
+//
+void on_idle_timer(asd_timer* timer, void* ctx)
 {
-    struct timeval current_time;
-    gettimeofday(&current_time, NULL);
-    long elapsed_time_ms =
-        (current_time.tv_sec - last_activity_time->tv_sec) * MSTOSEC;
-    elapsed_time_ms +=
-        (current_time.tv_usec - last_activity_time->tv_usec) / MSTOSEC;
-
-    if (!*send_idle_warning_message && elapsed_time_ms > warning_time_ms)
+    asd_state* state = (asd_state*)ctx;
+    long idle_timeout_ms = state->config.timecfg.idle_timeout;
+    long warning_time_ms = idle_timeout_ms * 0.9;
+    uint64_t elapsed_ms = timer_now_ms() - state->last_activity_ms;
+
+    if (!is_connected || !state->config.timecfg.is_timeout_enabled)
+        return;
+
+    if (!state->idle_warning_sent)
     {
+        if (elapsed_ms < (uint64_t)warning_time_ms)
+        {
+            timer_schedule(&state->timers, timer,
+                           state->last_activity_ms + warning_time_ms);
+            return;
+        }
         send_warning_message(idle_timeout_ms, warning_time_ms);
-        *send_idle_warning_message = true;
+        state->idle_warning_sent = true;
     }
 
-    if (elapsed_time_ms > idle_timeout_ms)
+    if (elapsed_ms < (uint64_t)idle_timeout_ms)
     {
-        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Daemon, ASD_LogOption_None,
-                "Time limit reached, disconnect");
-        return true; // Idle timeout occurred
+        timer_schedule(&state->timers, timer,
+                       state->last_activity_ms + idle_timeout_ms);
+        return;
     }
+    ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Daemon, ASD_LogOption_None,
+            "Time limit reached, disconnect");
+    close_connection(state);
+}
+
+//
+// Bring the epoll registration in line with the wanted descriptors: add
+// the new ones, update the ones whose events changed and drop the ones no
+// longer wanted. Nothing reaches the kernel while the set is unchanged.
+//
+STATUS watch_fds_sync(event_loop* loop, const watched_fd* wanted,
+                      int num_wanted)
+{
+    STATUS result = ST_OK;
 
-    return false; // No idle timeout
+    if (!loop || (!wanted && num_wanted > 0))
+        return ST_ERR;
+
+    for (int i = 0; i < num_wanted; i++)
+    {
+        struct epoll_event event = {0};
+        watched_fd* entry = NULL;
+        int op = EPOLL_CTL_ADD;
+
+        for (int j = 0; j < loop->num_watched; j++)
+        {
+            if (loop->watched[j].fd == wanted[i].fd)
+            {
+                entry = &loop->watched[j];
+                break;
+            }
+        }
+        if (entry)
+        {
+            entry->seen = true;
+            if (entry->events == wanted[i].events &&
+                entry->kind == wanted[i].kind)
+                continue;
+            op = EPOLL_CTL_MOD;
+        }
+        else if (loop->num_watched < MAX_FDS)
+        {
+            entry = &loop->watched[loop->num_watched++];
+        }
+        else
+        {
+            result = ST_ERR;
+            break;
+        }
+
+        event.events = wanted[i].events;
+        event.data.fd = wanted[i].fd;
+        if (epoll_ctl(loop->epoll_fd, op, wanted[i].fd, &event) != 0)
+        {
+            // The kernel drops a descriptor from the set when it is closed,
+            // the number may since have been reused.
+            op = (op == EPOLL_CTL_ADD) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            if ((errno != EEXIST && errno != ENOENT) ||
+                epoll_ctl(loop->epoll_fd, op, wanted[i].fd, &event) != 0)
+            {
+                ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                        ASD_LogOption_None, "Failed to watch fd %d: %d",
+                        wanted[i].fd, errno);
+                result = ST_ERR;
+            }
+        }
+        entry->fd = wanted[i].fd;
+        entry->events = wanted[i].events;
+        entry->kind = wanted[i].kind;
+        entry->seen = true;
+    }
+
+    for (int j = 0; j < loop->num_watched;)
+    {
+        if (loop->watched[j].seen)
+        {
+            loop->watched[j++].seen = false;
+            continue;
+        }
+        // fails harmlessly when the descriptor was already closed
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->watched[j].fd, NULL);
+        loop->watched[j] = loop->watched[--loop->num_watched];
+    }
+    return result;
+}
+
+//
+// Drop descriptors that were closed behind the loop's back (fd -1 for all
+// the descriptors of a kind), so that a reused number is registered again.
+//
+void watch_fds_forget(event_loop* loop, watch_kind kind, int fd)
+{
+    if (!loop)
+        return;
+    for (int j = 0; j < loop->num_watched;)
+    {
+        if (loop->watched[j].kind == kind &&
+            (fd == -1 || loop->watched[j].fd == fd))
+            loop->watched[j] = loop->watched[--loop->num_watched];
+        else
+            j++;
+    }
 }
 
 STATUS request_processing_loop(asd_state* state)
 {
     STATUS result = ST_OK;
-    struct pollfd poll_fds[MAX_FDS] = {{0}};
-
-    struct timeval last_activity_time;
-    gettimeofday(&last_activity_time, NULL);
-    bool send_idle_warning_message = false;
-    long warning_time = main_state.config.timecfg.idle_timeout * 0.9;
-    poll_fds[HOST_FD_INDEX].fd = state->host_fd;
-    poll_fds[HOST_FD_INDEX].events = POLLIN;
+    struct epoll_event events[MAX_FDS];
+    watched_fd wanted[MAX_FDS];
+
+    state->last_activity_ms = timer_now_ms();
+    state->idle_warning_sent = false;
     while (1)
     {
         session_fdarr_t session_fds = {-1};
+        struct pollfd client_fds[MAX_FDS] = {{0}};
         int n_clients = 0, i;
         int n_gpios = 0;
-        int n_poll_ret = -1;
+        int n_wanted = 0;
+        int n_events = -1;
         int n_timeout = -1;       // infinite
-        int n_poll_timeout = 10;  // 10 milliseconds
-        int client_fd_index = 0;
+        bool gpio_ready = false;
+        bool host_ready = false;
+        bool client_pending = false;
+        bool timer_ready = false;
+        bool auth_ready = false;
+        bool activity = false;
+        int auth_fd = auth_get_event_fd();
         asd_target_interface_events target_events;
 
+        if (stats_dump_requested)
+        {
+            stats_dump_requested = 0;
+            ASD_stats_dump();
+        }
         if (is_connected && main_state.config.timecfg.is_timeout_enabled)
         {
-            if (check_idle_timeout(&last_activity_time,
-                                   &send_idle_warning_message,
-                                   main_state.config.timecfg.idle_timeout,
-                                   warning_time))
-            {
-                close_connection(state);
-                gettimeofday(&last_activity_time, NULL);
-                send_idle_warning_message = false;
-                continue;
-            }
+            // first due at the warning, on_idle_timer takes it from there
+            if (!timer_pending(&state->idle_timer))
+                timer_schedule(&state->timers, &state->idle_timer,
+                               state->last_activity_ms +
+                                   (uint64_t)(main_state.config.timecfg
+                                                  .idle_timeout *
+                                              0.9));
+        }
+        else
+        {
+            timer_cancel(&state->timers, &state->idle_timer);
+        }
+
+        wanted[n_wanted].fd = state->host_fd;
+        wanted[n_wanted].events = EPOLLIN;
+        wanted[n_wanted++].kind = WATCH_HOST;
+        wanted[n_wanted].fd = state->timers.fd;
+        wanted[n_wanted].events = EPOLLIN;
+        wanted[n_wanted++].kind = WATCH_TIMER;
+        wanted[n_wanted].fd = state->event_fd;
+        wanted[n_wanted].events = EPOLLIN;
+        wanted[n_wanted++].kind = WATCH_EVENT;
+        if (auth_fd != -1)
+        {
+            wanted[n_wanted].fd = auth_fd;
+            wanted[n_wanted].events = EPOLLIN;
+            wanted[n_wanted++].kind = WATCH_AUTH;
         }
         if (asd_api_target_ioctl(NULL, &target_events,
                                  IOCTL_TARGET_GET_PIN_FDS) == ST_OK)
@@ -830,12 +1699,16 @@ STATUS request_processing_loop(asd_state* state)
             n_gpios = target_events.num_fds;
             for (i = 0; i < n_gpios; i++)
             {
-                poll_fds[GPIO_FD_INDEX + i] = target_events.fds[i];
+                target_events.fds[i].revents = 0;
+                wanted[n_wanted].fd = target_events.fds[i].fd;
+                // poll and epoll share the values of the event bits
+                wanted[n_wanted].events =
+                    (uint32_t)(unsigned short)target_events.fds[i].events;
+                wanted[n_wanted++].kind = WATCH_TARGET;
             }
         }
         if (result == ST_OK)
         {
-            client_fd_index = GPIO_FD_INDEX + n_gpios;
             if (session_getfds(state->session, &session_fds, &n_clients,
                                &n_timeout) != ST_OK)
             {
@@ -849,59 +1722,144 @@ STATUS request_processing_loop(asd_state* state)
             {
                 for (i = 0; i < n_clients; i++)
                 {
-                    poll_fds[client_fd_index + i].fd = session_fds[i];
-                    poll_fds[client_fd_index + i].events = POLLIN;
+                    client_fds[i].fd = session_fds[i];
+                    client_fds[i].events = POLLIN;
+                    wanted[n_wanted].fd = session_fds[i];
+                    wanted[n_wanted].events = EPOLLIN;
+                    wanted[n_wanted++].kind = WATCH_CLIENT;
                 }
             }
         }
+        if (result == ST_OK)
+            result = watch_fds_sync(&state->loop, wanted, n_wanted);
         if (result == ST_OK)
         {
-            // Processing network events
-            n_poll_ret = poll(poll_fds, (nfds_t)(client_fd_index + n_clients),
-                              n_poll_timeout);
+            // Deadlines arrive through the timer fd, the wait only has a
+            // timeout when TLS already holds data.
+            n_events = epoll_wait(state->loop.epoll_fd, events, MAX_FDS,
+                                  n_timeout);
 
-            if (n_poll_ret == -1)      // poll error
+            if (n_events == -1)      // epoll error
             {
-                result = ST_ERR;
+                // a signal (SIGUSR1) is not an error
+                if (errno != EINTR)
+                    result = ST_ERR;
             }
-            else if (n_poll_ret > 0)   // poll returned with network events
+            else
             {
-                if (poll_fds[HOST_FD_INDEX].revents & POLLIN)
+                for (int e = 0; e < n_events; e++)
                 {
-                    process_new_client(state, poll_fds, MAX_FDS, &n_clients,
-                                       client_fd_index);
+                    short revents = (short)events[e].events;
+                    if (events[e].data.fd == state->timers.fd)
+                    {
+                        timer_ready = true;
+                        continue;
+                    }
+                    if (events[e].data.fd == state->event_fd)
+                    {
+                        // the worker sealed responses, sent below
+                        uint64_t wakes;
+                        if (read(state->event_fd, &wakes, sizeof(wakes)) < 0 &&
+                            errno != EAGAIN)
+                            result = ST_ERR;
+                        continue;
+                    }
+                    if (auth_fd != -1 && events[e].data.fd == auth_fd)
+                    {
+                        // credentials checked, answered below
+                        auth_ready = true;
+                        continue;
+                    }
+                    activity = true;
+                    if (events[e].data.fd == state->host_fd)
+                    {
+                        host_ready = true;
+                        continue;
+                    }
+                    for (i = 0; i < n_gpios; i++)
+                    {
+                        if (target_events.fds[i].fd == events[e].data.fd)
+                        {
+                            target_events.fds[i].revents = revents;
+                            gpio_ready = true;
+                        }
+                    }
+                    for (i = 0; i < n_clients; i++)
+                    {
+                        if (client_fds[i].fd == events[e].data.fd)
+                            client_fds[i].revents = revents;
+                    }
                 }
-                process_all_client_messages(
-                    state, (const struct pollfd*)(&poll_fds[client_fd_index]),
-                    (size_t)n_clients);
-
-                if (is_connected)
+                if (n_timeout == 0)
                 {
-                    gettimeofday(&last_activity_time,
-                                 NULL); // Update last activity time
-                    send_idle_warning_message = false;
+                    // Data already decrypted by TLS does not make the
+                    // socket readable.
+                    for (i = 0; i < n_clients; i++)
+                    {
+                        bool pending = false;
+                        extnet_conn_t* conn =
+                            session_lookup_conn(state->session,
+                                                client_fds[i].fd);
+                        if (conn &&
+                            session_get_data_pending(state->session, conn,
+                                                     &pending) == ST_OK &&
+                            pending)
+                        {
+                            client_fds[i].revents |= POLLIN;
+                            client_pending = true;
+                        }
+                    }
                 }
             }
         }
-        if (result == ST_OK)
+        if (result == ST_OK && (activity || client_pending))
         {
-            if (n_gpios > 0)
+            if (host_ready)
             {
-                poll_asd_target_interface_events poll_target_fds;
-                poll_target_fds.poll_fds = &poll_fds[GPIO_FD_INDEX];
-                poll_target_fds.num_fds = n_gpios;
+                process_new_client(state, client_fds, MAX_FDS, &n_clients, 0);
+            }
+            process_all_client_messages(
+                state, (const struct pollfd*)client_fds, (size_t)n_clients);
 
-                if (asd_api_target_ioctl(
-                        &poll_target_fds, NULL,
-                        IOCTL_TARGET_PROCESS_ALL_PIN_EVENTS) != ST_OK)
-                {
-                    close_connection(state);
-                    continue;
-                }
+            if (is_connected)
+            {
+                // the idle timer sees it next time it fires
+                state->last_activity_ms = timer_now_ms();
+                state->idle_warning_sent = false;
+            }
+        }
+        if (result == ST_OK && auth_ready)
+            auth_process_results(state->session, state->extnet,
+                                 on_auth_result, state);
+        // after the messages, which may have reset the idle time
+        if (result == ST_OK && timer_ready)
+            timer_queue_expire(&state->timers);
+        if (result == ST_OK && gpio_ready)
+        {
+            poll_asd_target_interface_events poll_target_fds;
+            poll_target_fds.poll_fds = target_events.fds;
+            poll_target_fds.num_fds = n_gpios;
+
+            if (asd_api_target_ioctl(&poll_target_fds, NULL,
+                                     IOCTL_TARGET_PROCESS_ALL_PIN_EVENTS) !=
+                ST_OK)
+            {
+                close_connection(state);
+                continue;
             }
         }
         if (result != ST_OK)
             break;
+        // Everything produced during this iteration (responses, pin and
+        // BPK events, remote logs) leaves in as few writes as possible,
+        // together with what the worker handed over.
+        if (is_connected && flush_out_msgs() != ST_OK)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_No_Remote,
+                    "Failed to send the queued messages to the client");
+            close_connection(state);
+        }
     }
     return result;
 }
@@ -949,6 +1907,12 @@ STATUS process_new_client(asd_state* state, struct pollfd* poll_fds,
                     "Failed to accept incoming connection.");
             on_connection_aborted();
         }
+        else
+        {
+            // the number may belong to a session closed since the last
+            // registration update
+            watch_fds_forget(&state->loop, WATCH_CLIENT, new_extconn.sockfd);
+        }
     }
 
     if (result == ST_OK)
@@ -1054,11 +2018,36 @@ STATUS process_client_message(asd_state* state, const struct pollfd poll_fd)
         }
     }
 
-    if (result == ST_OK && (b_data_pending || poll_fd.revents & POLLIN))
+    if (result == ST_OK && (b_data_pending || poll_fd.revents & POLLIN) &&
+        session_is_observer(state->session, p_extconn))
+    {
+        // observers only listen, nothing they send reaches the target
+        result = discard_observer_input(state, p_extconn);
+    }
+    else if (result == ST_OK && (b_data_pending || poll_fd.revents & POLLIN) &&
+             session_auth_pending(state->session, p_extconn))
+    {
+        // nothing is expected before the handshake response
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Data from fd %d while authenticating, closing",
+                p_extconn->sockfd);
+        on_connection_aborted();
+        session_close(state->session, p_extconn);
+    }
+    else if (result == ST_OK && (b_data_pending || poll_fd.revents & POLLIN))
     {
         result = ensure_client_authenticated(state, p_extconn);
 
-        if (result == ST_OK)
+        if (result == ST_OK && session_is_observer(state->session, p_extconn))
+        {
+            // joined read-only, the target is left alone
+        }
+        else if (result == ST_OK &&
+                 session_auth_pending(state->session, p_extconn))
+        {
+            // the workers check the password, see on_auth_result
+        }
+        else if (result == ST_OK)
         {
             result = asd_api_target_ioctl(NULL, NULL, IOCTL_TARGET_PROCESS_MSG);
             if (result != ST_OK)
@@ -1081,9 +2070,10 @@ size_t read_data(void* buffer, size_t length)
     size_t size = 0;
     if (p_extconn && buffer)
     {
-
+        uint64_t start = ASD_stats_now();
         int cnt = extnet_recv(main_state.extnet, p_extconn, buffer, length,
                               &b_data_pending);
+        ASD_stats_record(ASD_Stage_SocketRead, start);
 
         if (cnt < 1)
         {
@@ -1115,6 +2105,20 @@ static void send_remote_log_message(ASD_LogLevel asd_level,
     asd_api_target_ioctl(&remote_log, NULL, IOCTL_TARGET_SEND_REMOTE_LOG_MSG);
 }
 
+static void send_remote_log_record(ASD_LogLevel asd_level,
+                                   ASD_LogStream asd_stream,
+                                   const unsigned char* record, size_t len)
+{
+    asd_target_interface_remote_log_record log_record = {
+        asd_level,
+        asd_stream,
+        record,
+        len
+    };
+    asd_api_target_ioctl(&log_record, NULL,
+                         IOCTL_TARGET_SEND_REMOTE_LOG_RECORD);
+}
+
 STATUS ensure_client_authenticated(asd_state* state, extnet_conn_t* p_extconn)
 {
     STATUS result = ST_ERR;
@@ -1126,38 +2130,92 @@ STATUS ensure_client_authenticated(asd_state* state, extnet_conn_t* p_extconn)
             // Authenticate the client
             result =
                 auth_client_handshake(state->session, state->extnet, p_extconn);
-            if (result == ST_OK)
-            {
-                result = session_auth_complete(state->session, p_extconn);
-            }
-            if (result == ST_OK)
-            {
+            // finished once the workers checked the password
+            if (result != ST_OK ||
+                !session_auth_pending(state->session, p_extconn))
+                result =
+                    finish_client_authentication(state, p_extconn, result);
+        }
+    }
+    return result;
+}
+
+STATUS finish_client_authentication(asd_state* state, extnet_conn_t* p_extconn,
+                                    STATUS result)
+{
+    if (!state || !p_extconn)
+        return ST_ERR;
+
+    if (result == ST_OK)
+    {
+        result = session_auth_complete(state->session, p_extconn);
+    }
+    if (result == ST_OK && session_is_observer(state->session, p_extconn))
+    {
+        log_client_address(p_extconn);
+        update_observing();
+    }
+    else if (result == ST_OK)
+    {
 #ifdef ENABLE_DEBUG_LOGGING
-                ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Daemon,
-                        ASD_LogOption_None,
-                        "Session on fd %d now authenticated",
-                        p_extconn->sockfd);
+        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Session on fd %d now authenticated", p_extconn->sockfd);
 #endif
 
-                result = on_client_connect(state, p_extconn);
-                if (result != ST_OK)
-                {
-                    ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
-                            ASD_LogOption_None, "Connection attempt failed.");
-                    on_client_disconnect(state);
-                }
-            }
-
-            if (result != ST_OK)
-            {
-                on_connection_aborted();
-                session_close(state->session, p_extconn);
-            }
+        result = on_client_connect(state, p_extconn);
+        if (result != ST_OK)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_None, "Connection attempt failed.");
+            on_client_disconnect(state);
         }
     }
+
+    if (result != ST_OK)
+    {
+        on_connection_aborted();
+        session_close(state->session, p_extconn);
+    }
     return result;
 }
 
+// Called from auth_process_results for every client the authentication
+// workers are done with.
+void on_auth_result(Session* session, extnet_conn_t* p_extconn, STATUS result,
+                    void* ctx)
+{
+    asd_state* state = (asd_state*)ctx;
+    (void)session;
+
+    finish_client_authentication(state, p_extconn, result);
+}
+
+STATUS discard_observer_input(asd_state* state, extnet_conn_t* p_extconn)
+{
+    unsigned char buffer[256];
+    bool b_pending = false;
+    int cnt;
+
+    if (!state || !p_extconn)
+        return ST_ERR;
+
+    cnt = extnet_recv(state->extnet, p_extconn, buffer, sizeof(buffer),
+                      &b_pending);
+    if (cnt < 1)
+    {
+        ASD_log(ASD_LogLevel_Info, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Observer on fd %d disconnected", p_extconn->sockfd);
+        session_close(state->session, p_extconn);
+        update_observing();
+        return ST_OK;
+    }
+    ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+            ASD_LogOption_No_Remote,
+            "Ignoring %d bytes from read-only observer on fd %d", cnt,
+            p_extconn->sockfd);
+    return session_set_data_pending(state->session, p_extconn, b_pending);
+}
+
 STATUS on_client_connect(asd_state* state, extnet_conn_t* p_extcon)
 {
     STATUS result = ST_OK;
@@ -1239,6 +2297,8 @@ STATUS on_client_connect(asd_state* state, extnet_conn_t* p_extcon)
             state->args.log_level, state->args.log_streams,
             state->args.use_syslog, state->args.log_timestamp_enable,
             main_should_remote_log, send_remote_log_message);
+        ASD_set_binary_logging(main_should_log_binary,
+                               send_remote_log_record);
     }
 
     return result;
@@ -1321,6 +2381,11 @@ STATUS on_client_disconnect(asd_state* state)
                     "Failed to de-initialize the asd_msg");
             result = ST_ERR;
         }
+        // the target closed its pin descriptors
+        watch_fds_forget(&state->loop, WATCH_TARGET, -1);
+
+        // whatever is still queued was meant for the client that left
+        discard_out_msgs();
     }
 
     if (result == ST_OK)
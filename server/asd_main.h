@@ -29,6 +29,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define _ASD_MAIN_H_
 
 #include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -36,6 +38,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "config.h"
 #include "authenticate.h"
 #include "ext_network.h"
+#include "ext_tls.h"
 #include "logging.h"
 #include "session.h"
 #include "sys/time.h"
@@ -64,6 +67,9 @@ typedef struct session_options
     char* cp_net_bind_device;
     extnet_hdlr_type_t e_extnet_type;
     auth_hdlr_type_t e_auth_type;
+    exttls_options tls;
+    int n_max_observers;
+    int n_auth_workers;
 } session_options;
 
 typedef struct asd_args
@@ -74,12 +80,52 @@ typedef struct asd_args
     ASD_LogLevel log_level;
     ASD_LogStream log_streams;
     bool log_timestamp_enable;
+    // local logs written by a thread, to log_file when set
+    bool log_async;
+    char* log_file;
     bool xdp_fail_enable;
     bool auto_sync_remote_logging;
     ASD_LogStream auto_sync_remote_logging_streams;
     timeout_config timeout;
 } asd_args;
 
+#define MAX_INPUT_SIZE 100
+#define HOST_FD_INDEX 0
+#define GPIO_FD_INDEX 1
+#define NUM_I3C_DEBUG_FDS 1
+#define NUM_TIMER_FDS 1
+#define NUM_EVENT_FDS 1
+#define NUM_AUTH_FDS 1
+#define MAX_FDS (GPIO_FD_INDEX + MAX_SESSIONS + NUM_GPIOS + NUM_DBUS_FDS + NUM_I3C_DEBUG_FDS + NUM_TIMER_FDS + NUM_EVENT_FDS + NUM_AUTH_FDS)
+
+typedef enum
+{
+    WATCH_HOST = 0,
+    WATCH_TARGET,
+    WATCH_CLIENT,
+    WATCH_TIMER,
+    WATCH_EVENT,
+    WATCH_AUTH
+} watch_kind;
+
+typedef struct watched_fd
+{
+    int fd;
+    uint32_t events;
+    watch_kind kind;
+    bool seen;
+} watched_fd;
+
+// The descriptors the request loop waits on. They stay registered with
+// epoll across iterations, the table mirrors what the kernel holds so that
+// epoll_ctl is only called when the set changes.
+typedef struct event_loop
+{
+    int epoll_fd;
+    watched_fd watched[MAX_FDS];
+    int num_watched;
+} event_loop;
+
 typedef struct asd_state
 {
     asd_args args;
@@ -88,13 +134,66 @@ typedef struct asd_state
     config config;
     Session* session;
     ExtNet* extnet;
+    event_loop loop;
+    // idle warning and disconnect, unauthenticated session expiry
+    timer_queue timers;
+    asd_timer idle_timer;
+    uint64_t last_activity_ms;
+    bool idle_warning_sent;
 } asd_state;
+// Responses are coalesced up to one full TLS record before hitting the
+// socket.
+#define OUT_QUEUE_SIZE 16384
+#define NUM_OUT_BUFFERS 4
 
-#define MAX_INPUT_SIZE 100
-#define HOST_FD_INDEX 0
-#define GPIO_FD_INDEX 1
-#define NUM_I3C_DEBUG_FDS 1
-#define MAX_FDS (GPIO_FD_INDEX + MAX_SESSIONS + NUM_GPIOS + NUM_DBUS_FDS + NUM_I3C_DEBUG_FDS)
+typedef struct out_buffer
+{
+    unsigned char buffer[OUT_QUEUE_SIZE];
+    size_t used;
+} out_buffer;
+
+// Only the socket thread talks to the client, so TLS never runs on the
+// hardware worker. Every thread appends its output, in order, to the
+// buffer at head; full or flushed buffers are sealed and wait between tail
+// and head until the socket thread sends them. head is only moved under
+// lock, tail only by the socket thread, and free_buffers holds back a
+// producer that would overrun the buffers not sent yet.
+typedef struct out_queue
+{
+    out_buffer ring[NUM_OUT_BUFFERS];
+    unsigned int head;
+    unsigned int tail;
+    pthread_mutex_t lock;
+    sem_t free_buffers;
+    pthread_t network_thread;
+    bool sending;
+    // a write to the client failed, set until its connection is dropped
+    bool send_failed;
+    // signalled whenever tail moves
+    pthread_cond_t sent;
+    // Events and remote logs for the read-only observers. Producers copy
+    // each one once into events[events_fill]; the socket thread swaps the
+    // buffers and writes the same bytes to every observer.
+    out_buffer events[2];
+    unsigned int events_fill;
+    bool observing;
+    bool events_dropped;
+} out_queue;
+
+// An observer that stays behind this long is disconnected.
+#define OBSERVER_MAX_BEHIND_MS 10000
+
+// Socket thread only: the events an observer did not take yet. Observers
+// are written to without blocking; whatever the socket does not take waits
+// here, and the events gathered meanwhile are not sent to that observer.
+typedef struct observer_backlog
+{
+    extnet_conn_t* conn; // NULL when the entry is free
+    int sockfd;
+    out_buffer pending;
+    size_t sent;
+    uint64_t behind_since_ms; // 0 while the observer keeps up
+} observer_backlog;
 
 typedef enum
 {
@@ -112,15 +211,25 @@ void showUsage(char** argv);
 STATUS init_asd_state(void);
 STATUS send_out_msg_on_socket(unsigned char* buffer,
                               size_t length);
+STATUS init_out_queue(void);
+STATUS queue_out_msg(const struct iovec* iov, int iovcnt);
+STATUS queue_out_event(const struct iovec* iov, int iovcnt);
+void update_observing(void);
+void send_observer_events(void);
+STATUS flush_out_msgs(void);
+STATUS flush_out_msgs_sync(void);
+STATUS send_sealed_out_msgs(void);
+void discard_out_msgs(void);
 void deinit_asd_state(asd_state* state);
 STATUS on_client_disconnect(asd_state* state);
 STATUS on_client_connect(asd_state* state, extnet_conn_t* p_extcon);
 void on_connection_aborted(void);
 void send_warning_message(long idle_timeout_ms, long warning_time_ms);
-bool check_idle_timeout(struct timeval* last_activity_time,
-                        bool* send_idle_warning_message,
-                        long idle_timeout_ms, long warning_time_ms);
+void on_idle_timer(asd_timer* timer, void* ctx);
 STATUS request_processing_loop(asd_state* state);
+STATUS watch_fds_sync(event_loop* loop, const watched_fd* wanted,
+                      int num_wanted);
+void watch_fds_forget(event_loop* loop, watch_kind kind, int fd);
 STATUS process_new_client(asd_state* state, struct pollfd* poll_fds,
                           size_t num_fds, int* num_clients, int client_index);
 STATUS process_all_client_messages(asd_state* state,
@@ -130,6 +239,11 @@ STATUS process_all_gpio_events(asd_state* state, const struct pollfd* poll_fds,
                                size_t num_fds);
 STATUS process_client_message(asd_state* state, struct pollfd poll_fd);
 STATUS ensure_client_authenticated(asd_state* state, extnet_conn_t* p_extconn);
+STATUS finish_client_authentication(asd_state* state, extnet_conn_t* p_extconn,
+                                    STATUS result);
+void on_auth_result(Session* session, extnet_conn_t* p_extconn, STATUS result,
+                    void* ctx);
+STATUS discard_observer_input(asd_state* state, extnet_conn_t* p_extconn);
 
 size_t read_data(void* buffer, size_t length);
 bool is_data_pending(void);
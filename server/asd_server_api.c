@@ -51,7 +51,10 @@ size_t asd_server_read(unsigned char* buffer, size_t length, void* opt)
 
 size_t asd_server_write(void* buffer, size_t length, void* opt)
 {
-    if(send_out_msg_on_socket(buffer, length) == ST_OK)
+    // only the socket thread writes to the client, wait for it to do so
+    struct iovec iov = {buffer, length};
+
+    if (queue_out_msg(&iov, 1) == ST_OK && flush_out_msgs_sync() == ST_OK)
         return length;
 
     return 0;
@@ -75,6 +78,21 @@ STATUS asd_server_ioctl(void* input, void* output, unsigned int cmd)
             *data_pending = is_data_pending();
             status = ST_OK;
             break;
+        case IOCTL_SERVER_QUEUE_MSG:
+            if (input == NULL)
+                break;
+            asd_msg_iov * msg_iov = (asd_msg_iov *) input;
+            status = queue_out_msg(msg_iov->iov, msg_iov->iovcnt);
+            break;
+        case IOCTL_SERVER_FLUSH_MSGS:
+            status = flush_out_msgs();
+            break;
+        case IOCTL_SERVER_QUEUE_EVENT:
+            if (input == NULL)
+                break;
+            msg_iov = (asd_msg_iov *) input;
+            status = queue_out_event(msg_iov->iov, msg_iov->iovcnt);
+            break;
     }
     return status;
 }
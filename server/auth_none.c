@@ -42,7 +42,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 STATUS authnone_init(void* p_hdlr_data);
 STATUS auth_none(Session* session, ExtNet* net_state, extnet_conn_t* p_extconn);
 
-auth_hdlrs_t authnone_hdlrs = {authnone_init, auth_none};
+auth_hdlrs_t authnone_hdlrs = {authnone_init, auth_none, NULL, NULL, NULL};
 
 /** @brief Initialize authentication handler
  *  @param [in] p_hdlr_data Pointer to handler specific data (not used)
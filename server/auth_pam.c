@@ -35,11 +35,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <errno.h>
 #include <openssl/rand.h>
+#include <pthread.h>
+#include <safe_mem_lib.h>
 #include <safe_str_lib.h>
 #include <security/pam_appl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -59,18 +62,98 @@ typedef enum
     AUTHRET_LOCKOUT,
 } auth_ret_t;
 
+/** Credentials of one handshake on their way through the workers */
+typedef struct
+{
+    unsigned int n_ticket;
+    /** Checked only to keep the timing, the client is locked out */
+    bool b_lockout;
+    unsigned char password[MAX_PW_LEN + 1];
+    unsigned int n_pwlen;
+    auth_ret_t ret;
+} auth_job_t;
+
+/** Workers checking credentials off the network thread. The network thread
+ *  queues jobs and takes the results, wiped of the password, once event_fd
+ *  is signalled. */
+static struct
+{
+    pthread_t workers[MAX_AUTH_WORKERS];
+    int n_workers;
+    int event_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    auth_job_t jobs[MAX_AUTH_JOBS];
+    int n_jobs_head;
+    int n_jobs;
+    auth_job_t results[MAX_AUTH_JOBS];
+    int n_results;
+    int n_outstanding; // queued, being checked or waiting in results
+    unsigned int n_next_ticket;
+    bool b_stopping;
+} sg_pool = {.n_workers = 0,
+             .event_fd = -1,
+             .lock = PTHREAD_MUTEX_INITIALIZER,
+             .wake = PTHREAD_COND_INITIALIZER};
+
+static time_t t_lockout = 0;
+/** Failed attempts, the oldest is replaced by the next one */
+static time_t ats_attempts[INVALID_AUTH_MAX_ATTEMPTS] = {0};
+
 STATUS authpam_init(void* p_hdlr_data);
 STATUS authpam_client_handshake(Session* session, ExtNet* net_state,
                                 extnet_conn_t* p_extconn);
+static int authpam_get_event_fd(void);
+static void authpam_process_results(Session* session, ExtNet* net_state,
+                                    auth_result_callback on_result,
+                                    void* ctx);
+static void authpam_deinit(void);
+static void* auth_worker(void* arg);
 
-auth_hdlrs_t authpam_hdlrs = {authpam_init, authpam_client_handshake};
+auth_hdlrs_t authpam_hdlrs = {authpam_init, authpam_client_handshake,
+                              authpam_get_event_fd, authpam_process_results,
+                              authpam_deinit};
 
 /** @brief Initialize PAM authentication handler
- *  @param [in] p_hdlr_data Pointer to handler specific data (not used)
+ *  @param [in] p_hdlr_data Pointer to the number of authentication workers
+ *  to start, PAM runs on the calling thread when NULL or 0.
  */
 STATUS authpam_init(void* p_hdlr_data)
 {
-    (void)p_hdlr_data;
+    int n_workers = p_hdlr_data ? *(int*)p_hdlr_data : 0;
+
+    if (n_workers > MAX_AUTH_WORKERS)
+        n_workers = MAX_AUTH_WORKERS;
+    if (n_workers <= 0 || sg_pool.n_workers > 0)
+        return ST_OK;
+
+    sg_pool.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sg_pool.event_fd == -1)
+    {
+        ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Network,
+                ASD_LogOption_None,
+                "Cannot create authentication event %d, authenticating on "
+                "the network thread",
+                errno);
+        return ST_OK;
+    }
+    for (int i = 0; i < n_workers; i++)
+    {
+        if (pthread_create(&sg_pool.workers[sg_pool.n_workers], NULL,
+                           auth_worker, NULL) != 0)
+        {
+            ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Network,
+                    ASD_LogOption_None,
+                    "Cannot start authentication worker %d", i);
+            break;
+        }
+        sg_pool.n_workers++;
+    }
+    if (sg_pool.n_workers == 0)
+    {
+        close(sg_pool.event_fd);
+        sg_pool.event_fd = -1;
+    }
     return ST_OK;
 }
 
@@ -204,7 +287,6 @@ static auth_ret_t credentials_are_valid(unsigned char* cp_password,
  */
 static auth_ret_t auth_track_attempt(auth_ret_t err_code)
 {
-    static time_t ats_attempts[INVALID_AUTH_MAX_ATTEMPTS] = {0};
     time_t t_now = time(0L);
     int n_invalid_in_period = 1;
     int n_oldest_index = 0;
@@ -254,22 +336,50 @@ static auth_ret_t auth_track_attempt(auth_ret_t err_code)
     return err_code;
 }
 
-/** @brief Validate the client header including version and password.
+/** @brief Tell if one more attempt could go over the limit.
+ *
+ *  Attempts the workers have not reported yet may all fail. When they and
+ *  the invalid attempts of the period already reach
+ *  INVALID_AUTH_MAX_ATTEMPTS, the next attempt is handled as locked out
+ *  instead of having its password checked. Without attempts in flight
+ *  auth_track_attempt decides alone, as when PAM runs on the network thread.
+ */
+static bool auth_attempts_exhausted(void)
+{
+    time_t t_now = time(0L);
+    int n_pending;
+    int n_invalid_in_period = 0;
+
+    pthread_mutex_lock(&sg_pool.lock);
+    n_pending = sg_pool.n_outstanding;
+    pthread_mutex_unlock(&sg_pool.lock);
+    if (n_pending == 0)
+        return false;
+
+    for (int i = 0; i < INVALID_AUTH_MAX_ATTEMPTS; i++)
+    {
+        if (ats_attempts[i] > (t_now - INVALID_AUTH_PERIOD_NSECS))
+            n_invalid_in_period++;
+    }
+    return n_pending + n_invalid_in_period >= INVALID_AUTH_MAX_ATTEMPTS;
+}
+
+/** @brief Validate the client header and take the password from it.
  *
+ *  @param [out] p_job Job the password is copied to.
  *  @param [in] cp_buf Buffer containing client header
  *  @param [in] n_buflen length of buffer read
  *
- *  @return Returns AUTHRET_SYSERR if unable to configure PAM;
- *                  AUTHRET_OK if authenticated;
- *                  AUTHRET_UNAUTHORIZED if password is invalid
+ *  @return Returns AUTHRET_OK if the password is ready to be checked;
  *                  AUTHRET_INVALIDDATA if header version is invalid
  *                  AUTHAUTH_LOCKOUT if too many invalid auth attempts have
  *                  been made
  */
-static auth_ret_t authenticate_client(char* cp_buf, int n_num_read)
+static auth_ret_t read_credentials(auth_job_t* p_job, char* cp_buf,
+                                   int n_num_read)
 {
-    auth_ret_t ret;
     auth_handshake_req_t* phdr = (auth_handshake_req_t*)cp_buf;
+    char* cp;
 
     if (n_num_read > sizeof(auth_handshake_req_t) ||
         phdr->auth_hdr_version > AUTH_HDR_VERSION)
@@ -277,28 +387,60 @@ static auth_ret_t authenticate_client(char* cp_buf, int n_num_read)
         ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network, ASD_LogOption_None,
                 "Invalid auth header version 0x%02x received len: %d",
                 phdr->auth_hdr_version, n_num_read);
-        ret = AUTHRET_INVALIDDATA;
+        return auth_track_attempt(AUTHRET_INVALIDDATA);
     }
-    else
+
+    // Testing with openssl s_client adding newline, strip it.
+    cp = memchr(cp_buf, '\n', (size_t)n_num_read);
+    if (cp)
     {
-        char* cp;
-        // Testing with openssl s_client adding newline, strip it.
-        cp = memchr(cp_buf, '\n', (size_t)n_num_read);
-        if (cp)
-        {
-            *cp = '\0';
-        }
+        *cp = '\0';
+    }
+    explicit_bzero(p_job, sizeof(*p_job));
+    if (memcpy_s(p_job->password, MAX_PW_LEN, phdr->auth_password,
+                 sizeof(phdr->auth_password)))
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network, ASD_LogOption_None,
+                "memcpy_s: password to auth job copy failed.");
+        return AUTHRET_SYSERR;
+    }
+    p_job->n_pwlen = n_num_read - sizeof(phdr->auth_hdr_version);
+    return AUTHRET_OK;
+}
 
-        // Validate the password.
-        ret = credentials_are_valid(
-            phdr->auth_password, n_num_read - sizeof(phdr->auth_hdr_version));
-        if (AUTHRET_OK != ret)
-        {
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network,
-                    ASD_LogOption_None, "Unauthenticated connection attempt");
-        }
+/** @brief Validate the credentials of a job with PAM, then wipe them.
+ *
+ *  The only part of a handshake which may run on an authentication worker.
+ */
+static void check_credentials(auth_job_t* p_job)
+{
+    p_job->ret = credentials_are_valid(p_job->password, p_job->n_pwlen);
+    if (AUTHRET_OK != p_job->ret)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network, ASD_LogOption_None,
+                "Unauthenticated connection attempt");
     }
-    return auth_track_attempt(ret);
+    explicit_bzero(p_job->password, sizeof(p_job->password));
+}
+
+/** @brief Final result of a checked job, counting failed attempts.
+ *
+ *  @return Returns AUTHRET_SYSERR if unable to configure PAM;
+ *                  AUTHRET_OK if authenticated;
+ *                  AUTHRET_UNAUTHORIZED if password is invalid
+ *                  AUTHAUTH_LOCKOUT if too many invalid auth attempts have
+ *                  been made
+ */
+static auth_ret_t job_result(auth_job_t* p_job)
+{
+    auth_ret_t ret;
+
+    // a valid password checked while locked out must not clear the invalid
+    // attempts either
+    if (p_job->b_lockout && AUTHRET_OK == p_job->ret)
+        return AUTHRET_LOCKOUT;
+    ret = auth_track_attempt(p_job->ret);
+    return p_job->b_lockout ? AUTHRET_LOCKOUT : ret;
 }
 
 /** @brief Send handshake response back to the client
@@ -359,23 +501,243 @@ static STATUS get_random_string(unsigned char* cp_buf, int n_sz)
     return st_ret;
 }
 
+/** @brief Answer the client once its credentials were checked.
+ *
+ *  @param [in] ret Result of the check.
+ *  @return ST_OK if the client is authenticated, otherwise ST_ERR.
+ */
+static STATUS finish_handshake(Session* session, ExtNet* net_state,
+                               extnet_conn_t* p_extconn, auth_ret_t ret)
+{
+    switch (ret)
+    {
+        case AUTHRET_OK:
+            // A session already controls the target, join it read-only.
+            if (session_observer_slot_available(session))
+            {
+                if (auth_handshake_response(net_state, p_extconn,
+                                            AUTH_HANDSHAKE_OBSERVER) != ST_OK)
+                    ret = AUTHRET_SYSERR;
+            }
+            // if session_get_authenticated_conn returns ST_ERR, then
+            // there is no current session, which is what we want.
+            else if (ST_OK != session_get_authenticated_conn(session, NULL))
+            {
+                if (auth_handshake_response(net_state, p_extconn,
+                                            AUTH_HANDSHAKE_SUCCESS) != ST_OK)
+                    ret = AUTHRET_SYSERR;
+            }
+            else
+            {
+                auth_handshake_response(net_state, p_extconn,
+                                        AUTH_HANDSHAKE_BUSY);
+                ret = AUTHRET_UNAUTHORIZED;
+            }
+            break;
+        case AUTHRET_SYSERR:
+            auth_handshake_response(net_state, p_extconn,
+                                    AUTH_HANDSHAKE_SYSERR);
+            break;
+        case AUTHRET_LOCKOUT:
+            t_lockout = time(0L) + INVALID_AUTH_LOCKOUT_NSECS;
+            // intentional fallthrough
+        case AUTHRET_UNAUTHORIZED:
+        case AUTHRET_INVALIDDATA:
+        default:
+            auth_handshake_response(net_state, p_extconn,
+                                    AUTH_HANDSHAKE_FAILURE);
+            break;
+    }
+    return (ret == AUTHRET_OK ? ST_OK : ST_ERR);
+}
+
+/** @brief Hand a job to the authentication workers
+ *
+ *  @return true if queued, false if the job has to be checked right away.
+ */
+static bool submit_job(Session* session, extnet_conn_t* p_extconn,
+                       auth_job_t* p_job)
+{
+    bool b_queued = false;
+
+    if (sg_pool.n_workers == 0)
+        return false;
+
+    if (++sg_pool.n_next_ticket == 0)
+        sg_pool.n_next_ticket = 1;
+    p_job->n_ticket = sg_pool.n_next_ticket;
+    if (session_set_auth_pending(session, p_extconn, p_job->n_ticket) != ST_OK)
+        return false;
+
+    // the attempt is pending from here on, see auth_attempts_exhausted
+    pthread_mutex_lock(&sg_pool.lock);
+    if (sg_pool.n_outstanding < MAX_AUTH_JOBS)
+    {
+        sg_pool.jobs[(sg_pool.n_jobs_head + sg_pool.n_jobs) % MAX_AUTH_JOBS] =
+            *p_job;
+        sg_pool.n_jobs++;
+        sg_pool.n_outstanding++;
+        pthread_cond_signal(&sg_pool.wake);
+        b_queued = true;
+    }
+    pthread_mutex_unlock(&sg_pool.lock);
+
+    if (!b_queued)
+        session_take_auth_pending(session, p_job->n_ticket);
+    return b_queued;
+}
+
+/** @brief Authentication worker, runs PAM for queued jobs. */
+static void* auth_worker(void* arg)
+{
+    auth_job_t job;
+    uint64_t wake = 1;
+    (void)arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&sg_pool.lock);
+        while (sg_pool.n_jobs == 0 && !sg_pool.b_stopping)
+            pthread_cond_wait(&sg_pool.wake, &sg_pool.lock);
+        if (sg_pool.b_stopping)
+        {
+            pthread_mutex_unlock(&sg_pool.lock);
+            break;
+        }
+        job = sg_pool.jobs[sg_pool.n_jobs_head];
+        explicit_bzero(&sg_pool.jobs[sg_pool.n_jobs_head], sizeof(job));
+        sg_pool.n_jobs_head = (sg_pool.n_jobs_head + 1) % MAX_AUTH_JOBS;
+        sg_pool.n_jobs--;
+        pthread_mutex_unlock(&sg_pool.lock);
+
+        check_credentials(&job);
+
+        // n_outstanding keeps room for every job in results
+        pthread_mutex_lock(&sg_pool.lock);
+        sg_pool.results[sg_pool.n_results++] = job;
+        pthread_mutex_unlock(&sg_pool.lock);
+        if (write(sg_pool.event_fd, &wake, sizeof(wake)) != sizeof(wake))
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network,
+                    ASD_LogOption_None,
+                    "Cannot signal authentication result %d", errno);
+        }
+    }
+    return NULL;
+}
+
+/** @brief Descriptor readable when the workers finished a job
+ *
+ *  @return -1 when PAM runs on the network thread.
+ */
+static int authpam_get_event_fd(void)
+{
+    return sg_pool.n_workers > 0 ? sg_pool.event_fd : -1;
+}
+
+/** @brief Answer the clients whose credentials the workers checked
+ *
+ *  @param [in] on_result Called for each client still connected.
+ */
+static void authpam_process_results(Session* session, ExtNet* net_state,
+                                    auth_result_callback on_result, void* ctx)
+{
+    auth_job_t results[MAX_AUTH_JOBS];
+    int n_results;
+    uint64_t wakes;
+
+    if (authpam_get_event_fd() == -1 || !on_result)
+        return;
+
+    // results are taken as a whole, the count does not matter
+    if (read(sg_pool.event_fd, &wakes, sizeof(wakes)) < 0 && errno != EAGAIN)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network, ASD_LogOption_None,
+                "Cannot read authentication event %d", errno);
+    }
+    pthread_mutex_lock(&sg_pool.lock);
+    n_results = sg_pool.n_results;
+    for (int i = 0; i < n_results; i++)
+        results[i] = sg_pool.results[i];
+    sg_pool.n_results = 0;
+    sg_pool.n_outstanding -= n_results;
+    pthread_mutex_unlock(&sg_pool.lock);
+
+    for (int i = 0; i < n_results; i++)
+    {
+        // A lockout may have started while the job waited, including for a
+        // result answered just before.
+        if (time(0L) < t_lockout)
+            results[i].b_lockout = true;
+        // the attempt counts even when the client left meanwhile
+        auth_ret_t ret = job_result(&results[i]);
+        extnet_conn_t* p_extconn =
+            session_take_auth_pending(session, results[i].n_ticket);
+
+        if (!p_extconn)
+        {
+#ifdef ENABLE_DEBUG_LOGGING
+            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Network,
+                    ASD_LogOption_None,
+                    "Dropping authentication result %u, session closed",
+                    results[i].n_ticket);
+#endif
+            continue;
+        }
+        on_result(session, p_extconn,
+                  finish_handshake(session, net_state, p_extconn, ret), ctx);
+    }
+}
+
+/** @brief Stop the authentication workers
+ *
+ *  Jobs not checked yet are wiped, results not processed yet are dropped
+ *  with their sessions.
+ */
+static void authpam_deinit(void)
+{
+    if (sg_pool.n_workers == 0)
+        return;
+
+    pthread_mutex_lock(&sg_pool.lock);
+    sg_pool.b_stopping = true;
+    pthread_cond_broadcast(&sg_pool.wake);
+    pthread_mutex_unlock(&sg_pool.lock);
+    for (int i = 0; i < sg_pool.n_workers; i++)
+        pthread_join(sg_pool.workers[i], NULL);
+
+    explicit_bzero(sg_pool.jobs, sizeof(sg_pool.jobs));
+    explicit_bzero(sg_pool.results, sizeof(sg_pool.results));
+    sg_pool.n_workers = 0;
+    sg_pool.n_jobs_head = 0;
+    sg_pool.n_jobs = 0;
+    sg_pool.n_results = 0;
+    sg_pool.n_outstanding = 0;
+    sg_pool.b_stopping = false;
+    close(sg_pool.event_fd);
+    sg_pool.event_fd = -1;
+}
+
 /** @brief Read and validate client header and password.
  *
  *  Called when client has not been authenticated each time data is available
- *  on the external socket.
+ *  on the external socket. With authentication workers the password is
+ *  checked off the network thread: the session is then left waiting and
+ *  ST_OK returned, the client is answered from authpam_process_results.
  *
  *  @param [in] p_extconn pointer
- *  @return AUTHRET_OK if successful, otherwise another auth_ret_t value.
+ *  @return ST_OK if successful or waiting for the workers, otherwise ST_ERR.
  */
 STATUS authpam_client_handshake(Session* session, ExtNet* net_state,
                                 extnet_conn_t* p_extconn)
 {
     static char ca_buf[10240];
-    static time_t t_lockout = 0;
     bool b_data_pending = false;
+    bool b_check = false;
     int n_read;
     auth_ret_t ret;
     auth_handshake_req_t lockout_req;
+    auth_job_t job;
 
     if (!session || !net_state || !p_extconn)
     {
@@ -399,11 +761,13 @@ STATUS authpam_client_handshake(Session* session, ExtNet* net_state,
         }
         else
         {
-            if (time(0) < t_lockout)
+            if (time(0) < t_lockout || auth_attempts_exhausted())
             {
                 // Validate a random password to keep timing the
                 // same.
-                authenticate_client((char*)&lockout_req, 20);
+                ret = read_credentials(&job, (char*)&lockout_req, 20);
+                job.b_lockout = true;
+                b_check = (ret == AUTHRET_OK);
                 ret = AUTHRET_LOCKOUT;
             }
             else if (b_data_pending)
@@ -414,43 +778,22 @@ STATUS authpam_client_handshake(Session* session, ExtNet* net_state,
             }
             else
             {
-                // Validate the header and password as read.
-                ret = authenticate_client(ca_buf, n_read);
+                // Validate the header and take the password as read.
+                ret = read_credentials(&job, ca_buf, n_read);
+                b_check = (ret == AUTHRET_OK);
             }
         }
         explicit_bzero(&ca_buf, sizeof(ca_buf));
     }
-    switch (ret)
+    if (b_check)
     {
-        case AUTHRET_OK:
-            // if session_get_authenticated_conn returns ST_ERR, then
-            // there is no current session, which is what we want.
-            if (ST_OK != session_get_authenticated_conn(session, NULL))
-            {
-                if (auth_handshake_response(net_state, p_extconn,
-                                            AUTH_HANDSHAKE_SUCCESS) != ST_OK)
-                    ret = AUTHRET_SYSERR;
-            }
-            else
-            {
-                auth_handshake_response(net_state, p_extconn,
-                                        AUTH_HANDSHAKE_BUSY);
-                ret = AUTHRET_UNAUTHORIZED;
-            }
-            break;
-        case AUTHRET_SYSERR:
-            auth_handshake_response(net_state, p_extconn,
-                                    AUTH_HANDSHAKE_SYSERR);
-            break;
-        case AUTHRET_LOCKOUT:
-            t_lockout = time(0L) + INVALID_AUTH_LOCKOUT_NSECS;
-            // intentional fallthrough
-        case AUTHRET_UNAUTHORIZED:
-        case AUTHRET_INVALIDDATA:
-        default:
-            auth_handshake_response(net_state, p_extconn,
-                                    AUTH_HANDSHAKE_FAILURE);
-            break;
+        if (submit_job(session, p_extconn, &job))
+        {
+            explicit_bzero(&job, sizeof(job));
+            return ST_OK;
+        }
+        check_credentials(&job);
+        ret = job_result(&job);
     }
-    return (ret == AUTHRET_OK ? ST_OK : ST_ERR);
+    return finish_handshake(session, net_state, p_extconn, ret);
 }
@@ -71,6 +71,7 @@ extern auth_hdlrs_t authpam_hdlrs;
 typedef enum
 {
     AUTH_HANDSHAKE_SUCCESS = 0x30,
+    AUTH_HANDSHAKE_OBSERVER = 0x31, // authenticated, read-only session
     AUTH_HANDSHAKE_SYSERR = 0x24, // system error.
     AUTH_HANDSHAKE_BUSY = 0x2b,   // session already in progress
     AUTH_HANDSHAKE_FAILURE = 0x3f,
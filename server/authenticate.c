@@ -55,7 +55,8 @@ static struct
 
 /** @brief Initialize authentication handler
  *  @param [in] e_type Handler type to use for authentication.
- *  @param [in] p_hdlr_data Pointer to handler specific data (not used)
+ *  @param [in] p_hdlr_data Pointer to handler specific data, for PAM the
+ *  number of authentication workers.
  */
 STATUS auth_init(auth_hdlr_type_t e_type, void* p_hdlr_data)
 {
@@ -112,3 +113,38 @@ STATUS auth_client_handshake(Session* session, ExtNet* net_state,
     }
     return st_ret;
 }
+
+/** @brief Get the descriptor signalled when deferred handshakes finish
+ *
+ *  @return -1 if the handler finishes every handshake right away.
+ */
+int auth_get_event_fd(void)
+{
+    if (!sg_data.p_hdlrs || !sg_data.p_hdlrs->get_event_fd)
+        return -1;
+    return sg_data.p_hdlrs->get_event_fd();
+}
+
+/** @brief Report the handshakes finished since the last call
+ *
+ *  Answers the clients and calls on_result for each of them. Runs on the
+ *  network thread when auth_get_event_fd is readable.
+ *
+ *  @param [in] on_result Called with ST_OK when the client authenticated.
+ */
+void auth_process_results(Session* session, ExtNet* state,
+                          auth_result_callback on_result, void* ctx)
+{
+    if (sg_data.p_hdlrs && sg_data.p_hdlrs->process_results && on_result)
+        sg_data.p_hdlrs->process_results(session, state, on_result, ctx);
+}
+
+/** @brief Release what the authentication handler holds
+ *
+ *  Runs once the sessions are closed, no handshake is waited for anymore.
+ */
+void auth_deinit(void)
+{
+    if (sg_data.p_hdlrs && sg_data.p_hdlrs->deinit)
+        sg_data.p_hdlrs->deinit();
+}
@@ -36,22 +36,45 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ext_network.h"
 #include "session.h"
 
+/** Threads checking credentials for the PAM handler, its handler data */
+#define DEFAULT_AUTH_WORKERS 2
+#define MAX_AUTH_WORKERS 4
+/** Handshakes the workers hold at most, later ones run on the caller */
+#define MAX_AUTH_JOBS (2 * MAX_SESSIONS)
+
 typedef enum
 {
     AUTH_HDLR_NONE,
     AUTH_HDLR_PAM
 } auth_hdlr_type_t;
 
+/** Called on the network thread once a deferred handshake has finished */
+typedef void (*auth_result_callback)(Session* session, extnet_conn_t* pconn,
+                                     STATUS result, void* ctx);
+
 // Function pointers for external network interface.
+// A handler may finish a handshake later: client_handshake then returns
+// ST_OK with the session marked by session_set_auth_pending, get_event_fd
+// becomes readable when results are ready and process_results reports them.
+// Both are NULL for handlers that always finish right away, as is deinit
+// for handlers without anything to release.
 typedef struct
 {
     STATUS (*init)(void* p_hdlr_data);
     STATUS(*client_handshake)
     (Session* session, ExtNet* state, extnet_conn_t* pconn);
+    int (*get_event_fd)(void);
+    void (*process_results)(Session* session, ExtNet* state,
+                            auth_result_callback on_result, void* ctx);
+    void (*deinit)(void);
 } auth_hdlrs_t;
 
 STATUS auth_init(auth_hdlr_type_t e_type, void* p_hdlr_data);
 STATUS auth_client_handshake(Session* session, ExtNet* state,
                              extnet_conn_t* p_extconn);
+int auth_get_event_fd(void);
+void auth_process_results(Session* session, ExtNet* state,
+                          auth_result_callback on_result, void* ctx);
+void auth_deinit(void);
 
 #endif
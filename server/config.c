@@ -42,6 +42,7 @@ STATUS set_config_defaults(config* config, const bus_options* opt, const timeout
     config->jtag.chain_mode = JTAG_CHAIN_SELECT_MODE_SINGLE;
     config->remote_logging.logging_level = IPC_LogType_Off;
     config->remote_logging.logging_stream = 0;
+    config->remote_logging.binary = 0;
     config->buscfg.enable_i2c = opt->enable_i2c;
     config->buscfg.enable_i3c = opt->enable_i3c;
     config->buscfg.enable_spp = opt->enable_spp;
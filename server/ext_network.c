@@ -40,6 +40,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+// clang-format off
+#include <safe_mem_lib.h>
+// clang-format on
 
 #include "asd_common.h"
 #include "ext_tcp.h"
@@ -241,6 +244,7 @@ STATUS extnet_accept_connection(ExtNet* state, int ext_listen_sockfd,
         return ST_ERR;
     }
 
+    pconn->rx = NULL;
     pconn->sockfd =
         accept(ext_listen_sockfd, (struct sockaddr*)&addr, (socklen_t*)&len);
     if (pconn->sockfd < 0)
@@ -255,6 +259,23 @@ STATUS extnet_accept_connection(ExtNet* state, int ext_listen_sockfd,
                 "Accepted client fd %d", pconn->sockfd);
 #endif
         st_ret = state->p_hdlrs->on_accept(state, pconn);
+        if (st_ret == ST_OK)
+        {
+            pconn->rx = (extnet_rx_buffer*)malloc(sizeof(extnet_rx_buffer));
+            if (pconn->rx == NULL)
+            {
+                ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network,
+                        ASD_LogOption_None,
+                        "Failed to allocate the receive buffer");
+                st_ret = ST_ERR;
+            }
+            else
+            {
+                pconn->rx->head = 0;
+                pconn->rx->tail = 0;
+                pconn->rx->more = false;
+            }
+        }
         if (st_ret != ST_OK)
             extnet_close_client(state, pconn);
     }
@@ -281,6 +302,7 @@ STATUS extnet_init_client(ExtNet* state, extnet_conn_t* pconn)
     else
     {
         pconn->sockfd = UNUSED_SOCKET_FD;
+        pconn->rx = NULL;
         st_ret = state->p_hdlrs->init_client(pconn);
     }
     return st_ret;
@@ -325,6 +347,12 @@ STATUS extnet_close_client(ExtNet* state, extnet_conn_t* pconn)
             }
             pconn->sockfd = UNUSED_SOCKET_FD;
             pconn->p_hdlr_data = NULL;
+            if (pconn->rx)
+            {
+                explicit_bzero(pconn->rx, sizeof(extnet_rx_buffer));
+                free(pconn->rx);
+                pconn->rx = NULL;
+            }
         }
     }
 
@@ -352,24 +380,62 @@ bool extnet_is_client_closed(ExtNet* state, extnet_conn_t* pconn)
 
 /** @brief Read data from external network connection
  *
- *  Called each time data is available on the external socket.
+ *  Called each time data is available on the external socket. Accepted
+ *  connections are read a buffer at a time: the handler is only called once
+ *  everything it returned last time was consumed, so the header and body
+ *  reads of the messages it holds are served from memory.
  *
  *  @param [in] pconn Connetion pointer
  *  @param [out] pv_buf Buffer where data will be stored.
  *  @param [in] sz_len sizeof pv_buf
+ *  @param [out] b_data_pending Indicates more data is available without
+ *               the socket being readable.
  *  @return number of bytes received.
  */
 int extnet_recv(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
                 size_t sz_len, bool* b_data_pending)
 {
     int n_ret = -1;
+    extnet_rx_buffer* rx;
+    size_t available;
+
+    if (!state || !pconn || !pv_buf || !b_data_pending || !state->p_hdlrs ||
+        !state->p_hdlrs->recv)
+        return n_ret;
 
-    if (state && state->p_hdlrs && state->p_hdlrs->recv && pconn && pv_buf &&
-        b_data_pending)
+    rx = pconn->rx;
+    if (rx == NULL)
+        return state->p_hdlrs->recv(pconn, pv_buf, sz_len, b_data_pending);
+
+    if (rx->head == rx->tail)
     {
-        n_ret = state->p_hdlrs->recv(pconn, pv_buf, sz_len, b_data_pending);
+        // consumed data may hold the authentication password
+        explicit_bzero(rx->data, rx->tail);
+        rx->head = 0;
+        rx->tail = 0;
+        n_ret = state->p_hdlrs->recv(pconn, rx->data, sizeof(rx->data),
+                                     &rx->more);
+        if (n_ret <= 0)
+        {
+            rx->more = false;
+            *b_data_pending = false;
+            return n_ret;
+        }
+        rx->tail = (size_t)n_ret;
     }
-    return n_ret;
+
+    available = rx->tail - rx->head;
+    if (sz_len > available)
+        sz_len = available;
+    if (sz_len && memcpy_s(pv_buf, sz_len, &rx->data[rx->head], sz_len))
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network, ASD_LogOption_None,
+                "memcpy_s: receive buffer copy failed.");
+        return -1;
+    }
+    rx->head += sz_len;
+    *b_data_pending = rx->head < rx->tail || rx->more;
+    return (int)sz_len;
 }
 
 /** @brief Write data to external network connection
@@ -392,3 +458,27 @@ int extnet_send(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
     }
     return n_ret;
 }
+
+/** @brief Write data to external network connection without blocking
+ *
+ *  For connections that must not hold up the caller when the peer stops
+ *  reading.
+ *
+ *  @param [in] pconn Connetion pointer
+ *  @param [in] pv_buf Data to write.
+ *  @param [in] sz_len Number of bytes in pv_buf
+ *  @return number of bytes written, 0 if the connection cannot take any
+ *          now, -1 on error.
+ */
+int extnet_send_nowait(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
+                       size_t sz_len)
+{
+    int n_ret = -1;
+
+    if (state && state->p_hdlrs && state->p_hdlrs->send_nowait && pconn &&
+        pv_buf)
+    {
+        n_ret = state->p_hdlrs->send_nowait(pconn, pv_buf, sz_len);
+    }
+    return n_ret;
+}
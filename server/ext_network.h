@@ -39,12 +39,25 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "asd_common.h"
 
 #define UNUSED_SOCKET_FD (-1)
+// One read from the connection fills this much, a full TLS record.
+#define EXTNET_RX_BUFFER_SIZE 16384
+
+// What was received from a connection and not handed to the reader yet.
+// Filled by a single handler recv, then served from memory until empty.
+typedef struct extnet_rx_buffer
+{
+    size_t head;
+    size_t tail;
+    bool more; // the handler holds data past the buffer
+    unsigned char data[EXTNET_RX_BUFFER_SIZE];
+} extnet_rx_buffer;
 
 // External network connection data structure.
 typedef struct
 {
-    int sockfd;        // File descriptor of socket
-    void* p_hdlr_data; // handler private data pointer
+    int sockfd;            // File descriptor of socket
+    void* p_hdlr_data;     // handler private data pointer
+    extnet_rx_buffer* rx;  // receive buffer, allocated on accept
 } extnet_conn_t;
 
 typedef enum
@@ -63,6 +76,9 @@ typedef struct
     int (*recv)(extnet_conn_t* pconn, void* pv_buf, size_t sz_len,
                 bool* b_data_pending);
     int (*send)(extnet_conn_t* pconn, void* pv_buf, size_t sz_len);
+    // Write only what fits without blocking, 0 when nothing does. Once
+    // part of the data was taken, the next call continues with the rest.
+    int (*send_nowait)(extnet_conn_t* pconn, void* pv_buf, size_t sz_len);
     void (*cleanup)(void);
 } extnet_hdlrs_t;
 
@@ -85,5 +101,7 @@ int extnet_recv(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
                 size_t sz_len, bool* b_data_pending);
 int extnet_send(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
                 size_t sz_len);
+int extnet_send_nowait(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
+                       size_t sz_len);
 
 #endif // __EXT_NETWORK_H_
@@ -32,6 +32,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "ext_tcp.h"
 
+#include <errno.h>
 #include <netinet/tcp.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -40,8 +41,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "logging.h"
 
 extnet_hdlrs_t tcp_hdlrs = {
-    exttcp_init, exttcp_on_accept, exttcp_on_close_client, exttcp_init_client,
-    exttcp_recv, exttcp_send,      exttcp_cleanup,
+    exttcp_init,        exttcp_on_accept, exttcp_on_close_client,
+    exttcp_init_client, exttcp_recv,      exttcp_send,
+    exttcp_send_nowait, exttcp_cleanup,
 };
 
 /** @brief Initialize TCP
@@ -175,3 +177,34 @@ int exttcp_send(extnet_conn_t* pconn, void* pv_buf, size_t sz_len)
     }
     return n_wr;
 }
+
+/** @brief Write data to external network connection without blocking
+ *
+ *  @param [in] pconn Connetion pointer
+ *  @param [in] pv_buf Data to write.
+ *  @param [in] sz_len Number of bytes in pv_buf
+ *  @return number of bytes written, 0 if the socket buffer is full.
+ */
+int exttcp_send_nowait(extnet_conn_t* pconn, void* pv_buf, size_t sz_len)
+{
+    int n_wr = -1;
+
+    if (!pconn || !pv_buf)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network, ASD_LogOption_None,
+                "%s called with invalid pointer", __FUNCTION__);
+    }
+    else if (pconn->sockfd < 0)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network, ASD_LogOption_None,
+                "%s called with invalid file descriptor %d", __FUNCTION__,
+                pconn->sockfd);
+    }
+    else
+    {
+        n_wr = (int)send(pconn->sockfd, pv_buf, sz_len, MSG_DONTWAIT);
+        if (n_wr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            n_wr = 0;
+    }
+    return n_wr;
+}
@@ -47,5 +47,7 @@ extern STATUS exttcp_on_close_client(extnet_conn_t* pconn);
 extern int exttcp_recv(extnet_conn_t* pconn, void* pv_buf, size_t sz_len,
                        bool* b_data_pending);
 extern int exttcp_send(extnet_conn_t* pconn, void* pv_buf, size_t sz_len);
+extern int exttcp_send_nowait(extnet_conn_t* pconn, void* pv_buf,
+                              size_t sz_len);
 
 #endif //__EXT_TCP_H
@@ -32,11 +32,43 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __EXT_TLS_H
 #define __EXT_TLS_H
 
+#include <openssl/ssl.h>
+
 #include "asd_common.h"
 #include "ext_network.h"
 
+// Let the kernel build and parse the TLS records once the handshake is done,
+// when both OpenSSL and the kernel support it.
+#ifdef SSL_OP_ENABLE_KTLS
+#define ASD_SSL_OP_KTLS SSL_OP_ENABLE_KTLS
+#else
+#define ASD_SSL_OP_KTLS 0
+#endif
+
+// Session tickets let a reconnecting client resume with a PSK instead of a
+// full handshake. Tickets stay valid for ticket_lifetime seconds, 0 turns
+// them off, and the key encrypting them is replaced every
+// ticket_key_rotation seconds. Older keys are kept to decrypt the tickets
+// still in their lifetime, up to MAX_TICKET_KEYS keys.
+#define DEFAULT_TLS_TICKET_LIFETIME 7200
+#define DEFAULT_TLS_TICKET_KEY_ROTATION 3600
+#define MAX_TLS_TICKET_LIFETIME 604800
+#define MAX_TICKET_KEYS 4
+#define TICKET_KEY_NAME_LEN 16
+#define TICKET_KEY_LEN 32
+
+typedef struct exttls_options
+{
+    unsigned int ticket_lifetime;
+    unsigned int ticket_key_rotation;
+    // Prefer ChaCha20-Poly1305 and X25519, cheaper than AES-GCM and P-384
+    // on BMC cores without crypto extensions.
+    bool cheap_crypto;
+} exttls_options;
+
 extern extnet_hdlrs_t tls_hdlrs;
 
+extern void exttls_set_options(const exttls_options* options);
 extern STATUS exttls_init(void* p_hdlr_data);
 extern void exttls_cleanup(void);
 extern STATUS exttls_on_accept(void* net_state, extnet_conn_t* pconn);
@@ -45,5 +77,7 @@ extern STATUS exttls_on_close_client(extnet_conn_t* pconn);
 extern int exttls_recv(extnet_conn_t* pconn, void* pv_buf, size_t sz_len,
                        bool* b_data_pending);
 extern int exttls_send(extnet_conn_t* pconn, void* pv_buf, size_t sz_len);
+extern int exttls_send_nowait(extnet_conn_t* pconn, void* pv_buf,
+                              size_t sz_len);
 
 #endif //__EXT_TLS_H
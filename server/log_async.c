@@ -0,0 +1,352 @@
+/*
+Copyright (c) 2019, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file log_async.c
+ * @brief Local log output written by a background thread
+ *
+ * Once started, ASD_log formats a message into a slot of a bounded ring and
+ * returns, a thread writes the slots out to stderr, syslog or a file. Any
+ * thread may log: a slot is claimed by advancing the enqueue position with a
+ * compare and swap and published through its sequence number, so a caller
+ * never waits on another one or on the output. When the ring is full the
+ * message is dropped and counted, the count is written out with the next
+ * batch. The ring is written out on log_async_stop and, as far as a signal
+ * handler can, when asd crashes.
+ */
+#include "log_async.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <safe_mem_lib.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+typedef struct log_slot
+{
+    // position + 1 once published, position + LOG_ASYNC_SLOTS once free
+    size_t sequence;
+    size_t len;
+    char line[LOG_ASYNC_LINE];
+} log_slot;
+
+typedef struct log_async
+{
+    log_slot slots[LOG_ASYNC_SLOTS];
+    size_t enqueue_pos;
+    size_t dequeue_pos; // the thread's alone
+    uint64_t dropped;
+    uint64_t dropped_reported;
+    bool sleeping;
+    bool running;
+    int wake_fd;
+    int out_fd; // -1 for syslog
+    pthread_t thread;
+} log_async;
+
+static const int crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+// static, a caller still holding the writer after log_async_stop only
+// writes into a slot nobody reads
+static log_async async_log = {.wake_fd = -1, .out_fd = -1};
+static struct sigaction
+    crash_actions[sizeof(crash_signals) / sizeof(crash_signals[0])];
+
+static void log_async_write(ASD_LogLevel level, const char* line, size_t len)
+{
+    size_t pos = __atomic_load_n(&async_log.enqueue_pos, __ATOMIC_RELAXED);
+    log_slot* slot;
+    (void)level;
+
+    while (true)
+    {
+        slot = &async_log.slots[pos & (LOG_ASYNC_SLOTS - 1)];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == pos)
+        {
+            if (__atomic_compare_exchange_n(&async_log.enqueue_pos, &pos,
+                                            pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((ptrdiff_t)(sequence - pos) < 0)
+        {
+            // a lap behind, the thread hasn't written this slot yet
+            __atomic_add_fetch(&async_log.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&async_log.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (len > sizeof(slot->line))
+        len = sizeof(slot->line);
+    memcpy_s(slot->line, sizeof(slot->line), line, len);
+    slot->len = len;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    // only a sleeping thread costs the caller a system call
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&async_log.sleeping, false, __ATOMIC_SEQ_CST))
+    {
+        uint64_t one = 1;
+        if (write(async_log.wake_fd, &one, sizeof(one)) != sizeof(one))
+        {
+            // the thread wakes up on its own soon enough
+        }
+    }
+}
+
+static log_slot* next_slot(size_t pos)
+{
+    log_slot* slot = &async_log.slots[pos & (LOG_ASYNC_SLOTS - 1)];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+        return NULL;
+    return slot;
+}
+
+static void write_all(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        data += written;
+        len -= (size_t)written;
+    }
+}
+
+static void output_line(char* batch, size_t* used, const char* line,
+                        size_t len)
+{
+    if (async_log.out_fd == -1)
+    {
+        syslog(LOG_USER, "%.*s", (int)len, line);
+        return;
+    }
+    if (*used + len + 1 > LOG_ASYNC_BATCH)
+    {
+        write_all(async_log.out_fd, batch, *used);
+        *used = 0;
+    }
+    memcpy_s(&batch[*used], LOG_ASYNC_BATCH - *used, line, len);
+    *used += len;
+    batch[(*used)++] = '\n';
+}
+
+// Write out every published slot, in as few writes as they fit.
+static void log_async_flush(void)
+{
+    static char batch[LOG_ASYNC_BATCH];
+    size_t used = 0;
+    log_slot* slot;
+    uint64_t dropped;
+
+    while ((slot = next_slot(async_log.dequeue_pos)) != NULL)
+    {
+        output_line(batch, &used, slot->line, slot->len);
+        __atomic_store_n(&slot->sequence,
+                         async_log.dequeue_pos + LOG_ASYNC_SLOTS,
+                         __ATOMIC_RELEASE);
+        async_log.dequeue_pos++;
+    }
+
+    dropped = __atomic_load_n(&async_log.dropped, __ATOMIC_RELAXED);
+    if (dropped != async_log.dropped_reported)
+    {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%llu log messages dropped",
+                           (unsigned long long)(dropped -
+                                                async_log.dropped_reported));
+        output_line(batch, &used, line, (size_t)len);
+        async_log.dropped_reported = dropped;
+    }
+    if (used > 0)
+        write_all(async_log.out_fd, batch, used);
+}
+
+static void* log_async_thread(void* arg)
+{
+    struct pollfd wake = {async_log.wake_fd, POLLIN, 0};
+    uint64_t count;
+    (void)arg;
+
+    while (__atomic_load_n(&async_log.running, __ATOMIC_ACQUIRE))
+    {
+        log_async_flush();
+        __atomic_store_n(&async_log.sleeping, true, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        // a message published before the flag was seen gets no wake-up
+        if (next_slot(async_log.dequeue_pos) != NULL)
+        {
+            __atomic_store_n(&async_log.sleeping, false, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (poll(&wake, 1, LOG_ASYNC_IDLE_MS) > 0 &&
+            read(async_log.wake_fd, &count, sizeof(count)) < 0)
+        {
+            // nothing to read, somebody else woke us
+        }
+        __atomic_store_n(&async_log.sleeping, false, __ATOMIC_RELAXED);
+    }
+    log_async_flush();
+    return NULL;
+}
+
+// Write what is left in the ring with the only calls a signal handler can
+// make, without touching the thread's position, then crash as before.
+static void on_crash_signal(int signum)
+{
+    int fd = async_log.out_fd == -1 ? STDERR_FILENO : async_log.out_fd;
+    size_t pos = async_log.dequeue_pos;
+    log_slot* slot;
+
+    while ((slot = next_slot(pos++)) != NULL)
+    {
+        write_all(fd, slot->line, slot->len);
+        write_all(fd, "\n", 1);
+    }
+    raise(signum);
+}
+
+static void set_crash_handlers(bool install)
+{
+    struct sigaction action = {0};
+    action.sa_handler = on_crash_signal;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]);
+         i++)
+    {
+        if (install)
+            sigaction(crash_signals[i], &action, &crash_actions[i]);
+        else
+            sigaction(crash_signals[i], &crash_actions[i], NULL);
+    }
+}
+
+/** @brief Start writing the local logs from a background thread
+ *
+ *  @param log_file  File the logs are appended to, NULL for stderr or syslog.
+ *  @param use_syslog  Write to syslog rather than stderr when no file is set.
+ *  @return ST_OK if successful, ST_ERR otherwise.
+ */
+STATUS log_async_start(const char* log_file, bool use_syslog)
+{
+    if (async_log.running)
+        return ST_ERR;
+
+    if (log_file)
+    {
+        async_log.out_fd = open(log_file,
+                                O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                                0640);
+        if (async_log.out_fd == -1)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_None, "Could not open the log file %s: %d",
+                    log_file, errno);
+            return ST_ERR;
+        }
+    }
+    else
+    {
+        async_log.out_fd = use_syslog ? -1 : STDERR_FILENO;
+    }
+
+    // the wake fd stays open for good, a caller still holding the writer
+    // after log_async_stop must not write into a reused descriptor
+    if (async_log.wake_fd == -1)
+        async_log.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (async_log.wake_fd == -1)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Could not create the log event fd: %d", errno);
+        log_async_stop();
+        return ST_ERR;
+    }
+
+    for (size_t i = 0; i < LOG_ASYNC_SLOTS; i++)
+        async_log.slots[i].sequence = i;
+    async_log.enqueue_pos = 0;
+    async_log.dequeue_pos = 0;
+    async_log.dropped = 0;
+    async_log.dropped_reported = 0;
+    async_log.sleeping = false;
+    async_log.running = true;
+    if (pthread_create(&async_log.thread, NULL, log_async_thread, NULL) != 0)
+    {
+        async_log.running = false;
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Could not start the log thread");
+        log_async_stop();
+        return ST_ERR;
+    }
+    set_crash_handlers(true);
+    ASD_set_log_writer(log_async_write);
+    return ST_OK;
+}
+
+/** @brief Write out what is queued and go back to logging directly */
+void log_async_stop(void)
+{
+    ASD_set_log_writer(NULL);
+    if (__atomic_load_n(&async_log.running, __ATOMIC_ACQUIRE))
+    {
+        uint64_t one = 1;
+        set_crash_handlers(false);
+        __atomic_store_n(&async_log.running, false, __ATOMIC_RELEASE);
+        if (write(async_log.wake_fd, &one, sizeof(one)) != sizeof(one))
+        {
+            // it notices within LOG_ASYNC_IDLE_MS
+        }
+        pthread_join(async_log.thread, NULL);
+    }
+    if (async_log.out_fd > STDERR_FILENO)
+        close(async_log.out_fd);
+    async_log.out_fd = -1;
+}
+
+/** @brief Messages dropped because the ring was full */
+uint64_t log_async_dropped(void)
+{
+    return __atomic_load_n(&async_log.dropped, __ATOMIC_RELAXED);
+}
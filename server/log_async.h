@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2019, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file log_async.h
+ * @brief Local log output written by a background thread
+ */
+
+#ifndef __LOG_ASYNC_H
+#define __LOG_ASYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asd_common.h"
+
+/** Messages the ring holds before new ones are dropped, a power of two */
+#define LOG_ASYNC_SLOTS 256
+/** Longest line kept, longer messages are cut */
+#define LOG_ASYNC_LINE 512
+/** Lines gathered into one write */
+#define LOG_ASYNC_BATCH 16384
+/** Longest the thread sleeps without being woken */
+#define LOG_ASYNC_IDLE_MS 100
+
+extern STATUS log_async_start(const char* log_file, bool use_syslog);
+extern void log_async_stop(void);
+extern uint64_t log_async_dropped(void);
+
+#endif
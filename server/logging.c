@@ -30,6 +30,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ctype.h>
 #include <safe_str_lib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +42,9 @@ static bool WriteToSyslog = false;
 static bool log_timestamp = false;
 static ShouldLogFunctionPtr shouldLogCallback = NULL;
 static LogFunctionPtr loggingCallback = NULL;
+static ShouldLogFunctionPtr shouldLogBinaryCallback = NULL;
+static LogRecordFunctionPtr logRecordCallback = NULL;
+static LogWriteFunctionPtr logWriteCallback = NULL;
 ASD_LogLevel asd_log_level = ASD_LogLevel_Error;
 ASD_LogStream asd_log_streams = ASD_LogStream_All;
 
@@ -52,6 +56,12 @@ bool ShouldLog(ASD_LogLevel level, ASD_LogStream stream)
     return log;
 }
 
+static bool should_log_binary(ASD_LogLevel level, ASD_LogStream stream)
+{
+    return shouldLogBinaryCallback && logRecordCallback &&
+           shouldLogBinaryCallback(level, stream);
+}
+
 bool ASD_get_timestamp(char* time_buffer)
 {
     struct timespec ts;
@@ -88,6 +98,44 @@ void ASD_log(ASD_LogLevel level, ASD_LogStream stream, ASD_LogOption options,
     if (!local_log && !remoteLog)
         return;
 
+    if (remoteLog && should_log_binary(level, stream))
+    {
+        // the arguments go out as they are, nothing is formatted for it
+        unsigned char record[LOG_RECORD_LENGTH];
+        size_t len;
+        va_list args;
+        va_start(args, format);
+        len = ASD_log_encode_message(record, sizeof(record), format, args);
+        va_end(args);
+        if (len > 0)
+            logRecordCallback(level, stream, record, len);
+        remoteLog = false;
+        if (!local_log)
+            return;
+    }
+
+    if (local_log && logWriteCallback)
+    {
+        // a single pass into the line, the writer takes it from there
+        size_t len = 0;
+        int written;
+        va_list args;
+        if (ASD_get_timestamp(log_buffer))
+            len = strnlen(log_buffer, LOG_TIMESTAMP_LENGTH);
+        va_start(args, format);
+        written = vsnprintf(&log_buffer[len], sizeof(log_buffer) - len,
+                            format, args);
+        va_end(args);
+        if (written > 0)
+            len += (size_t)written < sizeof(log_buffer) - len
+                       ? (size_t)written
+                       : sizeof(log_buffer) - len - 1;
+        logWriteCallback(level, log_buffer, len);
+        local_log = false;
+        if (!remoteLog)
+            return;
+    }
+
     if (ASD_get_timestamp(log_buffer))
     {
         va_list args;
@@ -161,6 +209,25 @@ void ASD_log_buffer(ASD_LogLevel level, ASD_LogStream stream,
     if (!local_log && !remoteLog)
         return;
 
+    if (remoteLog && should_log_binary(level, stream))
+    {
+        // as many records as needed, each fits the longest prefix
+        unsigned char record[LOG_RECORD_LENGTH];
+        size_t chunk = sizeof(record) - 4 - LOG_RECORD_MAX_PREFIX;
+        for (size_t sent = 0; sent < len; sent += chunk)
+        {
+            size_t rec_len = ASD_log_encode_data(
+                record, sizeof(record), LOG_RECORD_BUFFER, prefixPtr,
+                &ptr[sent], len - sent < chunk ? len - sent : chunk);
+            if (rec_len == 0)
+                break;
+            logRecordCallback(level, stream, record, rec_len);
+        }
+        remoteLog = false;
+        if (!local_log)
+            return;
+    }
+
     // Combine the timestamp and log message
     if (ASD_get_timestamp(line_buffer))
         line = &line_buffer[LOG_TIMESTAMP_LENGTH-1];
@@ -188,7 +255,12 @@ void ASD_log_buffer(ASD_LogLevel level, ASD_LogStream stream,
         }
         *h = '\n';
         i += l;
-        if (local_log)
+        if (local_log && logWriteCallback)
+        {
+            logWriteCallback(level, line_buffer,
+                             (size_t)((char*)h - line_buffer));
+        }
+        else if (local_log)
         {
             if (WriteToSyslog)
                 syslog(LOG_USER, "%s", line_buffer);
@@ -224,6 +296,18 @@ void buffer_to_hex(unsigned int number_of_bits, unsigned int number_of_bytes,
     }
 }
 
+static void log_shift_record(ASD_LogLevel level, ASD_LogStream stream,
+                             const unsigned char* buffer,
+                             unsigned int number_of_bits,
+                             const char* prefixPtr)
+{
+    unsigned char record[LOG_RECORD_LENGTH];
+    size_t len = ASD_log_encode_data(record, sizeof(record), LOG_RECORD_SHIFT,
+                                     prefixPtr, buffer, number_of_bits);
+    if (len > 0)
+        logRecordCallback(level, stream, record, len);
+}
+
 void ASD_log_shift(ASD_LogLevel level, ASD_LogStream stream,
                    ASD_LogOption options, unsigned int number_of_bits,
                    unsigned int size_bytes, unsigned char* buffer,
@@ -249,6 +333,14 @@ void ASD_log_shift(ASD_LogLevel level, ASD_LogStream stream,
         number_of_bits = (number_of_bytes * 8);
     }
 
+    if (remoteLog && should_log_binary(level, stream))
+    {
+        log_shift_record(level, stream, buffer, number_of_bits, prefixPtr);
+        if (!local_log)
+            return;
+        options |= ASD_LogOption_No_Remote;
+    }
+
     result = (unsigned char*)malloc(result_size + 1);
     if (!result)
     {
@@ -285,6 +377,15 @@ void ASD_log_shift_to_from(ASD_LogLevel level, ASD_LogStream stream,
         number_of_bits = (number_of_bytes * 8);
     }
 
+    if (remoteLog && should_log_binary(level, stream))
+    {
+        log_shift_record(level, stream, buffer + (from / 8), to - from,
+                         prefixPtr);
+        if (!local_log)
+            return;
+        options |= ASD_LogOption_No_Remote;
+    }
+
     result = (unsigned char*)malloc(result_size + 1);
     if (!result)
     {
@@ -317,6 +418,296 @@ void ASD_update_log_settings(ASD_LogLevel level, ASD_LogStream stream)
     asd_log_streams = stream;
 }
 
+void ASD_set_binary_logging(ShouldLogFunctionPtr should_log_binary,
+                            LogRecordFunctionPtr log_record)
+{
+    shouldLogBinaryCallback = should_log_binary;
+    logRecordCallback = log_record;
+}
+
+void ASD_set_log_writer(LogWriteFunctionPtr log_write)
+{
+    logWriteCallback = log_write;
+}
+
+// FNV-1a, the decoder hashes the strings of the binary the same way.
+uint32_t ASD_log_format_id(const char* format)
+{
+    uint32_t hash = 2166136261u;
+    if (!format)
+        return 0;
+    while (*format)
+    {
+        hash ^= (unsigned char)*format++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool put_number(unsigned char* record, size_t size, size_t* pos,
+                       uint64_t value, size_t width)
+{
+    if (*pos + width > size)
+        return false;
+    for (size_t i = 0; i < width; i++)
+        record[(*pos)++] = (unsigned char)(value >> (8 * i));
+    return true;
+}
+
+static bool put_arg(unsigned char* record, size_t size, size_t* pos,
+                    uint64_t value, size_t width)
+{
+    size_t start = *pos;
+    if (put_number(record, size, pos,
+                   width > 4 ? LOG_ARG_INT64 : LOG_ARG_INT32, 1) &&
+        put_number(record, size, pos, value, width > 4 ? 8 : 4))
+        return true;
+    *pos = start;
+    return false;
+}
+
+static bool put_string(unsigned char* record, size_t size, size_t* pos,
+                       const char* string)
+{
+    size_t len;
+    if (!string)
+        string = "(null)";
+    if (*pos + 3 > size)
+        return false;
+    // a long string is cut to what is left of the record
+    len = strnlen(string, size - *pos - 3);
+    if (len > UINT16_MAX)
+        len = UINT16_MAX;
+    put_number(record, size, pos, LOG_ARG_STRING, 1);
+    put_number(record, size, pos, len, 2);
+    memcpy(&record[*pos], string, len);
+    *pos += len;
+    return true;
+}
+
+typedef enum
+{
+    LEN_INT = 0,
+    LEN_LONG,
+    LEN_LONG_LONG,
+    LEN_SIZE,
+    LEN_INTMAX,
+    LEN_PTRDIFF,
+    LEN_LONG_DOUBLE
+} arg_length;
+
+// Take an integer of the size the length modifier gives off the list.
+static uint64_t next_int(va_list* args, arg_length length, bool is_signed,
+                         size_t* width)
+{
+    switch (length)
+    {
+        case LEN_LONG:
+            *width = sizeof(long);
+            return is_signed ? (uint64_t)(int64_t)va_arg(*args, long)
+                             : (uint64_t)va_arg(*args, unsigned long);
+        case LEN_LONG_LONG:
+            *width = sizeof(long long);
+            return is_signed ? (uint64_t)va_arg(*args, long long)
+                             : (uint64_t)va_arg(*args, unsigned long long);
+        case LEN_SIZE:
+            *width = sizeof(size_t);
+            return (uint64_t)va_arg(*args, size_t);
+        case LEN_INTMAX:
+            *width = sizeof(intmax_t);
+            return (uint64_t)va_arg(*args, intmax_t);
+        case LEN_PTRDIFF:
+            *width = sizeof(ptrdiff_t);
+            return (uint64_t)va_arg(*args, ptrdiff_t);
+        default:
+            *width = sizeof(int);
+            return is_signed ? (uint64_t)(int64_t)va_arg(*args, int)
+                             : (uint64_t)va_arg(*args, unsigned int);
+    }
+}
+
+size_t ASD_log_encode_message(unsigned char* record, size_t size,
+                              const char* format, va_list args)
+{
+    size_t pos = 0;
+    bool fits = true;
+    va_list ap;
+
+    if (!record || !format ||
+        !put_number(record, size, &pos, LOG_RECORD_MESSAGE, 1) ||
+        !put_number(record, size, &pos, ASD_log_format_id(format), 4))
+        return 0;
+
+    va_copy(ap, args);
+    for (const char* p = format; *p && fits; p++)
+    {
+        arg_length length = LEN_INT;
+        size_t width = 0;
+        uint64_t value;
+        double real;
+
+        if (*p != '%')
+            continue;
+        p++;
+        if (*p == '%')
+            continue;
+        while (*p && strchr("-+ #0'", *p))
+            p++;
+        if (*p == '*')
+        {
+            fits = put_arg(record, size, &pos, (uint64_t)va_arg(ap, int), 4);
+            p++;
+        }
+        while (isdigit((unsigned char)*p))
+            p++;
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                fits = fits &&
+                       put_arg(record, size, &pos, (uint64_t)va_arg(ap, int),
+                               4);
+                p++;
+            }
+            while (isdigit((unsigned char)*p))
+                p++;
+        }
+        switch (*p)
+        {
+            case 'h':
+                p++;
+                if (*p == 'h')
+                    p++;
+                break;
+            case 'l':
+                p++;
+                length = LEN_LONG;
+                if (*p == 'l')
+                {
+                    p++;
+                    length = LEN_LONG_LONG;
+                }
+                break;
+            case 'z':
+                p++;
+                length = LEN_SIZE;
+                break;
+            case 'j':
+                p++;
+                length = LEN_INTMAX;
+                break;
+            case 't':
+                p++;
+                length = LEN_PTRDIFF;
+                break;
+            case 'L':
+                p++;
+                length = LEN_LONG_DOUBLE;
+                break;
+        }
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+                value = next_int(&ap, length, true, &width);
+                fits = fits && put_arg(record, size, &pos, value, width);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            case 'c':
+                value = next_int(&ap, length, false, &width);
+                fits = fits && put_arg(record, size, &pos, value, width);
+                break;
+            case 'p':
+                value = (uint64_t)(uintptr_t)va_arg(ap, void*);
+                fits = fits && put_arg(record, size, &pos, value, 8);
+                break;
+            case 's':
+                fits = fits &&
+                       put_string(record, size, &pos, va_arg(ap, const char*));
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                if (length == LEN_LONG_DOUBLE)
+                    real = (double)va_arg(ap, long double);
+                else
+                    real = va_arg(ap, double);
+                memcpy(&value, &real, sizeof(value));
+                fits = fits &&
+                       put_number(record, size, &pos, LOG_ARG_DOUBLE, 1) &&
+                       put_number(record, size, &pos, value, 8);
+                break;
+            case 'n':
+                (void)va_arg(ap, void*);
+                break;
+            default:
+                // where the next argument starts is unknown from here on
+                fits = false;
+                break;
+        }
+        if (!*p)
+            break;
+    }
+    va_end(ap);
+    return pos;
+}
+
+size_t ASD_log_encode_data(unsigned char* record, size_t size, uint8_t kind,
+                           const char* prefix, const unsigned char* data,
+                           size_t count)
+{
+    size_t prefix_len = prefix ? strnlen(prefix, LOG_RECORD_MAX_PREFIX) : 0;
+    size_t pos = 0;
+    size_t room;
+    size_t bytes;
+
+    if (!record || (!data && count) ||
+        (kind != LOG_RECORD_BUFFER && kind != LOG_RECORD_SHIFT) ||
+        size < 4 + prefix_len)
+        return 0;
+
+    record[pos++] = kind;
+    record[pos++] = (unsigned char)prefix_len;
+    if (prefix_len)
+        memcpy(&record[pos], prefix, prefix_len);
+    pos += prefix_len;
+    room = size - pos - 2;
+
+    if (count > UINT16_MAX)
+        count = UINT16_MAX;
+    if (kind == LOG_RECORD_SHIFT)
+    {
+        bytes = (count + 7) / 8;
+        if (bytes > room)
+        {
+            bytes = room;
+            count = bytes * 8;
+        }
+    }
+    else
+    {
+        if (count > room)
+            count = room;
+        bytes = count;
+    }
+    put_number(record, size, &pos, count, 2);
+    if (bytes)
+        memcpy(&record[pos], data, bytes);
+    // bits past the count are not part of the scan
+    if (kind == LOG_RECORD_SHIFT && count % 8)
+        record[pos + bytes - 1] &= (unsigned char)(0xff >> (8 - count % 8));
+    return pos + bytes;
+}
+
 
 ASD_LogLevel convert_remote_log_level(uint8_t remote_level)
 {
@@ -486,6 +877,9 @@ bool strtostreams(char* input, ASD_LogStream* output)
                         result = false;
                     }
                 } while (0);
+                // one unknown stream rejects the whole list
+                if (!result)
+                    break;
             }
             free(original);
         }
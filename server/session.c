@@ -29,9 +29,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * @file session.c
  * @brief Functions supporting tracking of remote sessions
  *
- * The current model is that only one session is authenticated at a time.
- * But additional unauthenticated connections are allowed to meet security
- * goals:
+ * The current model is that only one session controls the target at a time.
+ * Once it is authenticated, up to n_max_observers further sessions may
+ * authenticate as read-only observers; they are sent the events and remote
+ * log messages of the controlling session and nothing they send reaches the
+ * hardware. Additional unauthenticated connections are allowed to meet
+ * security goals:
  * 1. Don't allow an unauthenticated connection to hold a session open
  *    preventing access for other users.
  * 2  Don't give an adversary more information than necessary about sessions in
@@ -57,6 +60,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ext_network.h"
 #include "logging.h"
 
+static void session_auth_expired(asd_timer* timer, void* ctx);
+
+static time_t session_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
 /** @brief Initialize session information
  *
  *  Initialize session data. Called once during initialization sequence.
@@ -85,14 +97,19 @@ Session* session_init(ExtNet* extnet)
         if (result != ST_OK)
             break;
         p_sess->t_auth_tout = 0;
+        timer_init(&p_sess->auth_timer, session_auth_expired, state);
         p_sess->b_authenticated = false;
         p_sess->b_data_pending = false;
+        p_sess->b_observer = false;
+        p_sess->n_auth_ticket = 0;
     }
     if (result == ST_OK)
     {
         state->n_authenticated_id = NO_SESSION_AUTHENTICATED;
+        state->n_max_observers = DEFAULT_MAX_OBSERVERS;
         state->b_initialized = true;
         state->extnet = extnet;
+        state->timers = NULL;
     }
     else
     {
@@ -102,6 +119,19 @@ Session* session_init(ExtNet* extnet)
     return state;
 }
 
+/** @brief Expire unauthenticated sessions through a timer queue
+ *
+ *  Without it, expired sessions are only closed by
+ *  session_close_expired_unauth.
+ *
+ *  @param [in] timers Timer queue run by the request loop.
+ */
+void session_set_timer_queue(Session* state, timer_queue* timers)
+{
+    if (state)
+        state->timers = timers;
+}
+
 /** @brief Find session
  *
  *  Given a session file descriptor, return a pointer to the session struct
@@ -182,8 +212,20 @@ STATUS session_open(Session* state, extnet_conn_t* p_extconn)
                         ASD_LogOption_None,
                         "memcpy_s: p_extconn to p_sess copy failed.");
             }
-            p_sess->t_auth_tout = SESSION_AUTH_EXPIRE_TIMEOUT + time(0);
+            p_sess->t_auth_tout = SESSION_AUTH_EXPIRE_TIMEOUT + session_now();
             p_sess->b_authenticated = false;
+            if (state->timers &&
+                timer_schedule(state->timers, &p_sess->auth_timer,
+                               timer_now_ms() +
+                                   SESSION_AUTH_EXPIRE_TIMEOUT * 1000) !=
+                    ST_OK)
+            {
+                ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network,
+                        ASD_LogOption_None,
+                        "Cannot schedule authentication expiry for "
+                        "session %d",
+                        p_sess->id);
+            }
 #ifdef ENABLE_DEBUG_LOGGING
             ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Network,
                     ASD_LogOption_None, "opened session %d fd %d", p_sess->id,
@@ -221,7 +263,11 @@ static STATUS session_close_private(Session* state, session_t* p_sess)
         state->n_authenticated_id = NO_SESSION_AUTHENTICATED;
     }
     p_sess->t_auth_tout = 0;
+    timer_cancel(state->timers, &p_sess->auth_timer);
     p_sess->b_authenticated = false;
+    p_sess->b_observer = false;
+    // a result still on its way is for the connection closed here
+    p_sess->n_auth_ticket = 0;
     return ST_OK;
 }
 
@@ -275,6 +321,32 @@ void session_close_all(Session* state)
     }
 }
 
+/** @brief Close a session whose authentication timer expired
+ *
+ *  Runs from timer_queue_expire, in place of a periodic
+ *  session_close_expired_unauth.
+ */
+static void session_auth_expired(asd_timer* timer, void* ctx)
+{
+    Session* state = (Session*)ctx;
+
+    for (int i = 0; i < MAX_SESSIONS; i++)
+    {
+        session_t* p_sess = &state->sessions[i];
+        if (&p_sess->auth_timer == timer &&
+            !extnet_is_client_closed(state->extnet, &p_sess->extconn) &&
+            !p_sess->b_authenticated)
+        {
+#ifdef ENABLE_DEBUG_LOGGING
+            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Network,
+                    ASD_LogOption_None, "Unauthenticated Session %d time out",
+                    p_sess->id);
+#endif
+            session_close_private(state, p_sess);
+        }
+    }
+}
+
 /** @brief Close expired sessions which have not authenticated
  *
  *  Close all open sessions open longer than the maximum time which have not
@@ -289,7 +361,8 @@ void session_close_expired_unauth(Session* state)
             session_t* p_sess = &state->sessions[i];
             if (p_sess &&
                 !extnet_is_client_closed(state->extnet, &p_sess->extconn) &&
-                !p_sess->b_authenticated && p_sess->t_auth_tout <= time(0))
+                !p_sess->b_authenticated &&
+                p_sess->t_auth_tout <= session_now())
             {
 #ifdef ENABLE_DEBUG_LOGGING
                 ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Network,
@@ -349,7 +422,9 @@ STATUS session_auth_complete(Session* state, extnet_conn_t* p_extconn)
 
     if (state && state->b_initialized && p_extconn)
     {
-        if (state->n_authenticated_id >= 0)
+        bool b_observer = state->n_authenticated_id >= 0;
+
+        if (b_observer && !session_observer_slot_available(state))
         {
             ASD_log(ASD_LogLevel_Error, ASD_LogStream_Network,
                     ASD_LogOption_None,
@@ -368,8 +443,21 @@ STATUS session_auth_complete(Session* state, extnet_conn_t* p_extconn)
             }
             else
             {
-                state->n_authenticated_id = p_sess->id;
+                if (b_observer)
+                {
+                    ASD_log(ASD_LogLevel_Info, ASD_LogStream_Network,
+                            ASD_LogOption_None,
+                            "Session %d is observing session %d", p_sess->id,
+                            state->n_authenticated_id);
+                }
+                else
+                {
+                    state->n_authenticated_id = p_sess->id;
+                }
+                p_sess->b_observer = b_observer;
                 p_sess->b_authenticated = true;
+                p_sess->n_auth_ticket = 0;
+                timer_cancel(state->timers, &p_sess->auth_timer);
                 st_ret = ST_OK;
             }
         }
@@ -411,6 +499,158 @@ STATUS session_get_authenticated_conn(Session* state,
     return st_ret;
 }
 
+/** @brief Mark the credentials of a session as being checked
+ *
+ *  @param [in] p_extconn connection associated with session
+ *  @param [in] n_ticket Non-zero number the result will come back with.
+ *
+ *  @return ST_OK if successful.
+ *          ST_ERR if invalid session
+ */
+STATUS session_set_auth_pending(Session* state, extnet_conn_t* p_extconn,
+                                unsigned int n_ticket)
+{
+    STATUS st_ret = ST_ERR;
+
+    if (state && state->b_initialized && p_extconn && n_ticket != 0 &&
+        p_extconn->sockfd != UNUSED_SOCKET_FD)
+    {
+        session_t* p_sess = session_find_private(state, p_extconn->sockfd);
+        if (p_sess && !p_sess->b_authenticated)
+        {
+            p_sess->n_auth_ticket = n_ticket;
+            st_ret = ST_OK;
+        }
+    }
+    return st_ret;
+}
+
+/** @brief Indicate if the credentials of a session are being checked
+ *
+ *  @param [in] p_extconn connection associated with session
+ *  @return true while the session waits for its authentication result.
+ */
+bool session_auth_pending(Session* state, extnet_conn_t* p_extconn)
+{
+    session_t* p_sess;
+
+    if (!state || !state->b_initialized || !p_extconn ||
+        p_extconn->sockfd == UNUSED_SOCKET_FD)
+        return false;
+
+    p_sess = session_find_private(state, p_extconn->sockfd);
+    return p_sess && p_sess->n_auth_ticket != 0;
+}
+
+/** @brief Find the session an authentication result belongs to
+ *
+ *  The session no longer waits for a result afterwards.
+ *
+ *  @param [in] n_ticket Number passed to session_set_auth_pending.
+ *
+ *  @return NULL if the session was closed in the meantime, otherwise its
+ *          connection.
+ */
+extnet_conn_t* session_take_auth_pending(Session* state, unsigned int n_ticket)
+{
+    if (state && state->b_initialized && n_ticket != 0)
+    {
+        for (int i = 0; i < MAX_SESSIONS; i++)
+        {
+            session_t* p_sess = &state->sessions[i];
+            if (p_sess->n_auth_ticket == n_ticket)
+            {
+                p_sess->n_auth_ticket = 0;
+                return &p_sess->extconn;
+            }
+        }
+    }
+    return NULL;
+}
+
+/** @brief Set how many read-only observers may join the controller
+ *
+ *  @param [in] n_max_observers 0 keeps the target to a single session.
+ *
+ *  @return ST_OK if successful.
+ *          ST_ERR if n_max_observers is out of range.
+ */
+STATUS session_set_max_observers(Session* state, int n_max_observers)
+{
+    STATUS st_ret = ST_ERR;
+    if (state && state->b_initialized && n_max_observers >= 0 &&
+        n_max_observers <= MAX_OBSERVERS)
+    {
+        state->n_max_observers = n_max_observers;
+        st_ret = ST_OK;
+    }
+    return st_ret;
+}
+
+/** @brief Indicate if the next session to authenticate becomes an observer
+ *
+ *  @return true if a session controls the target and fewer than
+ *          n_max_observers sessions observe it.
+ */
+bool session_observer_slot_available(Session* state)
+{
+    int n_observers = 0;
+
+    if (!state || !state->b_initialized || state->n_authenticated_id < 0)
+        return false;
+
+    for (int i = 0; i < MAX_SESSIONS; i++)
+    {
+        if (state->sessions[i].b_observer)
+            n_observers++;
+    }
+    return n_observers < state->n_max_observers;
+}
+
+/** @brief Indicate if session is a read-only observer
+ *
+ *  @param [in] p_extconn connection associated with session
+ *  @return true if the session authenticated as an observer.
+ */
+bool session_is_observer(Session* state, extnet_conn_t* p_extconn)
+{
+    session_t* p_sess;
+
+    if (!state || !state->b_initialized || !p_extconn ||
+        p_extconn->sockfd == UNUSED_SOCKET_FD)
+        return false;
+
+    p_sess = session_find_private(state, p_extconn->sockfd);
+    return p_sess && p_sess->b_observer;
+}
+
+/** @brief Get connections of all observer sessions
+ *
+ *  The connections stay owned by the sessions, they are valid until the
+ *  next session is opened or closed.
+ *
+ *  @param [out] ap_conns Connections of the observers.
+ *
+ *  @return Number of connections returned in ap_conns.
+ */
+int session_get_observer_conns(Session* state,
+                               extnet_conn_t* ap_conns[MAX_OBSERVERS])
+{
+    int n_conns = 0;
+
+    if (state && state->b_initialized && ap_conns)
+    {
+        for (int i = 0; i < MAX_SESSIONS && n_conns < MAX_OBSERVERS; i++)
+        {
+            session_t* p_sess = &state->sessions[i];
+            if (p_sess->b_observer &&
+                !extnet_is_client_closed(state->extnet, &p_sess->extconn))
+                ap_conns[n_conns++] = &p_sess->extconn;
+        }
+    }
+    return n_conns;
+}
+
 /** @brief Get file descriptor set for all open sessions
  *
  *  Assumes that p_fdset points to valid fdset structure that has been zeroed.
@@ -419,6 +659,8 @@ STATUS session_get_authenticated_conn(Session* state,
  *  @param [in/out] fdset File descriptor set used to return session file
  *  descriptors.
  *  @param [in/out] pn_maxfd Max value of file descriptors in set.
+ *  @param [in/out] pn_timeout_ms Set to 0 when a session has data pending,
+ *  authentication expiry is left to the session timers.
  *
  *  @return Returns ST_ERR if invalid pointer passed to fdset.
  *          ST_OK if successful.
@@ -438,25 +680,6 @@ STATUS session_getfds(Session* state, session_fdarr_t* na_fds, int* pn_fds,
             session_t* p_sess = &state->sessions[i];
             if (!extnet_is_client_closed(state->extnet, &p_sess->extconn))
             {
-                if (!p_sess->b_authenticated)
-                {
-                    int n_msremain =
-                        (int)(1000 * (p_sess->t_auth_tout - time(0L)));
-                    if (n_msremain < 0)
-                    {
-                        n_msremain = 0;
-                    }
-                    if (*pn_timeout_ms < 0 || n_msremain < *pn_timeout_ms)
-                    {
-                        *pn_timeout_ms = n_msremain;
-#ifdef ENABLE_DEBUG_LOGGING
-                        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Network,
-                                ASD_LogOption_None,
-                                "Session %d time remaining: %d", p_sess->id,
-                                n_msremain);
-#endif
-                    }
-                }
                 session_get_data_pending(state, &p_sess->extconn,
                                          &b_data_pending);
                 if (b_data_pending)
@@ -37,11 +37,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "asd_common.h"
 #include "ext_network.h"
+#include "timer_queue.h"
 
 /** Max number of sessions */
 #define MAX_SESSIONS 5
 #define SESSION_AUTH_EXPIRE_TIMEOUT 15
 #define NO_SESSION_AUTHENTICATED (-1)
+/** Observers share the session slots with the controlling session */
+#define MAX_OBSERVERS (MAX_SESSIONS - 1)
+#define DEFAULT_MAX_OBSERVERS 0
 
 typedef int session_fdarr_t[MAX_SESSIONS];
 
@@ -50,10 +54,17 @@ typedef struct
 {
     int id;
     extnet_conn_t extconn; // External Connection
-    time_t t_auth_tout;    // Time stamp when authentication attempt times out
+    time_t t_auth_tout;    // CLOCK_MONOTONIC second the authentication
+                           // attempt times out
+    asd_timer auth_timer;  // closes the session at t_auth_tout
     bool b_authenticated;  // True if session is authenticated.
     bool b_data_pending;   // Hint that more data is pending for the
                            // connection.
+    bool b_observer;       // Authenticated read-only session, it receives
+                           // events and remote logs but never reaches the
+                           // hardware.
+    unsigned int n_auth_ticket; // credentials handed to the authentication
+                                // workers, 0 when none are.
 } session_t;
 
 /** Global data struct */
@@ -61,11 +72,14 @@ typedef struct Session
 {
     bool b_initialized;
     session_t sessions[MAX_SESSIONS];
-    int n_authenticated_id; // only one session may be authenticated.
+    int n_authenticated_id; // only one session may control the target.
+    int n_max_observers;    // read-only sessions next to the controller.
     ExtNet* extnet;
+    timer_queue* timers; // authentication expiry, none when NULL
 } Session;
 
 extern Session* session_init(ExtNet* extnet);
+extern void session_set_timer_queue(Session* state, timer_queue* timers);
 extern extnet_conn_t* session_lookup_conn(Session* state, int fd);
 extern STATUS session_open(Session* state, extnet_conn_t* p_extconn);
 extern STATUS session_close(Session* state, extnet_conn_t* p_extconn);
@@ -76,6 +90,17 @@ extern STATUS session_already_authenticated(Session* state,
 extern STATUS session_auth_complete(Session* state, extnet_conn_t* p_extconn);
 extern STATUS session_get_authenticated_conn(Session* state,
                                              extnet_conn_t* p_authd_conn);
+extern STATUS session_set_auth_pending(Session* state,
+                                       extnet_conn_t* p_extconn,
+                                       unsigned int n_ticket);
+extern bool session_auth_pending(Session* state, extnet_conn_t* p_extconn);
+extern extnet_conn_t* session_take_auth_pending(Session* state,
+                                                unsigned int n_ticket);
+extern STATUS session_set_max_observers(Session* state, int n_max_observers);
+extern bool session_observer_slot_available(Session* state);
+extern bool session_is_observer(Session* state, extnet_conn_t* p_extconn);
+extern int session_get_observer_conns(Session* state,
+                                      extnet_conn_t* ap_conns[MAX_OBSERVERS]);
 extern STATUS session_getfds(Session* state, session_fdarr_t* na_fds,
                              int* pn_fds, int* pn_timeout);
 extern STATUS session_set_data_pending(Session* state, extnet_conn_t* p_extconn,
@@ -25,6 +25,7 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <setjmp.h>
@@ -35,16 +36,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "../asd_common.h"
 #include "../asd_main.h"
-#include "../asd_msg.h"
 #include "../authenticate.h"
 #include "../ext_network.h"
 #include "../logging.h"
 #include "../session.h"
+#include "asd_target_interface.h"
 #include "cmocka.h"
 
 // static char temporary_log_buffer[512];
@@ -78,21 +81,40 @@ void __wrap_ASD_log_buffer(ASD_LogLevel level, ASD_LogStream stream,
 void __wrap_ASD_initialize_log_settings(ASD_LogLevel level,
                                         ASD_LogStream stream,
                                         bool write_to_syslog,
+                                        bool log_timestamp_enable,
                                         ShouldLogFunctionPtr should_log_ptr,
                                         LogFunctionPtr log_ptr)
 {
     check_expected(level);
     check_expected(stream);
     check_expected(write_to_syslog);
+    check_expected(log_timestamp_enable);
     check_expected_ptr(should_log_ptr);
     check_expected_ptr(log_ptr);
 }
 
+void __wrap_ASD_set_binary_logging(ShouldLogFunctionPtr should_log_binary,
+                                   LogRecordFunctionPtr log_record)
+{
+    (void)should_log_binary;
+    (void)log_record;
+}
+
+STATUS __wrap_log_async_start(const char* log_file, bool use_syslog)
+{
+    (void)log_file;
+    (void)use_syslog;
+    return ST_OK;
+}
+
+void __wrap_log_async_stop(void) {}
+
 void expect_any_ASD_initialize_log_settings()
 {
     expect_any(__wrap_ASD_initialize_log_settings, level);
     expect_any(__wrap_ASD_initialize_log_settings, stream);
     expect_any(__wrap_ASD_initialize_log_settings, write_to_syslog);
+    expect_any(__wrap_ASD_initialize_log_settings, log_timestamp_enable);
     expect_any(__wrap_ASD_initialize_log_settings, should_log_ptr);
     expect_any(__wrap_ASD_initialize_log_settings, log_ptr);
 }
@@ -103,6 +125,8 @@ void expect_default_ASD_initialize_log_settings()
     expect_value(__wrap_ASD_initialize_log_settings, stream,
                  DEFAULT_LOG_STREAMS);
     expect_value(__wrap_ASD_initialize_log_settings, write_to_syslog, false);
+    expect_value(__wrap_ASD_initialize_log_settings, log_timestamp_enable,
+                 false);
     expect_any(__wrap_ASD_initialize_log_settings, should_log_ptr);
     expect_any(__wrap_ASD_initialize_log_settings, log_ptr);
 }
@@ -259,6 +283,12 @@ void __wrap_session_close_expired_unauth(Session* state)
     check_expected_ptr(state);
 }
 
+void __wrap_session_set_timer_queue(Session* state, timer_queue* timers)
+{
+    (void)state;
+    (void)timers;
+}
+
 int MEMCPY_SAFE_RESULT = 0;
 int __wrap_memcpy_safe(void* dest, size_t destsize, const void* src,
                        size_t count)
@@ -297,6 +327,55 @@ void expect_session_auth_complete(STATUS result)
     SESSION_AUTH_COMPLETE_RESULT = result;
 }
 
+// no observers unless a test asks for them
+STATUS __wrap_session_set_max_observers(Session* state, int n_max_observers)
+{
+    (void)state;
+    (void)n_max_observers;
+    return ST_OK;
+}
+
+bool __wrap_session_is_observer(Session* state, extnet_conn_t* p_extconn)
+{
+    (void)state;
+    (void)p_extconn;
+    return false;
+}
+
+// set while a test has the workers check the password
+bool SESSION_AUTH_PENDING = false;
+bool __wrap_session_auth_pending(Session* state, extnet_conn_t* p_extconn)
+{
+    (void)state;
+    (void)p_extconn;
+    return SESSION_AUTH_PENDING;
+}
+
+int __wrap_auth_get_event_fd(void)
+{
+    return -1;
+}
+
+void __wrap_auth_process_results(Session* session, ExtNet* net_state,
+                                 auth_result_callback on_result, void* ctx)
+{
+    (void)session;
+    (void)net_state;
+    (void)on_result;
+    (void)ctx;
+}
+
+extnet_conn_t* FAKE_OBSERVERS[MAX_OBSERVERS];
+int NUM_FAKE_OBSERVERS = 0;
+int __wrap_session_get_observer_conns(Session* state,
+                                      extnet_conn_t* ap_conns[MAX_OBSERVERS])
+{
+    (void)state;
+    for (int i = 0; i < NUM_FAKE_OBSERVERS; i++)
+        ap_conns[i] = FAKE_OBSERVERS[i];
+    return NUM_FAKE_OBSERVERS;
+}
+
 STATUS SESSION_GET_AUTHENTICATED_CONN_RESULT = ST_OK;
 STATUS __wrap_session_get_authenticated_conn(Session* state,
                                              extnet_conn_t* p_authd_conn)
@@ -313,6 +392,14 @@ void expect_session_get_authenticated_conn(STATUS result)
     SESSION_GET_AUTHENTICATED_CONN_RESULT = result;
 }
 
+void expect_session_get_authenticated_conn_count(STATUS result, int count)
+{
+    expect_any_count(__wrap_session_get_authenticated_conn, state, count);
+    expect_any_count(__wrap_session_get_authenticated_conn, p_authd_conn,
+                     count);
+    SESSION_GET_AUTHENTICATED_CONN_RESULT = result;
+}
+
 int SESSION_FDS_RESULT_INDEX = 0;
 STATUS SESSION_FDS_RESULT[2];
 int SESSION_FDS_COUNT = 0;
@@ -383,101 +470,78 @@ void expect_session_get_data_pending(STATUS result, bool pending)
     SESSION_DATA_PENDING = pending;
 }
 
+int __real_close(int fd);
 void __wrap_close(int fd)
 {
     check_expected(fd);
 }
 
-ASD_MSG* FAKE_ASD_MSG_INIT_RESULT = NULL;
-ASD_MSG* __wrap_asd_msg_init(SendFunctionPtr send_function,
-                             ReadFunctionPtr read_function, void* cb_state,
-                             config* config)
-{
-    check_expected_ptr(cb_state);
-    check_expected_ptr(send_function);
-    check_expected_ptr(read_function);
-    check_expected_ptr(config);
-    return FAKE_ASD_MSG_INIT_RESULT;
-}
-
-void expect_any_asd_msg_init(ASD_MSG* sdk)
+STATUS ASD_API_TARGET_INIT_RESULT = ST_OK;
+STATUS __wrap_asd_api_target_init(config* asd_cfg)
 {
-    FAKE_ASD_MSG_INIT_RESULT = sdk;
-    expect_any(__wrap_asd_msg_init, cb_state);
-    expect_any(__wrap_asd_msg_init, send_function);
-    expect_any(__wrap_asd_msg_init, read_function);
-    expect_any(__wrap_asd_msg_init, config);
+    check_expected_ptr(asd_cfg);
+    return ASD_API_TARGET_INIT_RESULT;
 }
 
-STATUS ASD_MSG_FREE_RESULT = ST_OK;
-STATUS __wrap_asd_msg_free(ASD_MSG* state)
+void expect_asd_api_target_init(STATUS result)
 {
-    check_expected_ptr(state);
-    return ASD_MSG_FREE_RESULT;
+    expect_any(__wrap_asd_api_target_init, asd_cfg);
+    ASD_API_TARGET_INIT_RESULT = result;
 }
 
-void expect_asd_msg_free(STATUS result)
+int ASD_API_TARGET_DEINIT_CALLS = 0;
+STATUS ASD_API_TARGET_DEINIT_RESULT = ST_OK;
+STATUS __wrap_asd_api_target_deinit(void)
 {
-    expect_any(__wrap_asd_msg_free, state);
-    ASD_MSG_FREE_RESULT = result;
-}
-
-STATUS ASD_MSG_READ_RESULT = ST_OK;
-STATUS __wrap_asd_msg_read(ASD_MSG* state, void* conn, bool* data_pending)
-{
-    check_expected_ptr(state);
-    check_expected_ptr(conn);
-    check_expected_ptr(data_pending);
-    return ASD_MSG_READ_RESULT;
+    ASD_API_TARGET_DEINIT_CALLS++;
+    return ASD_API_TARGET_DEINIT_RESULT;
 }
 
-void expect_asd_msg_read(STATUS result)
+void expect_asd_api_target_deinit(STATUS result)
 {
-    expect_any(__wrap_asd_msg_read, state);
-    expect_any(__wrap_asd_msg_read, conn);
-    expect_any(__wrap_asd_msg_read, data_pending);
-    ASD_MSG_READ_RESULT = result;
+    ASD_API_TARGET_DEINIT_CALLS = 0;
+    ASD_API_TARGET_DEINIT_RESULT = result;
 }
 
 target_fdarr_t GPIO_FDS;
 int NUM_GPIO_FDS = 0;
-int ASD_MSG_GET_FDS_INDEX = 0;
-STATUS ASD_MSG_GET_FDS_RESULT[2];
-STATUS __wrap_asd_msg_get_fds(ASD_MSG* state, target_fdarr_t* fds, int* num_fds)
-{
-    check_expected_ptr(state);
-    check_expected_ptr(fds);
-    check_expected_ptr(num_fds);
-    *num_fds = NUM_GPIO_FDS;
-    for (int i = 0; i < NUM_GPIO_FDS; i++)
+int TARGET_GET_PIN_FDS_INDEX = 0;
+STATUS TARGET_GET_PIN_FDS_RESULT[2];
+STATUS TARGET_IOCTL_RESULT = ST_OK;
+STATUS __wrap_asd_api_target_ioctl(void* input, void* output, unsigned int cmd)
+{
+    (void)input;
+    check_expected(cmd);
+    if (cmd == IOCTL_TARGET_GET_PIN_FDS)
     {
-        (*fds)[i] = GPIO_FDS[i];
+        asd_target_interface_events* events =
+            (asd_target_interface_events*)output;
+        events->num_fds = NUM_GPIO_FDS;
+        for (int i = 0; i < NUM_GPIO_FDS; i++)
+        {
+            events->fds[i] = GPIO_FDS[i];
+        }
+        return TARGET_GET_PIN_FDS_RESULT[TARGET_GET_PIN_FDS_INDEX++];
     }
-    return ASD_MSG_GET_FDS_RESULT[ASD_MSG_GET_FDS_INDEX++];
+    return TARGET_IOCTL_RESULT;
 }
 
-void expect_asd_msg_get_fds(STATUS result, int index)
+void expect_target_get_pin_fds(STATUS result, int index)
 {
-    expect_any(__wrap_asd_msg_get_fds, state);
-    expect_any(__wrap_asd_msg_get_fds, fds);
-    expect_any(__wrap_asd_msg_get_fds, num_fds);
-    ASD_MSG_GET_FDS_RESULT[index] = result;
-    ASD_MSG_GET_FDS_INDEX = 0;
+    expect_value(__wrap_asd_api_target_ioctl, cmd, IOCTL_TARGET_GET_PIN_FDS);
+    TARGET_GET_PIN_FDS_RESULT[index] = result;
+    TARGET_GET_PIN_FDS_INDEX = 0;
 }
 
-STATUS ASD_MSG_EVENT_RESULT = ST_OK;
-STATUS __wrap_asd_msg_event(ASD_MSG* state, int fd)
+void expect_target_ioctl(unsigned int cmd, STATUS result)
 {
-    check_expected_ptr(state);
-    check_expected(fd);
-    return ASD_MSG_EVENT_RESULT;
+    expect_value(__wrap_asd_api_target_ioctl, cmd, cmd);
+    TARGET_IOCTL_RESULT = result;
 }
 
-void expect_asd_msg_event(STATUS result)
+void __wrap_exttls_set_options(const exttls_options* options)
 {
-    expect_any(__wrap_asd_msg_event, state);
-    expect_any(__wrap_asd_msg_event, fd);
-    ASD_MSG_EVENT_RESULT = result;
+    (void)options;
 }
 
 ExtNet EXTNET;
@@ -540,21 +604,13 @@ void expect_extnet_accept_connection()
     expect_any(__wrap_extnet_accept_connection, pconn);
 }
 
-STATUS __wrap_extnet_close_client(extnet_conn_t* pconn)
-{
-    return ST_OK;
-}
-
-STATUS __wrap_extnet_init_client(extnet_conn_t* pconn)
+STATUS __wrap_extnet_close_client(ExtNet* state, extnet_conn_t* pconn)
 {
+    (void)state;
+    (void)pconn;
     return ST_OK;
 }
 
-bool __wrap_extnet_is_client_closed(extnet_conn_t* pconn)
-{
-    return false;
-}
-
 int EXTNET_RECV_RESULT = 0;
 bool EXTNET_RECV_PENDING = false;
 int __wrap_extnet_recv(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
@@ -591,6 +647,29 @@ int __wrap_extnet_send(ExtNet* state, extnet_conn_t* pconn, void* pv_buf,
     return EXTNET_SEND_RESULT;
 }
 
+// one result per call, the observer sockets never block
+int EXTNET_SEND_NOWAIT_RESULTS[4];
+int EXTNET_SEND_NOWAIT_INDEX = 0;
+int __wrap_extnet_send_nowait(ExtNet* state, extnet_conn_t* pconn,
+                              void* pv_buf, size_t sz_len)
+{
+    check_expected_ptr(state);
+    check_expected_ptr(pconn);
+    check_expected_ptr(pv_buf);
+    check_expected(sz_len);
+    return EXTNET_SEND_NOWAIT_RESULTS[EXTNET_SEND_NOWAIT_INDEX++];
+}
+
+void expect_extnet_send_nowait(extnet_conn_t* pconn, size_t sz_len,
+                               int result, int index)
+{
+    expect_any(__wrap_extnet_send_nowait, state);
+    expect_value(__wrap_extnet_send_nowait, pconn, pconn);
+    expect_any(__wrap_extnet_send_nowait, pv_buf);
+    expect_value(__wrap_extnet_send_nowait, sz_len, sz_len);
+    EXTNET_SEND_NOWAIT_RESULTS[index] = result;
+}
+
 STATUS FAKE_AUTH_INIT_RESULT = ST_OK;
 STATUS __wrap_auth_init(auth_hdlr_type_t e_type, void* p_hdlr_data)
 {
@@ -606,9 +685,18 @@ void expect_any_auth_init()
     FAKE_AUTH_INIT_RESULT = ST_OK;
 }
 
+int AUTH_DEINIT_CALLS = 0;
+void __wrap_auth_deinit(void)
+{
+    AUTH_DEINIT_CALLS++;
+}
+
 STATUS AUTH_CLIENT_HANDSHAKE_RESULT = ST_OK;
-STATUS __wrap_auth_client_handshake(extnet_conn_t* p_extconn)
+STATUS __wrap_auth_client_handshake(Session* session, ExtNet* state,
+                                    extnet_conn_t* p_extconn)
 {
+    (void)session;
+    (void)state;
     check_expected_ptr(p_extconn);
     return AUTH_CLIENT_HANDSHAKE_RESULT;
 }
@@ -620,17 +708,20 @@ void expect_auth_client_handshake(STATUS result)
 }
 
 STATUS SET_CONFIG_DEFAULTS_RESULT = ST_OK;
-STATUS __wrap_set_config_defaults(config* config, const i2c_options* i2c)
+STATUS __wrap_set_config_defaults(config* config, const bus_options* opt,
+                                  const timeout_config* tmo_cfg)
 {
     check_expected_ptr(config);
-    check_expected_ptr(i2c);
+    check_expected_ptr(opt);
+    check_expected_ptr(tmo_cfg);
     return SET_CONFIG_DEFAULTS_RESULT;
 }
 
 void expect_set_config_defaults(STATUS result)
 {
     expect_any(__wrap_set_config_defaults, config);
-    expect_any(__wrap_set_config_defaults, i2c);
+    expect_any(__wrap_set_config_defaults, opt);
+    expect_any(__wrap_set_config_defaults, tmo_cfg);
     SET_CONFIG_DEFAULTS_RESULT = result;
 }
 
@@ -649,6 +740,66 @@ void expect_any_eventfd()
     EVENT_FD_RESULT = 0;
 }
 
+extern asd_state main_state;
+extern extnet_conn_t* p_extconn;
+extern bool b_data_pending;
+
+int EPOLL_FD_RESULT = 0;
+int __wrap_epoll_create1(int flags)
+{
+    check_expected(flags);
+    return EPOLL_FD_RESULT;
+}
+
+void expect_any_epoll_create1()
+{
+    expect_any(__wrap_epoll_create1, flags);
+    EPOLL_FD_RESULT = 98;
+}
+
+#define TIMER_FD 97
+STATUS TIMER_QUEUE_INIT_RESULT = ST_OK;
+STATUS __wrap_timer_queue_init(timer_queue* queue)
+{
+    check_expected_ptr(queue);
+    queue->fd = TIMER_FD;
+    queue->count = 0;
+    queue->armed_ms = 0;
+    return TIMER_QUEUE_INIT_RESULT;
+}
+
+void expect_any_timer_queue_init()
+{
+    expect_any(__wrap_timer_queue_init, queue);
+    TIMER_QUEUE_INIT_RESULT = ST_OK;
+}
+
+void __wrap_timer_queue_expire(timer_queue* queue)
+{
+    check_expected_ptr(queue);
+}
+
+// what init_asd_state leaves for the loop
+void init_loop_state(asd_state* asd)
+{
+    asd->event_fd = 99;
+    asd->loop.epoll_fd = 98;
+    asd->loop.num_watched = 0;
+    asd->timers.fd = TIMER_FD;
+    asd->timers.count = 0;
+    asd->timers.armed_ms = 0;
+    timer_init(&asd->idle_timer, on_idle_timer, asd);
+}
+
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    (void)epfd;
+    (void)op;
+    (void)fd;
+    (void)event;
+    return 0;
+}
+
 void expect_asd_init()
 {
     expect_any_ASD_initialize_log_settings();
@@ -658,10 +809,13 @@ void expect_asd_init()
     expect_any_session_init();
     expect_any_eventfd();
     expect_any_extnet_open_external_socket();
+    expect_any_epoll_create1();
+    expect_any_timer_queue_init();
 }
 
 uint64_t FAKE_READ_VALUE = 0;
 ssize_t FAKE_READ_RESULT = 0;
+ssize_t __real_read(int fd, void* buf, size_t count);
 ssize_t __wrap_read(int fd, void* buf, size_t count)
 {
     check_expected(fd);
@@ -680,15 +834,16 @@ void expect_read(int fd, int result, uint64_t value)
     FAKE_READ_VALUE = value;
 }
 
-void expect_on_client_connect(ASD_MSG* asd_msg, STATUS result)
+void expect_on_client_connect(STATUS result)
 {
     expect_getpeername(0);
+    expect_target_ioctl(IOCTL_TARGET_GET_I2C_I3C_BUS_CONFIG, ST_OK);
 
     expect_set_config_defaults(result);
 
     if (result == ST_OK)
     {
-        expect_any_asd_msg_init(asd_msg);
+        expect_asd_api_target_init(ST_OK);
         expect_any_ASD_initialize_log_settings();
     }
 }
@@ -699,7 +854,7 @@ void expect_on_client_disconnect(STATUS result)
     if (result == ST_OK)
     {
         expect_any_ASD_initialize_log_settings();
-        expect_asd_msg_free(ST_OK);
+        expect_asd_api_target_deinit(ST_OK);
     }
 }
 
@@ -708,38 +863,42 @@ void expect_process_client_message(extnet_conn_t* conn, int fd, STATUS result)
     expect_session_lookup_conn(conn, fd);
     expect_session_get_data_pending(ST_OK, true);
     expect_session_already_authenticated(ST_OK);
-    expect_asd_msg_read(ST_OK);
+    expect_target_ioctl(IOCTL_TARGET_PROCESS_MSG, ST_OK);
     expect_session_data_pending(result);
 }
 
-int POLL_RESULT = 0;
-short POLL_REVENTS[MAX_FDS];
-int __wrap_poll(struct pollfd* fds, nfds_t nfds, int timeout)
+int EPOLL_RESULT = 0;
+struct epoll_event EPOLL_EVENTS[MAX_FDS];
+int __wrap_epoll_wait(int epfd, struct epoll_event* events, int maxevents,
+                      int timeout)
 {
-    check_expected_ptr(fds);
-    check_expected(nfds);
+    check_expected(epfd);
+    check_expected(maxevents);
     check_expected(timeout);
 
-    for (int i = 0; i < MAX_FDS; i++)
+    for (int i = 0; i < EPOLL_RESULT; i++)
     {
-        fds[i].revents = POLL_REVENTS[i];
+        events[i] = EPOLL_EVENTS[i];
     }
+    if (EPOLL_RESULT < 0)
+        errno = EBADF;
 
-    return POLL_RESULT;
+    return EPOLL_RESULT;
 }
 
-void expect_poll(int timeout, int result)
+void expect_epoll_wait(int timeout, int result)
 {
-    expect_any(__wrap_poll, fds);
-    expect_any(__wrap_poll, nfds);
-    expect_value(__wrap_poll, timeout, timeout);
-    POLL_RESULT = result;
+    expect_any(__wrap_epoll_wait, epfd);
+    expect_value(__wrap_epoll_wait, maxevents, MAX_FDS);
+    expect_value(__wrap_epoll_wait, timeout, timeout);
+    EPOLL_RESULT = result;
 }
 
 void expect_process_new_client(asd_state* asd, ExtNet* extnet)
 {
     asd->extnet = extnet;
     asd->args.session.e_auth_type = AUTH_HDLR_NONE;
+    asd->loop.num_watched = 0;
 
     expect_extnet_accept_connection();
     expect_session_open();
@@ -795,8 +954,11 @@ void asd_main_process_command_line_request_processing_failure_test(void** state)
     EXTNET_INIT_MALLOC = true;
     expect_default_ASD_initialize_log_settings();
     expect_asd_init();
+    expect_target_get_pin_fds(ST_ERR, 0);
     expect_session_getfds(ST_ERR, 0);
     expect_any(__wrap_session_close_all, state);
+    expect_value(__wrap_close, fd, 98);
+    expect_value(__wrap_close, fd, TIMER_FD);
 
     assert_int_equal(asd_main(1, (char**)&argv), 1);
     SESSION_INIT_MALLOC = false;
@@ -810,8 +972,8 @@ void process_command_line_sets_defaults_test(void** state)
     optind = 1;
     char* argv[] = {"blah"};
     assert_true(process_command_line(1, (char**)&argv, &args));
-    assert_int_equal(args.i2c.enable, DEFAULT_I2C_ENABLE);
-    assert_int_equal(args.i2c.bus, DEFAULT_I2C_BUS);
+    assert_int_equal(args.busopt.enable_i2c, DEFAULT_I2C_ENABLE);
+    assert_int_equal(args.busopt.bus, DEFAULT_I2C_BUS);
     assert_false(args.use_syslog);
     assert_int_equal(args.log_streams, DEFAULT_LOG_STREAMS);
     assert_int_equal(args.log_level, DEFAULT_LOG_LEVEL);
@@ -820,6 +982,13 @@ void process_command_line_sets_defaults_test(void** state)
     assert_int_equal(args.session.cp_net_bind_device, NULL);
     assert_int_equal(args.session.e_extnet_type, EXTNET_HDLR_TLS);
     assert_int_equal(args.session.e_auth_type, AUTH_HDLR_PAM);
+    assert_int_equal(args.session.tls.ticket_lifetime,
+                     DEFAULT_TLS_TICKET_LIFETIME);
+    assert_int_equal(args.session.tls.ticket_key_rotation,
+                     DEFAULT_TLS_TICKET_KEY_ROTATION);
+    assert_false(args.session.tls.cheap_crypto);
+    assert_int_equal(args.session.n_max_observers, DEFAULT_MAX_OBSERVERS);
+    assert_int_equal(args.session.n_auth_workers, DEFAULT_AUTH_WORKERS);
 }
 
 void process_command_line_port_number_test(void** state)
@@ -827,7 +996,7 @@ void process_command_line_port_number_test(void** state)
     (void)state; /* unused */
     asd_args args;
     optind = 1;
-    char* argv[] = {"blah", "-p 5555"};
+    char* argv[] = {"blah", "-p5555"};
     assert_true(process_command_line(2, (char**)&argv, &args));
     assert_int_equal(args.session.n_port_number, 5555);
 }
@@ -858,9 +1027,68 @@ void process_command_line_set_key_file_test(void** state)
     (void)state; /* unused */
     asd_args args;
     optind = 1;
-    char* argv[] = {"blah", "-kblah-halb"};
+    char* argv[] = {"blah", "-kblah/halb.pem"};
+    assert_true(process_command_line(2, (char**)&argv, &args));
+    assert_string_equal(args.session.cp_certkeyfile, "blah/halb.pem");
+}
+
+void process_command_line_set_tls_options_test(void** state)
+{
+    (void)state; /* unused */
+    asd_args args;
+    optind = 1;
+    char* argv[] = {"blah", "--tls-ticket-lifetime=0",
+                    "--tls-ticket-rotation=600", "--tls-cheap-crypto"};
+    assert_true(process_command_line(4, (char**)&argv, &args));
+    assert_int_equal(args.session.tls.ticket_lifetime, 0);
+    assert_int_equal(args.session.tls.ticket_key_rotation, 600);
+    assert_true(args.session.tls.cheap_crypto);
+}
+
+void process_command_line_rejects_zero_tls_ticket_rotation_test(void** state)
+{
+    (void)state; /* unused */
+    asd_args args;
+    optind = 1;
+    char* argv[] = {"blah", "--tls-ticket-rotation=0"};
+    assert_false(process_command_line(2, (char**)&argv, &args));
+}
+
+void process_command_line_set_observers_test(void** state)
+{
+    (void)state; /* unused */
+    asd_args args;
+    optind = 1;
+    char* argv[] = {"blah", "--observers=2"};
     assert_true(process_command_line(2, (char**)&argv, &args));
-    assert_string_equal(args.session.cp_certkeyfile, "blah-halb");
+    assert_int_equal(args.session.n_max_observers, 2);
+}
+
+void process_command_line_rejects_too_many_observers_test(void** state)
+{
+    (void)state; /* unused */
+    asd_args args;
+    optind = 1;
+    // observers take the slots the controller leaves
+    char* argv[] = {"blah", "--observers=5"};
+    assert_false(process_command_line(2, (char**)&argv, &args));
+}
+
+void process_command_line_set_log_async_test(void** state)
+{
+    (void)state; /* unused */
+    asd_args args;
+    optind = 1;
+    char* argv[] = {"blah", "--log-async"};
+    assert_true(process_command_line(2, (char**)&argv, &args));
+    assert_true(args.log_async);
+    assert_null(args.log_file);
+
+    optind = 1;
+    char* file_argv[] = {"blah", "--log-async=/tmp/asd.log"};
+    assert_true(process_command_line(2, (char**)&file_argv, &args));
+    assert_true(args.log_async);
+    assert_string_equal(args.log_file, "/tmp/asd.log");
 }
 
 void process_command_line_set_net_bind_device_test(void** state)
@@ -878,10 +1106,10 @@ void process_command_line_set_i2c_test(void** state)
     (void)state; /* unused */
     asd_args args;
     optind = 1;
-    char* argv[] = {"blah", "-i 4"};
+    char* argv[] = {"blah", "-i4"};
     assert_true(process_command_line(2, (char**)&argv, &args));
-    assert_int_equal(args.i2c.enable, true);
-    assert_int_equal(args.i2c.bus, 4);
+    assert_int_equal(args.busopt.enable_i2c, true);
+    assert_int_equal(args.busopt.bus, 4);
 }
 
 static void process_command_line_log_level_test(void** state)
@@ -939,46 +1167,42 @@ static void
     init_asd_state_handles_set_config_defaults_failure_test(void** state)
 {
     (void)state;
-    asd_state asd_state;
     expect_set_config_defaults(ST_ERR);
-    assert_int_equal(ST_ERR, init_asd_state(&asd_state));
+    assert_int_equal(ST_ERR, init_asd_state());
 }
 
 static void init_asd_state_handles_extnet_init_failure_test(void** state)
 {
     (void)state;
-    asd_state asd_state;
     expect_any_ASD_initialize_log_settings();
     expect_set_config_defaults(ST_OK);
 
     FAKE_EXTNET_INIT_RESULT = NULL;
     expect_value(__wrap_extnet_init, eType,
-                 asd_state.args.session.e_extnet_type);
+                 main_state.args.session.e_extnet_type);
     expect_any(__wrap_extnet_init, p_hdlr_data);
     expect_value(__wrap_extnet_init, n_max_sessions, MAX_SESSIONS);
 
-    assert_int_equal(ST_ERR, init_asd_state(&asd_state));
+    assert_int_equal(ST_ERR, init_asd_state());
 }
 
 static void init_asd_state_handles_auth_init_failure_test(void** state)
 {
     (void)state;
-    asd_state asd_state;
     expect_any_ASD_initialize_log_settings();
     expect_set_config_defaults(ST_OK);
     expect_any_extnet_init();
 
     FAKE_AUTH_INIT_RESULT = ST_ERR;
-    expect_value(__wrap_auth_init, e_type, asd_state.args.session.e_auth_type);
+    expect_value(__wrap_auth_init, e_type, main_state.args.session.e_auth_type);
     expect_any(__wrap_auth_init, p_hdlr_data);
 
-    assert_int_equal(ST_ERR, init_asd_state(&asd_state));
+    assert_int_equal(ST_ERR, init_asd_state());
 }
 
 static void init_asd_state_handles_session_init_failure_test(void** state)
 {
     (void)state;
-    asd_state asd_state;
     expect_any_ASD_initialize_log_settings();
     expect_set_config_defaults(ST_OK);
     expect_any_extnet_init();
@@ -987,13 +1211,12 @@ static void init_asd_state_handles_session_init_failure_test(void** state)
     expect_any(__wrap_session_init, extnet);
     SESSION_INIT_RESULT = NULL;
 
-    assert_int_equal(ST_ERR, init_asd_state(&asd_state));
+    assert_int_equal(ST_ERR, init_asd_state());
 }
 
 void init_asd_state_handles_eventfd_failure_test(void** state)
 {
     (void)state;
-    asd_state asd_state;
     expect_any_ASD_initialize_log_settings();
     expect_set_config_defaults(ST_OK);
     expect_any_extnet_init();
@@ -1004,14 +1227,13 @@ void init_asd_state_handles_eventfd_failure_test(void** state)
     expect_value(__wrap_eventfd, flags, O_NONBLOCK);
     EVENT_FD_RESULT = -1;
 
-    assert_int_equal(ST_ERR, init_asd_state(&asd_state));
+    assert_int_equal(ST_ERR, init_asd_state());
 }
 
 static void init_asd_state_handles_extnet_open_external_socket_failure_test(
     void** state)
 {
     (void)state;
-    asd_state asd_state;
     expect_any_ASD_initialize_log_settings();
     expect_set_config_defaults(ST_OK);
     expect_any_extnet_init();
@@ -1023,16 +1245,15 @@ static void init_asd_state_handles_extnet_open_external_socket_failure_test(
     expect_any(__wrap_extnet_open_external_socket, state);
     expect_any(__wrap_extnet_open_external_socket, cp_bind_if);
     expect_value(__wrap_extnet_open_external_socket, u16_port,
-                 asd_state.args.session.n_port_number);
+                 main_state.args.session.n_port_number);
     expect_any(__wrap_extnet_open_external_socket, pfd_sock);
 
-    assert_int_equal(ST_ERR, init_asd_state(&asd_state));
+    assert_int_equal(ST_ERR, init_asd_state());
 }
 
 static void init_asd_state_returns_true_test(void** state)
 {
     (void)state;
-    asd_state asd_state;
     expect_any_ASD_initialize_log_settings();
     expect_set_config_defaults(ST_OK);
     expect_any_extnet_init();
@@ -1040,8 +1261,10 @@ static void init_asd_state_returns_true_test(void** state)
     expect_any_session_init();
     expect_any_eventfd();
     expect_any_extnet_open_external_socket();
+    expect_any_epoll_create1();
+    expect_any_timer_queue_init();
 
-    assert_int_equal(ST_OK, init_asd_state(&asd_state));
+    assert_int_equal(ST_OK, init_asd_state());
 }
 
 void asd_main_init_asd_state_failure_test(void** state)
@@ -1049,11 +1272,17 @@ void asd_main_init_asd_state_failure_test(void** state)
     (void)state;
     optind = 1;
     char* argv[] = {"blah"};
+    main_state.host_fd = 0;
+    main_state.loop.epoll_fd = 0;
+    main_state.timers.fd = 0;
+    main_state.extnet = NULL;
+    main_state.session = NULL;
 
     expect_default_ASD_initialize_log_settings();
 
     // cause init_asd_state to fail
     expect_set_config_defaults(ST_ERR);
+    expect_any(__wrap_session_close_all, state);
 
     assert_int_equal(asd_main(1, (char**)&argv), 1);
 }
@@ -1063,47 +1292,47 @@ void deinit_asd_state_test(void** state)
     (void)state;
     int expected_fd = 68;
     asd_state asd_state;
-    ASD_MSG sdk;
     Session session;
     asd_state.session = &session;
     asd_state.host_fd = expected_fd;
-    asd_state.asd_msg = &sdk;
+    asd_state.loop.epoll_fd = 98;
+    asd_state.timers.fd = TIMER_FD;
+    asd_state.timers.count = 0;
 
     expect_any(__wrap_session_close_all, state);
     expect_value(__wrap_close, fd, expected_fd);
-    expect_asd_msg_free(ST_OK);
+    expect_value(__wrap_close, fd, 98);
+    expect_value(__wrap_close, fd, TIMER_FD);
+    expect_asd_api_target_deinit(ST_OK);
+    AUTH_DEINIT_CALLS = 0;
 
     deinit_asd_state(&asd_state);
+    assert_int_equal(1, ASD_API_TARGET_DEINIT_CALLS);
+    assert_int_equal(1, AUTH_DEINIT_CALLS);
 }
 
 void send_out_msg_on_socket_params_test(void** state)
 {
     (void)state;
-    unsigned char buffer[9];
-    asd_state asd_state;
 
-    assert_int_equal(ST_ERR,
-                     send_out_msg_on_socket(NULL, (unsigned char*)&buffer, 1));
-    assert_int_equal(ST_ERR, send_out_msg_on_socket(&asd_state, NULL, 1));
+    assert_int_equal(ST_ERR, send_out_msg_on_socket(NULL, 1));
 }
 
 void send_out_msg_on_socket_no_authenticated_socket_test(void** state)
 {
     (void)state;
     unsigned char buffer[9];
-    asd_state asd_state;
 
     expect_session_get_authenticated_conn(ST_ERR);
 
-    assert_int_equal(
-        ST_ERR, send_out_msg_on_socket(&asd_state, (unsigned char*)&buffer, 1));
+    assert_int_equal(ST_ERR,
+                     send_out_msg_on_socket((unsigned char*)&buffer, 1));
 }
 
 void send_out_msg_on_socket_send_failure_test(void** state)
 {
     (void)state;
     unsigned char buffer[9];
-    asd_state asd_state;
     int given_length = 9;
     int actual_length = 8;
 
@@ -1114,16 +1343,14 @@ void send_out_msg_on_socket_send_failure_test(void** state)
     expect_value(__wrap_extnet_send, sz_len, given_length);
     EXTNET_SEND_RESULT = actual_length;
 
-    assert_int_equal(ST_ERR,
-                     send_out_msg_on_socket(&asd_state, (unsigned char*)&buffer,
-                                            given_length));
+    assert_int_equal(ST_ERR, send_out_msg_on_socket((unsigned char*)&buffer,
+                                                    given_length));
 }
 
 void send_out_msg_on_socket_success_test(void** state)
 {
     (void)state;
     unsigned char buffer[9];
-    asd_state asd_state;
     int length = 9;
 
     expect_session_get_authenticated_conn(ST_OK);
@@ -1133,21 +1360,183 @@ void send_out_msg_on_socket_success_test(void** state)
     expect_value(__wrap_extnet_send, sz_len, length);
     EXTNET_SEND_RESULT = length;
 
-    assert_int_equal(ST_OK, send_out_msg_on_socket(
-                                &asd_state, (unsigned char*)&buffer, length));
+    assert_int_equal(ST_OK,
+                     send_out_msg_on_socket((unsigned char*)&buffer, length));
+}
+
+void queue_out_msg_params_test(void** state)
+{
+    (void)state;
+    unsigned char buffer[OUT_QUEUE_SIZE + 1];
+    struct iovec iov = {buffer, sizeof(buffer)};
+
+    assert_int_equal(ST_ERR, queue_out_msg(NULL, 1));
+    assert_int_equal(ST_ERR, queue_out_msg(&iov, 0));
+    assert_int_equal(ST_ERR, queue_out_msg(&iov, 1));
+}
+
+void queue_out_msg_coalesces_until_flush_test(void** state)
+{
+    (void)state;
+    unsigned char header[4] = {0};
+    unsigned char payload[9] = {0};
+    struct iovec iov[2] = {{header, sizeof(header)},
+                           {payload, sizeof(payload)}};
+    int length = 2 * (sizeof(header) + sizeof(payload)) + sizeof(header);
+
+    assert_int_equal(ST_OK, init_out_queue());
+    // nothing reaches the socket while responses are being queued
+    assert_int_equal(ST_OK, queue_out_msg(iov, 2));
+    assert_int_equal(ST_OK, queue_out_msg(iov, 2));
+    assert_int_equal(ST_OK, queue_out_msg(iov, 1));
+
+    expect_session_get_authenticated_conn(ST_OK);
+    expect_any(__wrap_extnet_send, state);
+    expect_any(__wrap_extnet_send, pconn);
+    expect_any(__wrap_extnet_send, pv_buf);
+    expect_value(__wrap_extnet_send, sz_len, length);
+    EXTNET_SEND_RESULT = length;
+
+    assert_int_equal(ST_OK, flush_out_msgs());
+    // the queue is empty again, so a second flush does not write
+    assert_int_equal(ST_OK, flush_out_msgs());
+}
+
+void queue_out_msg_seals_full_buffers_test(void** state)
+{
+    (void)state;
+    unsigned char buffer[OUT_QUEUE_SIZE / 2 + 1] = {0};
+    struct iovec iov = {buffer, sizeof(buffer)};
+
+    assert_int_equal(ST_OK, init_out_queue());
+    // the second one does not fit, the first buffer is sealed
+    assert_int_equal(ST_OK, queue_out_msg(&iov, 1));
+    assert_int_equal(ST_OK, queue_out_msg(&iov, 1));
+
+    expect_session_get_authenticated_conn(ST_OK);
+    expect_any(__wrap_extnet_send, state);
+    expect_any(__wrap_extnet_send, pconn);
+    expect_any(__wrap_extnet_send, pv_buf);
+    expect_value(__wrap_extnet_send, sz_len, sizeof(buffer));
+    expect_session_get_authenticated_conn(ST_OK);
+    expect_any(__wrap_extnet_send, state);
+    expect_any(__wrap_extnet_send, pconn);
+    expect_any(__wrap_extnet_send, pv_buf);
+    expect_value(__wrap_extnet_send, sz_len, sizeof(buffer));
+    EXTNET_SEND_RESULT = sizeof(buffer);
+
+    assert_int_equal(ST_OK, flush_out_msgs());
+}
+
+void send_observer_events_does_not_wait_for_observer_test(void** state)
+{
+    (void)state;
+    unsigned char event[10] = {0};
+    struct iovec iov = {event, sizeof(event)};
+    extnet_conn_t observer;
+    observer.sockfd = 7;
+
+    assert_int_equal(ST_OK, init_out_queue());
+    FAKE_OBSERVERS[0] = &observer;
+    NUM_FAKE_OBSERVERS = 1;
+    update_observing();
+
+    // the socket takes part of the event, the rest waits for the observer
+    assert_int_equal(ST_OK, queue_out_event(&iov, 1));
+    EXTNET_SEND_NOWAIT_INDEX = 0;
+    expect_extnet_send_nowait(&observer, sizeof(event), 4, 0);
+    expect_extnet_send_nowait(&observer, sizeof(event) - 4, 0, 1);
+    send_observer_events();
+
+    // still full, the next event is not sent to it
+    assert_int_equal(ST_OK, queue_out_event(&iov, 1));
+    EXTNET_SEND_NOWAIT_INDEX = 0;
+    expect_extnet_send_nowait(&observer, sizeof(event) - 4, 0, 0);
+    send_observer_events();
+
+    // caught up, it gets the events from then on
+    assert_int_equal(ST_OK, queue_out_event(&iov, 1));
+    EXTNET_SEND_NOWAIT_INDEX = 0;
+    expect_extnet_send_nowait(&observer, sizeof(event) - 4, sizeof(event) - 4,
+                              0);
+    expect_extnet_send_nowait(&observer, sizeof(event), sizeof(event), 1);
+    send_observer_events();
+
+    // an observer that cannot be written to is closed
+    assert_int_equal(ST_OK, queue_out_event(&iov, 1));
+    EXTNET_SEND_NOWAIT_INDEX = 0;
+    expect_extnet_send_nowait(&observer, sizeof(event), -1, 0);
+    expect_value(__wrap_session_close, p_extconn, &observer);
+    expect_any(__wrap_session_close, state);
+    SESSION_CLOSE_RESULT = ST_OK;
+    send_observer_events();
+
+    NUM_FAKE_OBSERVERS = 0;
+    update_observing();
+}
+
+static void* queue_from_worker(void* arg)
+{
+    struct iovec* iov = (struct iovec*)arg;
+    // more than every buffer holds, so the worker has to wait for the
+    // socket thread
+    for (int i = 0; i < 2 * NUM_OUT_BUFFERS; i++)
+        queue_out_msg(iov, 1);
+    flush_out_msgs();
+    return NULL;
+}
+
+void queue_out_msg_from_worker_sent_by_socket_thread_test(void** state)
+{
+    (void)state;
+    unsigned char buffer[OUT_QUEUE_SIZE / 2 + 1] = {0};
+    struct iovec iov = {buffer, sizeof(buffer)};
+    pthread_t worker;
+    int wake[2];
+    uint64_t wakes;
+    int sent = 0;
+
+    assert_int_equal(ST_OK, init_out_queue());
+    assert_int_equal(0, pipe(wake));
+    main_state.event_fd = wake[1];
+
+    expect_session_get_authenticated_conn_count(ST_OK, 2 * NUM_OUT_BUFFERS);
+    expect_any_count(__wrap_extnet_send, state, 2 * NUM_OUT_BUFFERS);
+    expect_any_count(__wrap_extnet_send, pconn, 2 * NUM_OUT_BUFFERS);
+    expect_any_count(__wrap_extnet_send, pv_buf, 2 * NUM_OUT_BUFFERS);
+    expect_value_count(__wrap_extnet_send, sz_len, sizeof(buffer),
+                       2 * NUM_OUT_BUFFERS);
+    EXTNET_SEND_RESULT = sizeof(buffer);
+
+    assert_int_equal(0, pthread_create(&worker, NULL, queue_from_worker,
+                                       &iov));
+    // what the request loop does on the event fd
+    while (sent < 2 * NUM_OUT_BUFFERS)
+    {
+        assert_true(__real_read(wake[0], &wakes, sizeof(wakes)) > 0);
+        sent += (int)wakes;
+        send_sealed_out_msgs();
+    }
+    pthread_join(worker, NULL);
+
+    __real_close(wake[0]);
+    __real_close(wake[1]);
+    main_state.event_fd = 0;
 }
 
 void request_processing_loop_poll_failure_test(void** state)
 {
     (void)state;
     asd_state asd_state;
+    asd_state.host_fd = 5;
+    init_loop_state(&asd_state);
 
     SESSION_FDS_COUNT = 1;
     SESSION_FDS[0] = 777;
     SESSION_TIMEOUT = 0;
     expect_session_getfds(ST_OK, 0);
-    expect_asd_msg_get_fds(ST_OK, 0);
-    expect_poll(SESSION_TIMEOUT, -1);
+    expect_target_get_pin_fds(ST_OK, 0);
+    expect_epoll_wait(SESSION_TIMEOUT, -1);
 
     assert_int_equal(ST_ERR, request_processing_loop(&asd_state));
 }
@@ -1155,15 +1544,15 @@ void request_processing_loop_poll_failure_test(void** state)
 void request_processing_loop_process_get_session_fds_failure_test(void** state)
 {
     (void)state;
-    ASD_MSG sdk;
     asd_state asd_state;
     asd_state.event_fd = 99;
-    asd_state.asd_msg = &sdk;
+    asd_state.host_fd = 5;
+    init_loop_state(&asd_state);
 
     SESSION_FDS_COUNT = 1;
     SESSION_FDS[0] = 777;
     SESSION_TIMEOUT = 0;
-    expect_asd_msg_get_fds(ST_OK, 0);
+    expect_target_get_pin_fds(ST_OK, 0);
     expect_session_getfds(ST_ERR, 0);
 
     assert_int_equal(ST_ERR, request_processing_loop(&asd_state));
@@ -1172,21 +1561,21 @@ void request_processing_loop_process_get_session_fds_failure_test(void** state)
 void request_processing_loop_expect_process_new_client_test(void** state)
 {
     (void)state;
-    ASD_MSG sdk;
     asd_state asd_state;
     asd_state.event_fd = 99;
-    asd_state.asd_msg = &sdk;
+    asd_state.host_fd = 5;
+    init_loop_state(&asd_state);
 
     NUM_GPIO_FDS = 0;
-    expect_asd_msg_get_fds(ST_OK, 0);
+    expect_target_get_pin_fds(ST_OK, 0);
 
     SESSION_FDS_COUNT = 0;
-    SESSION_TIMEOUT = 0;
+    SESSION_TIMEOUT = -1;
     expect_session_getfds(ST_OK, 0);
 
-    POLL_REVENTS[HOST_FD_INDEX] = POLLIN;
-    POLL_REVENTS[GPIO_FD_INDEX] = 0;
-    expect_poll(SESSION_TIMEOUT, 0);
+    EPOLL_EVENTS[0].events = EPOLLIN;
+    EPOLL_EVENTS[0].data.fd = asd_state.host_fd;
+    expect_epoll_wait(SESSION_TIMEOUT, 1);
 
     expect_extnet_accept_connection();
     expect_session_open();
@@ -1196,7 +1585,35 @@ void request_processing_loop_expect_process_new_client_test(void** state)
     expect_any(__wrap_session_lookup_conn, fd);
 
     // loop will continue forever, so create an error to end the test
-    expect_asd_msg_get_fds(ST_ERR, 1);
+    expect_target_get_pin_fds(ST_ERR, 1);
+    expect_session_getfds(ST_ERR, 1);
+
+    assert_int_equal(ST_ERR, request_processing_loop(&asd_state));
+}
+
+void request_processing_loop_timer_fd_runs_expired_timers_test(void** state)
+{
+    (void)state;
+    asd_state asd_state;
+    asd_state.host_fd = 5;
+    init_loop_state(&asd_state);
+
+    NUM_GPIO_FDS = 0;
+    expect_target_get_pin_fds(ST_OK, 0);
+
+    SESSION_FDS_COUNT = 1;
+    SESSION_FDS[0] = 777;
+    SESSION_TIMEOUT = -1;
+    expect_session_getfds(ST_OK, 0);
+
+    // deadlines come from the timer fd, the wait itself has no timeout
+    EPOLL_EVENTS[0].events = EPOLLIN;
+    EPOLL_EVENTS[0].data.fd = TIMER_FD;
+    expect_epoll_wait(SESSION_TIMEOUT, 1);
+    expect_value(__wrap_timer_queue_expire, queue, &asd_state.timers);
+
+    // loop will continue forever, so create an error to end the test
+    expect_target_get_pin_fds(ST_ERR, 1);
     expect_session_getfds(ST_ERR, 1);
 
     assert_int_equal(ST_ERR, request_processing_loop(&asd_state));
@@ -1205,25 +1622,26 @@ void request_processing_loop_expect_process_new_client_test(void** state)
 void request_processing_loop_gpio_failure_test(void** state)
 {
     (void)state;
-    ASD_MSG sdk;
     asd_state asd_state;
     asd_state.event_fd = 99;
-    asd_state.asd_msg = &sdk;
+    asd_state.host_fd = 5;
+    init_loop_state(&asd_state);
     GPIO_FDS[0].fd = 1;
     GPIO_FDS[0].events = POLLIN;
     NUM_GPIO_FDS = 1;
-    expect_asd_msg_get_fds(ST_OK, 0);
+    expect_target_get_pin_fds(ST_OK, 0);
 
     SESSION_FDS_COUNT = 1;
     SESSION_FDS[0] = 777;
-    SESSION_TIMEOUT = 0;
+    SESSION_TIMEOUT = -1;
     expect_session_getfds(ST_OK, 0);
 
-    POLL_REVENTS[0] = 0;
-    POLL_REVENTS[1] = POLL_GPIO;
-    expect_poll(SESSION_TIMEOUT, 0);
+    EPOLL_EVENTS[0].events = EPOLLIN;
+    EPOLL_EVENTS[0].data.fd = GPIO_FDS[0].fd;
+    expect_epoll_wait(SESSION_TIMEOUT, 1);
+    expect_any(__wrap_session_close_expired_unauth, state);
 
-    expect_asd_msg_event(ST_ERR);
+    expect_target_ioctl(IOCTL_TARGET_PROCESS_ALL_PIN_EVENTS, ST_ERR);
 
     // session will be closed
     expect_session_get_authenticated_conn(ST_OK);
@@ -1231,12 +1649,35 @@ void request_processing_loop_gpio_failure_test(void** state)
     expect_session_close(ST_OK);
 
     // loop will continue forever, so create an error to end the test
-    expect_asd_msg_get_fds(ST_ERR, 1);
+    expect_target_get_pin_fds(ST_ERR, 1);
     expect_session_getfds(ST_ERR, 1);
 
     assert_int_equal(ST_ERR, request_processing_loop(&asd_state));
 }
 
+void watch_fds_sync_only_touches_changes_test(void** state)
+{
+    (void)state;
+    event_loop loop = {0};
+    watched_fd wanted[3] = {{5, EPOLLIN, WATCH_HOST, false},
+                            {1, EPOLLPRI, WATCH_TARGET, false},
+                            {777, EPOLLIN, WATCH_CLIENT, false}};
+
+    assert_int_equal(ST_ERR, watch_fds_sync(NULL, wanted, 3));
+    assert_int_equal(ST_OK, watch_fds_sync(&loop, wanted, 3));
+    assert_int_equal(3, loop.num_watched);
+
+    // the client left and the target events changed
+    wanted[1].events = EPOLLIN;
+    assert_int_equal(ST_OK, watch_fds_sync(&loop, wanted, 2));
+    assert_int_equal(2, loop.num_watched);
+    assert_int_equal(EPOLLIN, loop.watched[1].events);
+
+    watch_fds_forget(&loop, WATCH_TARGET, -1);
+    assert_int_equal(1, loop.num_watched);
+    assert_int_equal(5, loop.watched[0].fd);
+}
+
 void process_new_client_invalid_params_test(void** state)
 {
     (void)state;
@@ -1276,6 +1717,7 @@ void process_new_client_session_open_test(void** state)
     ExtNet extnet;
     int clients = 0;
     asd.extnet = &extnet;
+    asd.loop.num_watched = 0;
 
     expect_extnet_accept_connection();
 
@@ -1390,6 +1832,7 @@ void process_client_message_session_get_data_pending_failure_test(void** state)
     assert_int_equal(ST_ERR, process_client_message(&sdk, fd));
 }
 
+// asd_msg_read runs behind the target interface, PROCESS_MSG fails for it
 void process_client_message_asd_msg_read_failure_test(void** state)
 {
     (void)state;
@@ -1402,12 +1845,10 @@ void process_client_message_asd_msg_read_failure_test(void** state)
     expect_session_lookup_conn(&conn, expected_fd);
     expect_session_get_data_pending(ST_OK, true);
     expect_session_already_authenticated(ST_OK);
-    expect_asd_msg_read(ST_ERR);
+    expect_target_ioctl(IOCTL_TARGET_PROCESS_MSG, ST_ERR);
     // After the read failure, these items are called to close the
     // connection
-    expect_set_config_defaults(ST_OK);
-    expect_any_ASD_initialize_log_settings();
-    expect_asd_msg_free(ST_OK);
+    expect_on_client_disconnect(ST_OK);
     expect_session_close(ST_OK);
 
     assert_int_equal(ST_ERR, process_client_message(&sdk, fd));
@@ -1425,7 +1866,7 @@ void process_client_message_session_set_data_pending_failure_test(void** state)
     expect_session_lookup_conn(&conn, expected_fd);
     expect_session_get_data_pending(ST_OK, true);
     expect_session_already_authenticated(ST_OK);
-    expect_asd_msg_read(ST_OK);
+    expect_target_ioctl(IOCTL_TARGET_PROCESS_MSG, ST_OK);
     expect_session_data_pending(ST_ERR);
 
     assert_int_equal(ST_ERR, process_client_message(&sdk, fd));
@@ -1450,78 +1891,55 @@ void process_client_message_success_test(void** state)
 void read_data_invalid_params_test(void** state)
 {
     (void)state;
-    asd_state asd;
     extnet_conn_t connection;
-    char* buffer = "blah";
-    size_t num = 0;
-    bool pending = false;
-    assert_int_equal(ST_ERR,
-                     read_data(NULL, &connection, buffer, &num, &pending));
-    assert_int_equal(ST_ERR, read_data(&asd, NULL, buffer, &num, &pending));
-    assert_int_equal(ST_ERR,
-                     read_data(&asd, &connection, NULL, &num, &pending));
-    assert_int_equal(ST_ERR,
-                     read_data(&asd, &connection, buffer, NULL, &pending));
-    assert_int_equal(ST_ERR, read_data(&asd, &connection, buffer, &num, NULL));
+    char buffer[50];
+
+    p_extconn = NULL;
+    assert_int_equal(0, read_data(buffer, sizeof(buffer)));
+    p_extconn = &connection;
+    assert_int_equal(0, read_data(NULL, sizeof(buffer)));
+    p_extconn = NULL;
 }
 
 void read_data_extnet_recv_failure_0_test(void** state)
 {
     (void)state;
-    asd_state asd;
     extnet_conn_t connection;
-    char* buffer = "blah";
-    size_t num = 50;
-    int expected_recv = 0;
-    int expected_remaining = (int)(num);
-    bool pending = false;
+    char buffer[50];
 
-    expect_extnet_recv(expected_recv, num, false);
-    expect_on_client_disconnect(ST_OK);
-    expect_session_close(ST_OK);
+    p_extconn = &connection;
+    expect_extnet_recv(0, sizeof(buffer), false);
 
-    assert_int_equal(ST_ERR,
-                     read_data(&asd, &connection, buffer, &num, &pending));
-    assert_int_equal(num, expected_remaining);
+    assert_int_equal(0, read_data(buffer, sizeof(buffer)));
+    p_extconn = NULL;
 }
 
 void read_data_extnet_recv_failure_neg1_test(void** state)
 {
     (void)state;
-    asd_state asd;
     extnet_conn_t connection;
-    char* buffer = "blah";
-    size_t num = 50;
-    int expected_recv = -1;
-    int expected_remaining = (int)(num);
-    bool pending = false;
+    char buffer[50];
 
-    expect_extnet_recv(expected_recv, num, false);
-    expect_on_client_disconnect(ST_OK);
-    expect_session_close(ST_OK);
+    p_extconn = &connection;
+    expect_extnet_recv(-1, sizeof(buffer), false);
 
-    assert_int_equal(ST_ERR,
-                     read_data(&asd, &connection, buffer, &num, &pending));
-    assert_int_equal(num, expected_remaining);
+    assert_int_equal(0, read_data(buffer, sizeof(buffer)));
+    p_extconn = NULL;
 }
 
 void read_data_success_test(void** state)
 {
     (void)state;
-    asd_state asd;
     extnet_conn_t connection;
-    char* buffer = "blah";
-    size_t num = 50;
-    int expected_recv = 10;
-    int expected_remaining = (int)(num - expected_recv);
-    bool pending = false;
+    char buffer[50];
 
-    expect_extnet_recv(expected_recv, num, true);
+    p_extconn = &connection;
+    b_data_pending = false;
+    expect_extnet_recv(10, sizeof(buffer), true);
 
-    assert_int_equal(ST_OK,
-                     read_data(&asd, &connection, buffer, &num, &pending));
-    assert_int_equal(num, expected_remaining);
-    assert_true(pending);
+    assert_int_equal(10, read_data(buffer, sizeof(buffer)));
+    assert_true(b_data_pending);
+    p_extconn = NULL;
 }
 
 void ensure_client_authenticated_invalid_params_test(void** state)
@@ -1576,14 +1994,12 @@ void ensure_client_authenticated_connect_failure_test(void** state)
 {
     (void)state;
     asd_state asd;
-    ASD_MSG sdk;
     extnet_conn_t connection;
-    asd.asd_msg = &sdk;
 
     expect_session_already_authenticated(ST_ERR);
     expect_auth_client_handshake(ST_OK);
     expect_session_auth_complete(ST_OK);
-    expect_on_client_connect(asd.asd_msg, ST_ERR);
+    expect_on_client_connect(ST_ERR);
     expect_on_client_disconnect(ST_ERR);
     expect_session_close(ST_OK);
 
@@ -1594,14 +2010,12 @@ void ensure_client_authenticated_connect_failure_memcpy_fail_test(void** state)
 {
     (void)state;
     asd_state asd;
-    ASD_MSG sdk;
     extnet_conn_t connection;
-    asd.asd_msg = &sdk;
 
     expect_session_already_authenticated(ST_ERR);
     expect_auth_client_handshake(ST_OK);
     expect_session_auth_complete(ST_OK);
-    expect_on_client_connect(asd.asd_msg, ST_ERR);
+    expect_on_client_connect(ST_ERR);
     expect_on_client_disconnect(ST_ERR);
     expect_session_close(ST_OK);
     MEMCPY_SAFE_RESULT = 1;
@@ -1612,16 +2026,52 @@ void ensure_client_authenticated_success_test(void** state)
 {
     (void)state;
     asd_state asd;
-    ASD_MSG sdk;
     extnet_conn_t connection;
-    asd.asd_msg = &sdk;
 
     expect_session_already_authenticated(ST_ERR);
     expect_auth_client_handshake(ST_OK);
     expect_session_auth_complete(ST_OK);
-    expect_on_client_connect(asd.asd_msg, ST_OK);
+    expect_on_client_connect(ST_OK);
+
+    assert_int_equal(ST_OK, ensure_client_authenticated(&asd, &connection));
+}
+
+void ensure_client_authenticated_pending_test(void** state)
+{
+    (void)state;
+    asd_state asd;
+    extnet_conn_t connection;
 
+    expect_session_already_authenticated(ST_ERR);
+    expect_auth_client_handshake(ST_OK);
+    SESSION_AUTH_PENDING = true;
+
+    // nothing completes until the workers are done
     assert_int_equal(ST_OK, ensure_client_authenticated(&asd, &connection));
+    SESSION_AUTH_PENDING = false;
+}
+
+void on_auth_result_success_test(void** state)
+{
+    (void)state;
+    asd_state asd;
+    extnet_conn_t connection;
+
+    expect_session_auth_complete(ST_OK);
+    expect_on_client_connect(ST_OK);
+
+    on_auth_result(NULL, &connection, ST_OK, &asd);
+}
+
+void on_auth_result_failure_test(void** state)
+{
+    (void)state;
+    asd_state asd;
+    extnet_conn_t connection;
+
+    expect_session_close(ST_OK);
+
+    on_auth_result(NULL, &connection, ST_ERR, &asd);
 }
 
 void on_client_connect_invalid_params_test(void** state)
@@ -1641,11 +2091,13 @@ void on_client_connect_set_config_defaults_failure_test(void** state)
     connection.sockfd = 8;
 
     expect_getpeername_check_fd(0, connection.sockfd);
+    expect_target_ioctl(IOCTL_TARGET_GET_I2C_I3C_BUS_CONFIG, ST_OK);
     expect_set_config_defaults(ST_ERR);
 
     assert_int_equal(ST_ERR, on_client_connect(&asd, &connection));
 }
 
+// asd_msg_init runs behind asd_api_target_init
 void on_client_connect_asd_msg_init_failure_test(void** state)
 {
     (void)state;
@@ -1653,8 +2105,9 @@ void on_client_connect_asd_msg_init_failure_test(void** state)
     extnet_conn_t connection;
     connection.sockfd = 8;
     expect_getpeername_check_fd(0, connection.sockfd);
+    expect_target_ioctl(IOCTL_TARGET_GET_I2C_I3C_BUS_CONFIG, ST_OK);
     expect_set_config_defaults(ST_OK);
-    expect_any_asd_msg_init(NULL);
+    expect_asd_api_target_init(ST_ERR);
 
     assert_int_equal(ST_ERR, on_client_connect(&asd, &connection));
 }
@@ -1662,13 +2115,13 @@ void on_client_connect_asd_msg_init_failure_test(void** state)
 void on_client_connect_success_test(void** state)
 {
     (void)state;
-    ASD_MSG sdk;
     asd_state asd;
     extnet_conn_t connection;
     connection.sockfd = 8;
     expect_getpeername_check_fd(0, connection.sockfd);
+    expect_target_ioctl(IOCTL_TARGET_GET_I2C_I3C_BUS_CONFIG, ST_OK);
     expect_set_config_defaults(ST_OK);
-    expect_any_asd_msg_init(&sdk);
+    expect_asd_api_target_init(ST_OK);
     expect_any_ASD_initialize_log_settings();
 
     assert_int_equal(ST_OK, on_client_connect(&asd, &connection));
@@ -1689,26 +2142,30 @@ void on_client_disconnect_set_config_defaults_failure_test(void** state)
     assert_int_equal(ST_ERR, on_client_disconnect(&asd));
 }
 
+// asd_msg_free runs behind asd_api_target_deinit
 void on_client_disconnect_asd_msg_free_failure_test(void** state)
 {
     (void)state;
     asd_state asd;
+    asd.loop.num_watched = 0;
     expect_set_config_defaults(ST_OK);
 
     expect_any_ASD_initialize_log_settings();
-    expect_asd_msg_free(ST_ERR);
+    expect_asd_api_target_deinit(ST_ERR);
 
     assert_int_equal(ST_ERR, on_client_disconnect(&asd));
+    assert_int_equal(1, ASD_API_TARGET_DEINIT_CALLS);
 }
 
 void on_client_disconnect_success_test(void** state)
 {
     (void)state;
     asd_state asd;
+    asd.loop.num_watched = 0;
     expect_set_config_defaults(ST_OK);
 
     expect_any_ASD_initialize_log_settings();
-    expect_asd_msg_free(ST_OK);
+    expect_asd_api_target_deinit(ST_OK);
 
     assert_int_equal(ST_OK, on_client_disconnect(&asd));
 }
@@ -1733,6 +2190,13 @@ int main()
         cmocka_unit_test(process_command_line_log_to_syslog_test),
         cmocka_unit_test(process_command_line_set_unsecure_mode_test),
         cmocka_unit_test(process_command_line_set_key_file_test),
+        cmocka_unit_test(process_command_line_set_tls_options_test),
+        cmocka_unit_test(
+            process_command_line_rejects_zero_tls_ticket_rotation_test),
+        cmocka_unit_test(process_command_line_set_observers_test),
+        cmocka_unit_test(
+            process_command_line_rejects_too_many_observers_test),
+        cmocka_unit_test(process_command_line_set_log_async_test),
         cmocka_unit_test(process_command_line_set_net_bind_device_test),
         cmocka_unit_test(process_command_line_set_i2c_test),
         cmocka_unit_test(process_command_line_log_level_test),
@@ -1756,13 +2220,22 @@ int main()
         cmocka_unit_test(send_out_msg_on_socket_no_authenticated_socket_test),
         cmocka_unit_test(send_out_msg_on_socket_send_failure_test),
         cmocka_unit_test(send_out_msg_on_socket_success_test),
+        cmocka_unit_test(queue_out_msg_params_test),
+        cmocka_unit_test(queue_out_msg_coalesces_until_flush_test),
+        cmocka_unit_test(queue_out_msg_seals_full_buffers_test),
+        cmocka_unit_test(send_observer_events_does_not_wait_for_observer_test),
+        cmocka_unit_test(
+            queue_out_msg_from_worker_sent_by_socket_thread_test),
 
         cmocka_unit_test(request_processing_loop_poll_failure_test),
         cmocka_unit_test(
             request_processing_loop_process_get_session_fds_failure_test),
         cmocka_unit_test(
             request_processing_loop_expect_process_new_client_test),
+        cmocka_unit_test(
+            request_processing_loop_timer_fd_runs_expired_timers_test),
         cmocka_unit_test(request_processing_loop_gpio_failure_test),
+        cmocka_unit_test(watch_fds_sync_only_touches_changes_test),
         cmocka_unit_test(process_new_client_invalid_params_test),
         cmocka_unit_test(process_new_client_accept_connection_failure_test),
         cmocka_unit_test(process_new_client_session_open_test),
@@ -1798,6 +2271,9 @@ int main()
         cmocka_unit_test(
             ensure_client_authenticated_connect_failure_memcpy_fail_test),
         cmocka_unit_test(ensure_client_authenticated_success_test),
+        cmocka_unit_test(ensure_client_authenticated_pending_test),
+        cmocka_unit_test(on_auth_result_success_test),
+        cmocka_unit_test(on_auth_result_failure_test),
         cmocka_unit_test(on_client_connect_invalid_params_test),
         cmocka_unit_test(on_client_connect_set_config_defaults_failure_test),
         cmocka_unit_test(on_client_connect_asd_msg_init_failure_test),
@@ -25,7 +25,9 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <security/pam_appl.h>
 #include <setjmp.h>
 #include <stdarg.h>
@@ -37,6 +39,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <sys/socket.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "../auth_pam.h"
 #include "../authenticate.h"
@@ -265,6 +269,56 @@ void expect_session_get_authenticated_conn(STATUS status)
     SESSION_GET_AUTHENTICATED_CONN_RESULT = status;
 }
 
+bool SESSION_OBSERVER_SLOT_AVAILABLE = false;
+bool __wrap_session_observer_slot_available(Session* state)
+{
+    (void)state;
+    return SESSION_OBSERVER_SLOT_AVAILABLE;
+}
+
+unsigned int PENDING_TICKET = 0;
+extnet_conn_t* PENDING_CONN = NULL;
+STATUS __wrap_session_set_auth_pending(Session* state, extnet_conn_t* p_extconn,
+                                       unsigned int n_ticket)
+{
+    (void)state;
+    PENDING_TICKET = n_ticket;
+    PENDING_CONN = p_extconn;
+    return ST_OK;
+}
+
+extnet_conn_t* __wrap_session_take_auth_pending(Session* state,
+                                                unsigned int n_ticket)
+{
+    (void)state;
+    if (n_ticket == 0 || n_ticket != PENDING_TICKET)
+        return NULL;
+    PENDING_TICKET = 0;
+    return PENDING_CONN;
+}
+
+STATUS AUTH_RESULT = ST_OK;
+extnet_conn_t* AUTH_RESULT_CONN = NULL;
+static void on_auth_result(Session* session, extnet_conn_t* pconn,
+                           STATUS result, void* ctx)
+{
+    (void)session;
+    (void)ctx;
+    AUTH_RESULT = result;
+    AUTH_RESULT_CONN = pconn;
+}
+
+// moves the clock of the lockout and the invalid attempts
+time_t TIME_OFFSET = 0;
+time_t __real_time(time_t* t);
+time_t __wrap_time(time_t* t)
+{
+    time_t t_now = __real_time(NULL) + TIME_OFFSET;
+    if (t)
+        *t = t_now;
+    return t_now;
+}
+
 int STRCPY_SAFE_RESULT = 0;
 int __wrap_strcpy_safe(char* dest, size_t destsize, const char* src,
                        size_t count)
@@ -479,6 +533,32 @@ void authpam_client_handshake_session_already_authenticated_test(void** state)
         ST_ERR, authpam_hdlrs.client_handshake(&session, &net_state, &extconn));
 }
 
+void authpam_client_handshake_observer_test(void** state)
+{
+    (void)state;
+    char* passphrase = "123abc";
+    char version_passphrase[265];
+    int dummy_pamh;
+    memset(&version_passphrase, 0, sizeof(version_passphrase));
+    version_passphrase[0] = AUTH_HDR_VERSION;
+    memcpy(&version_passphrase[1], passphrase, 6);
+    Session session;
+    ExtNet net_state;
+    extnet_conn_t extconn;
+    expect_RAND_bytes_success();
+    expect_extnet_recv_success(false, (char*)version_passphrase,
+                               strlen(version_passphrase));
+    expect_pam_start(true, (pam_handle_t*)&dummy_pamh);
+    expect_pam_authenticate(true);
+    expect_pam_end(true);
+    // a session controls the target and observers are allowed
+    SESSION_OBSERVER_SLOT_AVAILABLE = true;
+    expect_extnet_send(true, AUTH_HANDSHAKE_OBSERVER);
+    assert_int_equal(
+        ST_OK, authpam_hdlrs.client_handshake(&session, &net_state, &extconn));
+    SESSION_OBSERVER_SLOT_AVAILABLE = false;
+}
+
 void authpam_client_handshake_fail_to_send_result_test(void** state)
 {
     (void)state;
@@ -597,6 +677,132 @@ void authpam_client_handshake_locked_out_test(void** state)
         ST_ERR, authpam_hdlrs.client_handshake(&session, &net_state, &extconn));
 }
 
+// The client is still locked out by
+// authpam_client_handshake_locked_out_test, PAM is run anyway.
+void authpam_client_handshake_on_worker_test(void** state)
+{
+    (void)state;
+    int n_workers = 1;
+    char* passphrase = "123abc";
+    char version_passphrase[265];
+    memset(&version_passphrase, 0, sizeof(version_passphrase));
+    version_passphrase[0] = AUTH_HDR_VERSION;
+    memcpy(&version_passphrase[1], passphrase, 6);
+    Session session;
+    ExtNet net_state;
+    extnet_conn_t extconn;
+
+    assert_int_equal(-1, authpam_hdlrs.get_event_fd());
+    assert_int_equal(ST_OK, authpam_hdlrs.init(&n_workers));
+    struct pollfd pfd = {authpam_hdlrs.get_event_fd(), POLLIN, 0};
+    assert_true(pfd.fd >= 0);
+
+    expect_RAND_bytes_success();
+    expect_extnet_recv_success(false, (char*)version_passphrase,
+                               strlen(version_passphrase));
+    expect_authenticate(false, passphrase);
+    // the network thread returns before PAM has run
+    assert_int_equal(
+        ST_OK, authpam_hdlrs.client_handshake(&session, &net_state, &extconn));
+    assert_int_not_equal(0, PENDING_TICKET);
+    assert_ptr_equal(&extconn, PENDING_CONN);
+
+    assert_int_equal(1, poll(&pfd, 1, 5000));
+    AUTH_RESULT = ST_OK;
+    expect_extnet_send(true, AUTH_HANDSHAKE_FAILURE);
+    authpam_hdlrs.process_results(&session, &net_state, on_auth_result, NULL);
+    assert_int_equal(ST_ERR, AUTH_RESULT);
+    assert_ptr_equal(&extconn, AUTH_RESULT_CONN);
+    assert_int_equal(0, PENDING_TICKET);
+
+    authpam_hdlrs.deinit();
+    assert_int_equal(-1, authpam_hdlrs.get_event_fd());
+    assert_int_equal(-1, fcntl(pfd.fd, F_GETFD));
+}
+
+// Queues a handshake with a worker and returns once it is pending.
+static void submit_logon_attempt(extnet_conn_t* p_extconn, bool success)
+{
+    char* passphrase = "123abc";
+    char version_passphrase[265];
+    memset(&version_passphrase, 0, sizeof(version_passphrase));
+    version_passphrase[0] = AUTH_HDR_VERSION;
+    memcpy(&version_passphrase[1], passphrase, 6);
+    Session session;
+    ExtNet net_state;
+
+    expect_RAND_bytes_success();
+    expect_extnet_recv_success(false, (char*)version_passphrase,
+                               strlen(version_passphrase));
+    expect_authenticate(success, passphrase);
+    assert_int_equal(
+        ST_OK, authpam_hdlrs.client_handshake(&session, &net_state, p_extconn));
+    assert_ptr_equal(p_extconn, PENDING_CONN);
+}
+
+// Processes the worker results until the pending client is answered.
+static void wait_logon_result(void)
+{
+    struct pollfd pfd = {authpam_hdlrs.get_event_fd(), POLLIN, 0};
+    Session session;
+    ExtNet net_state;
+
+    AUTH_RESULT_CONN = NULL;
+    while (!AUTH_RESULT_CONN)
+    {
+        assert_int_equal(1, poll(&pfd, 1, 5000));
+        authpam_hdlrs.process_results(&session, &net_state, on_auth_result,
+                                      NULL);
+    }
+}
+
+// A client with attempts still on the workers is handled as locked out when
+// they may take it over the limit, its valid password is not checked.
+void authpam_client_handshake_attempts_in_flight_test(void** state)
+{
+    (void)state;
+    int n_workers = 1;
+    extnet_conn_t first;
+    extnet_conn_t second;
+
+    // past any lockout and invalid attempt of the tests before
+    TIME_OFFSET += INVALID_AUTH_LOCKOUT_NSECS + INVALID_AUTH_PERIOD_NSECS + 1;
+    for (int i = 1; i < INVALID_AUTH_MAX_ATTEMPTS; i++)
+        do_failed_logon_attempt();
+
+    assert_int_equal(ST_OK, authpam_hdlrs.init(&n_workers));
+    submit_logon_attempt(&first, false);
+    submit_logon_attempt(&second, true);
+
+    expect_extnet_send(true, AUTH_HANDSHAKE_FAILURE);
+    wait_logon_result();
+    assert_ptr_equal(&second, AUTH_RESULT_CONN);
+    assert_int_equal(ST_ERR, AUTH_RESULT);
+    authpam_hdlrs.deinit();
+}
+
+// A lockout started after the password was queued, which happens when the
+// results of the workers come in out of order with the attempts.
+void authpam_process_results_locked_out_meanwhile_test(void** state)
+{
+    (void)state;
+    int n_workers = 1;
+    extnet_conn_t extconn;
+
+    // authpam_client_handshake_attempts_in_flight_test left the client
+    // locked out, a valid password is queued after it ended
+    TIME_OFFSET += INVALID_AUTH_LOCKOUT_NSECS + INVALID_AUTH_PERIOD_NSECS + 1;
+    assert_int_equal(ST_OK, authpam_hdlrs.init(&n_workers));
+    submit_logon_attempt(&extconn, true);
+    TIME_OFFSET -= INVALID_AUTH_LOCKOUT_NSECS + INVALID_AUTH_PERIOD_NSECS + 1;
+
+    expect_extnet_send(true, AUTH_HANDSHAKE_FAILURE);
+    wait_logon_result();
+    assert_ptr_equal(&extconn, AUTH_RESULT_CONN);
+    assert_int_equal(ST_ERR, AUTH_RESULT);
+    authpam_hdlrs.deinit();
+}
+
 void pam_conversation_function_invalid_params_test(void** state)
 {
     (void)state;
@@ -746,6 +952,7 @@ int main()
         cmocka_unit_test(authpam_client_handshake_pam_end_failure_test),
         cmocka_unit_test(
             authpam_client_handshake_session_already_authenticated_test),
+        cmocka_unit_test(authpam_client_handshake_observer_test),
         cmocka_unit_test(authpam_client_handshake_fail_to_send_result_test),
         cmocka_unit_test(authpam_client_handshake_success_test),
         cmocka_unit_test(authpam_client_handshake_strip_null_test),
@@ -758,6 +965,9 @@ int main()
         cmocka_unit_test(
             pam_conversation_function_missing_message_echo_off_msg_test),
         cmocka_unit_test(pam_conversation_function_success_test),
+        cmocka_unit_test(authpam_client_handshake_on_worker_test),
+        cmocka_unit_test(authpam_client_handshake_attempts_in_flight_test),
+        cmocka_unit_test(authpam_process_results_locked_out_meanwhile_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -77,8 +77,41 @@ STATUS fake_auth_pam(Session* session, ExtNet* state, extnet_conn_t* p_extconn)
     return ST_OK;
 }
 
-auth_hdlrs_t authnone_hdlrs = {fake_authnone_init, fake_auth_none};
-auth_hdlrs_t authpam_hdlrs = {fake_authpam_init, fake_auth_pam};
+int fake_auth_get_event_fd(void)
+{
+    return 42;
+}
+
+bool fake_auth_process_results_was_called = false;
+void fake_auth_process_results(Session* session, ExtNet* state,
+                               auth_result_callback on_result, void* ctx)
+{
+    (void)session;
+    (void)state;
+    (void)on_result;
+    (void)ctx;
+    fake_auth_process_results_was_called = true;
+}
+
+bool fake_auth_deinit_was_called = false;
+void fake_auth_deinit(void)
+{
+    fake_auth_deinit_was_called = true;
+}
+
+void fake_on_result(Session* session, extnet_conn_t* p_extconn,
+                    STATUS result, void* ctx)
+{
+    (void)session;
+    (void)p_extconn;
+    (void)result;
+    (void)ctx;
+}
+
+auth_hdlrs_t authnone_hdlrs = {fake_authnone_init, fake_auth_none, NULL, NULL,
+                               NULL};
+auth_hdlrs_t authpam_hdlrs = {fake_authpam_init, fake_auth_pam, NULL, NULL,
+                              NULL};
 
 // static char temporary_log_buffer[512];
 void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
@@ -103,7 +136,12 @@ static int setup(void** state)
     authnone_hdlrs.client_handshake = fake_auth_none;
     authpam_hdlrs.init = fake_authnone_init;
     authpam_hdlrs.client_handshake = fake_auth_none;
+    authpam_hdlrs.get_event_fd = NULL;
+    authpam_hdlrs.process_results = NULL;
+    authpam_hdlrs.deinit = NULL;
     fake_authnone_init_was_called = false;
+    fake_auth_process_results_was_called = false;
+    fake_auth_deinit_was_called = false;
     fake_auth_none_was_called = false;
     return 0;
 }
@@ -156,6 +194,44 @@ void auth_client_handshake_calls_client_handshake_successfully_test(
     assert_true(fake_auth_none_was_called);
 }
 
+void auth_get_event_fd_without_handler_fd_test(void** state)
+{
+    (void)state;
+    assert_int_equal(ST_OK, auth_init(AUTH_HDLR_PAM, NULL));
+    assert_int_equal(-1, auth_get_event_fd());
+    auth_process_results(NULL, NULL, fake_on_result, NULL);
+    assert_false(fake_auth_process_results_was_called);
+}
+
+void auth_process_results_calls_process_results_successfully_test(
+    void** state)
+{
+    (void)state;
+    authpam_hdlrs.get_event_fd = fake_auth_get_event_fd;
+    authpam_hdlrs.process_results = fake_auth_process_results;
+    assert_int_equal(ST_OK, auth_init(AUTH_HDLR_PAM, NULL));
+    assert_int_equal(42, auth_get_event_fd());
+    auth_process_results(NULL, NULL, fake_on_result, NULL);
+    assert_true(fake_auth_process_results_was_called);
+}
+
+void auth_deinit_without_handler_deinit_test(void** state)
+{
+    (void)state;
+    assert_int_equal(ST_OK, auth_init(AUTH_HDLR_NONE, NULL));
+    auth_deinit();
+    assert_false(fake_auth_deinit_was_called);
+}
+
+void auth_deinit_calls_deinit_successfully_test(void** state)
+{
+    (void)state;
+    authpam_hdlrs.deinit = fake_auth_deinit;
+    assert_int_equal(ST_OK, auth_init(AUTH_HDLR_PAM, NULL));
+    auth_deinit();
+    assert_true(fake_auth_deinit_was_called);
+}
+
 int main()
 {
     const struct CMUnitTest tests[] = {
@@ -171,6 +247,15 @@ int main()
         cmocka_unit_test_setup_teardown(
             auth_client_handshake_calls_client_handshake_successfully_test,
             setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            auth_get_event_fd_without_handler_fd_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            auth_process_results_calls_process_results_successfully_test,
+            setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            auth_deinit_without_handler_deinit_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            auth_deinit_calls_deinit_successfully_test, setup, teardown),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
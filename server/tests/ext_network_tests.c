@@ -85,16 +85,22 @@ int fake_exttcp_send(extnet_conn_t* pconn, void* pv_buf, size_t sz_len)
     return FAKE_SEND_RESULT;
 }
 
+int FAKE_SEND_NOWAIT_RESULT = 0;
+int fake_exttcp_send_nowait(extnet_conn_t* pconn, void* pv_buf, size_t sz_len)
+{
+    return FAKE_SEND_NOWAIT_RESULT;
+}
+
 extnet_hdlrs_t tcp_hdlrs = {
     fake_exttcp_init,        fake_exttcp_on_accept, fake_exttcp_on_close_client,
     fake_exttcp_init_client, fake_exttcp_recv,      fake_exttcp_send,
-    fake_exttcp_cleanup,
+    fake_exttcp_send_nowait, fake_exttcp_cleanup,
 };
 
 extnet_hdlrs_t tls_hdlrs = {
     fake_exttcp_init,        fake_exttcp_on_accept, fake_exttcp_on_close_client,
     fake_exttcp_init_client, fake_exttcp_recv,      fake_exttcp_send,
-    fake_exttcp_cleanup,
+    fake_exttcp_send_nowait, fake_exttcp_cleanup,
 };
 
 // static char temporary_log_buffer[512];
@@ -532,6 +538,8 @@ void extnet_accept_connection_success_test(void** state)
     assert_int_equal(ST_OK,
                      extnet_accept_connection(&extnet, sockfd, &connection));
     assert_int_equal(connection.sockfd, sockfd);
+    assert_non_null(connection.rx);
+    free(connection.rx);
 }
 
 void extnet_init_client_invalid_params_test(void** state)
@@ -602,6 +610,7 @@ void extnet_close_client_failure_test(void** state)
     ExtNet extnet;
     extnet_conn_t connection;
     connection.sockfd = 9;
+    connection.rx = NULL;
     extnet.p_hdlrs = &tcp_hdlrs;
     extnet.p_hdlrs->on_close_client = fake_exttcp_on_close_client;
     ON_CLOSE_CLIENT_RESULT = ST_ERR;
@@ -616,6 +625,7 @@ void extnet_close_client_socket_close_failure_test(void** state)
     ExtNet extnet;
     extnet_conn_t connection;
     connection.sockfd = 9;
+    connection.rx = NULL;
     extnet.p_hdlrs = &tcp_hdlrs;
     extnet.p_hdlrs->on_close_client = fake_exttcp_on_close_client;
     ON_CLOSE_CLIENT_RESULT = ST_OK;
@@ -630,6 +640,7 @@ void extnet_close_client_success_test(void** state)
     ExtNet extnet;
     extnet_conn_t connection;
     connection.sockfd = 9;
+    connection.rx = NULL;
     extnet.p_hdlrs = &tcp_hdlrs;
     extnet.p_hdlrs->on_close_client = fake_exttcp_on_close_client;
     ON_CLOSE_CLIENT_RESULT = ST_OK;
@@ -694,12 +705,44 @@ void extnet_recv_success_test(void** state)
     char data[len];
     bool pending;
     int expected = 6;
+    connection.rx = NULL;
     extnet.p_hdlrs = &tcp_hdlrs;
     FAKE_RECV_RESULT = expected;
     assert_int_equal(expected,
                      extnet_recv(&extnet, &connection, &data, len, &pending));
 }
 
+void extnet_recv_serves_reads_from_buffer_test(void** state)
+{
+    (void)state;
+    ExtNet extnet;
+    extnet_conn_t connection;
+    extnet_rx_buffer rx;
+    char data[8];
+    bool pending = false;
+    connection.rx = &rx;
+    rx.head = 0;
+    rx.tail = 0;
+    rx.more = false;
+    extnet.p_hdlrs = &tcp_hdlrs;
+
+    // one handler read brings in two 4 byte headers and a partial third
+    FAKE_RECV_RESULT = 10;
+    memset(rx.data, 0, sizeof(rx.data));
+    assert_int_equal(4, extnet_recv(&extnet, &connection, &data, 4, &pending));
+    assert_true(pending);
+    FAKE_RECV_RESULT = -1;
+    assert_int_equal(4, extnet_recv(&extnet, &connection, &data, 4, &pending));
+    assert_true(pending);
+    // reads never go past what the handler returned
+    assert_int_equal(2, extnet_recv(&extnet, &connection, &data, 4, &pending));
+    assert_false(pending);
+    // then the handler is called again
+    assert_int_equal(-1,
+                     extnet_recv(&extnet, &connection, &data, 4, &pending));
+    assert_false(pending);
+}
+
 void extnet_send_invalid_params_test(void** state)
 {
     (void)state;
@@ -729,6 +772,37 @@ void extnet_send_success_test(void** state)
     assert_int_equal(expected, extnet_send(&extnet, &connection, &data, len));
 }
 
+void extnet_send_nowait_invalid_params_test(void** state)
+{
+    (void)state;
+    ExtNet extnet;
+    extnet_conn_t connection;
+    size_t len = 15;
+    char data[len];
+
+    assert_int_equal(-1, extnet_send_nowait(NULL, &connection, &data, len));
+    assert_int_equal(-1, extnet_send_nowait(&extnet, NULL, &data, len));
+    assert_int_equal(-1, extnet_send_nowait(&extnet, &connection, NULL, len));
+    extnet.p_hdlrs = NULL;
+    assert_int_equal(-1, extnet_send_nowait(&extnet, &connection, &data, len));
+    extnet.p_hdlrs = &tcp_hdlrs;
+}
+
+void extnet_send_nowait_success_test(void** state)
+{
+    (void)state;
+    ExtNet extnet;
+    extnet_conn_t connection;
+    size_t len = 15;
+    char data[len];
+    extnet.p_hdlrs = &tcp_hdlrs;
+    // the socket buffer is full
+    FAKE_SEND_NOWAIT_RESULT = 0;
+    assert_int_equal(0, extnet_send_nowait(&extnet, &connection, &data, len));
+    FAKE_SEND_NOWAIT_RESULT = 9;
+    assert_int_equal(9, extnet_send_nowait(&extnet, &connection, &data, len));
+}
+
 int main()
 {
     const struct CMUnitTest tests[] = {
@@ -765,8 +839,11 @@ int main()
         cmocka_unit_test(extnet_is_client_closed_success_test),
         cmocka_unit_test(extnet_recv_invalid_params_test),
         cmocka_unit_test(extnet_recv_success_test),
+        cmocka_unit_test(extnet_recv_serves_reads_from_buffer_test),
         cmocka_unit_test(extnet_send_invalid_params_test),
         cmocka_unit_test(extnet_send_success_test),
+        cmocka_unit_test(extnet_send_nowait_invalid_params_test),
+        cmocka_unit_test(extnet_send_nowait_success_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
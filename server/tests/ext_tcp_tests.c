@@ -25,6 +25,7 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <errno.h>
 #include <getopt.h>
 #include <setjmp.h>
 #include <stdarg.h>
@@ -67,12 +68,19 @@ ssize_t __wrap_recv(int socket, void* buffer, size_t length, int flags)
     return length;
 }
 
+// the peer stopped reading and the socket buffer is full
+bool SEND_WOULD_BLOCK = false;
 ssize_t __wrap_send(int socket, void* buffer, size_t length, int flags)
 {
     check_expected(socket);
     check_expected_ptr(buffer);
     check_expected(length);
     check_expected(flags);
+    if (SEND_WOULD_BLOCK)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
     return length;
 }
 
@@ -195,6 +203,37 @@ void exttcp_send_returns_calls_recv_test(void** state)
                      exttcp_send(&connection, &buffer, expected_length));
 }
 
+void exttcp_send_nowait_returns_error_on_invalid_socket_fd_test(void** state)
+{
+    (void)state;
+    extnet_conn_t connection;
+    connection.sockfd = -1;
+    char buffer[15];
+    assert_int_equal(-1, exttcp_send_nowait(NULL, &buffer, 1));
+    assert_int_equal(-1, exttcp_send_nowait(&connection, &buffer, 1));
+}
+
+void exttcp_send_nowait_does_not_block_test(void** state)
+{
+    (void)state;
+    int expected_socket = 12;
+    size_t expected_length = 1234;
+    extnet_conn_t connection;
+    connection.sockfd = expected_socket;
+    char buffer[15];
+    expect_value_count(__wrap_send, socket, expected_socket, 2);
+    expect_any_count(__wrap_send, buffer, 2);
+    expect_value_count(__wrap_send, length, expected_length, 2);
+    expect_value_count(__wrap_send, flags, MSG_DONTWAIT, 2);
+
+    assert_int_equal(expected_length,
+                     exttcp_send_nowait(&connection, &buffer, expected_length));
+    SEND_WOULD_BLOCK = true;
+    assert_int_equal(0,
+                     exttcp_send_nowait(&connection, &buffer, expected_length));
+    SEND_WOULD_BLOCK = false;
+}
+
 int main()
 {
     const struct CMUnitTest tests[] = {
@@ -214,7 +253,10 @@ int main()
         cmocka_unit_test(
             exttcp_send_returns_error_on_invalid_buffer_pointer_test),
         cmocka_unit_test(exttcp_send_returns_error_on_invalid_socket_fd_test),
-        cmocka_unit_test(exttcp_send_returns_calls_recv_test)};
+        cmocka_unit_test(exttcp_send_returns_calls_recv_test),
+        cmocka_unit_test(
+            exttcp_send_nowait_returns_error_on_invalid_socket_fd_test),
+        cmocka_unit_test(exttcp_send_nowait_does_not_block_test)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
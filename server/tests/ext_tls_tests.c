@@ -42,6 +42,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "../ext_network.h"
 #include "../ext_tls.h"
 #include "../logging.h"
+#include "asd_stats.h"
 #include "cmocka.h"
 
 // static char temporary_log_buffer[512];
@@ -142,7 +143,7 @@ void expect_SSL_CTX_set_options()
     expect_value(__wrap_SSL_CTX_set_options, op,
                  SSL_OP_NO_SSLv3 | SSL_OP_NO_SSLv2 | SSL_OP_NO_TLSv1 |
                      SSL_OP_NO_TLSv1_1 | SSL_OP_NO_COMPRESSION |
-                     SSL_OP_CIPHER_SERVER_PREFERENCE);
+                     SSL_OP_CIPHER_SERVER_PREFERENCE | ASD_SSL_OP_KTLS);
     SSL_CTX_SET_OPTIONS_RESULT = 0;
 }
 
@@ -162,7 +163,7 @@ void expect_SSL_CTX_set_cipher_list(bool success)
         SSL_CTX_SET_CIPHER_LIST_RESULT = 0;
     expect_any(__wrap_SSL_CTX_set_cipher_list, ctx);
     expect_string(__wrap_SSL_CTX_set_cipher_list, str,
-                  "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:!"
+                  "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:!"
                   "aNULL:!eNULL@STRENGTH");
 }
 
@@ -325,6 +326,12 @@ void expect_SSL_read(int result, int expected_size, int ssl_error,
 }
 
 int SSL_PENDING_RESULT = 0;
+int __wrap_SSL_has_pending(const SSL* s)
+{
+    (void)s;
+    return 0;
+}
+
 int __wrap_SSL_pending(const SSL* s)
 {
     check_expected_ptr(s);
@@ -406,6 +413,100 @@ int expect_SSL_accept(acceptFailType type)
     }
 }
 
+long __wrap_SSL_CTX_set_timeout(SSL_CTX* ctx, long t)
+{
+    (void)ctx;
+    return t;
+}
+
+// SSL_CTX_set1_curves_list and SSL_CTX_set_read_ahead
+long __wrap_SSL_CTX_ctrl(SSL_CTX* ctx, int cmd, long larg, void* parg)
+{
+    (void)ctx;
+    (void)cmd;
+    (void)larg;
+    (void)parg;
+    return 1;
+}
+
+int __wrap_SSL_CTX_set_num_tickets(SSL_CTX* ctx, size_t num_tickets)
+{
+    (void)ctx;
+    (void)num_tickets;
+    return 1;
+}
+
+typedef int (*ticket_key_cb_fn)(SSL*, unsigned char*, unsigned char*,
+                                EVP_CIPHER_CTX*, EVP_MAC_CTX*, int);
+ticket_key_cb_fn TICKET_KEY_CB = NULL;
+int __wrap_SSL_CTX_set_tlsext_ticket_key_evp_cb(SSL_CTX* ctx,
+                                                ticket_key_cb_fn fp)
+{
+    (void)ctx;
+    TICKET_KEY_CB = fp;
+    return 1;
+}
+
+int SSL_CTX_SET_CIPHERSUITES_CALLS = 0;
+int __wrap_SSL_CTX_set_ciphersuites(SSL_CTX* ctx, const char* str)
+{
+    (void)ctx;
+    assert_non_null(strstr(str, "CHACHA20"));
+    SSL_CTX_SET_CIPHERSUITES_CALLS++;
+    return 1;
+}
+
+int SSL_SESSION_REUSED_RESULT = 0;
+int __wrap_SSL_session_reused(const SSL* s)
+{
+    (void)s;
+    return SSL_SESSION_REUSED_RESULT;
+}
+
+const char* __wrap_SSL_get_version(const SSL* s)
+{
+    (void)s;
+    return "TLSv1.3";
+}
+
+const SSL_CIPHER* __wrap_SSL_get_current_cipher(const SSL* s)
+{
+    (void)s;
+    return NULL;
+}
+
+const char* __wrap_SSL_CIPHER_get_name(const SSL_CIPHER* c)
+{
+    (void)c;
+    return "TLS_AES_256_GCM_SHA384";
+}
+
+int FAKE_BIO;
+BIO* __wrap_SSL_get_wbio(const SSL* s)
+{
+    (void)s;
+    return (BIO*)&FAKE_BIO;
+}
+
+BIO* __wrap_SSL_get_rbio(const SSL* s)
+{
+    (void)s;
+    return (BIO*)&FAKE_BIO;
+}
+
+long BIO_CTRL_RESULT = 0;
+int BIO_CTRL_CALLS = 0;
+long __wrap_BIO_ctrl(BIO* bp, int cmd, long larg, void* parg)
+{
+    (void)bp;
+    (void)larg;
+    (void)parg;
+    assert_true(cmd == BIO_CTRL_GET_KTLS_SEND ||
+                cmd == BIO_CTRL_GET_KTLS_RECV);
+    BIO_CTRL_CALLS++;
+    return BIO_CTRL_RESULT;
+}
+
 X509* SSL_GET_PEER_CERTIFICATE_RESULT = NULL;
 X509* __wrap_SSL_get_peer_certificate(const SSL* s)
 {
@@ -614,6 +715,85 @@ void exttls_cleanup_success_test(void** state)
     exttls_cleanup();
 }
 
+void exttls_init_cheap_crypto_test(void** state)
+{
+    (void)state;
+    char* certfile = "some/cert_file.pem";
+    exttls_options options = {DEFAULT_TLS_TICKET_LIFETIME,
+                              DEFAULT_TLS_TICKET_KEY_ROTATION, true};
+    exttls_set_options(&options);
+    SSL_CTX_SET_CIPHERSUITES_CALLS = 0;
+    expect_SSL_load_error_strings();
+    expect_OpenSSL_add_ssl_algorithms();
+    expect_SSL_CTX_new(true);
+    expect_SSL_CTX_set_options();
+    // ChaCha20 goes first, the server preference keeps it there
+    SSL_CTX_SET_CIPHER_LIST_RESULT = 1;
+    expect_any(__wrap_SSL_CTX_set_cipher_list, ctx);
+    expect_string(__wrap_SSL_CTX_set_cipher_list, str,
+                  "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:"
+                  "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:!"
+                  "aNULL:!eNULL");
+    expect_SSL_CTX_use_certificate_file(true, certfile);
+    expect_SSL_CTX_use_PrivateKey_file(true, certfile);
+    expect_SSL_CTX_check_private_key(true);
+    assert_int_equal(ST_OK, exttls_init(certfile));
+    assert_int_equal(1, SSL_CTX_SET_CIPHERSUITES_CALLS);
+
+    options.cheap_crypto = false;
+    exttls_set_options(&options);
+    expect_cleanup();
+    exttls_cleanup();
+}
+
+static int run_ticket_key_cb(unsigned char* key_name, int enc)
+{
+    unsigned char iv[EVP_MAX_IV_LENGTH] = {0};
+    EVP_CIPHER_CTX* cipher_ctx = EVP_CIPHER_CTX_new();
+    EVP_MAC* mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    EVP_MAC_CTX* mac_ctx = EVP_MAC_CTX_new(mac);
+    int result = TICKET_KEY_CB(NULL, key_name, iv, cipher_ctx, mac_ctx, enc);
+
+    EVP_MAC_CTX_free(mac_ctx);
+    EVP_MAC_free(mac);
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    return result;
+}
+
+void exttls_session_ticket_keys_rotate_test(void** state)
+{
+    (void)state;
+    char* certfile = "some/cert_file.pem";
+    unsigned char first[TICKET_KEY_NAME_LEN];
+    unsigned char second[TICKET_KEY_NAME_LEN];
+    unsigned char unknown[TICKET_KEY_NAME_LEN] = {0};
+    exttls_options options = {DEFAULT_TLS_TICKET_LIFETIME,
+                              DEFAULT_TLS_TICKET_KEY_ROTATION, false};
+    exttls_set_options(&options);
+    TICKET_KEY_CB = NULL;
+    expect_exttls_init(certfile);
+    assert_int_equal(ST_OK, exttls_init(certfile));
+    assert_non_null(TICKET_KEY_CB);
+
+    assert_int_equal(1, run_ticket_key_cb(first, 1));
+    assert_int_equal(1, run_ticket_key_cb(first, 0));
+    // a ticket from another server or a past run takes a full handshake
+    assert_int_equal(0, run_ticket_key_cb(unknown, 0));
+
+    // with every ticket issued on a new key, the previous key still
+    // decrypts but asks for a renewed ticket
+    options.ticket_key_rotation = 0;
+    exttls_set_options(&options);
+    assert_int_equal(1, run_ticket_key_cb(second, 1));
+    assert_memory_not_equal(first, second, sizeof(first));
+    assert_int_equal(2, run_ticket_key_cb(first, 0));
+
+    options.ticket_key_rotation = DEFAULT_TLS_TICKET_KEY_ROTATION;
+    exttls_set_options(&options);
+    expect_cleanup();
+    exttls_cleanup();
+}
+
 void exttls_on_accept_invalid_params_test(void** state)
 {
     (void)state;
@@ -741,6 +921,48 @@ void exttls_on_accept_success_test(void** state)
     assert_int_equal(ST_OK, exttls_on_accept(&dummy_net_state, &conn));
 }
 
+void exttls_on_accept_ktls_active_test(void** state)
+{
+    (void)state;
+    int expected_fd = 77;
+    int dummy_net_state;
+    extnet_conn_t conn;
+    conn.sockfd = expected_fd;
+    expect_SSL_new(true);
+    expect_SSL_set_fd(true, expected_fd);
+    expect_setsockopt(true, expected_fd);
+    expect_SSL_accept(ACCEPT_FAIL_NONE);
+    expect_SSL_get_peer_certificate(true);
+    BIO_CTRL_RESULT = 1;
+    BIO_CTRL_CALLS = 0;
+    assert_int_equal(ST_OK, exttls_on_accept(&dummy_net_state, &conn));
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    assert_int_equal(2, BIO_CTRL_CALLS);
+#endif
+    BIO_CTRL_RESULT = 0;
+}
+
+void exttls_on_accept_resumed_handshake_test(void** state)
+{
+    (void)state;
+    int expected_fd = 77;
+    int dummy_net_state;
+    extnet_conn_t conn;
+    uint64_t full = asd_stats[ASD_Stage_TlsHandshake].count;
+    uint64_t resumed = asd_stats[ASD_Stage_TlsResume].count;
+    conn.sockfd = expected_fd;
+    expect_SSL_new(true);
+    expect_SSL_set_fd(true, expected_fd);
+    expect_setsockopt(true, expected_fd);
+    expect_SSL_accept(ACCEPT_FAIL_NONE);
+    expect_SSL_get_peer_certificate(false);
+    SSL_SESSION_REUSED_RESULT = 1;
+    assert_int_equal(ST_OK, exttls_on_accept(&dummy_net_state, &conn));
+    SSL_SESSION_REUSED_RESULT = 0;
+    assert_int_equal(full, asd_stats[ASD_Stage_TlsHandshake].count);
+    assert_int_equal(resumed + 1, asd_stats[ASD_Stage_TlsResume].count);
+}
+
 void exttls_init_client_invalid_params_test(void** state)
 {
     (void)state;
@@ -850,6 +1072,33 @@ void exttls_recv_success_test(void** state)
     free(buf);
 }
 
+void exttls_recv_takes_rest_of_record_test(void** state)
+{
+    (void)state;
+    char* expect_data = "blah";
+    extnet_conn_t conn;
+    size_t sz_len = 8;
+    int fake_ssl = 8;
+    void* buf = malloc(sz_len);
+    bool pending = true;
+    conn.sockfd = 1;
+    conn.p_hdlr_data = &fake_ssl;
+
+    // the first read stops short with decrypted bytes left, a second read
+    // takes them without waiting for the socket
+    expect_SSL_read(4, (int)sz_len, 0, expect_data, (int)strlen(expect_data));
+    expect_any(__wrap_SSL_pending, s);
+    expect_SSL_read(4, 4, 0, expect_data, (int)strlen(expect_data));
+    expect_any(__wrap_SSL_pending, s);
+    SSL_PENDING_RESULT = 4;
+    assert_int_equal(sz_len, exttls_recv(&conn, buf, sz_len, &pending));
+    assert_true(pending);
+    assert_memory_equal("blahblah", buf, sz_len);
+    SSL_PENDING_RESULT = 0;
+
+    free(buf);
+}
+
 void exttls_send_invalid_params_test(void** state)
 {
     (void)state;
@@ -922,6 +1171,8 @@ int main()
         cmocka_unit_test(exttls_init_SSL_CTX_check_private_key_failure_test),
         cmocka_unit_test(exttls_init_success_test),
         cmocka_unit_test(exttls_cleanup_success_test),
+        cmocka_unit_test(exttls_init_cheap_crypto_test),
+        cmocka_unit_test(exttls_session_ticket_keys_rotate_test),
         cmocka_unit_test(exttls_on_accept_invalid_params_test),
         cmocka_unit_test(exttls_on_accept_invalid_socket_test),
         cmocka_unit_test(exttls_on_accept_ssl_new_failure_test),
@@ -933,6 +1184,8 @@ int main()
         cmocka_unit_test(
             exttls_on_accept_SSL_get_peer_certificate_failure_test),
         cmocka_unit_test(exttls_on_accept_success_test),
+        cmocka_unit_test(exttls_on_accept_ktls_active_test),
+        cmocka_unit_test(exttls_on_accept_resumed_handshake_test),
         cmocka_unit_test(exttls_init_client_invalid_params_test),
         cmocka_unit_test(exttls_init_client_success_test),
         cmocka_unit_test(exttls_on_close_client_invalid_params_test),
@@ -940,6 +1193,7 @@ int main()
         cmocka_unit_test(exttls_recv_invalid_params_test),
         cmocka_unit_test(exttls_recv_errors_test),
         cmocka_unit_test(exttls_recv_success_test),
+        cmocka_unit_test(exttls_recv_takes_rest_of_record_test),
         cmocka_unit_test(exttls_send_invalid_params_test),
         cmocka_unit_test(exttls_send_errors_test),
         cmocka_unit_test(exttls_send_success_test),
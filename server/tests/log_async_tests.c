@@ -0,0 +1,212 @@
+/*
+Copyright (c) 2019, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../log_async.h"
+#include "../logging.h"
+#include "cmocka.h"
+
+#define LOG_THREADS 4
+#define LOGS_PER_THREAD 2000
+
+static char log_path[] = "/tmp/log_async_testXXXXXX";
+
+static int setup(void** state)
+{
+    int fd;
+    (void)state;
+    strcpy(log_path, "/tmp/log_async_testXXXXXX");
+    fd = mkstemp(log_path);
+    assert_true(fd != -1);
+    close(fd);
+    ASD_initialize_log_settings(ASD_LogLevel_Trace, ASD_LogStream_All, false,
+                                false, NULL, NULL);
+    return 0;
+}
+
+static int teardown(void** state)
+{
+    (void)state;
+    log_async_stop();
+    unlink(log_path);
+    return 0;
+}
+
+static char* read_log(void)
+{
+    FILE* file = fopen(log_path, "r");
+    char* text = (char*)calloc(1, 1 << 20);
+    assert_non_null(file);
+    assert_non_null(text);
+    fread(text, 1, (1 << 20) - 1, file);
+    fclose(file);
+    return text;
+}
+
+void log_async_start_bad_file_test(void** state)
+{
+    (void)state;
+    assert_int_equal(ST_ERR,
+                     log_async_start("/nonexistent/asd/asd.log", false));
+}
+
+void log_async_start_twice_test(void** state)
+{
+    (void)state;
+    assert_int_equal(ST_OK, log_async_start(log_path, false));
+    assert_int_equal(ST_ERR, log_async_start(log_path, false));
+}
+
+void log_async_writes_lines_in_order_test(void** state)
+{
+    const unsigned char data[] = {0x01, 0x23, 0x45, 0x67};
+    char expected[512];
+    size_t len = 0;
+    char* text;
+    (void)state;
+
+    assert_int_equal(ST_OK, log_async_start(log_path, false));
+    for (int i = 0; i < 10; i++)
+    {
+        ASD_log(ASD_LogLevel_Info, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "line %d of %s", i, "ten");
+        len += (size_t)snprintf(&expected[len], sizeof(expected) - len,
+                                "line %d of %s\n", i, "ten");
+    }
+    ASD_log_buffer(ASD_LogLevel_Info, ASD_LogStream_Daemon,
+                   ASD_LogOption_None, data, sizeof(data), "TDI");
+    snprintf(&expected[len], sizeof(expected) - len,
+             "TDI   : 0000000: 0123 4567 \n");
+    log_async_stop();
+
+    text = read_log();
+    assert_string_equal(expected, text);
+    assert_int_equal(0, log_async_dropped());
+    free(text);
+}
+
+void log_async_stop_logs_directly_again_test(void** state)
+{
+    char* text;
+    (void)state;
+
+    assert_int_equal(ST_OK, log_async_start(log_path, false));
+    log_async_stop();
+    // goes to stderr now, not to the file
+    ASD_log(ASD_LogLevel_Info, ASD_LogStream_Daemon, ASD_LogOption_None,
+            "after stop");
+    text = read_log();
+    assert_string_equal("", text);
+    free(text);
+}
+
+static void* log_thread(void* arg)
+{
+    int thread = (int)(intptr_t)arg;
+    for (int i = 0; i < LOGS_PER_THREAD; i++)
+        ASD_log(ASD_LogLevel_Info, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "thread %d message %d", thread, i);
+    return NULL;
+}
+
+void log_async_counts_dropped_messages_test(void** state)
+{
+    pthread_t threads[LOG_THREADS];
+    int last[LOG_THREADS];
+    uint64_t written = 0;
+    unsigned long long reported = 0;
+    char* text;
+    char* line;
+    char* save = NULL;
+    (void)state;
+
+    assert_int_equal(ST_OK, log_async_start(log_path, false));
+    for (int i = 0; i < LOG_THREADS; i++)
+    {
+        last[i] = -1;
+        assert_int_equal(0, pthread_create(&threads[i], NULL, log_thread,
+                                           (void*)(intptr_t)i));
+    }
+    for (int i = 0; i < LOG_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    log_async_stop();
+
+    // every message is either written, in order, or counted as dropped
+    text = read_log();
+    for (line = strtok_r(text, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save))
+    {
+        int thread;
+        int message;
+        unsigned long long dropped;
+        if (sscanf(line, "thread %d message %d", &thread, &message) == 2)
+        {
+            assert_in_range(thread, 0, LOG_THREADS - 1);
+            assert_true(message > last[thread]);
+            last[thread] = message;
+            written++;
+        }
+        else
+        {
+            assert_int_equal(1, sscanf(line, "%llu log messages dropped",
+                                       &dropped));
+            reported += dropped;
+        }
+    }
+    assert_int_equal(LOG_THREADS * LOGS_PER_THREAD,
+                     written + log_async_dropped());
+    assert_int_equal(reported, log_async_dropped());
+    free(text);
+}
+
+int main()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(log_async_start_bad_file_test, setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(log_async_start_twice_test, setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(log_async_writes_lines_in_order_test,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            log_async_stop_logs_directly_again_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            log_async_counts_dropped_messages_test, setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -58,6 +58,38 @@ static void sendRemoteLoggingMessage(ASD_LogLevel level, ASD_LogStream stream,
     memcpy(&remoteMessageCalledWithMessage, message, strlen(message) + 1);
 }
 
+bool shouldLogBinaryResponse = false;
+static bool shouldLogBinary(ASD_LogLevel level, ASD_LogStream stream)
+{
+    (void)level;
+    (void)stream;
+    return shouldLogBinaryResponse;
+}
+
+unsigned char logRecord[LOG_RECORD_LENGTH];
+size_t logRecordLength = 0;
+int logRecordCount = 0;
+static void sendLogRecord(ASD_LogLevel level, ASD_LogStream stream,
+                          const unsigned char* record, size_t len)
+{
+    (void)level;
+    (void)stream;
+    memcpy(logRecord, record, len);
+    logRecordLength = len;
+    logRecordCount++;
+}
+
+static size_t encode(unsigned char* record, size_t size, const char* format,
+                     ...)
+{
+    size_t len;
+    va_list args;
+    va_start(args, format);
+    len = ASD_log_encode_message(record, size, format, args);
+    va_end(args);
+    return len;
+}
+
 void __wrap_vsyslog(int priority, const char* format, ...)
 {
     check_expected(priority);
@@ -115,6 +147,10 @@ static int setup(void** state)
     remoteMessageCalledWithStream = ASD_LogStream_None;
     shouldRemoteLogResponse = false;
     shouldRemoteLogCalled = false;
+    shouldLogBinaryResponse = false;
+    logRecordLength = 0;
+    logRecordCount = 0;
+    ASD_set_binary_logging(NULL, NULL);
     return 0;
 }
 
@@ -128,7 +164,7 @@ void ASD_log_writes_to_syslog_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Error, ASD_LogStream_All, true,
-                                NULL, NULL);
+                                false, NULL, NULL);
     const char* expected = "some log message text";
     expect_value(__wrap_vsyslog, priority, LOG_USER);
     expect_string(__wrap_vsyslog, format, expected);
@@ -140,7 +176,7 @@ void ASD_log_writes_to_stderr_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Error, ASD_LogStream_All, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
     const char* expected = "some log message text";
     expect_value(__wrap_vfprintf, file, stderr);
     expect_string(__wrap_vfprintf, format, expected);
@@ -157,7 +193,8 @@ void ASD_log_writes_to_logging_callback_test(void** state)
            sizeof(remoteMessageCalledWithMessage));
     const char* expected = "some log message text";
     ASD_initialize_log_settings(ASD_LogLevel_Error, ASD_LogStream_JTAG, false,
-                                shouldRemoteLog, sendRemoteLoggingMessage);
+                                false, shouldRemoteLog,
+                                sendRemoteLoggingMessage);
     ASD_log(ASD_LogLevel_Trace, ASD_LogStream_JTAG, ASD_LogOption_None,
             expected);
     assert_true(shouldRemoteLogCalled);
@@ -197,7 +234,7 @@ void ASD_log_buffer_writes_to_syslog_with_undersize_prefix_test(void** state)
     expect_string(__wrap_syslog, temporary_syslog_buffer,
                   "TEST  : 0000000: 1020 30\n");
     ASD_initialize_log_settings(ASD_LogLevel_Warning, ASD_LogStream_Pins, true,
-                                NULL, NULL);
+                                false, NULL, NULL);
     ASD_log_buffer(ASD_LogLevel_Warning, ASD_LogStream_Pins, ASD_LogOption_None,
                    &buffer[0], length, prefix);
 }
@@ -213,7 +250,7 @@ void ASD_log_buffer_writes_to_syslog_with_max_prefix_test(void** state)
     expect_string(__wrap_syslog, temporary_syslog_buffer,
                   "TESTTE: 0000000: 1020 30\n");
     ASD_initialize_log_settings(ASD_LogLevel_Info, ASD_LogStream_I2C, true,
-                                NULL, NULL);
+                                false, NULL, NULL);
     ASD_log_buffer(ASD_LogLevel_Info, ASD_LogStream_I2C, ASD_LogOption_None,
                    &buffer[0], length, prefix);
 }
@@ -229,7 +266,7 @@ void ASD_log_buffer_writes_to_syslog_with_oversize_prefix_test(void** state)
     expect_string(__wrap_syslog, temporary_syslog_buffer,
                   "TESTTE: 0000000: 1020 30\n");
     ASD_initialize_log_settings(ASD_LogLevel_Debug, ASD_LogStream_Test, true,
-                                NULL, NULL);
+                                false, NULL, NULL);
     ASD_log_buffer(ASD_LogLevel_Debug, ASD_LogStream_Test, ASD_LogOption_None,
                    &buffer[0], length, prefix);
 }
@@ -245,7 +282,8 @@ void ASD_log_buffer_writes_to_logging_callback_test(void** state)
     size_t length = 3;
     const unsigned char buffer[] = {16, 32, 48};
     ASD_initialize_log_settings(ASD_LogLevel_Trace, ASD_LogStream_All, false,
-                                shouldRemoteLog, sendRemoteLoggingMessage);
+                                false, shouldRemoteLog,
+                                sendRemoteLoggingMessage);
     ASD_log_buffer(ASD_LogLevel_Trace, ASD_LogStream_JTAG, ASD_LogOption_None,
                    &buffer[0], length, prefix);
     assert_true(shouldRemoteLogCalled);
@@ -261,7 +299,8 @@ void ASD_log_buffer_doesnt_log_test(void** state)
     size_t length = 3;
     const unsigned char buffer[] = {16, 32, 48};
     ASD_initialize_log_settings(ASD_LogLevel_Off, ASD_LogStream_None, false,
-                                shouldRemoteLog, sendRemoteLoggingMessage);
+                                false, shouldRemoteLog,
+                                sendRemoteLoggingMessage);
     // test will have unmet expectations if test fails.
     ASD_log_buffer(ASD_LogLevel_Trace, ASD_LogStream_JTAG, ASD_LogOption_None,
                    &buffer[0], length, "TEST");
@@ -276,7 +315,7 @@ void ASD_log_buffer_writes_to_stderr_test(void** state)
     size_t length = 3;
     const unsigned char buffer[] = {16, 32, 48};
     ASD_initialize_log_settings(ASD_LogLevel_Trace, ASD_LogStream_JTAG, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
 
     // It seems that we cannot mock fprintf with cmocka.
     // Perhaps cmocka is using fprintf and so it fails to link the mock
@@ -289,7 +328,7 @@ void ASD_initialize_log_settings_IRDR_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Trace, ASD_LogStream_JTAG, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
     assert_int_equal(asd_log_level, ASD_LogLevel_Trace);
     assert_int_equal(asd_log_streams, ASD_LogStream_JTAG);
 }
@@ -298,7 +337,7 @@ void ASD_initialize_log_settings_all_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Debug, ASD_LogStream_All, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
     assert_int_equal(asd_log_level, ASD_LogLevel_Debug);
     assert_int_equal(asd_log_streams, ASD_LogStream_All);
 }
@@ -307,7 +346,7 @@ void ASD_log_shift_invalid_params_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Debug, ASD_LogStream_All, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
     unsigned char data[1024];
     memset(&data, ~0, sizeof(data));
     // these function calls should return without doing anything.
@@ -325,7 +364,7 @@ void ASD_log_shift_malloc_failure_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Debug, ASD_LogStream_All, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
     unsigned char data[1024];
     memset(&data, ~0, sizeof(data));
     expect_value(__wrap_malloc, size, (sizeof(data) * 2) + 1);
@@ -338,7 +377,7 @@ void ASD_log_shift_writes_correct_log_messages_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Trace, ASD_LogStream_All, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
     unsigned char data[1024];
     memset(&data, ~0, sizeof(data));
     const char* expected_format = "%s: [%db] 0x%s";
@@ -405,7 +444,8 @@ void ASD_log_shift_doesnt_log_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Off, ASD_LogStream_None, false,
-                                shouldRemoteLog, sendRemoteLoggingMessage);
+                                false, shouldRemoteLog,
+                                sendRemoteLoggingMessage);
     unsigned char data[1024];
     memset(&data, ~0, sizeof(data));
     ASD_log_shift(ASD_LogLevel_Error, ASD_LogStream_JTAG, ASD_LogOption_None,
@@ -416,7 +456,7 @@ void ASD_should_log_correctly_filters_messages_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Trace, ASD_LogStream_All, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
 
     const char* expected = "some log message text";
     expect_value(__wrap_vfprintf, file, stderr);
@@ -459,7 +499,7 @@ void ASD_should_log_honors_no_remote_option_test(void** state)
 {
     (void)state;
     ASD_initialize_log_settings(ASD_LogLevel_Error, ASD_LogStream_All, false,
-                                NULL, NULL);
+                                false, NULL, NULL);
     shouldRemoteLogResponse = true;
     const char* expected = "some log message text";
     ASD_log(ASD_LogLevel_Trace, ASD_LogStream_Test, ASD_LogOption_No_Remote,
@@ -467,6 +507,94 @@ void ASD_should_log_honors_no_remote_option_test(void** state)
     assert_false(shouldRemoteLogCalled);
 }
 
+void ASD_log_encode_message_test(void** state)
+{
+    (void)state;
+    unsigned char record[64];
+    const char* format = "%d %-4s %llx %c %5.*f %%";
+    uint32_t id = ASD_log_format_id(format);
+    size_t len = encode(record, sizeof(record), format, -2, "ab",
+                        0x1122334455ULL, 'z', 2, 0.5);
+    const unsigned char expected[] = {
+        LOG_RECORD_MESSAGE, id & 0xff, (id >> 8) & 0xff, (id >> 16) & 0xff,
+        id >> 24,
+        LOG_ARG_INT32,  0xfe, 0xff, 0xff, 0xff,
+        LOG_ARG_STRING, 2,    0,    'a',  'b',
+        LOG_ARG_INT64,  0x55, 0x44, 0x33, 0x22, 0x11, 0, 0, 0,
+        LOG_ARG_INT32,  'z',  0,    0,    0,
+        LOG_ARG_INT32,  2,    0,    0,    0,
+        LOG_ARG_DOUBLE, 0,    0,    0,    0,    0,    0, 0xe0, 0x3f};
+
+    assert_int_equal(sizeof(expected), len);
+    assert_memory_equal(expected, record, len);
+    // FNV-1a of the empty string
+    assert_int_equal(2166136261u, ASD_log_format_id(""));
+}
+
+void ASD_log_encode_message_truncates_test(void** state)
+{
+    (void)state;
+    unsigned char record[16];
+    size_t len = encode(record, sizeof(record), "%s %d",
+                        "a string longer than the record", 5);
+
+    // the string is cut, the number no longer fits
+    assert_int_equal(sizeof(record), len);
+    assert_int_equal(LOG_ARG_STRING, record[5]);
+    assert_int_equal(sizeof(record) - 8, record[6]);
+}
+
+void ASD_log_encode_data_shift_masks_last_byte_test(void** state)
+{
+    (void)state;
+    unsigned char record[16];
+    unsigned char data[] = {0xff, 0xff};
+    size_t len = ASD_log_encode_data(record, sizeof(record), LOG_RECORD_SHIFT,
+                                     "TDI", data, 12);
+    const unsigned char expected[] = {LOG_RECORD_SHIFT, 3, 'T', 'D', 'I',
+                                      12, 0, 0xff, 0x0f};
+
+    assert_int_equal(sizeof(expected), len);
+    assert_memory_equal(expected, record, len);
+    assert_int_equal(0, ASD_log_encode_data(record, sizeof(record), 0, "TDI",
+                                            data, 12));
+}
+
+void ASD_log_sends_binary_record_test(void** state)
+{
+    (void)state;
+    unsigned char data[1000];
+    shouldRemoteLogResponse = true;
+    shouldLogBinaryResponse = true;
+    memset(&remoteMessageCalledWithMessage[0], 0,
+           sizeof(remoteMessageCalledWithMessage));
+    ASD_initialize_log_settings(ASD_LogLevel_Off, ASD_LogStream_None,
+                                false, false, shouldRemoteLog,
+                                sendRemoteLoggingMessage);
+    ASD_set_binary_logging(shouldLogBinary, sendLogRecord);
+
+    ASD_log(ASD_LogLevel_Debug, ASD_LogStream_JTAG, ASD_LogOption_None,
+            "value %d", 3);
+    assert_int_equal(1, logRecordCount);
+    assert_int_equal(LOG_RECORD_MESSAGE, logRecord[0]);
+    assert_int_equal(10, logRecordLength);
+    // nothing went out as text
+    assert_string_equal("", remoteMessageCalledWithMessage);
+
+    // a long buffer is split over several records
+    memset(data, 0xa5, sizeof(data));
+    ASD_log_buffer(ASD_LogLevel_Debug, ASD_LogStream_JTAG, ASD_LogOption_None,
+                   data, sizeof(data), "[RX]");
+    assert_int_equal(3, logRecordCount);
+    assert_int_equal(LOG_RECORD_BUFFER, logRecord[0]);
+
+    ASD_log_shift(ASD_LogLevel_Debug, ASD_LogStream_JTAG, ASD_LogOption_None,
+                  10, sizeof(data), data, "TDO");
+    assert_int_equal(4, logRecordCount);
+    assert_int_equal(LOG_RECORD_SHIFT, logRecord[0]);
+    assert_string_equal("", remoteMessageCalledWithMessage);
+}
+
 void strtolevel_test(void** state)
 {
     (void)state;
@@ -582,6 +710,14 @@ int main()
             ASD_should_log_correctly_filters_messages_test, setup, teardown),
         cmocka_unit_test_setup_teardown(
             ASD_should_log_honors_no_remote_option_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(ASD_log_encode_message_test, setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(
+            ASD_log_encode_message_truncates_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            ASD_log_encode_data_shift_masks_last_byte_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(ASD_log_sends_binary_record_test,
+                                        setup, teardown),
         cmocka_unit_test_setup_teardown(strtolevel_test, setup, teardown),
         cmocka_unit_test_setup_teardown(strtostreams_test, setup, teardown),
         cmocka_unit_test_setup_teardown(streamtostring_test, setup, teardown),
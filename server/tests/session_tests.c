@@ -286,6 +286,8 @@ void session_close_already_closed_test(void** state)
     session.sessions[0].id = id;
     session.sessions[0].b_authenticated = true;
     session.sessions[0].t_auth_tout = 2;
+    timer_init(&session.sessions[0].auth_timer, NULL, NULL);
+    session.timers = NULL;
     extnet_conn_t connection;
     connection.sockfd = fd;
     expect_any(__wrap_extnet_is_client_closed, state);
@@ -310,6 +312,8 @@ void session_close_success_test(void** state)
     session.sessions[0].id = id;
     session.sessions[0].b_authenticated = true;
     session.sessions[0].t_auth_tout = 2;
+    timer_init(&session.sessions[0].auth_timer, NULL, NULL);
+    session.timers = NULL;
     extnet_conn_t connection;
     connection.sockfd = fd;
     expect_any(__wrap_extnet_is_client_closed, state);
@@ -409,6 +413,43 @@ void session_close_expired_unauth_closes_timed_out_connections_test(
     free(session);
 }
 
+void session_auth_timer_closes_unauthenticated_session_test(void** state)
+{
+    (void)state;
+    timer_queue timers;
+    extnet_conn_t connections[2];
+    Session* session = init_session_and_check_success();
+    assert_int_equal(ST_OK, timer_queue_init(&timers));
+    session_set_timer_queue(session, &timers);
+    EXTNET_IS_CLIENT_CLOSED_RESPONSE = false;
+    MEMCPY_SAFE_RESULT = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        connections[i].sockfd = i;
+        assert_int_equal(ST_OK, session_open(session, &connections[i]));
+        assert_true(timer_pending(&session->sessions[i].auth_timer));
+    }
+
+    // authenticating stops the expiry
+    assert_int_equal(ST_OK, session_auth_complete(session, &connections[0]));
+    assert_false(timer_pending(&session->sessions[0].auth_timer));
+    assert_int_equal(1, timers.count);
+
+    // due right away instead of in SESSION_AUTH_EXPIRE_TIMEOUT
+    timer_schedule(&timers, &session->sessions[1].auth_timer, 1);
+    expect_any_count(__wrap_extnet_is_client_closed, state, 2);
+    expect_any_count(__wrap_extnet_is_client_closed, pconn, 2);
+    expect_any(__wrap_extnet_close_client, state);
+    expect_any(__wrap_extnet_close_client, pconn);
+    timer_queue_expire(&timers);
+
+    assert_int_equal(0, session->sessions[1].t_auth_tout);
+    assert_true(session->sessions[0].b_authenticated);
+    assert_int_equal(0, timers.count);
+    timer_queue_deinit(&timers);
+    free(session);
+}
+
 void session_already_authenticated_invalid_params_test(void** state)
 {
     (void)state;
@@ -490,6 +531,7 @@ void session_auth_complete_another_session_already_authenticated_test(
     connection.sockfd = 6;
     session.b_initialized = true;
     session.n_authenticated_id = 66; // not 6
+    session.n_max_observers = 0;
     assert_int_equal(ST_ERR, session_auth_complete(&session, &connection));
 }
 
@@ -514,12 +556,112 @@ void session_auth_complete_success_test(void** state)
     session.b_initialized = true;
     session.n_authenticated_id = UNUSED_SOCKET_FD;
     session.sessions[0].extconn.sockfd = fd;
+    timer_init(&session.sessions[0].auth_timer, NULL, NULL);
+    session.timers = NULL;
     assert_int_equal(ST_OK, session_auth_complete(&session, &connection));
 
     assert_int_equal(session.n_authenticated_id, session.sessions[0].id);
     assert_true(session.sessions[0].b_authenticated);
 }
 
+void session_set_max_observers_test(void** state)
+{
+    (void)state;
+    Session* session = init_session_and_check_success();
+    assert_int_equal(DEFAULT_MAX_OBSERVERS, session->n_max_observers);
+    assert_int_equal(ST_ERR, session_set_max_observers(NULL, 1));
+    assert_int_equal(ST_ERR, session_set_max_observers(session, -1));
+    assert_int_equal(ST_ERR,
+                     session_set_max_observers(session, MAX_OBSERVERS + 1));
+    assert_int_equal(ST_OK, session_set_max_observers(session, MAX_OBSERVERS));
+    assert_int_equal(MAX_OBSERVERS, session->n_max_observers);
+    free(session);
+}
+
+void session_auth_complete_observer_test(void** state)
+{
+    (void)state;
+    extnet_conn_t connections[3];
+    extnet_conn_t* observers[MAX_OBSERVERS];
+    Session* session = init_session_and_check_success();
+    EXTNET_IS_CLIENT_CLOSED_RESPONSE = false;
+    MEMCPY_SAFE_RESULT = 0;
+    assert_int_equal(ST_OK, session_set_max_observers(session, 1));
+    for (int i = 0; i < 3; i++)
+    {
+        connections[i].sockfd = i + 10;
+        assert_int_equal(ST_OK, session_open(session, &connections[i]));
+    }
+
+    // nobody to observe yet
+    assert_false(session_observer_slot_available(session));
+    assert_int_equal(ST_OK, session_auth_complete(session, &connections[0]));
+    assert_false(session_is_observer(session, &connections[0]));
+
+    assert_true(session_observer_slot_available(session));
+    assert_int_equal(ST_OK, session_auth_complete(session, &connections[1]));
+    assert_true(session_is_observer(session, &connections[1]));
+    assert_true(session->sessions[1].b_authenticated);
+    assert_int_equal(0, session->n_authenticated_id);
+
+    // the only observer slot is taken
+    assert_false(session_observer_slot_available(session));
+    assert_int_equal(ST_ERR, session_auth_complete(session, &connections[2]));
+    assert_false(session_is_observer(session, &connections[2]));
+
+    // only the observer session is checked for a closed client
+    expect_any(__wrap_extnet_is_client_closed, state);
+    expect_any(__wrap_extnet_is_client_closed, pconn);
+    assert_int_equal(1, session_get_observer_conns(session, observers));
+    assert_ptr_equal(&session->sessions[1].extconn, observers[0]);
+
+    // a closed observer frees its slot, the controller stays
+    expect_any(__wrap_extnet_is_client_closed, state);
+    expect_any(__wrap_extnet_is_client_closed, pconn);
+    expect_any(__wrap_extnet_close_client, state);
+    expect_any(__wrap_extnet_close_client, pconn);
+    assert_int_equal(ST_OK, session_close(session, &connections[1]));
+    assert_false(session->sessions[1].b_observer);
+    assert_int_equal(0, session->n_authenticated_id);
+    assert_true(session_observer_slot_available(session));
+    free(session);
+}
+
+void session_auth_pending_test(void** state)
+{
+    (void)state;
+    extnet_conn_t connections[2];
+    Session* session = init_session_and_check_success();
+    EXTNET_IS_CLIENT_CLOSED_RESPONSE = false;
+    for (int i = 0; i < 2; i++)
+    {
+        connections[i].sockfd = i + 10;
+        assert_int_equal(ST_OK, session_open(session, &connections[i]));
+    }
+
+    assert_int_equal(ST_ERR,
+                     session_set_auth_pending(session, &connections[0], 0));
+    assert_int_equal(ST_OK,
+                     session_set_auth_pending(session, &connections[0], 7));
+    assert_int_equal(ST_OK,
+                     session_set_auth_pending(session, &connections[1], 8));
+    assert_true(session_auth_pending(session, &connections[0]));
+
+    assert_ptr_equal(&session->sessions[0].extconn,
+                     session_take_auth_pending(session, 7));
+    assert_false(session_auth_pending(session, &connections[0]));
+    assert_null(session_take_auth_pending(session, 7));
+
+    // the result of a closed session has nobody to go to
+    expect_any(__wrap_extnet_is_client_closed, state);
+    expect_any(__wrap_extnet_is_client_closed, pconn);
+    expect_any(__wrap_extnet_close_client, state);
+    expect_any(__wrap_extnet_close_client, pconn);
+    assert_int_equal(ST_OK, session_close(session, &connections[1]));
+    assert_null(session_take_auth_pending(session, 8));
+    free(session);
+}
+
 void session_get_authenticated_conn_invalid_params_test(void** state)
 {
     (void)state;
@@ -587,8 +729,9 @@ void session_getfds_success_test(void** state)
     {
         session.sessions[i].id = i;
         session.sessions[i].extconn.sockfd = i;
-        session.sessions[0].t_auth_tout = 0;
-        session.sessions[1].t_auth_tout = time(0L) - 10000;
+        // an expired authentication no longer shortens the timeout
+        session.sessions[i].t_auth_tout = 1;
+        session.sessions[i].b_data_pending = false;
 
         expect_any(__wrap_extnet_is_client_closed, state);
         expect_any(__wrap_extnet_is_client_closed, pconn);
@@ -598,7 +741,16 @@ void session_getfds_success_test(void** state)
     assert_int_equal(ST_OK,
                      session_getfds(&session, &session_fds, &count, &timeout));
     assert_int_equal(MAX_SESSIONS, count);
-    assert_int_equal(MAX_SESSIONS, count);
+    assert_int_equal(-1, timeout);
+
+    session.sessions[1].b_data_pending = true;
+    for (int i = 0; i < MAX_SESSIONS; i++)
+    {
+        expect_any(__wrap_extnet_is_client_closed, state);
+        expect_any(__wrap_extnet_is_client_closed, pconn);
+    }
+    assert_int_equal(ST_OK,
+                     session_getfds(&session, &session_fds, &count, &timeout));
     assert_int_equal(0, timeout);
 }
 
@@ -748,6 +900,8 @@ int main()
         cmocka_unit_test(session_close_expired_unauth_invalid_params_test),
         cmocka_unit_test(
             session_close_expired_unauth_closes_timed_out_connections_test),
+        cmocka_unit_test(
+            session_auth_timer_closes_unauthenticated_session_test),
         cmocka_unit_test(session_already_authenticated_invalid_params_test),
         cmocka_unit_test(session_already_authenticated_invalid_session_test),
         cmocka_unit_test(session_already_authenticated_success_test),
@@ -756,6 +910,9 @@ int main()
             session_auth_complete_another_session_already_authenticated_test),
         cmocka_unit_test(session_auth_complete_session_not_found_test),
         cmocka_unit_test(session_auth_complete_success_test),
+        cmocka_unit_test(session_set_max_observers_test),
+        cmocka_unit_test(session_auth_complete_observer_test),
+        cmocka_unit_test(session_auth_pending_test),
         cmocka_unit_test(session_get_authenticated_conn_invalid_params_test),
         cmocka_unit_test(session_get_authenticated_conn_success_test),
         cmocka_unit_test(session_get_authenticated_conn_memcpy_fail_test),
@@ -0,0 +1,217 @@
+/*
+Copyright (c) 2019, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+
+#include "../logging.h"
+#include "../timer_queue.h"
+#include "cmocka.h"
+
+static int fired[MAX_TIMERS];
+static int fired_count;
+
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)format;
+}
+
+static void record_callback(asd_timer* timer, void* ctx)
+{
+    (void)timer;
+    fired[fired_count++] = *(int*)ctx;
+}
+
+static int setup(void** state)
+{
+    static timer_queue queue;
+    fired_count = 0;
+    assert_int_equal(ST_OK, timer_queue_init(&queue));
+    *state = &queue;
+    return 0;
+}
+
+static int teardown(void** state)
+{
+    timer_queue_deinit((timer_queue*)*state);
+    return 0;
+}
+
+void timer_queue_init_invalid_params_test(void** state)
+{
+    (void)state;
+    assert_int_equal(ST_ERR, timer_queue_init(NULL));
+    timer_queue_deinit(NULL); // simply does not crash
+}
+
+void timer_schedule_invalid_params_test(void** state)
+{
+    asd_timer timer;
+    timer_init(&timer, record_callback, NULL);
+    assert_int_equal(ST_ERR, timer_schedule(NULL, &timer, 1));
+    assert_int_equal(ST_ERR, timer_schedule(*state, NULL, 1));
+    assert_false(timer_pending(&timer));
+}
+
+void timer_schedule_arms_earliest_deadline_test(void** state)
+{
+    timer_queue* queue = *state;
+    asd_timer timers[3];
+    int ids[3] = {0, 1, 2};
+    uint64_t now = timer_now_ms();
+    struct itimerspec spec;
+
+    for (int i = 0; i < 3; i++)
+        timer_init(&timers[i], record_callback, &ids[i]);
+    assert_int_equal(ST_OK, timer_schedule(queue, &timers[0], now + 30000));
+    assert_int_equal(ST_OK, timer_schedule(queue, &timers[1], now + 10000));
+    assert_int_equal(ST_OK, timer_schedule(queue, &timers[2], now + 20000));
+
+    assert_int_equal(3, queue->count);
+    assert_ptr_equal(&timers[1], queue->heap[0]);
+    assert_int_equal(now + 10000, queue->armed_ms);
+    assert_int_equal(0, timerfd_gettime(queue->fd, &spec));
+    assert_true(spec.it_value.tv_sec > 0);
+
+    // moving the earliest one back rearms for the next one
+    assert_int_equal(ST_OK, timer_schedule(queue, &timers[1], now + 40000));
+    assert_int_equal(3, queue->count);
+    assert_ptr_equal(&timers[2], queue->heap[0]);
+    assert_int_equal(now + 20000, queue->armed_ms);
+
+    timer_cancel(queue, &timers[2]);
+    assert_false(timer_pending(&timers[2]));
+    assert_int_equal(now + 30000, queue->armed_ms);
+
+    timer_cancel(queue, &timers[0]);
+    timer_cancel(queue, &timers[1]);
+    assert_int_equal(0, queue->count);
+    assert_int_equal(0, queue->armed_ms);
+    assert_int_equal(0, timerfd_gettime(queue->fd, &spec));
+    assert_int_equal(0, spec.it_value.tv_sec);
+    assert_int_equal(0, spec.it_value.tv_nsec);
+}
+
+void timer_schedule_full_queue_test(void** state)
+{
+    timer_queue* queue = *state;
+    asd_timer timers[MAX_TIMERS + 1];
+    uint64_t now = timer_now_ms();
+
+    for (int i = 0; i < MAX_TIMERS; i++)
+    {
+        timer_init(&timers[i], record_callback, NULL);
+        assert_int_equal(ST_OK, timer_schedule(queue, &timers[i], now + 1000));
+    }
+    timer_init(&timers[MAX_TIMERS], record_callback, NULL);
+    assert_int_equal(ST_ERR,
+                     timer_schedule(queue, &timers[MAX_TIMERS], now + 1000));
+    assert_false(timer_pending(&timers[MAX_TIMERS]));
+
+    // the timers live on this stack frame, unqueue them before returning
+    for (int i = 0; i < MAX_TIMERS; i++)
+        timer_cancel(queue, &timers[i]);
+}
+
+void timer_queue_expire_runs_due_timers_in_order_test(void** state)
+{
+    timer_queue* queue = *state;
+    asd_timer timers[4];
+    int ids[4] = {0, 1, 2, 3};
+    uint64_t now = timer_now_ms();
+
+    for (int i = 0; i < 4; i++)
+        timer_init(&timers[i], record_callback, &ids[i]);
+    timer_schedule(queue, &timers[0], now - 10);
+    timer_schedule(queue, &timers[1], now + 60000);
+    timer_schedule(queue, &timers[2], now - 30);
+    timer_schedule(queue, &timers[3], now - 20);
+
+    timer_queue_expire(queue);
+
+    assert_int_equal(3, fired_count);
+    assert_int_equal(2, fired[0]);
+    assert_int_equal(3, fired[1]);
+    assert_int_equal(0, fired[2]);
+    assert_false(timer_pending(&timers[0]));
+    assert_true(timer_pending(&timers[1]));
+    assert_int_equal(1, queue->count);
+    assert_int_equal(now + 60000, queue->armed_ms);
+    timer_cancel(queue, &timers[1]);
+}
+
+static void reschedule_callback(asd_timer* timer, void* ctx)
+{
+    timer_queue* queue = ctx;
+    fired_count++;
+    timer_schedule(queue, timer, timer_now_ms() + 60000);
+}
+
+void timer_queue_expire_callback_can_reschedule_test(void** state)
+{
+    timer_queue* queue = *state;
+    asd_timer timer;
+
+    timer_init(&timer, reschedule_callback, queue);
+    timer_schedule(queue, &timer, 1);
+    timer_queue_expire(queue);
+
+    assert_int_equal(1, fired_count);
+    assert_true(timer_pending(&timer));
+    assert_true(timer.deadline_ms > timer_now_ms());
+    assert_int_equal(timer.deadline_ms, queue->armed_ms);
+    timer_cancel(queue, &timer);
+}
+
+int main()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(timer_queue_init_invalid_params_test),
+        cmocka_unit_test_setup_teardown(timer_schedule_invalid_params_test,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            timer_schedule_arms_earliest_deadline_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(timer_schedule_full_queue_test, setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(
+            timer_queue_expire_runs_due_timers_in_order_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            timer_queue_expire_callback_can_reschedule_test, setup,
+            teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,250 @@
+/*
+Copyright (c) 2019, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file timer_queue.c
+ * @brief Deadlines of the request loop behind a single timerfd
+ *
+ * The loop waits on the timerfd with everything else, so a deadline costs
+ * no wake-up until it is due. Deadlines are on CLOCK_MONOTONIC and do not
+ * move with the wall clock. The timerfd is only reprogrammed when the
+ * earliest deadline changes; callers that push a deadline back on every
+ * event should rather check on expiry and reschedule.
+ */
+#include "timer_queue.h"
+
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+uint64_t timer_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/** @brief Create the timerfd
+ *
+ *  @return ST_OK if successful, ST_ERR otherwise.
+ */
+STATUS timer_queue_init(timer_queue* queue)
+{
+    if (queue == NULL)
+        return ST_ERR;
+
+    queue->count = 0;
+    queue->armed_ms = 0;
+    queue->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (queue->fd == -1)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Could not create the timer fd: %d", errno);
+        return ST_ERR;
+    }
+    return ST_OK;
+}
+
+void timer_queue_deinit(timer_queue* queue)
+{
+    if (queue == NULL || queue->fd == -1)
+        return;
+    for (int i = 0; i < queue->count; i++)
+        queue->heap[i]->index = TIMER_NOT_QUEUED;
+    queue->count = 0;
+    close(queue->fd);
+    queue->fd = -1;
+}
+
+void timer_init(asd_timer* timer, asd_timer_callback callback, void* ctx)
+{
+    timer->deadline_ms = 0;
+    timer->index = TIMER_NOT_QUEUED;
+    timer->callback = callback;
+    timer->ctx = ctx;
+}
+
+bool timer_pending(const asd_timer* timer)
+{
+    return timer != NULL && timer->index != TIMER_NOT_QUEUED;
+}
+
+static void heap_place(timer_queue* queue, asd_timer* timer, int index)
+{
+    queue->heap[index] = timer;
+    timer->index = index;
+}
+
+static void heap_up(timer_queue* queue, int index)
+{
+    asd_timer* timer = queue->heap[index];
+
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (queue->heap[parent]->deadline_ms <= timer->deadline_ms)
+            break;
+        heap_place(queue, queue->heap[parent], index);
+        index = parent;
+    }
+    heap_place(queue, timer, index);
+}
+
+static void heap_down(timer_queue* queue, int index)
+{
+    asd_timer* timer = queue->heap[index];
+
+    while (1)
+    {
+        int child = 2 * index + 1;
+        if (child >= queue->count)
+            break;
+        if (child + 1 < queue->count &&
+            queue->heap[child + 1]->deadline_ms <
+                queue->heap[child]->deadline_ms)
+            child++;
+        if (timer->deadline_ms <= queue->heap[child]->deadline_ms)
+            break;
+        heap_place(queue, queue->heap[child], index);
+        index = child;
+    }
+    heap_place(queue, timer, index);
+}
+
+static void heap_remove(timer_queue* queue, asd_timer* timer)
+{
+    int index = timer->index;
+    asd_timer* last = queue->heap[--queue->count];
+
+    timer->index = TIMER_NOT_QUEUED;
+    if (last == timer)
+        return;
+    heap_place(queue, last, index);
+    heap_up(queue, index);
+    heap_down(queue, last->index);
+}
+
+//
+// Program the timerfd for the earliest deadline, when it changed.
+//
+static void timer_queue_arm(timer_queue* queue)
+{
+    struct itimerspec spec = {{0, 0}, {0, 0}};
+    uint64_t deadline = queue->count ? queue->heap[0]->deadline_ms : 0;
+
+    if (deadline == queue->armed_ms)
+        return;
+    if (deadline)
+    {
+        spec.it_value.tv_sec = (time_t)(deadline / 1000);
+        spec.it_value.tv_nsec = (long)(deadline % 1000) * 1000000;
+    }
+    if (timerfd_settime(queue->fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Could not arm the timer fd: %d", errno);
+        return;
+    }
+    queue->armed_ms = deadline;
+}
+
+/** @brief Run the timer's callback at deadline_ms (from timer_now_ms)
+ *
+ *  A timer already pending is moved to the new deadline.
+ *
+ *  @return ST_ERR if every timer slot is in use, ST_OK otherwise.
+ */
+STATUS timer_schedule(timer_queue* queue, asd_timer* timer,
+                      uint64_t deadline_ms)
+{
+    if (queue == NULL || timer == NULL)
+        return ST_ERR;
+
+    // 0 means disarmed to the timerfd
+    if (deadline_ms == 0)
+        deadline_ms = 1;
+    if (timer_pending(timer))
+    {
+        timer->deadline_ms = deadline_ms;
+        heap_up(queue, timer->index);
+        heap_down(queue, timer->index);
+    }
+    else
+    {
+        if (queue->count >= MAX_TIMERS)
+            return ST_ERR;
+        timer->deadline_ms = deadline_ms;
+        heap_place(queue, timer, queue->count++);
+        heap_up(queue, timer->index);
+    }
+    timer_queue_arm(queue);
+    return ST_OK;
+}
+
+void timer_cancel(timer_queue* queue, asd_timer* timer)
+{
+    if (queue == NULL || !timer_pending(timer))
+        return;
+    heap_remove(queue, timer);
+    timer_queue_arm(queue);
+}
+
+/** @brief Run the callbacks of every timer that is due
+ *
+ *  Called when the timerfd is readable. Callbacks may schedule or cancel
+ *  timers, including their own.
+ */
+void timer_queue_expire(timer_queue* queue)
+{
+    uint64_t expirations;
+    uint64_t now;
+
+    if (queue == NULL)
+        return;
+
+    // clears the readable state, it may fail when nothing expired yet
+    if (read(queue->fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "Could not read the timer fd: %d", errno);
+    }
+    queue->armed_ms = 0;
+
+    now = timer_now_ms();
+    while (queue->count && queue->heap[0]->deadline_ms <= now)
+    {
+        asd_timer* timer = queue->heap[0];
+        heap_remove(queue, timer);
+        if (timer->callback)
+            timer->callback(timer, timer->ctx);
+    }
+    timer_queue_arm(queue);
+}
@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2019, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file timer_queue.h
+ * @brief Deadlines of the request loop behind a single timerfd
+ */
+
+#ifndef __TIMER_QUEUE_H
+#define __TIMER_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asd_common.h"
+
+/** Idle warning and disconnect, plus one authentication expiry per session */
+#define MAX_TIMERS 8
+#define TIMER_NOT_QUEUED (-1)
+
+struct asd_timer;
+typedef void (*asd_timer_callback)(struct asd_timer* timer, void* ctx);
+
+/** A deadline on CLOCK_MONOTONIC, owned by the caller */
+typedef struct asd_timer
+{
+    uint64_t deadline_ms;
+    int index; // position in the heap, TIMER_NOT_QUEUED when idle
+    asd_timer_callback callback;
+    void* ctx;
+} asd_timer;
+
+/** Min-heap of the pending timers, the earliest one arms the timerfd */
+typedef struct timer_queue
+{
+    int fd;
+    asd_timer* heap[MAX_TIMERS];
+    int count;
+    uint64_t armed_ms; // deadline the timerfd is set to, 0 when disarmed
+} timer_queue;
+
+extern uint64_t timer_now_ms(void);
+extern STATUS timer_queue_init(timer_queue* queue);
+extern void timer_queue_deinit(timer_queue* queue);
+extern void timer_init(asd_timer* timer, asd_timer_callback callback,
+                       void* ctx);
+extern STATUS timer_schedule(timer_queue* queue, asd_timer* timer,
+                             uint64_t deadline_ms);
+extern void timer_cancel(timer_queue* queue, asd_timer* timer);
+extern bool timer_pending(const asd_timer* timer);
+extern void timer_queue_expire(timer_queue* queue);
+
+#endif
@@ -33,10 +33,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/file.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "asd_server_interface.h"
+#include "asd_stats.h"
 #include "../server/asd_main.h"
 
 ASD_MSG msg_state;
@@ -47,12 +51,15 @@ uint8_t spp_bulk_response_ibi_count = 0;
 
 static void get_scan_length(unsigned char cmd, uint8_t* num_of_bits,
                             uint8_t* num_of_bytes);
-STATUS process_jtag_message(struct asd_message* s_message);
 STATUS process_spp_message(struct asd_message* s_message);
 void process_message(void);
+static STATUS on_msg_recv(struct asd_message* msg);
+static STATUS dispatch_msg(struct asd_message* msg);
+static void process_received_message(struct asd_message* msg);
 void send_remote_log_message(ASD_LogLevel, ASD_LogStream, const char* message);
 bool should_remote_log(ASD_LogLevel, ASD_LogStream);
 STATUS write_cfg(writeCfg cmd, struct packet_data* packet);
+static STATUS write_cfg_operands(writeCfg cmd, const unsigned char* data);
 STATUS asd_write_set_active_chain_event(uint8_t scan_chain);
 bus_config_type bus_type(uint8_t bus);
 STATUS do_bus_select_command(struct packet_data* packet);
@@ -178,6 +185,300 @@ STATUS dev_flock(uint8_t bus, int op)
     return status;
 }
 
+// Set on the thread that holds hw_lock, hw_unlock() is a no-op elsewhere.
+static __thread bool hw_held = false;
+
+// A wait on the worker that lasts this long is logged and everything
+// queued is flushed once more.
+#ifndef WORKER_STALL_WARN_S
+#define WORKER_STALL_WARN_S 5
+#endif
+
+static inline bool pipeline_running(void)
+{
+    return __atomic_load_n(&msg_state.pipeline.running, __ATOMIC_SEQ_CST);
+}
+
+// Every field the waiters look at is written and read sequentially
+// consistent, so that a thread parking and one waking it up can never both
+// miss each other's update.
+#define PIPELINE_LOAD(field) __atomic_load_n(&(field), __ATOMIC_SEQ_CST)
+#define PIPELINE_STORE(field, value)                                           \
+    __atomic_store_n(&(field), (value), __ATOMIC_SEQ_CST)
+
+static bool slot_free(const msg_pipeline* pipeline)
+{
+    return PIPELINE_LOAD(pipeline->head) - PIPELINE_LOAD(pipeline->tail) <
+           NUM_IN_FLIGHT_BUFFERS_TO_USE;
+}
+
+static bool hw_free(const msg_pipeline* pipeline)
+{
+    return !PIPELINE_LOAD(pipeline->hw_busy);
+}
+
+static bool worker_exited(const msg_pipeline* pipeline)
+{
+    return PIPELINE_LOAD(pipeline->exited);
+}
+
+static bool work_ready(const msg_pipeline* pipeline)
+{
+    return !pipeline_running() ||
+           (PIPELINE_LOAD(pipeline->head) != PIPELINE_LOAD(pipeline->tail) &&
+            hw_free(pipeline));
+}
+
+static bool hw_try_acquire(msg_pipeline* pipeline)
+{
+    bool busy = false;
+
+    return __atomic_compare_exchange_n(&pipeline->hw_busy, &busy, true, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Parks the calling thread until ready() holds, the worker queues output
+// (when queued_out is given) or the deadline passes (when given). Returns
+// false on timeout.
+static bool pipeline_park(msg_pipeline* pipeline,
+                          bool (*ready)(const msg_pipeline*),
+                          const unsigned int* queued_out,
+                          const struct timespec* deadline)
+{
+    bool woken = true;
+
+    __atomic_add_fetch(&pipeline->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&pipeline->lock);
+    while (!ready(pipeline) &&
+           (!queued_out || PIPELINE_LOAD(pipeline->queued_out) == *queued_out))
+    {
+        if (!deadline)
+        {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        else if (pthread_cond_timedwait(&pipeline->changed, &pipeline->lock,
+                                        deadline) == ETIMEDOUT)
+        {
+            woken = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    __atomic_sub_fetch(&pipeline->waiters, 1, __ATOMIC_SEQ_CST);
+    return woken;
+}
+
+// Called after moving any of the fields the waiters look at.
+static void pipeline_wake(msg_pipeline* pipeline)
+{
+    if (PIPELINE_LOAD(pipeline->waiters) == 0)
+        return;
+    pthread_mutex_lock(&pipeline->lock);
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void* msg_pipeline_worker(void* arg)
+{
+    msg_pipeline* pipeline = (msg_pipeline*)arg;
+
+    while (pipeline_running())
+    {
+        unsigned int tail = pipeline->tail;
+
+        if (PIPELINE_LOAD(pipeline->head) == tail ||
+            !hw_try_acquire(pipeline))
+        {
+            pipeline_park(pipeline, work_ready, NULL, NULL);
+            continue;
+        }
+        // the socket thread does not touch the slot before tail moves
+        struct asd_message* msg =
+            &pipeline->ring[tail % NUM_IN_FLIGHT_BUFFERS_TO_USE];
+
+        hw_held = true;
+        STATUS result = on_msg_recv(msg);
+        hw_held = false;
+        if (result == ST_ERR)
+        {
+            // reported to the socket thread on its next asd_msg_read so
+            // that the connection is torn down the same way as before
+            PIPELINE_STORE(pipeline->worker_status, ST_ERR);
+        }
+
+        PIPELINE_STORE(pipeline->hw_busy, false);
+        PIPELINE_STORE(pipeline->tail, tail + 1);
+        pipeline_wake(pipeline);
+        if (PIPELINE_LOAD(pipeline->head) == tail + 1)
+        {
+            // Nothing else in flight: hand the queued responses to the
+            // socket thread now rather than when the output buffer fills up.
+            asd_api_server_ioctl(NULL, NULL, IOCTL_SERVER_FLUSH_MSGS);
+        }
+    }
+    PIPELINE_STORE(pipeline->exited, true);
+    pipeline_wake(pipeline);
+    return NULL;
+}
+
+// Blocks the socket thread until ready() holds. The worker stalls when the
+// socket thread has not sent its earlier responses yet, possibly while it
+// is busy with the hardware, so what is queued is flushed before the wait
+// and again each time the worker queues more.
+static void worker_wait(msg_pipeline* pipeline,
+                        bool (*ready)(const msg_pipeline*))
+{
+    struct timespec deadline;
+
+    while (!ready(pipeline))
+    {
+        unsigned int queued_out = PIPELINE_LOAD(pipeline->queued_out);
+
+        asd_api_server_ioctl(NULL, NULL, IOCTL_SERVER_FLUSH_MSGS);
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += WORKER_STALL_WARN_S;
+        if (!pipeline_park(pipeline, ready, &queued_out, &deadline))
+        {
+            ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+                    ASD_LogOption_No_Remote,
+                    "Still waiting on the message worker");
+        }
+    }
+}
+
+// Wakes the socket thread if it waits on the worker, so that it sends what
+// was just queued.
+static void pipeline_output_queued(void)
+{
+    msg_pipeline* pipeline = &msg_state.pipeline;
+
+    __atomic_add_fetch(&pipeline->queued_out, 1, __ATOMIC_SEQ_CST);
+    pipeline_wake(pipeline);
+}
+
+STATUS msg_pipeline_start(void)
+{
+    msg_pipeline* pipeline = &msg_state.pipeline;
+    pthread_condattr_t attr;
+    sigset_t block;
+    sigset_t previous;
+    int created;
+
+    pipeline->head = 0;
+    pipeline->tail = 0;
+    pipeline->waiters = 0;
+    pipeline->hw_busy = false;
+    pipeline->queued_out = 0;
+    pipeline->exited = false;
+    pipeline->worker_status = ST_OK;
+    if (pthread_condattr_init(&attr) != 0)
+        return ST_ERR;
+    // the stall deadline must not move with the wall clock
+    if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+        pthread_cond_init(&pipeline->changed, &attr) != 0)
+    {
+        pthread_condattr_destroy(&attr);
+        return ST_ERR;
+    }
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&pipeline->lock, NULL);
+    PIPELINE_STORE(pipeline->running, true);
+    // The worker inherits a mask without SIGUSR1 so that the signal lands on
+    // the socket thread and wakes its event loop.
+    sigemptyset(&block);
+    sigaddset(&block, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &block, &previous);
+    created = pthread_create(&pipeline->worker, NULL, msg_pipeline_worker,
+                             pipeline);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (created != 0)
+    {
+        PIPELINE_STORE(pipeline->running, false);
+        pthread_mutex_destroy(&pipeline->lock);
+        pthread_cond_destroy(&pipeline->changed);
+        return ST_ERR;
+    }
+    return ST_OK;
+}
+
+void msg_pipeline_stop(void)
+{
+    msg_pipeline* pipeline = &msg_state.pipeline;
+
+    if (!pipeline_running())
+        return;
+
+    // Anything still queued belongs to the client that is going away, so
+    // the worker drops it instead of driving it to the target.
+    PIPELINE_STORE(pipeline->running, false);
+    pipeline_wake(pipeline);
+    worker_wait(pipeline, worker_exited);
+    pthread_join(pipeline->worker, NULL);
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->changed);
+}
+
+STATUS msg_pipeline_push(struct asd_message* msg)
+{
+    msg_pipeline* pipeline = &msg_state.pipeline;
+    int size = get_message_size(msg);
+    unsigned int head = pipeline->head;
+
+    if (size < 0)
+        return ST_ERR;
+
+    // Back-pressure: the client is told how many messages it may have in
+    // flight, so this only blocks when it ignores that limit.
+    worker_wait(pipeline, slot_free);
+
+    // the worker does not look at the slot before head moves past it
+    struct asd_message* slot =
+        &pipeline->ring[head % NUM_IN_FLIGHT_BUFFERS_TO_USE];
+    if (memcpy_s(&slot->header, sizeof(struct message_header), &msg->header,
+                 sizeof(struct message_header)) ||
+        (size > 0 &&
+         memcpy_s(slot->buffer, MAX_DATA_SIZE, msg->buffer, (size_t)size)))
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon, ASD_LogOption_None,
+                "memcpy_s: message to pipeline slot copy failed.");
+        return ST_ERR;
+    }
+
+    PIPELINE_STORE(pipeline->head, head + 1);
+    pipeline_wake(pipeline);
+    return ST_OK;
+}
+
+static inline void hw_lock(void)
+{
+    msg_pipeline* pipeline = &msg_state.pipeline;
+
+    if (!pipeline_running())
+        return;
+    while (!hw_try_acquire(pipeline))
+        worker_wait(pipeline, hw_free);
+    hw_held = true;
+}
+
+static inline void hw_unlock(void)
+{
+    msg_pipeline* pipeline = &msg_state.pipeline;
+
+    if (!hw_held)
+        return;
+    hw_held = false;
+    PIPELINE_STORE(pipeline->hw_busy, false);
+    pipeline_wake(pipeline);
+}
+
+// Called by the read state machine once a whole message is in in_msg.
+static STATUS on_msg_complete(void)
+{
+    if (pipeline_running())
+        return msg_pipeline_push(&msg_state.in_msg.msg);
+    return asd_msg_on_msg_recv();
+}
+
 STATUS asd_msg_init(config* asd_cfg)
 {
     if (asd_cfg == NULL)
@@ -192,6 +493,7 @@ STATUS asd_msg_init(config* asd_cfg)
     else
     {
         msg_state.jtag_handler = JTAGHandler();
+        msg_state.jtag_multi = NULL;
         msg_state.target_handler = TargetHandler();
         msg_state.buscfg = &asd_cfg->buscfg;
         msg_state.i2c_handler = I2CHandler(msg_state.buscfg);
@@ -215,8 +517,29 @@ STATUS asd_msg_init(config* asd_cfg)
             msg_state.in_msg.read_index = 0;
             msg_state.prdy_timeout = 0;
             msg_state.jtag_chain_mode = JTAG_CHAIN_SELECT_MODE_SINGLE;
+            msg_state.ext_scan.pending = false;
             instance = &msg_state;
             read_openbmc_version();
+            if (asd_cfg->jtag.simulate)
+                JTAG_set_backend(msg_state.jtag_handler,
+                                 JTAG_Backend_Simulator,
+                                 asd_cfg->jtag.sim_chain);
+            if (asd_cfg->jtag.trace_file)
+            {
+                // a trace that can't be created never keeps the daemon
+                // from running, it is just not recorded
+                msg_state.jtag_handler->trace = JTAG_trace_open(
+                    asd_cfg->jtag.trace_file, JTAG_TRACE_DEFAULT_SIZE);
+            }
+#if defined(PIPELINE_MSG_PROCESSING) && !defined(UNIT_TEST_MAIN)
+            if (msg_pipeline_start() != ST_OK)
+            {
+                ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+                        ASD_LogOption_None,
+                        "Failed to start message worker, processing "
+                        "messages inline");
+            }
+#endif
         }
     }
     asd_poll_timeout_ms = 0;
@@ -251,6 +574,10 @@ STATUS asd_msg_free(void)
 
     if (instance)
     {
+        msg_pipeline_stop();
+        // controller 0 runs on the JTAG handler, stop it first
+        JTAG_multi_destroy(msg_state.jtag_multi);
+        msg_state.jtag_multi = NULL;
         if (msg_state.jtag_handler)
         {
             jtag_result = JTAG_deinitialize(msg_state.jtag_handler);
@@ -260,6 +587,7 @@ STATUS asd_msg_free(void)
                         ASD_LogOption_None,
                         "Failed to de-initialize the JTAG handler");
             }
+            JTAG_trace_close(msg_state.jtag_handler->trace);
             free(msg_state.jtag_handler);
             msg_state.jtag_handler = NULL;
         }
@@ -361,10 +689,43 @@ static uint8_t get_supported_jtag_chains(void)
 }
 
 STATUS asd_msg_on_msg_recv(void)
+{
+    return on_msg_recv(&msg_state.in_msg.msg);
+}
+
+//
+// Handle one message, accounting the time it took to the stage of its type.
+//
+static STATUS on_msg_recv(struct asd_message* msg)
+{
+    uint64_t start = ASD_stats_now();
+    uint8_t type = msg->header.type;
+    STATUS result = dispatch_msg(msg);
+
+    switch (type)
+    {
+        case AGENT_CONTROL_TYPE:
+            ASD_stats_record(ASD_Stage_DecodeAgent, start);
+            break;
+        case JTAG_TYPE:
+            ASD_stats_record(ASD_Stage_DecodeJtag, start);
+            break;
+        case I2C_TYPE:
+            ASD_stats_record(ASD_Stage_DecodeI2c, start);
+            break;
+        case SPP_TYPE:
+            ASD_stats_record(ASD_Stage_DecodeSpp, start);
+            break;
+        default:
+            break;
+    }
+    return result;
+}
+
+static STATUS dispatch_msg(struct asd_message* msg)
 {
     STATUS result = ST_OK;
 
-    struct asd_message* msg = &msg_state.in_msg.msg;
     struct asd_message* msg_out = &msg_state.out_msg;
 
     int data_size = get_message_size(msg);
@@ -589,6 +950,10 @@ STATUS asd_msg_on_msg_recv(void)
                     // only have it implemented with one
                     // stream, we wont do much with this
                     // stored stream.
+                    // A client setting the binary bit gets log records
+                    // instead of text. Older servers keep the bit clear
+                    // in the log events they send, which is how the
+                    // client learns whether it was honored.
                     u_int8_t* logging = get_packet_data(&packet, 1);
                     if (!logging)
                         break;
@@ -614,9 +979,11 @@ STATUS asd_msg_on_msg_recv(void)
                     ASD_log(
                         ASD_LogLevel_Debug, ASD_LogStream_SDK,
                         ASD_LogOption_No_Remote,
-                        "Remote logging command received. Stream: %d Level: %d",
+                        "Remote logging command received. Stream: %d Level: "
+                        "%d Binary: %d",
                         msg_state.asd_cfg->remote_logging.logging_stream,
-                        msg_state.asd_cfg->remote_logging.logging_level);
+                        msg_state.asd_cfg->remote_logging.logging_level,
+                        msg_state.asd_cfg->remote_logging.binary);
 #endif
                 }
                 else if (*config_type == AGENT_CONFIG_TYPE_GPIO)
@@ -726,6 +1093,21 @@ STATUS asd_msg_on_msg_recv(void)
                 // valid delays will be from 1 to 255. (1ms to 255ms)
                 usleep(delay*1000);
                 break;
+            case LATENCY_STATS_CMD:
+            {
+                int stats_size = ASD_stats_encode(
+                    msg->buffer, data_size, &msg_state.out_msg.buffer[1],
+                    MAX_DATA_SIZE - 1);
+                if (stats_size < 0)
+                {
+                    msg_state.out_msg.header.cmd_stat = ASD_UNKNOWN_ERROR;
+                    break;
+                }
+                msg_state.out_msg.header.size_lsb = (stats_size + 1) & 0xFF;
+                msg_state.out_msg.header.size_msb =
+                    ((stats_size + 1) >> 8) & 0x1F;
+                break;
+            }
             default:
             {
 #ifdef ENABLE_DEBUG_LOGGING
@@ -834,7 +1216,7 @@ STATUS asd_msg_on_msg_recv(void)
                 return result;
             }
         }
-        process_message();
+        process_received_message(msg);
     }
     return result;
 }
@@ -921,7 +1303,7 @@ void send_remote_log_message(ASD_LogLevel asd_level, ASD_LogStream asd_stream,
         msg.header.size_lsb = lsb_from_msg_size(buffer_length);
         msg.header.size_msb = msb_from_msg_size(buffer_length);
         msg.header.cmd_stat = ASD_SUCCESS;
-        if (send_response(&msg) != ST_OK)
+        if (send_event(&msg) != ST_OK)
         {
             ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_No_Remote,
                 "Failed to send remote message to client");
@@ -929,9 +1311,58 @@ void send_remote_log_message(ASD_LogLevel asd_level, ASD_LogStream asd_stream,
     }
 }
 
+// A binary log record, see logging.h. The config byte has the binary bit
+// set so the client tells it from a text message.
+void send_remote_log_record(ASD_LogLevel asd_level, ASD_LogStream asd_stream,
+                            const unsigned char* record, size_t len)
+{
+    if (!instance || !record || len == 0)
+        return;
+
+    if (should_remote_log(asd_level, asd_stream))
+    {
+        remote_logging_config config_byte = {{0}};
+        config_byte.logging_level =
+            instance->asd_cfg->ipc_asd_log_map[asd_level];
+        config_byte.logging_stream =
+            instance->asd_cfg->remote_logging.logging_stream;
+        config_byte.binary = 1;
+        struct asd_message msg = {{0}};
+
+        // records are smaller than a message, never cut one
+        if (len > (MAX_DATA_SIZE - 2))
+            return;
+        u_int32_t buffer_length = (u_int32_t)len + 2;
+
+        msg.header.type = HARDWARE_LOG_EVENT;
+        msg.buffer[0] = AGENT_CONFIGURATION_CMD;
+        msg.buffer[1] = config_byte.value;
+        if (memcpy_s(&msg.buffer[2], sizeof(msg.buffer) - 2, record, len))
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                    ASD_LogOption_No_Remote,
+                    "memcpy_s: log record to msg buffer[2] copy failed.");
+            return;
+        }
+        msg.header.size_lsb = lsb_from_msg_size(buffer_length);
+        msg.header.size_msb = msb_from_msg_size(buffer_length);
+        msg.header.cmd_stat = ASD_SUCCESS;
+        if (send_event(&msg) != ST_OK)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                    ASD_LogOption_No_Remote,
+                    "Failed to send remote log record to client");
+        }
+    }
+}
+
 void process_message()
 {
-    struct asd_message* msg = &msg_state.in_msg.msg;
+    process_received_message(&msg_state.in_msg.msg);
+}
+
+static void process_received_message(struct asd_message* msg)
+{
     if (((msg->header.type != JTAG_TYPE) && (msg->header.type != I2C_TYPE) &&
         (msg->header.type != SPP_TYPE) ) ||
         (msg->header.cmd_stat != 0 && msg->header.cmd_stat != 0x80 &&
@@ -1065,493 +1496,1062 @@ STATUS read_status(const ReadType index, uint8_t pin,
     return status;
 }
 
-STATUS process_jtag_message(struct asd_message* s_message)
+// Multi-chain mode with chains selected: JTAG commands go to every selected
+// controller instead of the interpreter's own handler.
+static bool multi_chain_active(void)
 {
-    u_int32_t response_cnt = 0;
-    enum jtag_states end_state;
-    STATUS status = ST_OK;
-    int size = get_message_size(s_message);
-    struct packet_data packet;
-    unsigned char* data_ptr;
-    uint8_t cmd = 0;
+    return msg_state.jtag_chain_mode == JTAG_CHAIN_SELECT_MODE_MULTI &&
+           JTAG_multi_selected_count(msg_state.jtag_multi) > 0;
+}
 
-    if (size == -1)
+static STATUS set_padding(JTAGPaddingTypes padding, unsigned int value)
+{
+    if (multi_chain_active())
+        return JTAG_multi_set_padding(msg_state.jtag_multi, padding, value);
+    return JTAG_set_padding(msg_state.jtag_handler, padding, value);
+}
+
+static STATUS op_write_event_config(jtag_interp* interp, uint8_t cmd,
+                                    unsigned char* operands)
+{
+    STATUS status = write_event_config(operands[0]);
+    if (status != ST_OK)
     {
         ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                "Failed to process jtag message because "
-                "get message size failed.");
-        return ST_ERR;
+                "write_event_config failed, %d", status);
     }
+    return status;
+}
 
-    explicit_bzero(&msg_state.out_msg.header, sizeof(struct message_header));
-    explicit_bzero(&msg_state.out_msg.buffer, MAX_DATA_SIZE);
+static STATUS op_write_cfg(jtag_interp* interp, uint8_t cmd,
+                           unsigned char* operands)
+{
+    STATUS status = write_cfg_operands((writeCfg)cmd, operands);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "write_cfg failed, %d", status);
+    }
+    return status;
+}
 
+static STATUS select_multichain(jtag_interp* interp, uint8_t index)
+{
+    unsigned char* data_ptr;
+    uint8_t chain_bytes_length = (index & SCAN_CHAIN_SELECT_MASK) + 1;
+    uint8_t chain_bytes[MAX_MULTICHAINS];
+    explicit_bzero(chain_bytes, sizeof(chain_bytes));
+    // e.g.: chain_bytes_length = 1
+    // chain_bytes[0] = b'11111111 = Chain
+    // 0-7 are selected chain_bytes[1] =
+    // b'00000011 = Chain 8 (bit 0) and 9
+    // (bit 1) are selected Notes: support
+    // up to 16 chain_bytes = 128 jtag
+    // chains
+    data_ptr = get_packet_data(&interp->packet, chain_bytes_length);
+    if (data_ptr == NULL)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Failed to read data for chain_bytes");
+        return ST_ERR;
+    }
+    for (int i = 0; i < chain_bytes_length; i++)
+        chain_bytes[i] = data_ptr[i];
+    if (msg_state.jtag_multi == NULL)
+    {
+        msg_state.jtag_multi = JTAG_multi_create(
+            msg_state.jtag_handler,
+            msg_state.asd_cfg->jtag.simulate ? JTAG_Backend_Simulator
+                                             : JTAG_Backend_Driver,
+            msg_state.asd_cfg->jtag.sim_chain);
+        if (msg_state.jtag_multi == NULL)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                    "Failed to create the multi-chain JTAG controllers");
+            return ST_ERR;
+        }
+    }
+    if (JTAG_multi_select(msg_state.jtag_multi, chain_bytes,
+                          chain_bytes_length,
+                          msg_state.asd_cfg->jtag.mode ==
+                              JTAG_DRIVER_MODE_SOFTWARE) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Failed to select the JTAG chains");
+        return ST_ERR;
+    }
+    // e.g. < Chain 21 > Received chain
+    // bytes_length: Chain: 0x20 0000
+    char line[MAX_MULTICHAINS * CHARS_PER_CHAIN];
+    uint8_t pos = 0;
+    explicit_bzero(line, sizeof(line));
+    for (int i = chain_bytes_length - 1; i >= 0; i--)
+    {
+        size_t remaining_size = sizeof(line) - pos;
+        snprintf(&line[pos], remaining_size, "%02X", chain_bytes[i]);
+        pos = pos + 2;
+        if (i % 2 == 0 && i != 0)
+        {
+            remaining_size = sizeof(line) - pos;
+            snprintf(&line[pos], remaining_size, " ");
+            pos++;
+        }
+    }
 #ifdef ENABLE_DEBUG_LOGGING
-    ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Network, ASD_LogOption_No_Remote,
-            "NetReq tag: %d size: %d", s_message->header.tag, size);
-    ASD_log_buffer(ASD_LogLevel_Debug, ASD_LogStream_Network,
-                   ASD_LogOption_No_Remote, s_message->buffer, (size_t)size,
-                   "NetReq");
+    ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
+            "Chain : 0x%s", line);
 #endif
+    return ST_OK;
+}
 
-    packet.next_data = s_message->buffer;
-    packet.used = 0;
-    packet.total = (unsigned int)size;
+static STATUS op_write_pins(jtag_interp* interp, uint8_t cmd,
+                            unsigned char* operands)
+{
+    STATUS status = ST_OK;
+    uint8_t data = operands[0];
+    bool assert = (data >> 7) == 1;
+    uint8_t index = data & WRITE_PIN_MASK;
 
-    while (packet.used < packet.total)
+    if (index < PIN_MAX)
     {
-        data_ptr = get_packet_data(&packet, 1);
-        if (data_ptr == NULL)
+        Pin pin = (Pin)index;
+        status = target_write(msg_state.target_handler, pin, assert);
+        if (status != ST_OK)
         {
             ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Failed to read data for cmd, short packet");
-            status = ST_ERR;
-            break;
+                    "target_write failed, %d", status);
+            return status;
         }
-        else
-        {
-            cmd = *data_ptr;
-        }
-
-        if (cmd == WRITE_EVENT_CONFIG)
+#ifdef SKIP_WAIT_CYCLES_DURING_RESET
+        if (pin == PIN_RESET_BUTTON && assert == true)
         {
-            data_ptr = get_packet_data(&packet, 1);
-            if (data_ptr == NULL)
+            struct packet_data* packet = &interp->packet;
+            while (packet->used < packet->total)
             {
-                ASD_log(
-                    ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Failed to read data for WRITE_EVENT_CONFIG, short packet");
-                status = ST_ERR;
-                break;
-            }
-
-            status = write_event_config(*data_ptr);
-            if (status != ST_OK)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "write_event_config failed, %d",
-                        status);
-                break;
-            }
-        }
-        else if (cmd >= WRITE_CFG_MIN && cmd <= WRITE_CFG_MAX)
-        {
-            status = write_cfg((writeCfg)cmd, &packet);
-            if (status != ST_OK)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "write_cfg failed, %d", status);
-                break;
-            }
-        }
-        else if (cmd == WRITE_PINS)
-        {
-            data_ptr = get_packet_data(&packet, 1);
-            if (data_ptr == NULL)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Failed to read data for WRITE_PINS, short packet");
-                status = ST_ERR;
-                break;
-            }
-
-            uint8_t data = *data_ptr;
-            bool assert = (data >> 7) == 1;
-            uint8_t index = data & WRITE_PIN_MASK;
-
-            if (index < PIN_MAX)
-            {
-                Pin pin = (Pin)index;
-                status = target_write(msg_state.target_handler, pin, assert);
-                if (status != ST_OK)
+                unsigned char* data_ptr = get_packet_data(packet, 2);
+                if (data_ptr == NULL)
                 {
                     ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                            ASD_LogOption_None, "target_write failed, %d",
-                            status);
-                    break;
-                }
-#ifdef SKIP_WAIT_CYCLES_DURING_RESET
-                if (pin == PIN_RESET_BUTTON && assert == true)
-                {
-                    while (packet.used < packet.total)
-                    {
-                        data_ptr = get_packet_data(&packet, 2);
-                        if (data_ptr == NULL)
-                        {
-                            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                                    ASD_LogOption_None,
-                                    "Failed to read WAIT_CYCLES data");
-                            status = ST_ERR;
-                            break;
-                        }
-                        data = *data_ptr;
-                        if (data != WAIT_CYCLES_TCK_DISABLE)
-                        {
-                            packet.next_data -= 2;
-                            packet.used -= 2;
-                            break;
-                        }
-                    }
-                    if (status == ST_ERR)
-                        break;
-                }
-#endif
-            }
-            else if ((index & SCAN_CHAIN_SELECT) == SCAN_CHAIN_SELECT)
-            {
-                if (msg_state.jtag_chain_mode == JTAG_CHAIN_SELECT_MODE_SINGLE)
-                {
-                    uint8_t scan_chain = (index & SCAN_CHAIN_SELECT_MASK);
-                    if (scan_chain >= MAX_SCAN_CHAINS)
-                    {
-                        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                                ASD_LogOption_None,
-                                "Unexpected scan chain: 0x%02x", scan_chain);
-                        status = ST_ERR;
-                        break;
-                    }
-                    status =
-                        asd_write_set_active_chain_event(scan_chain);
-                    if (status != ST_OK)
-                    {
-                        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                                ASD_LogOption_None,
-                                "Target set active chain failed, %d", status);
-                        break;
-                    }
+                            ASD_LogOption_None,
+                            "Failed to read WAIT_CYCLES data");
+                    return ST_ERR;
                 }
-                else
+                if (*data_ptr != WAIT_CYCLES_TCK_DISABLE)
                 {
-                    uint8_t chain_bytes_length =
-                        (index & SCAN_CHAIN_SELECT_MASK) + 1;
-                    uint8_t chain_bytes[MAX_MULTICHAINS];
-                    explicit_bzero(chain_bytes, sizeof(chain_bytes));
-                    // e.g.: chain_bytes_length = 1
-                    // chain_bytes[0] = b'11111111 = Chain
-                    // 0-7 are selected chain_bytes[1] =
-                    // b'00000011 = Chain 8 (bit 0) and 9
-                    // (bit 1) are selected Notes: support
-                    // up to 16 chain_bytes = 128 jtag
-                    // chains
-                    for (int i = 0; i < chain_bytes_length; i++)
-                    {
-                        data_ptr = get_packet_data(&packet, 1);
-                        if (data_ptr == NULL)
-                        {
-                            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                                    ASD_LogOption_None,
-                                    "Failed to read data for chain_bytes");
-                            status = ST_ERR;
-                            break;
-                        }
-                        chain_bytes[i] = *data_ptr;
-                    }
-                    // Implementing specific code for
-                    // multi-jtag chain select add here:
-#ifdef ENABLE_DEBUG_LOGGING
-                    ASD_log(
-                        ASD_LogLevel_Debug, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Multi-jtag chain select command not yet implemented");
-#endif
-                    // e.g. < Chain 21 > Received chain
-                    // bytes_length: Chain: 0x20 0000
-                    char line[MAX_MULTICHAINS * CHARS_PER_CHAIN];
-                    uint8_t pos = 0;
-                    explicit_bzero(line, sizeof(line));
-                    for (int i = chain_bytes_length - 1; i >= 0; i--)
-                    {
-                        size_t remaining_size = sizeof(line) - pos;
-                        snprintf(&line[pos], remaining_size, "%02X",
-                                 chain_bytes[i]);
-                        pos = pos + 2;
-                        if (i % 2 == 0 && i != 0)
-                        {
-                            remaining_size = sizeof(line) - pos;
-                            snprintf(&line[pos], remaining_size, " ");
-                            pos++;
-                        }
-                    }
-#ifdef ENABLE_DEBUG_LOGGING
-                    ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK,
-                            ASD_LogOption_None, "Chain : 0x%s", line);
-#endif
+                    packet->next_data -= 2;
+                    packet->used -= 2;
+                    break;
                 }
             }
-            else
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Unexpected WRITE_PINS index: 0x%02x", index);
-                status = ST_ERR;
-                break;
-            }
         }
-        else if (cmd >= READ_STATUS_MIN && cmd <= READ_STATUS_MAX)
+#endif
+    }
+    else if ((index & SCAN_CHAIN_SELECT) == SCAN_CHAIN_SELECT)
+    {
+        if (msg_state.jtag_chain_mode == JTAG_CHAIN_SELECT_MODE_SINGLE)
         {
-            int bytes_written = 0;
-            uint8_t index = (cmd & READ_STATUS_MASK);
-            ReadType readStatusTypeIndex = (ReadType)index;
-
-            data_ptr = get_packet_data(&packet, 1);
-            if (data_ptr == NULL)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Failed to read data for Read Status, short packet");
-                status = ST_ERR;
-                break;
-            }
-
-            if (response_cnt + 2 > MAX_DATA_SIZE)
+            uint8_t scan_chain = (index & SCAN_CHAIN_SELECT_MASK);
+            if (scan_chain >= MAX_SCAN_CHAINS)
             {
                 ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Failed to process READ_STATUS. "
-                        "Response buffer already full");
-                status = ST_ERR;
-                break;
+                        ASD_LogOption_None, "Unexpected scan chain: 0x%02x",
+                        scan_chain);
+                return ST_ERR;
             }
-
-            uint8_t pin = (*data_ptr & READ_STATUS_PIN_MASK);
-            status = read_status(readStatusTypeIndex, pin,
-                                 &(msg_state.out_msg.buffer[response_cnt]),
-                                 &bytes_written);
+            status = asd_write_set_active_chain_event(scan_chain);
             if (status != ST_OK)
             {
                 ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "read_status failed, %d", status);
-                break;
+                        ASD_LogOption_None,
+                        "Target set active chain failed, %d", status);
             }
-            response_cnt += bytes_written;
         }
-        else if (cmd == WAIT_CYCLES_TCK_DISABLE ||
-                 cmd == WAIT_CYCLES_TCK_ENABLE)
+        else
         {
+            status = select_multichain(interp, index);
+        }
+    }
+    else
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Unexpected WRITE_PINS index: 0x%02x", index);
+        status = ST_ERR;
+    }
+    return status;
+}
 
-            data_ptr = get_packet_data(&packet, 1);
-            if (data_ptr == NULL)
-            {
-                ASD_log(
-                    ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Failed to read data for WAIT_CYCLES_TCK, short packet");
-                status = ST_ERR;
-                break;
-            }
+static STATUS op_read_status(jtag_interp* interp, uint8_t cmd,
+                             unsigned char* operands)
+{
+    int bytes_written = 0;
+    ReadType readStatusTypeIndex = (ReadType)(cmd & READ_STATUS_MASK);
 
-            unsigned int number_of_cycles = *data_ptr;
-            if (number_of_cycles == 0)
-                number_of_cycles = 256;
-            status = JTAG_wait_cycles(msg_state.jtag_handler, number_of_cycles);
-            if (status != ST_OK)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "JTAG_wait_cycles failed, %d",
-                        status);
-                break;
-            }
+    if (interp->response_cnt + 2 > MAX_DATA_SIZE)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Failed to process READ_STATUS. "
+                "Response buffer already full");
+        return ST_ERR;
+    }
+
+    uint8_t pin = (operands[0] & READ_STATUS_PIN_MASK);
+    STATUS status =
+        read_status(readStatusTypeIndex, pin,
+                    &(msg_state.out_msg.buffer[interp->response_cnt]),
+                    &bytes_written);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "read_status failed, %d", status);
+        return status;
+    }
+    interp->response_cnt += bytes_written;
+    return status;
+}
+
+static STATUS op_wait_cycles(jtag_interp* interp, uint8_t cmd,
+                             unsigned char* operands)
+{
+    struct packet_data* packet = &interp->packet;
+    unsigned int number_of_cycles = operands[0];
+    STATUS status;
+
+    if (number_of_cycles == 0)
+        number_of_cycles = MAX_WAIT_CYCLES;
+    // scripts chain waits back to back, the ones of the same kind right
+    // behind this one become part of a single wait
+    while (packet->used + 2 <= packet->total && packet->next_data[0] == cmd)
+    {
+        unsigned char* wait = get_packet_data(packet, 2);
+        number_of_cycles += wait[1] ? wait[1] : MAX_WAIT_CYCLES;
+    }
+
+    if (cmd == WAIT_CYCLES_TCK_DISABLE)
+        status = multi_chain_active()
+                     ? JTAG_multi_wait_idle(msg_state.jtag_multi,
+                                            number_of_cycles)
+                     : JTAG_wait_idle(msg_state.jtag_handler,
+                                      number_of_cycles);
+    else
+        status = multi_chain_active()
+                     ? JTAG_multi_wait_cycles(msg_state.jtag_multi,
+                                              number_of_cycles)
+                     : JTAG_wait_cycles(msg_state.jtag_handler,
+                                        number_of_cycles);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_wait_cycles failed, %d", status);
+    }
+    return status;
+}
+
+static STATUS op_wait_prdy(jtag_interp* interp, uint8_t cmd,
+                           unsigned char* operands)
+{
+    uint64_t start = ASD_stats_now();
+    STATUS status =
+        target_wait_PRDY(msg_state.target_handler, msg_state.prdy_timeout);
+    ASD_stats_record(ASD_Stage_PrdyWait, start);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                " wait for PRDY failed, %d", status);
+    }
+    return status;
+}
+
+static STATUS op_clear_timeout(jtag_interp* interp, uint8_t cmd,
+                               unsigned char* operands)
+{
+    // This command does not apply to JTAG
+    // so we will likely not implement it.
+    ASD_log(ASD_LogLevel_Info, ASD_LogStream_SDK, ASD_LogOption_None,
+            "CLEAR_TIMEOUT not yet implemented.");
+    return ST_OK;
+}
+
+static STATUS op_tap_reset(jtag_interp* interp, uint8_t cmd,
+                           unsigned char* operands)
+{
+    STATUS status = multi_chain_active()
+                        ? JTAG_multi_tap_reset(msg_state.jtag_multi)
+                        : JTAG_tap_reset(msg_state.jtag_handler);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_tap_reset failed, %d", status);
+    }
+    return status;
+}
+
+static STATUS op_wait_sync(jtag_interp* interp, uint8_t cmd,
+                           unsigned char* operands)
+{
+    // read timout and delay. 2 bytes each, LSB first
+    uint16_t timeout = operands[0] + (operands[1] << 8);
+    uint16_t delay = operands[2] + (operands[3] << 8);
+    STATUS status = target_wait_sync(msg_state.target_handler, timeout, delay);
+    if (status == ST_TIMEOUT)
+    {
+        ASD_log(ASD_LogLevel_Warning, ASD_LogStream_SDK, ASD_LogOption_None,
+                "target_wait_sync timed out");
+        status = ST_OK;
+    }
+    else if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "target_wait_sync failed: %d", status);
+    }
+    return status;
+}
+
+static STATUS op_tap_state(jtag_interp* interp, uint8_t cmd,
+                           unsigned char* operands)
+{
+    STATUS status;
+
+    // the scan before already ended past this state
+    if (interp->scan_end_state[interp->cmd_offset] == SCAN_END_FOLDED)
+        return multi_chain_active()
+                   ? ST_OK
+                   : JTAG_tap_state_folded(msg_state.jtag_handler);
+
+    if (multi_chain_active())
+        status = JTAG_multi_set_tap_state(
+            msg_state.jtag_multi,
+            (enum jtag_states)(cmd & (uint8_t)TAP_STATE_MASK));
+    else
+        status = JTAG_set_tap_state(
+            msg_state.jtag_handler,
+            (enum jtag_states)(cmd & (uint8_t)TAP_STATE_MASK));
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_set_tap_state failed, %d", status);
+    }
+    return status;
+}
+
+static bool get_scan_type(uint8_t cmd, ScanType* scan_type)
+{
+    if (cmd >= WRITE_SCAN_MIN && cmd <= WRITE_SCAN_MAX)
+        *scan_type = ScanType_Write;
+    else if (cmd >= READ_SCAN_MIN && cmd <= READ_SCAN_MAX)
+        *scan_type = ScanType_Read;
+    else if (cmd >= READ_WRITE_SCAN_MIN)
+        *scan_type = ScanType_ReadWrite;
+    else
+        return false;
+    return true;
+}
+
+// Extended scans end like the short scans of the same type.
+static bool get_ext_scan_type(uint8_t cmd, ScanType* scan_type)
+{
+    if (cmd == EXT_WRITE_SCAN)
+        *scan_type = ScanType_Write;
+    else if (cmd == EXT_READ_SCAN)
+        *scan_type = ScanType_Read;
+    else if (cmd == EXT_READ_WRITE_SCAN)
+        *scan_type = ScanType_ReadWrite;
+    else
+        return false;
+    return true;
+}
+
+// Turns the end state annotate_scan_end_states() resolved for a scan into
+// the state the driver has to leave the TAP in.
+static STATUS scan_end_state(jtag_interp* interp, ScanType scan_type,
+                             uint8_t resolved, enum jtag_states* end_state)
+{
+    if (resolved == SCAN_END_INVALID)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Unexpected sequence during %s scan: 0x%02x",
+                scan_type == ScanType_Read    ? "read"
+                : scan_type == ScanType_Write ? "write"
+                                              : "read write",
+                *interp->packet.next_data);
+        return ST_ERR;
+    }
+    if (resolved == SCAN_END_CURRENT)
+    {
+        STATUS status = JTAG_get_tap_state(msg_state.jtag_handler, end_state);
+        if (status != ST_OK)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                    "JTAG_get_tap_state failed, %d", status);
         }
-        else if (cmd == WAIT_PRDY)
+        return status;
+    }
+    *end_state = (enum jtag_states)resolved;
+    return ST_OK;
+}
+
+// Multi-chain scans reserve a [cmd][TDO] slot per selected chain, in chain
+// order, and each controller fills its own slot.
+static STATUS queue_multi_scan(jtag_interp* interp, ScanType scan_type,
+                               uint8_t cmd, unsigned char* tdi)
+{
+    uint8_t resolved = interp->scan_end_state[interp->cmd_offset];
+    unsigned int chains = JTAG_multi_selected_count(msg_state.jtag_multi);
+    uint8_t num_of_bits = 0;
+    uint8_t num_of_bytes = 0;
+    unsigned char* tdo = NULL;
+    STATUS status;
+
+    get_scan_length(cmd, &num_of_bits, &num_of_bytes);
+    if (resolved == SCAN_END_INVALID)
+    {
+        enum jtag_states end_state;
+        return scan_end_state(interp, scan_type, resolved, &end_state);
+    }
+    if (scan_type != ScanType_Write)
+    {
+        if (interp->response_cnt + chains * (sizeof(char) + num_of_bytes) >
+            MAX_DATA_SIZE)
         {
-            status =
-                target_wait_PRDY(msg_state.target_handler, msg_state.prdy_timeout);
-            if (status != ST_OK)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, " wait for PRDY failed, %d",
-                        status);
-                break;
-            }
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                    "Failed to process %s on %u chains. "
+                    "Response buffer already full",
+                    scan_type == ScanType_Read ? "READ_SCAN"
+                                               : "READ_WRITE_SCAN",
+                    chains);
+            return ST_ERR;
         }
-        else if (cmd == CLEAR_TIMEOUT)
+        for (unsigned int i = 0; i < chains; i++)
+            msg_state.out_msg.buffer[interp->response_cnt +
+                                     i * (sizeof(char) + num_of_bytes)] = cmd;
+        tdo = &(msg_state.out_msg.buffer[interp->response_cnt + 1]);
+    }
+
+    status = JTAG_multi_scan(msg_state.jtag_multi, num_of_bits,
+                             tdi ? num_of_bytes : 0, tdi,
+                             tdo ? num_of_bytes : 0, tdo,
+                             sizeof(char) + num_of_bytes, resolved);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_multi_scan failed, %d", status);
+        return status;
+    }
+    if (tdo)
+        interp->response_cnt += chains * (sizeof(char) + num_of_bytes);
+    return status;
+}
+
+static STATUS queue_scan(jtag_interp* interp, ScanType scan_type, uint8_t cmd,
+                         unsigned char* tdi)
+{
+    enum jtag_states end_state;
+    uint8_t num_of_bits = 0;
+    uint8_t num_of_bytes = 0;
+    unsigned char* tdo = NULL;
+    STATUS status;
+
+    if (multi_chain_active())
+        return queue_multi_scan(interp, scan_type, cmd, tdi);
+
+    get_scan_length(cmd, &num_of_bits, &num_of_bytes);
+    if (scan_type != ScanType_Write)
+    {
+        if (interp->response_cnt + sizeof(char) + num_of_bytes > MAX_DATA_SIZE)
         {
-            // This command does not apply to JTAG
-            // so we will likely not implement it.
-            ASD_log(ASD_LogLevel_Info, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "CLEAR_TIMEOUT not yet implemented.");
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                    "Failed to process %s. Response buffer already full",
+                    scan_type == ScanType_Read ? "READ_SCAN"
+                                               : "READ_WRITE_SCAN");
+            return ST_ERR;
         }
-        else if (cmd == TAP_RESET)
+        msg_state.out_msg.buffer[interp->response_cnt++] = cmd;
+        tdo = &(msg_state.out_msg.buffer[interp->response_cnt]);
+    }
+
+    status = scan_end_state(interp, scan_type,
+                            interp->scan_end_state[interp->cmd_offset],
+                            &end_state);
+    if (status != ST_OK)
+        return status;
+    status = JTAG_scan_program_add(msg_state.jtag_handler, num_of_bits,
+                                   tdi ? num_of_bytes : 0, tdi,
+                                   tdo ? num_of_bytes : 0, tdo, end_state);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_scan_program_add failed, %d", status);
+        return status;
+    }
+    if (tdo)
+        interp->response_cnt += num_of_bytes;
+    return status;
+}
+
+static STATUS op_write_scan(jtag_interp* interp, uint8_t cmd,
+                            unsigned char* operands)
+{
+    return queue_scan(interp, ScanType_Write, cmd, operands);
+}
+
+static STATUS op_read_scan(jtag_interp* interp, uint8_t cmd,
+                           unsigned char* operands)
+{
+    return queue_scan(interp, ScanType_Read, cmd, NULL);
+}
+
+static STATUS op_read_write_scan(jtag_interp* interp, uint8_t cmd,
+                                 unsigned char* operands)
+{
+    return queue_scan(interp, ScanType_ReadWrite, cmd, operands);
+}
+
+// Sends the response collected so far as a packet with
+// ASD_PACKET_CONTINUATION set and starts over with an empty buffer.
+static STATUS send_partial_response(jtag_interp* interp)
+{
+    if (memcpy_s(&msg_state.out_msg.header, sizeof(struct message_header),
+                 interp->header, sizeof(struct message_header)))
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_JTAG, ASD_LogOption_None,
+                "memcpy_s: message header to out msg header copy failed.");
+        return ST_ERR;
+    }
+    msg_state.out_msg.header.size_lsb = lsb_from_msg_size(interp->response_cnt);
+    msg_state.out_msg.header.size_msb = msb_from_msg_size(interp->response_cnt);
+    msg_state.out_msg.header.cmd_stat = ASD_SUCCESS | ASD_PACKET_CONTINUATION;
+    if (send_response(&msg_state.out_msg) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_No_Remote,
+                "Failed to send message back on the socket");
+        return ST_ERR;
+    }
+    explicit_bzero(msg_state.out_msg.buffer, MAX_DATA_SIZE);
+    interp->response_cnt = 0;
+    return ST_OK;
+}
+
+// Appends to the response, full buffers go out ahead of the rest.
+static STATUS append_response(jtag_interp* interp, const unsigned char* data,
+                              unsigned int bytes)
+{
+    while (bytes)
+    {
+        unsigned int chunk;
+
+        if (interp->response_cnt == MAX_DATA_SIZE &&
+            send_partial_response(interp) != ST_OK)
+            return ST_ERR;
+        chunk = MAX_DATA_SIZE - interp->response_cnt;
+        if (chunk > bytes)
+            chunk = bytes;
+        if (memcpy_s(&msg_state.out_msg.buffer[interp->response_cnt],
+                     MAX_DATA_SIZE - interp->response_cnt, data, chunk))
         {
-            status = JTAG_tap_reset(msg_state.jtag_handler);
-            if (status != ST_OK)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "JTAG_tap_reset failed, %d",
-                        status);
-                break;
-            }
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                    "memcpy_s: TDO to response copy failed.");
+            return ST_ERR;
         }
-        else if (cmd == WAIT_SYNC)
+        interp->response_cnt += chunk;
+        data += chunk;
+        bytes -= chunk;
+    }
+    return ST_OK;
+}
+
+static STATUS run_ext_scan(jtag_interp* interp)
+{
+    ext_scan* scan = &msg_state.ext_scan;
+    unsigned int bytes = DIV_ROUND_UP(scan->bits, BITS_PER_BYTE);
+    bool write = scan->cmd != EXT_READ_SCAN;
+    enum jtag_states end_state;
+    ScanType scan_type = ScanType_Read;
+    STATUS status;
+
+    get_ext_scan_type(scan->cmd, &scan_type);
+    status = scan_end_state(interp, scan_type, scan->end_state, &end_state);
+    if (status != ST_OK)
+        return status;
+
+    // TDI and TDO share the buffer, the whole scan is a single xfer
+    status = JTAG_shift(msg_state.jtag_handler, scan->bits,
+                        write ? bytes : 0, write ? scan->tdio : NULL,
+                        sizeof(scan->tdio), scan->tdio, end_state);
+    if (status != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_shift of %u bits failed, %d", scan->bits, status);
+        return status;
+    }
+    if (scan->cmd == EXT_WRITE_SCAN)
+        return ST_OK;
+    status = append_response(interp, &scan->cmd, sizeof(scan->cmd));
+    if (status == ST_OK)
+        status = append_response(interp, scan->tdio, bytes);
+    return status;
+}
+
+// TDI bytes the pending extended scan is still waiting for.
+static unsigned int ext_scan_tdi_left(void)
+{
+    ext_scan* scan = &msg_state.ext_scan;
+
+    if (!scan->pending || scan->cmd == EXT_READ_SCAN)
+        return 0;
+    return DIV_ROUND_UP(scan->bits, BITS_PER_BYTE) - scan->received;
+}
+
+// Stages the TDI the packet holds for the pending extended scan and runs
+// the scan once all of it is there.
+static STATUS continue_ext_scan(jtag_interp* interp)
+{
+    ext_scan* scan = &msg_state.ext_scan;
+
+    if (scan->cmd != EXT_READ_SCAN)
+    {
+        unsigned int chunk = interp->packet.total - interp->packet.used;
+        if (chunk > ext_scan_tdi_left())
+            chunk = ext_scan_tdi_left();
+        if (chunk)
         {
-            uint16_t timeout = 0;
-            uint16_t delay = 0;
-            data_ptr = get_packet_data(&packet, WAIT_SYNC_CMD_LENGTH);
-            if (data_ptr == NULL)
+            unsigned char* data = get_packet_data(&interp->packet, chunk);
+            if (data == NULL ||
+                memcpy_s(&scan->tdio[scan->received],
+                         sizeof(scan->tdio) - scan->received, data, chunk))
             {
                 ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
                         ASD_LogOption_None,
-                        "Failed to read data for the WaitSync command, short "
-                        "packet");
-                status = ST_ERR;
-                break;
-            }
-            // read timout and delay. 2 bytes each, LSB first
-            timeout = data_ptr[0] + (data_ptr[1] << 8);
-            delay = data_ptr[2] + (data_ptr[3] << 8);
-            status = target_wait_sync(msg_state.target_handler, timeout, delay);
-            if (status == ST_TIMEOUT)
-            {
-                ASD_log(ASD_LogLevel_Warning, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "target_wait_sync timed out");
-                status = ST_OK;
-            }
-            else if (status != ST_OK)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "target_wait_sync failed: %d",
-                        status);
-                break;
+                        "Failed to stage %u TDI bytes", chunk);
+                return ST_ERR;
             }
+            scan->received += chunk;
         }
-        else if (cmd >= TAP_STATE_MIN && cmd <= TAP_STATE_MAX)
+        // the rest comes with the next message
+        if (ext_scan_tdi_left())
+            return ST_OK;
+    }
+    scan->pending = false;
+    return run_ext_scan(interp);
+}
+
+static STATUS op_ext_scan(jtag_interp* interp, uint8_t cmd,
+                          unsigned char* operands)
+{
+    ext_scan* scan = &msg_state.ext_scan;
+    uint32_t bits = operands[0] | (operands[1] << 8) | (operands[2] << 16) |
+                    ((uint32_t)operands[3] << 24);
+
+    if (multi_chain_active())
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Extended scans run on a single chain only");
+        return ST_ERR;
+    }
+    if (bits == 0 || bits > EXT_SCAN_MAX_BITS)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Unexpected extended scan length: %u bits", bits);
+        return ST_ERR;
+    }
+    scan->pending = true;
+    scan->cmd = cmd;
+    scan->bits = bits;
+    scan->received = 0;
+    // a scan running into the next message gets this from that message
+    scan->end_state = interp->scan_end_state[interp->cmd_offset];
+    return continue_ext_scan(interp);
+}
+
+// Operand bytes of a scan opcode: 1-63 bits rounded up to bytes, 0 means 64.
+#define SCAN_OPERAND_BYTES(cmd)                                               \
+    (((cmd)&SCAN_LENGTH_MASK) ? ((((cmd)&SCAN_LENGTH_MASK) + 7) / 8) : 8)
+#define WRITE_SCAN_OPCODE(cmd)                                                \
+    [cmd] = {op_write_scan, SCAN_OPERAND_BYTES(cmd), false},
+#define READ_WRITE_SCAN_OPCODE(cmd)                                           \
+    [cmd] = {op_read_write_scan, SCAN_OPERAND_BYTES(cmd), false},
+#define READ_SCAN_OPCODE(cmd) [cmd] = {op_read_scan, 0, false},
+#define READ_STATUS_OPCODE(cmd) [cmd] = {op_read_status, 1, true},
+#define TAP_STATE_OPCODE(cmd) [cmd] = {op_tap_state, 0, true},
+#define EXT_SCAN_OPCODE(cmd)                                                  \
+    [cmd] = {op_ext_scan, EXT_SCAN_LENGTH_BYTES, true},
+// Expand m for each command byte of an opcode range, starting at cmd.
+#define OPCODES_4(m, cmd) m(cmd) m((cmd) + 1) m((cmd) + 2) m((cmd) + 3)
+#define OPCODES_8(m, cmd) OPCODES_4(m, cmd) OPCODES_4(m, (cmd) + 4)
+#define OPCODES_16(m, cmd) OPCODES_8(m, cmd) OPCODES_8(m, (cmd) + 8)
+#define OPCODES_64(m, cmd)                                                    \
+    OPCODES_16(m, cmd) OPCODES_16(m, (cmd) + 16) OPCODES_16(m, (cmd) + 32)    \
+        OPCODES_16(m, (cmd) + 48)
+
+// Every command byte maps straight to its handler and the number of operand
+// bytes that follow it. Opcodes without a handler are rejected as unknown.
+const jtag_opcode jtag_opcodes[256] = {
+    [WRITE_EVENT_CONFIG] = {op_write_event_config, 1, true},
+    [JTAG_FREQ] = {op_write_cfg, 1, true},
+    [DR_PREFIX] = {op_write_cfg, 1, true},
+    [DR_POSTFIX] = {op_write_cfg, 1, true},
+    [IR_PREFIX] = {op_write_cfg, 2, true},
+    [IR_POSTFIX] = {op_write_cfg, 2, true},
+    [PRDY_TIMEOUT] = {op_write_cfg, 1, true},
+    [WRITE_PINS] = {op_write_pins, 1, true},
+    OPCODES_8(READ_STATUS_OPCODE, READ_STATUS_MIN)
+    [WAIT_CYCLES_TCK_DISABLE] = {op_wait_cycles, 1, true},
+    [WAIT_CYCLES_TCK_ENABLE] = {op_wait_cycles, 1, true},
+    [WAIT_PRDY] = {op_wait_prdy, 0, true},
+    [CLEAR_TIMEOUT] = {op_clear_timeout, 0, true},
+    [TAP_RESET] = {op_tap_reset, 0, true},
+    EXT_SCAN_OPCODE(EXT_WRITE_SCAN)
+    EXT_SCAN_OPCODE(EXT_READ_SCAN)
+    EXT_SCAN_OPCODE(EXT_READ_WRITE_SCAN)
+    [WAIT_SYNC] = {op_wait_sync, WAIT_SYNC_CMD_LENGTH, true},
+    OPCODES_16(TAP_STATE_OPCODE, TAP_STATE_MIN)
+    OPCODES_64(WRITE_SCAN_OPCODE, WRITE_SCAN_MIN)
+    OPCODES_64(READ_SCAN_OPCODE, READ_SCAN_MIN)
+    OPCODES_64(READ_WRITE_SCAN_OPCODE, READ_WRITE_SCAN_MIN)
+};
+
+// Commands the hardware driver can run without leaving the state a scan
+// ended in, so a TAP state behind them still decides that end state.
+static bool keeps_tap_state(uint8_t cmd)
+{
+    return cmd == WRITE_EVENT_CONFIG || cmd == JTAG_FREQ ||
+           cmd == DR_PREFIX || cmd == DR_POSTFIX || cmd == IR_PREFIX ||
+           cmd == IR_POSTFIX || cmd == WAIT_CYCLES_TCK_DISABLE ||
+           cmd == WAIT_CYCLES_TCK_ENABLE;
+}
+
+// Commands that neither clock the TAP nor read its state, a TAP_STATE
+// behind them can still be folded into a software mode scan.
+static bool skips_tap_clock(uint8_t cmd)
+{
+    return cmd == WRITE_EVENT_CONFIG || cmd == JTAG_FREQ ||
+           cmd == DR_PREFIX || cmd == DR_POSTFIX || cmd == IR_PREFIX ||
+           cmd == IR_POSTFIX;
+}
+
+// One step on the way out of a shift state that a software mode xfer can
+// take in its end state: Exit1 to Pause or Update, Update on to RTI.
+static bool folds_into_scan(enum jtag_states from, enum jtag_states to)
+{
+    switch (from)
+    {
+        case jtag_ex1_dr:
+            return to == jtag_pau_dr || to == jtag_upd_dr;
+        case jtag_ex1_ir:
+            return to == jtag_pau_ir || to == jtag_upd_ir;
+        case jtag_upd_dr:
+        case jtag_upd_ir:
+            return to == jtag_rti;
+        default:
+            return false;
+    }
+}
+
+// Resolves the end state of every scan in the message in one forward pass.
+// A scan ends in the state of the TAP_STATE command right after it, or stays
+// put when it is followed by a scan of the same type or by nothing. Any other
+// command after a scan is an illegal sequence. In hardware mode a Pause-xR or
+// RTI state that follows that TAP_STATE, with only commands that keep the
+// TAP state in between, becomes the end state instead so the driver does
+// not stop in between. In software mode the scan keeps moving along
+// Exit1->Pause or Exit1->Update->RTI, the TAP_STATE commands it absorbs are
+// marked SCAN_END_FOLDED and cost no driver request. Extended scans follow
+// the same rules, one whose TDI opens the message gets its end state in
+// interp->ext_end_state.
+void annotate_scan_end_states(jtag_interp* interp,
+                              const unsigned char* buffer, unsigned int size)
+{
+    bool hw_mode = msg_state.asd_cfg->jtag.mode == JTAG_DRIVER_MODE_HARDWARE;
+    // end state of the scan waiting for the command that follows it
+    uint8_t* pending_scan = NULL;
+    ScanType pending_type = ScanType_Read;
+    // scan ended by a TAP_STATE, looking for a second one (hardware mode)
+    uint8_t* pending_tap = NULL;
+    // scan ended by a TAP_STATE and the offset of that TAP_STATE, looking
+    // for more moves to fold (software mode)
+    uint8_t* folding_scan = NULL;
+    unsigned int folding_tap = 0;
+    unsigned int offset = 0;
+
+    interp->ext_end_state = SCAN_END_CURRENT;
+    if (msg_state.ext_scan.pending &&
+        get_ext_scan_type(msg_state.ext_scan.cmd, &pending_type))
+        pending_scan = &interp->ext_end_state;
+
+    while (offset < size)
+    {
+        uint8_t cmd = buffer[offset];
+        const jtag_opcode* op = &jtag_opcodes[cmd];
+        unsigned int length = 1 + op->operand_len;
+        bool is_tap_state = cmd >= TAP_STATE_MIN && cmd <= TAP_STATE_MAX;
+        ScanType scan_type;
+
+        if (pending_tap != NULL)
         {
-            status = JTAG_set_tap_state(
-                msg_state.jtag_handler,
-                (enum jtag_states)(cmd & (uint8_t)TAP_STATE_MASK));
-            if (status != ST_OK)
+            if (is_tap_state)
             {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "JTAG_set_tap_state failed, %d",
-                        status);
-                break;
+                enum jtag_states next =
+                    (enum jtag_states)(cmd & TAP_STATE_MASK);
+                if (next == jtag_pau_dr || next == jtag_pau_ir ||
+                    next == jtag_rti)
+                    *pending_tap = (uint8_t)next;
+                pending_tap = NULL;
+            }
+            else if (!keeps_tap_state(cmd))
+            {
+                pending_tap = NULL;
             }
         }
-        else if (cmd >= WRITE_SCAN_MIN && cmd <= WRITE_SCAN_MAX)
-        {
-            uint8_t num_of_bits = 0;
-            uint8_t num_of_bytes = 0;
 
-            get_scan_length(cmd, &num_of_bits, &num_of_bytes);
-            data_ptr = get_packet_data(&packet, num_of_bytes);
-            if (data_ptr == NULL)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Failed to read data from buffer: %d", num_of_bytes);
-                status = ST_ERR;
-                break;
-            }
+        if (is_tap_state)
+            interp->scan_end_state[offset] = SCAN_END_CURRENT;
 
-            status = determine_shift_end_state(ScanType_Write, &packet,
-                                               &end_state);
-            if (status != ST_OK)
+        if (folding_scan != NULL)
+        {
+            enum jtag_states next = (enum jtag_states)(cmd & TAP_STATE_MASK);
+            if (is_tap_state &&
+                folds_into_scan((enum jtag_states)*folding_scan, next))
             {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "determine_shift_end_state failed, %d", status);
-                break;
+                *folding_scan = (uint8_t)next;
+                interp->scan_end_state[folding_tap] = SCAN_END_FOLDED;
+                folding_tap = offset;
             }
-            status = JTAG_shift(msg_state.jtag_handler, num_of_bits, num_of_bytes,
-                                data_ptr, 0, NULL, end_state);
-            if (status != ST_OK)
+            else if (!skips_tap_clock(cmd))
             {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "JTAG_shift failed, %d", status);
-                break;
+                folding_scan = NULL;
             }
         }
-        else if (cmd >= READ_SCAN_MIN && cmd <= READ_SCAN_MAX)
-        {
-            uint8_t num_of_bits = 0;
-            uint8_t num_of_bytes = 0;
 
-            get_scan_length(cmd, &num_of_bits, &num_of_bytes);
-            if (response_cnt + sizeof(char) + num_of_bytes > MAX_DATA_SIZE)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Failed to process READ_SCAN. "
-                        "Response buffer already full");
-                status = ST_ERR;
-                break;
-            }
-            msg_state.out_msg.buffer[response_cnt++] = cmd;
-            status = determine_shift_end_state(ScanType_Read, &packet,
-                                               &end_state);
-            if (status != ST_OK)
+        if (pending_scan != NULL)
+        {
+            if (is_tap_state)
             {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "determine_shift_end_state failed, %d", status);
-                break;
+                *pending_scan = (uint8_t)(cmd & TAP_STATE_MASK);
+                if (hw_mode)
+                {
+                    pending_tap = pending_scan;
+                }
+                else
+                {
+                    folding_scan = pending_scan;
+                    folding_tap = offset;
+                }
             }
-            status = JTAG_shift(
-                msg_state.jtag_handler, num_of_bits, 0, NULL, num_of_bytes,
-                &(msg_state.out_msg.buffer[response_cnt]), end_state);
-            if (status != ST_OK)
+            else if ((!get_scan_type(cmd, &scan_type) &&
+                      !get_ext_scan_type(cmd, &scan_type)) ||
+                     scan_type != pending_type)
             {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "JTAG_shift failed, %d", status);
-                break;
+                *pending_scan = SCAN_END_INVALID;
             }
-            response_cnt += num_of_bytes;
+            pending_scan = NULL;
         }
-        else if (cmd >= READ_WRITE_SCAN_MIN)
+
+        // The executor reports unknown commands and short packets.
+        if (op->handler == NULL || offset + length > size)
+            break;
+
+        if (get_scan_type(cmd, &scan_type) ||
+            get_ext_scan_type(cmd, &scan_type))
         {
-            uint8_t num_of_bits = 0;
-            uint8_t num_of_bytes = 0;
-            get_scan_length(cmd, &num_of_bits, &num_of_bytes);
-            if (response_cnt + sizeof(char) + num_of_bytes > MAX_DATA_SIZE)
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Failed to process READ_WRITE_SCAN. "
-                        "Response buffer already full");
-                status = ST_ERR;
+            interp->scan_end_state[offset] = SCAN_END_CURRENT;
+            pending_scan = &interp->scan_end_state[offset];
+            pending_type = scan_type;
+        }
+        if (cmd == WRITE_PINS &&
+            msg_state.jtag_chain_mode != JTAG_CHAIN_SELECT_MODE_SINGLE)
+        {
+            // multichain select carries its chain bytes after the operand
+            uint8_t index = buffer[offset + 1] & WRITE_PIN_MASK;
+            if (index >= PIN_MAX &&
+                (index & SCAN_CHAIN_SELECT) == SCAN_CHAIN_SELECT)
+                length += (index & SCAN_CHAIN_SELECT_MASK) + 1;
+        }
+        else if (cmd == EXT_WRITE_SCAN || cmd == EXT_READ_WRITE_SCAN)
+        {
+            // TDI follows the bit count, it may run past the message
+            const unsigned char* count = &buffer[offset + 1];
+            uint32_t bits = count[0] | (count[1] << 8) | (count[2] << 16) |
+                            ((uint32_t)count[3] << 24);
+            if (bits > EXT_SCAN_MAX_BITS)
                 break;
-            }
-            msg_state.out_msg.buffer[response_cnt++] = cmd;
-            data_ptr = get_packet_data(&packet, num_of_bytes);
-            if (data_ptr == NULL)
+            length += DIV_ROUND_UP(bits, BITS_PER_BYTE);
+        }
+        offset += length;
+    }
+}
+
+STATUS process_jtag_message(struct asd_message* s_message)
+{
+    STATUS status = ST_OK;
+    int size = get_message_size(s_message);
+    jtag_interp interp;
+    unsigned char* operands;
+    uint8_t cmd = 0;
+    unsigned int start;
+
+    if (size == -1)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Failed to process jtag message because "
+                "get message size failed.");
+        return ST_ERR;
+    }
+
+    explicit_bzero(&msg_state.out_msg.header, sizeof(struct message_header));
+    explicit_bzero(&msg_state.out_msg.buffer, MAX_DATA_SIZE);
+
+#ifdef ENABLE_DEBUG_LOGGING
+    ASD_log(ASD_LogLevel_Debug, ASD_LogStream_Network, ASD_LogOption_No_Remote,
+            "NetReq tag: %d size: %d", s_message->header.tag, size);
+    ASD_log_buffer(ASD_LogLevel_Debug, ASD_LogStream_Network,
+                   ASD_LogOption_No_Remote, s_message->buffer, (size_t)size,
+                   "NetReq");
+#endif
+
+    interp.packet.next_data = s_message->buffer;
+    interp.packet.used = 0;
+    interp.packet.total = (unsigned int)size;
+    interp.header = &s_message->header;
+    interp.response_cnt = 0;
+    // The message opens with the rest of an extended scan's TDI, the
+    // commands behind it decide where that scan ends.
+    start = ext_scan_tdi_left();
+    if (start > (unsigned int)size)
+        start = (unsigned int)size;
+    annotate_scan_end_states(&interp, &s_message->buffer[start],
+                             (unsigned int)size - start);
+    if (msg_state.ext_scan.pending)
+    {
+        msg_state.ext_scan.end_state = interp.ext_end_state;
+        status = continue_ext_scan(&interp);
+    }
+
+    while (status == ST_OK && interp.packet.used < interp.packet.total)
+    {
+        interp.cmd_offset = interp.packet.used - start;
+        cmd = *(unsigned char*)get_packet_data(&interp.packet, 1);
+        const jtag_opcode* op = &jtag_opcodes[cmd];
+
+        if (op->handler == NULL)
+        {
+            // Unknown Command
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                    "Encountered unknown command 0x%02x", (int)cmd);
+            status = ST_ERR;
+            break;
+        }
+
+        // The controllers run their queues in order by themselves, they
+        // only have to be done before the target is touched outside JTAG.
+        if (op->flush_scans && multi_chain_active())
+        {
+            if (!keeps_tap_state(cmd) && cmd != TAP_RESET &&
+                (cmd < TAP_STATE_MIN || cmd > TAP_STATE_MAX))
             {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Failed to read data from buffer: %d", num_of_bytes);
-                status = ST_ERR;
-                break;
+                status = JTAG_multi_wait(msg_state.jtag_multi);
+                if (status != ST_OK)
+                {
+                    ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                            ASD_LogOption_None, "JTAG_multi_wait failed, %d",
+                            status);
+                    break;
+                }
             }
-            status = determine_shift_end_state(ScanType_ReadWrite,
-                                               &packet, &end_state);
+        }
+        // Scans are queued in the scan program, every other command
+        // has to wait for the queued scans to reach the driver first.
+        else if (op->flush_scans)
+        {
+            status = JTAG_scan_program_execute(msg_state.jtag_handler);
             if (status != ST_OK)
             {
                 ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
                         ASD_LogOption_None,
-                        "determine_shift_end_state failed, %d", status);
+                        "JTAG_scan_program_execute failed, %d", status);
                 break;
             }
-            status =
-                JTAG_shift(msg_state.jtag_handler, num_of_bits, num_of_bytes,
-                           data_ptr, num_of_bytes,
-                           &(msg_state.out_msg.buffer[response_cnt]), end_state);
-            if (status != ST_OK)
+            // pins and sync points must see the TAP moves before them
+            if (!keeps_tap_state(cmd) && cmd != TAP_RESET &&
+                (cmd < TAP_STATE_MIN || cmd > TAP_STATE_MAX))
+            {
+                status = JTAG_sync_tap_state(msg_state.jtag_handler);
+                if (status != ST_OK)
+                {
+                    ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                            ASD_LogOption_None,
+                            "JTAG_sync_tap_state failed, %d", status);
+                    break;
+                }
+            }
+        }
+
+        // The only bounds check for the fixed part of the command.
+        operands = NULL;
+        if (op->operand_len)
+        {
+            operands = get_packet_data(&interp.packet, op->operand_len);
+            if (operands == NULL)
             {
                 ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "JTAG_shift failed, %d", status);
+                        ASD_LogOption_None,
+                        "Failed to read %d data bytes for command 0x%02x, "
+                        "short packet",
+                        op->operand_len, (int)cmd);
+                status = ST_ERR;
                 break;
             }
-            response_cnt += num_of_bytes;
         }
-        else
-        {
-            // Unknown Command
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Encountered unknown command 0x%02x", (int)cmd);
-            status = ST_ERR;
+
+        status = op->handler(&interp, cmd, operands);
+        if (status != ST_OK)
             break;
-        }
     }
 
+    // An extended scan still waiting for TDI is only fine when the client
+    // said the message continues.
+    if (status == ST_OK && msg_state.ext_scan.pending &&
+        !(s_message->header.cmd_stat & ASD_PACKET_CONTINUATION))
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Extended scan is missing %u TDI bytes", ext_scan_tdi_left());
+        status = ST_ERR;
+    }
+    if (status != ST_OK)
+        msg_state.ext_scan.pending = false;
+
+    // The response is only complete once every controller is done, and
+    // controller 0 shares the JTAG handler flushed below. Nothing to wait
+    // for when the message never reached the controllers.
+    if (msg_state.jtag_multi != NULL &&
+        (multi_chain_active() || msg_state.jtag_multi->dispatched) &&
+        JTAG_multi_wait(msg_state.jtag_multi) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_multi_wait failed");
+        status = ST_ERR;
+    }
+
+    // Flush whatever is still queued, including scans decoded ahead
+    // of a failing command.
+    if (JTAG_scan_program_execute(msg_state.jtag_handler) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_scan_program_execute failed");
+        status = ST_ERR;
+    }
+
+    // The TAP must be where the message left it before anything else
+    // touches the target.
+    if (JTAG_sync_tap_state(msg_state.jtag_handler) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "JTAG_sync_tap_state failed");
+        status = ST_ERR;
+    }
+
+    // The last response packet goes out with the message ending the scan,
+    // every message before it is acked with what it has so far.
+    if (status == ST_OK && msg_state.ext_scan.pending)
+        return send_partial_response(&interp);
+
     if (status == ST_OK)
     {
         if (memcpy_s(&msg_state.out_msg.header, sizeof(struct message_header),
@@ -1562,8 +2562,10 @@ STATUS process_jtag_message(struct asd_message* s_message)
             return ST_ERR;
         }
 
-        msg_state.out_msg.header.size_lsb = lsb_from_msg_size(response_cnt);
-        msg_state.out_msg.header.size_msb = msb_from_msg_size(response_cnt);
+        msg_state.out_msg.header.size_lsb =
+            lsb_from_msg_size(interp.response_cnt);
+        msg_state.out_msg.header.size_msb =
+            msb_from_msg_size(interp.response_cnt);
         msg_state.out_msg.header.cmd_stat = ASD_SUCCESS;
 
         status = send_response(&msg_state.out_msg);
@@ -2247,9 +3249,26 @@ STATUS process_spp_message(struct asd_message* s_message)
 
 STATUS write_cfg(const writeCfg cmd, struct packet_data* packet)
 {
-    STATUS status;
     unsigned char* data;
 
+    if (cmd < WRITE_CFG_MIN || cmd > WRITE_CFG_MAX)
+        return ST_ERR;
+
+    data = get_packet_data(packet, jtag_opcodes[cmd].operand_len);
+    if (data == NULL)
+    {
+        ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Unable to read data for write config 0x%02x", cmd);
+        return ST_ERR;
+    }
+    return write_cfg_operands(cmd, data);
+}
+
+// data holds the operand bytes of cmd, already bounds checked by the caller
+static STATUS write_cfg_operands(const writeCfg cmd, const unsigned char* data)
+{
+    STATUS status = ST_ERR;
+
     if (cmd == JTAG_FREQ)
     {
         // JTAG_FREQ (Index 1, Size: 1 Byte)
@@ -2259,183 +3278,119 @@ STATUS write_cfg(const writeCfg cmd, struct packet_data* packet)
         // clock of the TAP Controller first through the prescale value
         // (1,2,4,8) and then through the divisor (1-64).
         // e.g. system clock/(prescale * divisor)
-        data = get_packet_data(packet, 1);
-        if (data == NULL)
+        uint32_t tCLK = 0;
+        uint8_t divisorVal = 0;
+        uint8_t prescaleVal = 0;
+        prescaleVal = data[0] >> (uint8_t)5;
+        divisorVal = data[0] & (uint8_t)0x1f;
+
+        if (prescaleVal == 0)
         {
-            status = ST_ERR;
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Unable to read JTAG_FREQ data byte");
+            prescaleVal = 1;
+        }
+        else if (prescaleVal == 1)
+        {
+            prescaleVal = 2;
+        }
+        else if (prescaleVal == 2)
+        {
+            prescaleVal = 4;
+        }
+        else if (prescaleVal == 3)
+        {
+            prescaleVal = 8;
         }
         else
         {
-            uint32_t tCLK = 0;
-            uint8_t divisorVal = 0;
-            uint8_t prescaleVal = 0;
-            prescaleVal = data[0] >> (uint8_t)5;
-            divisorVal = data[0] & (uint8_t)0x1f;
-
-            if (prescaleVal == 0)
-            {
-                prescaleVal = 1;
-            }
-            else if (prescaleVal == 1)
-            {
-                prescaleVal = 2;
-            }
-            else if (prescaleVal == 2)
-            {
-                prescaleVal = 4;
-            }
-            else if (prescaleVal == 3)
-            {
-                prescaleVal = 8;
-            }
-            else
-            {
-                prescaleVal = 1;
-            }
+            prescaleVal = 1;
+        }
 
-            if (divisorVal == 0)
-            {
-                divisorVal = 64;
-            }
+        if (divisorVal == 0)
+        {
+            divisorVal = 64;
+        }
 
-            tCLK = (prescaleVal * divisorVal);
+        tCLK = (prescaleVal * divisorVal);
 #ifdef ENABLE_DEBUG_LOGGING
-            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Set JTAG TAP Pre: %d  Div: %d  TCK: %d", prescaleVal,
-                    divisorVal, tCLK);
+        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Set JTAG TAP Pre: %d  Div: %d  TCK: %d", prescaleVal,
+                divisorVal, tCLK);
 #endif
 
-            status = JTAG_set_jtag_tck(msg_state.jtag_handler, tCLK);
-            if (status != ST_OK)
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "Unable to set the JTAG TAP TCK!");
-        }
+        status = multi_chain_active()
+                     ? JTAG_multi_set_jtag_tck(msg_state.jtag_multi, tCLK)
+                     : JTAG_set_jtag_tck(msg_state.jtag_handler, tCLK);
+        if (status != ST_OK)
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                    ASD_LogOption_None, "Unable to set the JTAG TAP TCK!");
     }
     else if (cmd == DR_PREFIX)
     {
         // DR Postfix (A.K.A. DR Prefix in At-Scale Debug Arch. Spec.)
         // set drPaddingNearTDI 1 byte of data
 
-        data = get_packet_data(packet, 1);
-        if (data == NULL)
-        {
-            status = ST_ERR;
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Unable to read DRPost data byte");
-        }
-        else
-        {
 #ifdef ENABLE_DEBUG_LOGGING
-            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Setting DRPost padding to %d", data[0]);
+        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Setting DRPost padding to %d", data[0]);
 #endif
-            status = JTAG_set_padding(msg_state.jtag_handler,
-                                      JTAGPaddingTypes_DRPost, data[0]);
-            if (status != ST_OK)
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "failed to set DRPost padding");
-        }
+        status = set_padding(JTAGPaddingTypes_DRPost, data[0]);
+        if (status != ST_OK)
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                    ASD_LogOption_None, "failed to set DRPost padding");
     }
     else if (cmd == DR_POSTFIX)
     {
         // DR preFix (A.K.A. DR Postfix in At-Scale Debug Arch. Spec.)
         // drPaddingNearTDO 1 byte of data
 
-        data = get_packet_data(packet, 1);
-        if (data == NULL)
-        {
-            status = ST_ERR;
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Unable to read DRPre data byte");
-        }
-        else
-        {
 #ifdef ENABLE_DEBUG_LOGGING
-            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Setting DRPre padding to %d", data[0]);
+        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Setting DRPre padding to %d", data[0]);
 #endif
-            status = JTAG_set_padding(msg_state.jtag_handler,
-                                      JTAGPaddingTypes_DRPre, data[0]);
-            if (status != ST_OK)
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "failed to set DRPre padding");
-        }
+        status = set_padding(JTAGPaddingTypes_DRPre, data[0]);
+        if (status != ST_OK)
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                    ASD_LogOption_None, "failed to set DRPre padding");
     }
     else if (cmd == IR_PREFIX)
     {
         // IR Postfix (A.K.A. IR Prefix in At-Scale Debug Arch. Spec.)
         // irPaddingNearTDI 2 bytes of data
 
-        data = get_packet_data(packet, 2);
-        if (data == NULL)
-        {
-            status = ST_ERR;
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Unable to read IRPost data byte");
-        }
-        else
-        {
 #ifdef ENABLE_DEBUG_LOGGING
-            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Setting IRPost padding to %d", (data[1] << 8) | data[0]);
+        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Setting IRPost padding to %d", (data[1] << 8) | data[0]);
 #endif
-            status =
-                JTAG_set_padding(msg_state.jtag_handler, JTAGPaddingTypes_IRPost,
-                                 (data[1] << 8) | data[0]);
-            if (status != ST_OK)
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "failed to set IRPost padding");
-        }
+        status = set_padding(JTAGPaddingTypes_IRPost, (data[1] << 8) | data[0]);
+        if (status != ST_OK)
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                    ASD_LogOption_None, "failed to set IRPost padding");
     }
     else if (cmd == IR_POSTFIX)
     {
         // IR Prefix (A.K.A. IR Postfix in At-Scale Debug Arch. Spec.)
         // irPaddingNearTDO 2 bytes of data
 
-        data = get_packet_data(packet, 2);
-        if (data == NULL)
-        {
-            status = ST_ERR;
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Unable to read IRPre data byte");
-        }
-        else
-        {
 #ifdef ENABLE_DEBUG_LOGGING
-            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Setting IRPre padding to %d", (data[1] << 8) | data[0]);
+        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
+                "Setting IRPre padding to %d", (data[1] << 8) | data[0]);
 #endif
-            status =
-                JTAG_set_padding(msg_state.jtag_handler, JTAGPaddingTypes_IRPre,
-                                 (data[1] << 8) | data[0]);
-            if (status != ST_OK)
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None, "failed to set IRPre padding");
-        }
+        status = set_padding(JTAGPaddingTypes_IRPre, (data[1] << 8) | data[0]);
+        if (status != ST_OK)
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
+                    ASD_LogOption_None, "failed to set IRPre padding");
     }
     else if (cmd == PRDY_TIMEOUT)
     {
         // PRDY timeout
         // 1 bytes of data
 
-        data = get_packet_data(packet, 1);
-        if (data == NULL)
-        {
-            status = ST_ERR;
-            ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "Unable to read PRDY_TIMEOUT data byte");
-        }
-        else
-        {
 #ifdef ENABLE_DEBUG_LOGGING
-            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
-                    "PRDY Timeout config set to %d", data[0]);
+        ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK, ASD_LogOption_None,
+                "PRDY Timeout config set to %d", data[0]);
 #endif
-            msg_state.prdy_timeout = data[0];
-            status = ST_OK;
-        }
+        msg_state.prdy_timeout = data[0];
+        status = ST_OK;
     }
 
     return status;
@@ -2455,165 +3410,14 @@ static void get_scan_length(const unsigned char cmd, uint8_t* num_of_bits,
     }
 }
 
-STATUS determine_shift_end_state(ScanType scan_type,
-                                 struct packet_data* packet,
-                                 enum jtag_states* end_state)
-{
-    unsigned char* next_cmd_ptr = NULL;
-    unsigned char* next_cmd2_ptr = NULL;
-    unsigned int next_cmd2_counter = 0;
-    STATUS status;
-
-    if (!packet || !end_state)
-        return ST_ERR;
-
-    // First we will get the default end_state, to use if there are
-    // no more bytes to read from the packet.
-    status = JTAG_get_tap_state(msg_state.jtag_handler, end_state);
-
-    if (status == ST_OK)
-    {
-        // Peek ahead to get next command byte
-        next_cmd_ptr = get_packet_data(packet, 1);
-        if (next_cmd_ptr != NULL)
-        {
-            if (*next_cmd_ptr >= TAP_STATE_MIN &&
-                *next_cmd_ptr <= TAP_STATE_MAX)
-            {
-                ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Next is TAP_STATE(0x%x)", *next_cmd_ptr);
-                // Next command is a tap state command
-                *end_state = (enum jtag_states)(*next_cmd_ptr & TAP_STATE_MASK);
-
-                // In hardware mode, we must peek ahead for the next tap state
-                // to determine the end state
-                if (msg_state.asd_cfg->jtag.mode == JTAG_DRIVER_MODE_HARDWARE)
-                {
-                    while (packet->used < packet->total)
-                    {
-                        next_cmd2_ptr = get_packet_data(packet, 1);
-                        next_cmd2_counter++;
-                        if (next_cmd2_ptr == NULL)
-                            break;
-                        if (*next_cmd2_ptr >= TAP_STATE_MIN &&
-                            *next_cmd2_ptr <= TAP_STATE_MAX)
-                        {
-                            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK,
-                                    ASD_LogOption_None,
-                                    "Next2 is TAP_STATE(0x%x)", *next_cmd2_ptr);
-                            break;
-                        }
-                        else if (*next_cmd2_ptr == WRITE_EVENT_CONFIG ||
-                                 *next_cmd2_ptr == DR_PREFIX ||
-                                 *next_cmd2_ptr == DR_POSTFIX ||
-                                 *next_cmd2_ptr == WAIT_CYCLES_TCK_DISABLE ||
-                                 *next_cmd2_ptr == WAIT_CYCLES_TCK_ENABLE ||
-                                 *next_cmd2_ptr == JTAG_FREQ)
-                        {
-                            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK,
-                                    ASD_LogOption_None,
-                                    "Next2 is 1 byte length: 0x%x",
-                                    *next_cmd2_ptr);
-                            next_cmd2_ptr = get_packet_data(packet, 1);
-                            next_cmd2_counter++;
-                            continue;
-                        }
-                        else if (*next_cmd2_ptr == IR_PREFIX ||
-                                 *next_cmd2_ptr == IR_POSTFIX)
-                        {
-                            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK,
-                                    ASD_LogOption_None,
-                                    "Next2 is 2 byte length: 0x%x",
-                                    *next_cmd2_ptr);
-                            next_cmd2_ptr = get_packet_data(packet, 2);
-                            next_cmd2_counter = next_cmd2_counter + 2;
-                            continue;
-                        }
-                        else
-                        {
-                            ASD_log(ASD_LogLevel_Warning, ASD_LogStream_SDK,
-                                    ASD_LogOption_None,
-                                    "Not expected Next2 command 0x%x",
-                                    *next_cmd2_ptr);
-                            break;
-                        }
-                    }
-                }
-
-                if (next_cmd2_ptr)
-                {
-                    if (*next_cmd2_ptr >= TAP_STATE_MIN &&
-                        *next_cmd2_ptr <= TAP_STATE_MAX)
-                    {
-                        if ((*next_cmd2_ptr & TAP_STATE_MASK) == jtag_pau_dr ||
-                            (*next_cmd2_ptr & TAP_STATE_MASK) == jtag_pau_ir)
-                        {
-                            *end_state = (enum jtag_states)(*next_cmd2_ptr &
-                                                            TAP_STATE_MASK);
-#ifdef ENABLE_DEBUG_LOGGING
-                            ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SDK,
-                                    ASD_LogOption_None,
-                                    "Staying in state: 0x%02x", *end_state);
-#endif
-                        }
-                        else if ((*next_cmd2_ptr & TAP_STATE_MASK) == jtag_rti)
-                        {
-                            *end_state = jtag_rti;
-                        }
-                    }
-                }
-            }
-            else if (scan_type == ScanType_Read &&
-                     (*next_cmd_ptr < READ_SCAN_MIN ||
-                      *next_cmd_ptr > READ_SCAN_MAX))
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Unexpected sequence during read scan: 0x%02x",
-                        *next_cmd_ptr);
-                status = ST_ERR;
-            }
-            else if (scan_type == ScanType_Write &&
-                     (*next_cmd_ptr < WRITE_SCAN_MIN ||
-                      *next_cmd_ptr > WRITE_SCAN_MAX))
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Unexpected sequence during write scan: 0x%02x",
-                        *next_cmd_ptr);
-                status = ST_ERR;
-            }
-            else if (scan_type == ScanType_ReadWrite &&
-                     (*next_cmd_ptr < READ_WRITE_SCAN_MIN ||
-                      *next_cmd_ptr > READ_WRITE_SCAN_MAX))
-            {
-                ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK,
-                        ASD_LogOption_None,
-                        "Unexpected sequence during read write scan: 0x%02x",
-                        *next_cmd_ptr);
-                status = ST_ERR;
-            }
-
-            packet->next_data--; // Un-peek next_cmd_ptr
-            packet->used--;
-            if (next_cmd2_ptr)
-            {
-                packet->next_data -= next_cmd2_counter; // Un-peek next_cmd2_ptr
-                packet->used -= next_cmd2_counter;
-            }
-        }
-    }
-    return status;
-}
-
-STATUS asd_msg_read(void)
+static STATUS read_message_part(void)
 {
     STATUS result = ST_ERR;
     STATUS status = ST_ERR;
     bool b_data_pending = false;
 
     struct asd_message* msg = &msg_state.in_msg.msg;
+
     switch (msg_state.in_msg.read_state)
     {
         case READ_STATE_INITIAL:
@@ -2668,7 +3472,7 @@ STATUS asd_msg_read(void)
                         // next packet and
                         // process message.
                         msg_state.in_msg.read_state = READ_STATE_INITIAL;
-                        result = asd_msg_on_msg_recv();
+                        result = on_msg_complete();
                         if (result == ST_ERR)
                             break;
                     }
@@ -2713,7 +3517,7 @@ STATUS asd_msg_read(void)
                     // packet. Set back to initial
                     // state for next packet.
                     msg_state.in_msg.read_state = READ_STATE_INITIAL;
-                    result = asd_msg_on_msg_recv();
+                    result = on_msg_complete();
                     if (result == ST_ERR)
                         break;
                 }
@@ -2742,6 +3546,34 @@ STATUS asd_msg_read(void)
     return result;
 }
 
+// Reads what the server received, as many messages of it as it has
+// buffered, so a burst of pipelined messages costs one wakeup.
+STATUS asd_msg_read(void)
+{
+    STATUS result = ST_ERR;
+    bool b_data_pending = false;
+    unsigned int reads = 0;
+
+    do
+    {
+        if (pipeline_running() &&
+            __atomic_load_n(&msg_state.pipeline.worker_status,
+                            __ATOMIC_ACQUIRE) == ST_ERR)
+        {
+            ASD_log(ASD_LogLevel_Error, ASD_LogStream_Daemon,
+                    ASD_LogOption_None,
+                    "Message worker failed to process a message");
+            return ST_ERR;
+        }
+        result = read_message_part();
+        if (result != ST_OK ||
+            asd_api_server_ioctl(NULL, &b_data_pending,
+                                 IOCTL_SERVER_IS_DATA_PENDING) != ST_OK)
+            break;
+    } while (b_data_pending && ++reads < MAX_READS_PER_EVENT);
+    return result;
+}
+
 void* get_packet_data(struct packet_data* packet, int bytes_wanted)
 {
     void* p;
@@ -2776,10 +3608,17 @@ int get_message_size(struct asd_message* s_message)
     return result;
 }
 
-STATUS send_response(struct asd_message* message)
+// The one way out to the client for responses, pin and BPK events and
+// remote logs alike. The server appends each message whole under its own
+// queue lock, so any thread may call this without waiting for the message
+// the worker is running. Pin events are produced under hw_lock by their
+// caller, a remote log may land between two responses as it is a message
+// type of its own.
+static STATUS queue_message(struct asd_message* message, unsigned int cmd)
 {
-    unsigned char send_buffer[MAX_PACKET_SIZE];
-    size_t send_buffer_size = 0;
+    struct iovec iov[2];
+    asd_msg_iov msg_iov = {iov, 0};
+    STATUS result;
 
     if (!message)
         return ST_ERR;
@@ -2811,28 +3650,32 @@ STATUS send_response(struct asd_message* message)
                    "NetRsp");
 #endif
 
-    send_buffer_size = sizeof(struct message_header) + size;
-
-    if (memcpy_s(&send_buffer, MAX_PACKET_SIZE,
-                 (unsigned char*)&message->header, sizeof(message->header)))
+    // Header and payload are queued as they are; the server copies them
+    // once into its output queue and flushes several responses per write.
+    iov[msg_iov.iovcnt].iov_base = &message->header;
+    iov[msg_iov.iovcnt++].iov_len = sizeof(message->header);
+    if (size > 0)
     {
-        ASD_log(ASD_LogLevel_Error, ASD_LogStream_JTAG, ASD_LogOption_None,
-                "memcpy_s: message header to send_buffer copy failed.");
-    }
-    if (memcpy_s(&send_buffer[sizeof(message->header)],
-                 MAX_PACKET_SIZE - sizeof(message->header), message->buffer,
-                 (size_t)size))
-    {
-        ASD_log(ASD_LogLevel_Error, ASD_LogStream_JTAG, ASD_LogOption_None,
-                "memcpy_s: message buffer to send buffer offset copy failed.");
+        iov[msg_iov.iovcnt].iov_base = message->buffer;
+        iov[msg_iov.iovcnt++].iov_len = (size_t)size;
     }
 
-    size = asd_api_server_write(send_buffer, send_buffer_size, NULL);
+    result = asd_api_server_ioctl(&msg_iov, NULL, cmd);
+    if (pipeline_running())
+        pipeline_output_queued();
+    return result;
+}
 
-    if (size != send_buffer_size)
-        return ST_ERR;
+STATUS send_response(struct asd_message* message)
+{
+    return queue_message(message, IOCTL_SERVER_QUEUE_MSG);
+}
 
-    return ST_OK;
+// Events and remote log messages are not answers to a request, the server
+// also hands them to the read-only observer sessions.
+STATUS send_event(struct asd_message* message)
+{
+    return queue_message(message, IOCTL_SERVER_QUEUE_EVENT);
 }
 
 STATUS asd_msg_get_fds(target_fdarr_t* fds, int* num_fds)
@@ -2850,7 +3693,9 @@ STATUS asd_msg_get_fds(target_fdarr_t* fds, int* num_fds)
         // skip target_get_fds call for AGENT_CONTROL_TYPE commands
         if (msg->header.type != AGENT_CONTROL_TYPE)
         {
+            hw_lock();
             result = target_get_fds(msg_state.target_handler, fds, num_fds);
+            hw_unlock();
         }
     }
     return result;
@@ -2868,7 +3713,7 @@ static STATUS send_pin_event(ASD_EVENT value)
     message.header.origin_id = BROADCAST_MESSAGE_ORIGIN_ID;
     message.buffer[0] = (value & 0xFF);
 
-    result = send_response(&message);
+    result = send_event(&message);
     if (result != ST_OK)
     {
         ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_No_Remote,
@@ -2925,7 +3770,7 @@ STATUS send_bpk_event(ASD_EVENT event, ASD_EVENT_DATA event_data)
     for (size_t i = 0; i < event_data.size; i++) {
         message.buffer[i+2] = event_data.buffer[i];
     }
-    result = send_response(&message);
+    result = send_event(&message);
     if (result != ST_OK)
     {
         ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_No_Remote,
@@ -2951,7 +3796,7 @@ STATUS send_bulk_bpk_event(struct asd_message * message,
                    ASD_LogOption_No_Remote, message->buffer,
                    response_cnt, "BulkRp");
 
-    result = send_response(message);
+    result = send_event(message);
     if (result != ST_OK)
     {
         ASD_log(ASD_LogLevel_Error, ASD_LogStream_SDK, ASD_LogOption_No_Remote,
@@ -3122,8 +3967,10 @@ STATUS asd_msg_event(struct pollfd poll_fd)
     ASD_EVENT_DATA event_data;
     uint8_t event_buffer[512] = {0};
     struct asd_message* msg = &msg_state.in_msg.msg;
+    hw_lock();
     if (msg_state.target_handler == NULL || !msg_state.target_handler->initialized)
     {
+        hw_unlock();
         return ST_ERR;
     }
     event_data.buffer = event_buffer;
@@ -3157,6 +4004,7 @@ STATUS asd_msg_event(struct pollfd poll_fd)
             result = send_pin_event(event);
         }
     }
+    hw_unlock();
     return result;
 }
 
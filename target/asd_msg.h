@@ -31,12 +31,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "config.h"
 
 #include <poll.h>
+#include <pthread.h>
 
 #include "asd_common.h"
 #include "i2c_handler.h"
 #include "i2c_msg_builder.h"
 #include "i3c_handler.h"
 #include "jtag_handler.h"
+#include "jtag_multi.h"
 #include "logging.h"
 #include "target_handler.h"
 #include "vprobe_handler.h"
@@ -65,6 +67,16 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // disabled and a separate process to monitor for events is suggested.
 #define SKIP_WAIT_CYCLES_DURING_RESET
 
+// Hand every fully received message to a dedicated hardware worker thread
+// so the socket thread can already read and decode message N+1 while the
+// scans of message N are running on the driver. Comment this out to
+// process each message inline on the socket thread.
+#define PIPELINE_MSG_PROCESSING
+
+// asd_msg_read keeps parsing while the server has received data buffered,
+// up to this many reads, then lets the event loop serve the other fds.
+#define MAX_READS_PER_EVENT 128
+
 typedef STATUS (*SendFunctionPtr)(unsigned char* buffer,
                                   size_t length);
 typedef STATUS (*ReadFunctionPtr)(void* connection, void* buffer,
@@ -85,12 +97,54 @@ typedef struct incoming_msg
     struct asd_message msg;
 } incoming_msg;
 
+// Single producer / single consumer ring of received messages. head is
+// only written by the socket thread and tail only by the hardware worker,
+// both with atomic stores, so neither side takes a lock to push or pop.
+// lock and changed are only used to park a thread that has to wait: it
+// registers in waiters before checking again under lock, and whoever moves
+// one of the fields only broadcasts when somebody is parked.
+typedef struct msg_pipeline
+{
+    struct asd_message ring[NUM_IN_FLIGHT_BUFFERS_TO_USE];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    unsigned int waiters;
+    unsigned int head;
+    unsigned int tail;
+    // set by whichever thread is touching the handlers: the worker while
+    // it executes a message, the socket thread while it services pin events
+    bool hw_busy;
+    // bumped every time the worker queues output for the client
+    unsigned int queued_out;
+    bool exited;
+    pthread_t worker;
+    bool running;
+    STATUS worker_status;
+} msg_pipeline;
+
+// Extended scan whose TDI is still arriving, it may span JTAG messages.
+typedef struct ext_scan
+{
+    bool pending;
+    uint8_t cmd;
+    uint32_t bits;
+    // TDI bytes staged so far
+    uint32_t received;
+    // as resolved by annotate_scan_end_states() for the message the scan
+    // ends in
+    uint8_t end_state;
+    // TDI going out and TDO coming back, one driver xfer for the whole scan
+    unsigned char tdio[EXT_SCAN_MAX_BITS / 8];
+} ext_scan;
+
 typedef struct ASD_MSG
 {
     config* asd_cfg;
     struct incoming_msg in_msg;
     struct asd_message out_msg;
     JTAG_Handler* jtag_handler;
+    // multi-chain controllers, created on the first multi-chain select
+    JTAG_Multi* jtag_multi;
     Target_Control_Handle* target_handler;
     bus_config* buscfg;
     I2C_Handler* i2c_handler;
@@ -101,8 +155,10 @@ typedef struct ASD_MSG
     LogFunctionPtr send_remote_logging_message;
     unsigned char prdy_timeout;
     JTAG_CHAIN_SELECT_MODE jtag_chain_mode;
+    ext_scan ext_scan;
     char bmc_version[120];
     int bmc_version_size;
+    msg_pipeline pipeline;
 } ASD_MSG;
 
 struct packet_data
@@ -118,24 +174,71 @@ typedef enum
     ScanType_ReadWrite
 } ScanType;
 
+// Resolved end states of scan opcodes, other than a real jtag_states value.
+// SCAN_END_CURRENT (jtag_multi.h): nothing moves the TAP afterwards, stay
+// where the scan leaves it. SCAN_END_INVALID: the scan is followed by an
+// illegal command. SCAN_END_FOLDED marks a TAP_STATE opcode whose move was
+// made part of the scan before it, other TAP_STATE opcodes are marked
+// SCAN_END_CURRENT.
+#define SCAN_END_FOLDED 0xfd
+#define SCAN_END_INVALID 0xff
+
+// Decode state of one JTAG message while its opcodes are interpreted.
+typedef struct jtag_interp
+{
+    struct packet_data packet;
+    // header of the request, repeated on every response packet
+    const struct message_header* header;
+    u_int32_t response_cnt;
+    // offset of the opcode being executed within the message
+    unsigned int cmd_offset;
+    // end state of the scan opcode at each offset, or whether the
+    // TAP_STATE opcode there was folded, filled in by
+    // annotate_scan_end_states() before the message is executed
+    uint8_t scan_end_state[MAX_DATA_SIZE];
+    // end state of the pending extended scan whose TDI opens the message
+    uint8_t ext_end_state;
+} jtag_interp;
+
+typedef STATUS (*JTAGOpcodeHandler)(jtag_interp* interp, uint8_t cmd,
+                                    unsigned char* operands);
+
+typedef struct jtag_opcode
+{
+    JTAGOpcodeHandler handler;
+    // fixed operand bytes following the opcode, validated before the
+    // handler runs; handlers with variable trailers read those themselves
+    uint8_t operand_len;
+    // queued scans must reach the driver before this opcode executes
+    bool flush_scans;
+} jtag_opcode;
+
+extern const jtag_opcode jtag_opcodes[256];
+
 extern int asd_poll_timeout_ms;
 
 STATUS asd_msg_init(config* asd_cfg);
 STATUS asd_msg_free(void);
 STATUS asd_msg_on_msg_recv(void);
+STATUS msg_pipeline_start(void);
+void msg_pipeline_stop(void);
+STATUS msg_pipeline_push(struct asd_message* msg);
 int get_message_size(struct asd_message* s_message);
 uint8_t lsb_from_msg_size(u_int32_t response_cnt);
 uint8_t msb_from_msg_size(u_int32_t response_cnt);
-STATUS determine_shift_end_state(ScanType scan_type,
-                                 struct packet_data* packet,
-                                 enum jtag_states* end_state);
+void annotate_scan_end_states(jtag_interp* interp,
+                              const unsigned char* buffer, unsigned int size);
 STATUS asd_msg_read(void);
 void send_error_message(struct asd_message* input_message,
                         ASDError cmd_stat);
 STATUS send_response(struct asd_message* message);
+STATUS send_event(struct asd_message* message);
+void send_remote_log_record(ASD_LogLevel asd_level, ASD_LogStream asd_stream,
+                            const unsigned char* record, size_t len);
 STATUS asd_msg_get_fds(target_fdarr_t* fds, int* num_fds);
 STATUS asd_msg_event(struct pollfd poll_fd);
 STATUS process_i2c_messages(struct asd_message* in_msg);
+STATUS process_jtag_message(struct asd_message* s_message);
 STATUS do_read_command(uint8_t cmd, I2C_Msg_Builder* builder,
                        struct packet_data* packet, bool* force_stop);
 STATUS do_write_command(uint8_t cmd, I2C_Msg_Builder* builder,
@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "asd_stats.h"
+
+#include "logging.h"
+
+ASD_Histogram asd_stats[ASD_Stage_Count];
+
+static const char* stage_names[ASD_Stage_Count] = {
+    "socket_read",  "decode_agent", "decode_jtag",   "decode_i2c",
+    "decode_spp",   "jtag_xfer",    "jtag_bitbang",  "jtag_state",
+    "jtag_freq",    "i2c_rdwr",     "i3c_priv_xfer", "spp_write",
+    "spp_read",     "prdy_wait",    "response_send", "tls_handshake",
+    "tls_resume"};
+
+const char* ASD_stats_stage_name(ASD_Stage stage)
+{
+    if (stage >= ASD_Stage_Count)
+        return "unknown";
+    return stage_names[stage];
+}
+
+//
+// Smallest value accounted to bucket, the inverse of ASD_stats_bucket.
+//
+uint64_t ASD_stats_bucket_floor(unsigned int bucket)
+{
+    unsigned int octave = bucket >> ASD_STATS_SUB_BITS;
+    uint64_t mantissa = bucket & ((1U << ASD_STATS_SUB_BITS) - 1);
+
+    if (octave == 0)
+        return mantissa;
+    return ((1ULL << ASD_STATS_SUB_BITS) + mantissa) << (octave - 1);
+}
+
+//
+// Copy a stage out, and clear it when reset is set. Counters are read one
+// by one while other threads keep recording, the copy is only consistent
+// to within the samples recorded meanwhile.
+//
+void ASD_stats_snapshot(ASD_Stage stage, ASD_Histogram* snapshot, bool reset)
+{
+    ASD_Histogram* histogram = &asd_stats[stage];
+
+    if (reset)
+    {
+        snapshot->count =
+            __atomic_exchange_n(&histogram->count, 0, __ATOMIC_RELAXED);
+        snapshot->sum_ns =
+            __atomic_exchange_n(&histogram->sum_ns, 0, __ATOMIC_RELAXED);
+        snapshot->max_ns =
+            __atomic_exchange_n(&histogram->max_ns, 0, __ATOMIC_RELAXED);
+        for (unsigned int i = 0; i < ASD_STATS_BUCKETS; i++)
+            snapshot->buckets[i] = __atomic_exchange_n(&histogram->buckets[i],
+                                                       0, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        snapshot->count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+        snapshot->sum_ns =
+            __atomic_load_n(&histogram->sum_ns, __ATOMIC_RELAXED);
+        snapshot->max_ns =
+            __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+        for (unsigned int i = 0; i < ASD_STATS_BUCKETS; i++)
+            snapshot->buckets[i] =
+                __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+//
+// Upper bound of the bucket holding the per_10k-th sample, 5000 is the
+// median. Never above the largest value recorded.
+//
+uint64_t ASD_stats_percentile(const ASD_Histogram* histogram,
+                              unsigned int per_10k)
+{
+    uint64_t total = 0;
+    uint64_t rank;
+    uint64_t seen = 0;
+
+    for (unsigned int i = 0; i < ASD_STATS_BUCKETS; i++)
+        total += histogram->buckets[i];
+    if (total == 0)
+        return 0;
+    rank = (total * per_10k + 9999) / 10000;
+    if (rank == 0)
+        rank = 1;
+
+    for (unsigned int i = 0; i < ASD_STATS_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t upper = i + 1 < ASD_STATS_BUCKETS
+                                 ? ASD_stats_bucket_floor(i + 1) - 1
+                                 : histogram->max_ns;
+            return upper < histogram->max_ns ? upper : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+static size_t put_le(unsigned char* buffer, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++)
+        buffer[i] = (unsigned char)(value >> (8 * i));
+    return bytes;
+}
+
+//
+// Build the LATENCY_STATS_CMD response payload, returns its size or -1.
+//
+// Without request data it describes the histograms: number of stages,
+// ASD_STATS_SUB_BITS and ASD_STATS_MAX_BITS. Otherwise request[0] is the
+// stage and request[1] optional flags (ASD_STATS_RESET); the payload is the
+// stage, count, sum and max in ns (64 bit), the number of non-empty buckets
+// (16 bit) and for each of them its index (16 bit) and count (32 bit,
+// saturated). Integers are little endian.
+//
+int ASD_stats_encode(const unsigned char* request, int request_size,
+                     unsigned char* buffer, size_t size)
+{
+    ASD_Histogram snapshot;
+    size_t used = 0;
+    size_t count_pos;
+    uint16_t non_empty = 0;
+
+    if (request_size <= 0)
+    {
+        if (size < 3)
+            return -1;
+        buffer[0] = ASD_Stage_Count;
+        buffer[1] = ASD_STATS_SUB_BITS;
+        buffer[2] = ASD_STATS_MAX_BITS;
+        return 3;
+    }
+    if (request == NULL || request[0] >= ASD_Stage_Count)
+        return -1;
+
+    // worst case, every bucket in use
+    if (size < 1 + 3 * 8 + 2 + ASD_STATS_BUCKETS * 6)
+        return -1;
+
+    ASD_stats_snapshot((ASD_Stage)request[0], &snapshot,
+                       request_size > 1 && (request[1] & ASD_STATS_RESET));
+    buffer[used++] = request[0];
+    used += put_le(&buffer[used], snapshot.count, 8);
+    used += put_le(&buffer[used], snapshot.sum_ns, 8);
+    used += put_le(&buffer[used], snapshot.max_ns, 8);
+    count_pos = used;
+    used += 2;
+    for (unsigned int i = 0; i < ASD_STATS_BUCKETS; i++)
+    {
+        if (snapshot.buckets[i] == 0)
+            continue;
+        used += put_le(&buffer[used], i, 2);
+        used += put_le(&buffer[used],
+                       snapshot.buckets[i] > UINT32_MAX ? UINT32_MAX
+                                                        : snapshot.buckets[i],
+                       4);
+        non_empty++;
+    }
+    put_le(&buffer[count_pos], non_empty, 2);
+    return (int)used;
+}
+
+//
+// Log every stage that saw traffic, on SIGUSR1. Logged as a warning so that
+// the default log level shows it.
+//
+void ASD_stats_dump(void)
+{
+    ASD_Histogram snapshot;
+
+    ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+            ASD_LogOption_No_Remote,
+            "%-14s %10s %10s %10s %10s %10s %10s", "stage", "count",
+            "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+    for (int stage = 0; stage < ASD_Stage_Count; stage++)
+    {
+        ASD_stats_snapshot((ASD_Stage)stage, &snapshot, false);
+        if (snapshot.count == 0)
+            continue;
+        ASD_log(ASD_LogLevel_Warning, ASD_LogStream_Daemon,
+                ASD_LogOption_No_Remote,
+                "%-14s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f",
+                stage_names[stage], (unsigned long long)snapshot.count,
+                (double)snapshot.sum_ns / (double)snapshot.count / 1e3,
+                (double)ASD_stats_percentile(&snapshot, 5000) / 1e3,
+                (double)ASD_stats_percentile(&snapshot, 9900) / 1e3,
+                (double)ASD_stats_percentile(&snapshot, 9990) / 1e3,
+                (double)snapshot.max_ns / 1e3);
+    }
+}
@@ -126,6 +126,15 @@ STATUS asd_target_ioctl(void* input, void* output, unsigned int cmd)
             send_remote_log_message(remote_log->level, remote_log->stream, remote_log->msg);
             status = ST_OK;
             break;
+        case IOCTL_TARGET_SEND_REMOTE_LOG_RECORD:
+            if (input == NULL)
+                break;
+            asd_target_remote_log_record * log_record =
+                (asd_target_remote_log_record *)input;
+            send_remote_log_record(log_record->level, log_record->stream,
+                                   log_record->record, log_record->len);
+            status = ST_OK;
+            break;
         case IOCTL_TARGET_GET_I2C_I3C_BUS_CONFIG:
             if (output == NULL)
                 break;
@@ -145,6 +154,10 @@ static STATUS asd_target_process_all_pin_events(const struct pollfd* poll_fds, s
     // requests on the network.
     while(1)
     {
+        // Do not sit on queued events while waiting for the next one.
+        if (asd_poll_timeout_ms)
+            asd_api_server_ioctl(NULL, NULL, IOCTL_SERVER_FLUSH_MSGS);
+
         // Check if there has been a target event.
         poll_result = poll(poll_fds, num_fds, asd_poll_timeout_ms);
         if (poll_result <= 0)
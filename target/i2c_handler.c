@@ -44,6 +44,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <linux/i2c.h>
 // clang-format on
 
+#include "asd_stats.h"
 #include "logging.h"
 
 #define I2C_DEV_FILE_NAME "/dev/i2c"
@@ -165,7 +166,9 @@ STATUS i2c_read_write(I2C_Handler* state, void* msg_set)
         return ST_ERR;
     struct i2c_rdwr_ioctl_data* ioctl_data = msg_set;
 
+    uint64_t start = ASD_stats_now();
     int ret = ioctl(state->i2c_driver_handle, I2C_RDWR, ioctl_data);
+    ASD_stats_record(ASD_Stage_I2cRdwr, start);
 
     if (ret != ioctl_data->nmsgs)
     {
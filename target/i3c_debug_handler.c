@@ -27,6 +27,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "i3c_debug_handler.h"
 
+#include <stdio.h>
+
+#include "asd_stats.h"
+
 void debug_i3c_rx(i3c_cmd* cmd, int device_index)
 {
     if (cmd->read_len > 0 && cmd->rx_buffer != NULL)
@@ -135,7 +139,9 @@ ssize_t rx_i3c(int fd, uint8_t* buffer, int16_t read_len)
 {
     ssize_t read_ret = -1;
     memset(buffer, 0, read_len);
+    uint64_t start = ASD_stats_now();
     read_ret = read(fd, buffer, read_len);
+    ASD_stats_record(ASD_Stage_SppRead, start);
     ASD_log(ASD_LogLevel_Debug, ASD_LogStream_SPP, ASD_LogOption_None,
                 "Read: %i, errno=%i", read_ret, errno);
     if (read_ret < 0)
@@ -233,7 +239,9 @@ STATUS send_i3c_cmd(SPP_Handler* state, i3c_cmd *cmd)
     }
     debug_i3c_tx(cmd, state->device_index);
 
+    uint64_t start = ASD_stats_now();
     write_ret = write(state->spp_driver_handle, cmd->tx_buffer, cmd->write_len);
+    ASD_stats_record(ASD_Stage_SppWrite, start);
     if (write_ret < 0)
     {
         ASD_log(ASD_LogLevel_Error, ASD_LogStream_SPP, ASD_LogOption_None,
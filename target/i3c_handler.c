@@ -51,6 +51,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <dirent.h>
 // clang-format on
 
+#include "asd_stats.h"
 #include "logging.h"
 
 #define I3C_DEV_FILE_NAME "/dev/i3c"
@@ -379,7 +380,9 @@ STATUS i3c_read_write(I3C_Handler* state, void* msg_set)
 
     if (handle != UNINITIALIZED_I3C_DRIVER_HANDLE)
     {
+        uint64_t start = ASD_stats_now();
         int ret = ioctl(handle, I3C_IOC_PRIV_XFER(ioctl_data->nmsgs), xfers);
+        ASD_stats_record(ASD_Stage_I3cPrivXfer, start);
         if (ret < 0)
         {
             ASD_log(ASD_LogLevel_Error, stream, option,
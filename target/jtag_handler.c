@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "jtag_handler.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -34,11 +35,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 // clang-format off
 #include <safe_mem_lib.h>
 // clang-format on
 
+#include "asd_stats.h"
 #include "logging.h"
 
 static const ASD_LogStream stream = ASD_LogStream_JTAG;
@@ -47,6 +50,24 @@ static const char* JtagStatesString[] = {
     "TLR",   "RTI",   "SelDR", "CapDR", "ShfDR", "Ex1DR", "PauDR", "Ex2DR",
     "UpdDR", "SelIR", "CapIR", "ShfIR", "Ex1IR", "PauIR", "Ex2IR", "UpdIR"};
 
+const uint8_t JTAG_tap_next[JTAG_TAP_STATES][2] = {
+    {jtag_rti, jtag_tlr},        // TLR
+    {jtag_rti, jtag_sel_dr},     // RTI
+    {jtag_cap_dr, jtag_sel_ir},  // SelDR
+    {jtag_shf_dr, jtag_ex1_dr},  // CapDR
+    {jtag_shf_dr, jtag_ex1_dr},  // ShfDR
+    {jtag_pau_dr, jtag_upd_dr},  // Ex1DR
+    {jtag_pau_dr, jtag_ex2_dr},  // PauDR
+    {jtag_shf_dr, jtag_upd_dr},  // Ex2DR
+    {jtag_rti, jtag_sel_dr},     // UpdDR
+    {jtag_cap_ir, jtag_tlr},     // SelIR
+    {jtag_shf_ir, jtag_ex1_ir},  // CapIR
+    {jtag_shf_ir, jtag_ex1_ir},  // ShfIR
+    {jtag_pau_ir, jtag_upd_ir},  // Ex1IR
+    {jtag_pau_ir, jtag_ex2_ir},  // PauIR
+    {jtag_shf_ir, jtag_upd_ir},  // Ex2IR
+    {jtag_rti, jtag_sel_dr}};    // UpdIR
+
 #ifdef JTAG_LEGACY_DRIVER
 STATUS JTAG_clock_cycle(int handle, unsigned char tms, unsigned char tdi);
 #endif
@@ -55,6 +76,28 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
                      unsigned int output_bytes, unsigned char* output,
                      enum jtag_states current_tap_state,
                      enum jtag_states end_tap_state);
+static STATUS set_tap_state(JTAG_Handler* state, enum jtag_states tap_state);
+static STATUS sync_tap_state(JTAG_Handler* state);
+static STATUS shift(JTAG_Handler* state, unsigned int number_of_bits,
+                    unsigned int input_bytes, unsigned char* input,
+                    unsigned int output_bytes, unsigned char* output,
+                    enum jtag_states end_tap_state);
+static STATUS padded_shift(JTAG_Handler* state, unsigned int pre_bits,
+                           unsigned int post_bits, const unsigned char* pad,
+                           unsigned int number_of_bits,
+                           unsigned int input_bytes, unsigned char* input,
+                           unsigned int output_bytes, unsigned char* output,
+                           enum jtag_states current_tap_state,
+                           enum jtag_states end_tap_state);
+static void copy_bits(unsigned char* dest, unsigned int dest_offset,
+                      const unsigned char* src, unsigned int src_offset,
+                      unsigned int number_of_bits);
+static STATUS wait_cycles(JTAG_Handler* state, unsigned int number_of_cycles);
+static STATUS wait_idle(JTAG_Handler* state, unsigned int number_of_cycles);
+static STATUS set_jtag_tck(JTAG_Handler* state, unsigned int tck);
+#ifndef JTAG_LEGACY_DRIVER
+static int jtag_ioctl(JTAG_Handler* state, unsigned long request, void* arg);
+#endif
 
 void initialize_jtag_chains(JTAG_Handler* state)
 {
@@ -65,6 +108,8 @@ void initialize_jtag_chains(JTAG_Handler* state)
         state->chains[i].shift_padding.irPre = 0;
         state->chains[i].shift_padding.irPost = 0;
         state->chains[i].tap_state = jtag_tlr;
+        state->chains[i].driver_tap_state = jtag_tlr;
+        state->chains[i].tap_resync = false;
         state->chains[i].scan_state = JTAGScanState_Done;
     }
 }
@@ -84,6 +129,15 @@ JTAG_Handler* JTAGHandler()
              sizeof(state->padDataOne));
     explicit_bzero(state->padDataZero, sizeof(state->padDataZero));
     state->JTAG_driver_handle = -1;
+    state->controller = 0;
+    state->tck_frequency = 0;
+    state->backend = JTAG_Backend_Driver;
+    state->sim_chain = NULL;
+    state->sim = NULL;
+    state->scan_program.count = 0;
+    state->scan_program.total_bits = 0;
+    state->trace = NULL;
+    explicit_bzero(&state->tap_stats, sizeof(state->tap_stats));
 
     for (unsigned int i = 0; i < MAX_WAIT_CYCLES; i++)
     {
@@ -112,6 +166,102 @@ STATUS JTAG_clock_cycle(int handle, unsigned char tms, unsigned char tdi)
 }
 #endif
 
+#ifndef JTAG_LEGACY_DRIVER
+//
+// Route a driver request to the selected backend, timing the requests that
+// drive the TAP.
+//
+static int jtag_ioctl(JTAG_Handler* state, unsigned long request, void* arg)
+{
+    uint64_t start = ASD_stats_now();
+    ASD_Stage stage;
+    int ret;
+
+    if (state->sim != NULL)
+        ret = JTAG_sim_ioctl(state->sim, request, arg);
+    else
+        ret = ioctl(state->JTAG_driver_handle, request, arg);
+
+    switch (request)
+    {
+        case JTAG_IOCXFER:
+            stage = ASD_Stage_JtagXfer;
+            break;
+        case JTAG_IOCBITBANG:
+            stage = ASD_Stage_JtagBitbang;
+            break;
+        case JTAG_SIOCSTATE:
+            stage = ASD_Stage_JtagState;
+            break;
+        case JTAG_SIOCFREQ:
+            stage = ASD_Stage_JtagFreq;
+            break;
+        default:
+            return ret;
+    }
+    ASD_stats_record(stage, start);
+    return ret;
+}
+#endif
+
+static void close_backend(JTAG_Handler* state)
+{
+    if (state->sim != NULL)
+    {
+        JTAG_sim_destroy(state->sim);
+        state->sim = NULL;
+    }
+    else
+    {
+        close(state->JTAG_driver_handle);
+    }
+    state->JTAG_driver_handle = -1;
+}
+
+//
+// Select the backend JTAG_initialize opens, the driver by default.
+//
+STATUS JTAG_set_backend(JTAG_Handler* state, JTAG_Backend backend,
+                        const char* sim_chain)
+{
+    if (state == NULL || state->JTAG_driver_handle != -1 ||
+        state->sim != NULL)
+        return ST_ERR;
+
+#ifdef JTAG_LEGACY_DRIVER
+    if (backend == JTAG_Backend_Simulator)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "The JTAG simulator needs the jtag.h driver interface");
+        return ST_ERR;
+    }
+#endif
+    state->backend = backend;
+    state->sim_chain = sim_chain;
+    return ST_OK;
+}
+
+//
+// Select the /dev/jtagN controller JTAG_initialize opens, 0 by default.
+//
+STATUS JTAG_set_controller(JTAG_Handler* state, unsigned int controller)
+{
+    if (state == NULL || state->JTAG_driver_handle != -1 ||
+        state->sim != NULL)
+        return ST_ERR;
+
+#ifdef JTAG_LEGACY_DRIVER
+    if (controller != 0)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "The legacy JTAG driver has a single controller");
+        return ST_ERR;
+    }
+#endif
+    state->controller = controller;
+    return ST_OK;
+}
+
 STATUS JTAG_initialize(JTAG_Handler* state, bool sw_mode)
 {
 #ifndef JTAG_LEGACY_DRIVER
@@ -122,30 +272,41 @@ STATUS JTAG_initialize(JTAG_Handler* state, bool sw_mode)
         return ST_ERR;
 
     state->sw_mode = sw_mode;
+    state->tck_frequency = 0;
     ASD_log(ASD_LogLevel_Info, stream, option, "JTAG mode set to '%s'.",
             state->sw_mode ? "software" : "hardware");
 
+    if (state->backend == JTAG_Backend_Simulator)
+    {
+        state->sim = JTAG_sim_create(state->sim_chain);
+        if (state->sim == NULL)
+            return ST_ERR;
+    }
+    else
+    {
 #ifdef JTAG_LEGACY_DRIVER
-    state->JTAG_driver_handle = open("/dev/jtag", O_RDWR);
+        state->JTAG_driver_handle = open("/dev/jtag", O_RDWR);
 #else
-    state->JTAG_driver_handle = open("/dev/jtag0", O_RDWR);
+        char device[sizeof("/dev/jtag") + 10];
+        snprintf(device, sizeof(device), "/dev/jtag%u", state->controller);
+        state->JTAG_driver_handle = open(device, O_RDWR);
 #endif
-    if (state->JTAG_driver_handle == -1)
-    {
-        ASD_log(ASD_LogLevel_Error, stream, option,
-                "Can't open /dev/jtag, please install driver");
-        return ST_ERR;
+        if (state->JTAG_driver_handle == -1)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "Can't open /dev/jtag, please install driver");
+            return ST_ERR;
+        }
     }
 
 #ifndef JTAG_LEGACY_DRIVER
     jtag_mode.feature = JTAG_XFER_MODE;
     jtag_mode.mode = sw_mode ? JTAG_XFER_SW_MODE : JTAG_XFER_HW_MODE;
-    if (ioctl(state->JTAG_driver_handle, JTAG_SIOCMODE, &jtag_mode))
+    if (jtag_ioctl(state, JTAG_SIOCMODE, &jtag_mode))
     {
         ASD_log(ASD_LogLevel_Error, stream, option,
                 "Failed JTAG_SIOCMODE to set xfer mode");
-        close(state->JTAG_driver_handle);
-        state->JTAG_driver_handle = -1;
+        close_backend(state);
         return ST_ERR;
     }
 #endif
@@ -154,8 +315,7 @@ STATUS JTAG_initialize(JTAG_Handler* state, bool sw_mode)
     {
         ASD_log(ASD_LogLevel_Error, stream, option,
                 "Failed to reset tap state.");
-        close(state->JTAG_driver_handle);
-        state->JTAG_driver_handle = -1;
+        close_backend(state);
         return ST_ERR;
     }
 
@@ -168,8 +328,17 @@ STATUS JTAG_deinitialize(JTAG_Handler* state)
     if (state == NULL)
         return ST_ERR;
 
-    close(state->JTAG_driver_handle);
-    state->JTAG_driver_handle = -1;
+    // leave the TAP where the client last asked for it
+    if (state->JTAG_driver_handle != -1 || state->sim != NULL)
+        sync_tap_state(state);
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "TAP state: %llu moves, %llu ioctls, %llu folded into scans",
+            (unsigned long long)state->tap_stats.requests,
+            (unsigned long long)state->tap_stats.ioctls,
+            (unsigned long long)state->tap_stats.folded);
+    close_backend(state);
+    state->scan_program.count = 0;
+    state->scan_program.total_bits = 0;
 
     return ST_OK;
 }
@@ -234,39 +403,200 @@ STATUS JTAG_tap_reset(JTAG_Handler* state)
 //
 STATUS JTAG_set_tap_state(JTAG_Handler* state, enum jtag_states tap_state)
 {
+    JTAG_Trace_Record* record;
+    STATUS status;
+
     if (state == NULL)
         return ST_ERR;
-#ifdef JTAG_LEGACY_DRIVER
-    struct tap_state_param params;
-    params.mode = state->sw_mode ? SW_MODE : HW_MODE;
-    params.from_state = state->active_chain->tap_state;
-    params.to_state = tap_state;
-#else
+
+    record = JTAG_trace_begin(state->trace, JTAG_Trace_Op_TapState,
+                              (uint8_t)state->active_chain->tap_state,
+                              (uint8_t)tap_state, 0, 0, NULL, 0);
+    status = set_tap_state(state, tap_state);
+    JTAG_trace_commit(state->trace, record, NULL, status);
+    return status;
+}
+
+#ifndef JTAG_LEGACY_DRIVER
+//
+// Breadth first walk of the TAP graph from a state: the length of the
+// shortest TMS path to every state and how many such paths there are.
+//
+static void tap_paths(uint8_t from, uint8_t distance[], uint8_t paths[])
+{
+    uint8_t queue[JTAG_TAP_STATES];
+    unsigned int head = 0;
+    unsigned int tail = 0;
+
+    memset_s(distance, JTAG_TAP_STATES, 0xff, JTAG_TAP_STATES);
+    explicit_bzero(paths, JTAG_TAP_STATES);
+    distance[from] = 0;
+    paths[from] = 1;
+    queue[tail++] = from;
+    while (head < tail)
+    {
+        uint8_t at = queue[head++];
+        for (int tms = 0; tms < 2; tms++)
+        {
+            uint8_t to = JTAG_tap_next[at][tms];
+            if (distance[to] == 0xff)
+            {
+                distance[to] = distance[at] + 1;
+                queue[tail++] = to;
+            }
+            if (distance[to] == distance[at] + 1)
+                paths[to] += paths[at];
+        }
+    }
+}
+
+//
+// True when the only shortest path from driver to to runs through via, so
+// the driver walking driver->to in one request clocks the TAP exactly as
+// driver->via followed by via->to would.
+//
+static bool tap_on_path(enum jtag_states driver, enum jtag_states via,
+                        enum jtag_states to)
+{
+    uint8_t from_driver[JTAG_TAP_STATES];
+    uint8_t driver_paths[JTAG_TAP_STATES];
+    uint8_t from_via[JTAG_TAP_STATES];
+    uint8_t via_paths[JTAG_TAP_STATES];
+
+    if (driver >= JTAG_TAP_STATES || via >= JTAG_TAP_STATES ||
+        to >= JTAG_TAP_STATES)
+        return false;
+    tap_paths((uint8_t)driver, from_driver, driver_paths);
+    tap_paths((uint8_t)via, from_via, via_paths);
+    return driver_paths[to] == 1 &&
+           from_driver[via] + from_via[to] == from_driver[to];
+}
+
+//
+// Issue a JTAG_SIOCSTATE request and track where it left the TAP.
+//
+static STATUS tap_state_ioctl(JTAG_Handler* state,
+                              struct jtag_tap_state* tap_state_t)
+{
+    JTAG_Chain_State* chain = state->active_chain;
+
+    state->tap_stats.ioctls++;
+    if (jtag_ioctl(state, JTAG_SIOCSTATE, tap_state_t) < 0)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "ioctl AST_JTAG_SET_TAPSTATE failed");
+        chain->tap_resync = true;
+        return ST_ERR;
+    }
+    chain->driver_tap_state = tap_state_t->endstate;
+    chain->tap_resync = false;
+    return ST_OK;
+}
+#endif
+
+//
+// Move the TAP to the state the client last asked for, if a move is still
+// deferred.
+//
+static STATUS sync_tap_state(JTAG_Handler* state)
+{
+#ifndef JTAG_LEGACY_DRIVER
+    JTAG_Chain_State* chain = state->active_chain;
     struct jtag_tap_state tap_state_t;
-    tap_state_t.from = state->active_chain->tap_state;
-    tap_state_t.endstate = tap_state;
-    tap_state_t.reset =
-        (tap_state == jtag_tlr) ? JTAG_FORCE_RESET : JTAG_NO_RESET;
+
+    if (chain->driver_tap_state == chain->tap_state && !chain->tap_resync)
+        return ST_OK;
+
+    // after a failed request only the driver knows where the TAP is
+    tap_state_t.from =
+        chain->tap_resync ? JTAG_STATE_CURRENT : chain->driver_tap_state;
+    tap_state_t.endstate = chain->tap_state;
+    tap_state_t.reset = JTAG_NO_RESET;
     tap_state_t.tck = 0;
+    return tap_state_ioctl(state, &tap_state_t);
+#else
+    return ST_OK;
 #endif
+}
+
+STATUS JTAG_sync_tap_state(JTAG_Handler* state)
+{
+    if (state == NULL)
+        return ST_ERR;
+    return sync_tap_state(state);
+}
+
+//
+// Account a TAP_STATE command the caller made part of the end state of the
+// scan before it, the TAP has already moved past it.
+//
+STATUS JTAG_tap_state_folded(JTAG_Handler* state)
+{
+    if (state == NULL)
+        return ST_ERR;
+    state->tap_stats.folded++;
+    return ST_OK;
+}
+
+//
+// Requests for the state the TAP is already in cost nothing. In software
+// mode a move is deferred as long as it continues the driver's shortest
+// path from where it left the TAP, so RTI->SelDR->CapDR->ShfDR becomes a
+// single request. A move leaving that path flushes the deferred one first,
+// Capture and Update have side effects and must still be clocked.
+//
+static STATUS set_tap_state(JTAG_Handler* state, enum jtag_states tap_state)
+{
+    JTAG_Chain_State* chain = state->active_chain;
+
+    state->tap_stats.requests++;
+    if (tap_state != jtag_tlr && tap_state == chain->tap_state &&
+        !chain->tap_resync)
+        return ST_OK;
 
 #ifdef JTAG_LEGACY_DRIVER
-    if (ioctl(state->JTAG_driver_handle, AST_JTAG_SET_TAPSTATE, &params)
-#else
-  // Workaround to skip intermediate steps when using HW2 mode.
-  if (tap_state_t.reset || state->sw_mode)
-  {
-    if (ioctl(state->JTAG_driver_handle, JTAG_SIOCSTATE, &tap_state_t)
-#endif
-        < 0)
+    struct tap_state_param params;
+    params.mode = state->sw_mode ? SW_MODE : HW_MODE;
+    params.from_state = chain->tap_state;
+    params.to_state = tap_state;
+
+    state->tap_stats.ioctls++;
+    if (ioctl(state->JTAG_driver_handle, AST_JTAG_SET_TAPSTATE, &params) < 0)
     {
         ASD_log(ASD_LogLevel_Error, stream, option,
                 "ioctl AST_JTAG_SET_TAPSTATE failed");
         return ST_ERR;
     }
-  }
+    chain->driver_tap_state = tap_state;
+#else
+    if (tap_state == jtag_tlr)
+    {
+        struct jtag_tap_state tap_state_t;
+        tap_state_t.from = chain->tap_resync ? JTAG_STATE_CURRENT
+                                             : chain->driver_tap_state;
+        tap_state_t.endstate = jtag_tlr;
+        tap_state_t.reset = JTAG_FORCE_RESET;
+        tap_state_t.tck = 0;
+        if (tap_state_ioctl(state, &tap_state_t) != ST_OK)
+            return ST_ERR;
+    }
+    else if (state->sw_mode)
+    {
+        if (!chain->tap_resync &&
+            !tap_on_path(chain->driver_tap_state, chain->tap_state,
+                         tap_state) &&
+            sync_tap_state(state) != ST_OK)
+            return ST_ERR;
+    }
+    else
+    {
+        // Workaround to skip intermediate steps when using HW2 mode, the
+        // driver moves the TAP along with the next xfer.
+        chain->driver_tap_state = tap_state;
+    }
+#endif
 
-    state->active_chain->tap_state = tap_state;
+    chain->tap_state = tap_state;
 
     ASD_log(ASD_LogLevel_Info, stream, option, "Goto state: %s (%d)",
             tap_state >=
@@ -297,9 +627,33 @@ STATUS JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
                   unsigned int output_bytes, unsigned char* output,
                   enum jtag_states end_tap_state)
 {
+    JTAG_Trace_Record* record = NULL;
+    unsigned int bytes = DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE);
+    STATUS status;
+
     if (state == NULL)
         return ST_ERR;
 
+    if (state->trace)
+    {
+        // TDI is taken before the shift, input may be the TDO buffer.
+        record = JTAG_trace_begin(
+            state->trace, JTAG_Trace_Op_Shift,
+            (uint8_t)state->active_chain->tap_state, (uint8_t)end_tap_state,
+            number_of_bits, input_bytes < bytes ? input_bytes : bytes, input,
+            output ? (output_bytes < bytes ? output_bytes : bytes) : 0);
+    }
+    status = shift(state, number_of_bits, input_bytes, input, output_bytes,
+                   output, end_tap_state);
+    JTAG_trace_commit(state->trace, record, output, status);
+    return status;
+}
+
+static STATUS shift(JTAG_Handler* state, unsigned int number_of_bits,
+                    unsigned int input_bytes, unsigned char* input,
+                    unsigned int output_bytes, unsigned char* output,
+                    enum jtag_states end_tap_state)
+{
 #ifndef JTAG_LEGACY_DRIVER
     if (!state->sw_mode)
         return JTAG_shift_hw(state, number_of_bits, input_bytes, input,
@@ -310,6 +664,9 @@ STATUS JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
     unsigned int postFix = 0;
     unsigned char* padData = NULL;
     enum jtag_states current_state;
+
+    if (sync_tap_state(state) != ST_OK)
+        return ST_ERR;
     JTAG_get_tap_state(state, &current_state);
 
     if (current_state == jtag_shf_ir)
@@ -332,39 +689,119 @@ STATUS JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
     }
 
     if (state->active_chain->scan_state == JTAGScanState_Done)
-    {
         state->active_chain->scan_state = JTAGScanState_Run;
-        if (preFix)
-        {
-            if (perform_shift(state, preFix, IRMAXPADSIZE / 8, padData, 0, NULL,
-                              current_state, current_state) != ST_OK)
-                return ST_ERR;
-        }
+    else
+        preFix = 0;
+
+    if (current_state != end_tap_state)
+        state->active_chain->scan_state = JTAGScanState_Done;
+    else
+        postFix = 0;
+
+    if (preFix == 0 && postFix == 0)
+        return perform_shift(state, number_of_bits, input_bytes, input,
+                             output_bytes, output, current_state,
+                             end_tap_state);
+    return padded_shift(state, preFix, postFix, padData, number_of_bits,
+                        input_bytes, input, output_bytes, output,
+                        current_state, end_tap_state);
+}
+
+//
+// Shift the padding and the payload in one transfer. The pre-pad bits,
+// the payload and the post-pad bits are laid out back to back in the
+// handler's pad_tdio buffer, so a padded scan costs a single driver call
+// instead of one per segment. The payload TDO is sliced back out of the
+// same buffer afterwards.
+//
+static STATUS padded_shift(JTAG_Handler* state, unsigned int pre_bits,
+                           unsigned int post_bits, const unsigned char* pad,
+                           unsigned int number_of_bits,
+                           unsigned int input_bytes, unsigned char* input,
+                           unsigned int output_bytes, unsigned char* output,
+                           enum jtag_states current_tap_state,
+                           enum jtag_states end_tap_state)
+{
+    unsigned int total_bits = pre_bits + number_of_bits + post_bits;
+    unsigned int bytes = DIV_ROUND_UP(total_bits, BITS_PER_BYTE);
+    unsigned int input_bits = input_bytes * BITS_PER_BYTE;
+    unsigned char* tdio = state->pad_tdio;
+
+    if (bytes > sizeof(state->pad_tdio) ||
+        (output != NULL &&
+         DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE) > output_bytes))
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Padded shift of %d bits does not fit in the tdio buffer",
+                number_of_bits);
+        return ST_ERR;
     }
 
-    if ((postFix) && (current_state != end_tap_state))
+    if (input == NULL || input_bits < number_of_bits)
+        explicit_bzero(tdio, bytes);
+    copy_bits(tdio, 0, pad, 0, pre_bits);
+    if (input != NULL)
+        copy_bits(tdio, pre_bits, input,
+                  0, input_bits < number_of_bits ? input_bits : number_of_bits);
+    copy_bits(tdio, pre_bits + number_of_bits, pad, 0, post_bits);
+
+    if (perform_shift(state, total_bits, bytes, tdio, bytes, tdio,
+                      current_tap_state, end_tap_state) != ST_OK)
+        return ST_ERR;
+
+    if (output != NULL)
+        copy_bits(output, 0, tdio, pre_bits, number_of_bits);
+    return ST_OK;
+}
+
+//
+// Get the buffer handed to the driver as tdio. The driver reads TDI from
+// and returns TDO in the same buffer, so TDO lands directly in the caller's
+// output buffer. TDI is only staged in the handler scratch buffer when there
+// is no output buffer, so the caller's input is never overwritten.
+//
+static unsigned char* get_tdio_buffer(JTAG_Handler* state,
+                                      unsigned int number_of_bits,
+                                      unsigned int input_bytes,
+                                      unsigned char* input,
+                                      unsigned int output_bytes,
+                                      unsigned char* output)
+{
+    unsigned int bytes = DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE);
+    unsigned int tdio_bytes = output_bytes;
+    unsigned char* tdio = output;
+
+    if (tdio == NULL)
     {
-        state->active_chain->scan_state = JTAGScanState_Done;
-        if (perform_shift(state, number_of_bits, input_bytes, input,
-                          output_bytes, output, current_state,
-                          current_state) != ST_OK)
-            return ST_ERR;
-        if (perform_shift(state, postFix, IRMAXPADSIZE / 8, padData, 0, NULL,
-                          current_state, end_tap_state) != ST_OK)
-            return ST_ERR;
+        tdio = state->tdio_scratch;
+        tdio_bytes = sizeof(state->tdio_scratch);
     }
-    else
+
+    if (bytes > tdio_bytes)
     {
-        if (perform_shift(state, number_of_bits, input_bytes, input,
-                          output_bytes, output, current_state,
-                          end_tap_state) != ST_OK)
-            return ST_ERR;
-        if (current_state != end_tap_state)
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Shift of %d bits does not fit in %d bytes buffer",
+                number_of_bits, tdio_bytes);
+        return NULL;
+    }
+
+    if (input == NULL)
+    {
+        explicit_bzero(tdio, bytes);
+    }
+    else if (input != tdio)
+    {
+        if (input_bytes > bytes)
+            input_bytes = bytes;
+        if (memcpy_s(tdio, tdio_bytes, input, input_bytes))
         {
-            state->active_chain->scan_state = JTAGScanState_Done;
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "memcpy_s: input to tdio buffer copy failed.");
         }
+        if (input_bytes < bytes)
+            explicit_bzero(&tdio[input_bytes], bytes - input_bytes);
     }
-    return ST_OK;
+    return tdio;
 }
 
 STATUS JTAG_shift_hw(JTAG_Handler* state, unsigned int number_of_bits,
@@ -373,7 +810,7 @@ STATUS JTAG_shift_hw(JTAG_Handler* state, unsigned int number_of_bits,
                      enum jtag_states end_tap_state)
 {
     struct jtag_xfer xfer;
-    unsigned char tdio[MAX_DATA_SIZE];
+    unsigned char* tdio;
     enum jtag_states current_state;
     union pad_config padding;
 
@@ -429,44 +866,35 @@ STATUS JTAG_shift_hw(JTAG_Handler* state, unsigned int number_of_bits,
 
     xfer.padding = padding.int_value;
 
-    if (output != NULL)
-    {
-        if (memcpy_s(output, output_bytes, input,
-                     DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE)))
-        {
-            ASD_log(ASD_LogLevel_Error, stream, option,
-                    "memcpy_s: input to output copy buffer failed.");
-        }
-        xfer.tdio = (__u64)output;
-    }
-    else
-    {
-        if (memcpy_s(tdio, DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE), input,
-                     DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE)))
-        {
-            ASD_log(ASD_LogLevel_Error, stream, option,
-                    "memcpy_s: input to tdio buffer copy failed.");
-        }
-        xfer.tdio = (__u64)tdio;
-    }
-    if (ioctl(state->JTAG_driver_handle, JTAG_IOCXFER, &xfer) < 0)
+    tdio = get_tdio_buffer(state, number_of_bits, input_bytes, input,
+                           output_bytes, output);
+    if (tdio == NULL)
+        return ST_ERR;
+    xfer.tdio = (__u64)tdio;
+
+#ifdef ENABLE_DEBUG_LOGGING
+    if (input != NULL)
+        ASD_log_shift(ASD_LogLevel_Debug, stream, option, number_of_bits,
+                      input_bytes, input,
+                      (current_state == jtag_shf_dr) ? "Shift DR TDI"
+                                                     : "Shift IR TDI");
+#endif
+    if (jtag_ioctl(state, JTAG_IOCXFER, &xfer) < 0)
     {
         ASD_log(ASD_LogLevel_Error, stream, option,
                 "ioctl JTAG_IOCXFER failed");
+        state->active_chain->tap_resync = true;
         return ST_ERR;
     }
 
     state->active_chain->tap_state = end_tap_state;
+    state->active_chain->driver_tap_state = end_tap_state;
+    state->active_chain->tap_resync = false;
 
 #ifdef ENABLE_DEBUG_LOGGING
     if (padding.pre_pad_number)
         ASD_log(ASD_LogLevel_Debug, stream, option, "PrePadConfig = 0x%x",
                 xfer.padding);
-    if (input != NULL)
-        ASD_log_shift(ASD_LogLevel_Debug, stream, option, number_of_bits,
-                      input_bytes, input,
-                      (current_state == jtag_shf_dr) ? "Shift DR TDI"
-                                                     : "Shift IR TDI");
     if (output != NULL)
         ASD_log_shift(ASD_LogLevel_Debug, stream, option, number_of_bits,
                       output_bytes, output,
@@ -507,9 +935,16 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
                 "ioctl AST_JTAG_READWRITESCAN failed.");
         return ST_ERR;
     }
+#ifdef ENABLE_DEBUG_LOGGING
+    if (input != NULL)
+        ASD_log_shift(ASD_LogLevel_Debug, stream, option, number_of_bits,
+                      input_bytes, input,
+                      (current_tap_state == jtag_shf_dr) ? "Shift DR TDI"
+                                                         : "Shift IR TDI");
+#endif
 #else
     struct jtag_xfer xfer;
-    unsigned char tdio[MAX_DATA_SIZE];
+    unsigned char* tdio;
 
     xfer.from = current_tap_state;
     xfer.endstate = end_tap_state;
@@ -519,42 +954,32 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
     xfer.direction = JTAG_READ_WRITE_XFER;
     xfer.padding = 0;
 
-    if (output != NULL)
-    {
-        if (memcpy_s(output, output_bytes, input,
-                     DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE)))
-        {
-            ASD_log(ASD_LogLevel_Error, stream, option,
-                    "memcpy_s: input to output copy buffer failed.");
-        }
-        xfer.tdio = (__u64)output;
-    }
-    else
-    {
-        if (memcpy_s(tdio, DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE), input,
-                     DIV_ROUND_UP(number_of_bits, BITS_PER_BYTE)))
-        {
-            ASD_log(ASD_LogLevel_Error, stream, option,
-                    "memcpy_s: input to tdio buffer copy failed.");
-        }
-        xfer.tdio = (__u64)tdio;
-    }
-    if (ioctl(state->JTAG_driver_handle, JTAG_IOCXFER, &xfer) < 0)
+    tdio = get_tdio_buffer(state, number_of_bits, input_bytes, input,
+                           output_bytes, output);
+    if (tdio == NULL)
+        return ST_ERR;
+    xfer.tdio = (__u64)tdio;
+
+#ifdef ENABLE_DEBUG_LOGGING
+    if (input != NULL)
+        ASD_log_shift(ASD_LogLevel_Debug, stream, option, number_of_bits,
+                      input_bytes, input,
+                      (current_tap_state == jtag_shf_dr) ? "Shift DR TDI"
+                                                         : "Shift IR TDI");
+#endif
+    if (jtag_ioctl(state, JTAG_IOCXFER, &xfer) < 0)
     {
         ASD_log(ASD_LogLevel_Error, stream, option,
                 "ioctl JTAG_IOCXFER failed");
+        state->active_chain->tap_resync = true;
         return ST_ERR;
     }
 #endif
 
     state->active_chain->tap_state = end_tap_state;
+    state->active_chain->driver_tap_state = end_tap_state;
 
 #ifdef ENABLE_DEBUG_LOGGING
-    if (input != NULL)
-        ASD_log_shift(ASD_LogLevel_Debug, stream, option, number_of_bits,
-                      input_bytes, input,
-                      (current_tap_state == jtag_shf_dr) ? "Shift DR TDI"
-                                                         : "Shift IR TDI");
     if (output != NULL)
         ASD_log_shift(ASD_LogLevel_Debug, stream, option, number_of_bits,
                       output_bytes, output,
@@ -564,6 +989,184 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
     return ST_OK;
 }
 
+//
+// Copy a run of bits between LSB first bit streams. Single bits are only
+// moved until the destination is byte aligned and for the tail, the bulk
+// is assembled a byte at a time from two neighbouring source bytes.
+//
+static void copy_bits(unsigned char* dest, unsigned int dest_offset,
+                      const unsigned char* src, unsigned int src_offset,
+                      unsigned int number_of_bits)
+{
+    unsigned int shift;
+    unsigned int bytes;
+    const unsigned char* from;
+    unsigned char* to;
+
+    while (number_of_bits && (dest_offset % BITS_PER_BYTE))
+    {
+        unsigned char mask =
+            (unsigned char)(1 << (dest_offset % BITS_PER_BYTE));
+
+        if (src[src_offset / BITS_PER_BYTE] &
+            (1 << (src_offset % BITS_PER_BYTE)))
+            dest[dest_offset / BITS_PER_BYTE] |= mask;
+        else
+            dest[dest_offset / BITS_PER_BYTE] &= (unsigned char)~mask;
+        src_offset++;
+        dest_offset++;
+        number_of_bits--;
+    }
+
+    shift = src_offset % BITS_PER_BYTE;
+    bytes = number_of_bits / BITS_PER_BYTE;
+    from = &src[src_offset / BITS_PER_BYTE];
+    to = &dest[dest_offset / BITS_PER_BYTE];
+    if (shift == 0)
+    {
+        for (unsigned int i = 0; i < bytes; i++)
+            to[i] = from[i];
+    }
+    else
+    {
+        // every destination byte straddles two source bytes, both of which
+        // hold bits of the run, so from[i + 1] never reads past the source
+        for (unsigned int i = 0; i < bytes; i++)
+            to[i] = (unsigned char)((from[i] >> shift) |
+                                    (from[i + 1] << (BITS_PER_BYTE - shift)));
+    }
+
+    number_of_bits %= BITS_PER_BYTE;
+    if (number_of_bits)
+    {
+        // the tail keeps the destination bits above the run untouched
+        unsigned char bits = from[bytes] >> shift;
+        unsigned char mask = (unsigned char)((1 << number_of_bits) - 1);
+
+        if (shift + number_of_bits > BITS_PER_BYTE)
+            bits |= (unsigned char)(from[bytes + 1] << (BITS_PER_BYTE - shift));
+        to[bytes] = (unsigned char)((to[bytes] & ~mask) | (bits & mask));
+    }
+}
+
+//
+// Queue a scan in the scan program. Scans are only sent to the driver
+// when the program is executed, or as soon as the queued scans leave
+// the shift state since nothing can be concatenated after that.
+//
+STATUS JTAG_scan_program_add(JTAG_Handler* state, unsigned int number_of_bits,
+                             unsigned int input_bytes, unsigned char* input,
+                             unsigned int output_bytes, unsigned char* output,
+                             enum jtag_states end_tap_state)
+{
+    JTAG_Scan_Program* program;
+    JTAG_Scan_Desc* scan;
+    enum jtag_states current_state;
+
+    if (state == NULL)
+        return ST_ERR;
+
+    // same rule as a direct shift, only a scan in progress can be queued
+    JTAG_get_tap_state(state, &current_state);
+    if (current_state != jtag_shf_ir && current_state != jtag_shf_dr)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Scan queued but the tap is not in a ShiftIR/DR tap state");
+        return ST_ERR;
+    }
+
+    program = &state->scan_program;
+    if (program->count == MAX_SCAN_DESCRIPTORS ||
+        (program->total_bits + number_of_bits) >
+            (sizeof(program->tdio) * BITS_PER_BYTE))
+    {
+        if (JTAG_scan_program_execute(state) != ST_OK)
+            return ST_ERR;
+    }
+
+    scan = &program->scans[program->count++];
+    scan->number_of_bits = number_of_bits;
+    scan->input_bytes = input_bytes;
+    scan->input = input;
+    scan->output_bytes = output_bytes;
+    scan->output = output;
+    scan->end_tap_state = end_tap_state;
+    program->total_bits += number_of_bits;
+
+    if (current_state != end_tap_state)
+        return JTAG_scan_program_execute(state);
+
+    return ST_OK;
+}
+
+//
+// Send all queued scans to the driver. Every queued scan but the last one
+// ends in the shift state it started in, so the whole program is a single
+// continuous shift. TDI is concatenated in place in the program tdio buffer,
+// which the driver also returns TDO in, and the TDO bits are handed back to
+// each scan afterwards.
+//
+STATUS JTAG_scan_program_execute(JTAG_Handler* state)
+{
+    JTAG_Scan_Program* program;
+    JTAG_Scan_Desc* scan;
+    STATUS status = ST_OK;
+
+    if (state == NULL)
+        return ST_ERR;
+
+    program = &state->scan_program;
+    if (program->count == 1)
+    {
+        scan = &program->scans[0];
+        status = JTAG_shift(state, scan->number_of_bits, scan->input_bytes,
+                            scan->input, scan->output_bytes, scan->output,
+                            scan->end_tap_state);
+    }
+    else if (program->count > 1)
+    {
+        unsigned int bytes =
+            DIV_ROUND_UP(program->total_bits, BITS_PER_BYTE);
+        unsigned int offset = 0;
+
+        explicit_bzero(program->tdio, bytes);
+        for (unsigned int i = 0; i < program->count; i++)
+        {
+            scan = &program->scans[i];
+            if (scan->input != NULL)
+                copy_bits(program->tdio, offset, scan->input, 0,
+                          scan->number_of_bits);
+            offset += scan->number_of_bits;
+        }
+
+#ifdef ENABLE_DEBUG_LOGGING
+        ASD_log(ASD_LogLevel_Debug, stream, option,
+                "Scan program: %d scans in %d bits", program->count,
+                program->total_bits);
+#endif
+        status = JTAG_shift(state, program->total_bits, bytes, program->tdio,
+                            bytes, program->tdio,
+                            program->scans[program->count - 1].end_tap_state);
+
+        if (status == ST_OK)
+        {
+            offset = 0;
+            for (unsigned int i = 0; i < program->count; i++)
+            {
+                scan = &program->scans[i];
+                if (scan->output != NULL)
+                    copy_bits(scan->output, 0, program->tdio, offset,
+                              scan->number_of_bits);
+                offset += scan->number_of_bits;
+            }
+        }
+    }
+
+    program->count = 0;
+    program->total_bits = 0;
+    return status;
+}
+
 //
 // Wait for the requested cycles.
 //
@@ -573,9 +1176,27 @@ STATUS perform_shift(JTAG_Handler* state, unsigned int number_of_bits,
 //
 STATUS JTAG_wait_cycles(JTAG_Handler* state, unsigned int number_of_cycles)
 {
-#ifdef JTAG_LEGACY_DRIVER
+    JTAG_Trace_Record* record;
+    STATUS status;
+
     if (state == NULL)
         return ST_ERR;
+
+    record = JTAG_trace_begin(state->trace, JTAG_Trace_Op_WaitCycles,
+                              (uint8_t)state->active_chain->tap_state,
+                              (uint8_t)state->active_chain->tap_state,
+                              number_of_cycles, 0, NULL, 0);
+    status = wait_cycles(state, number_of_cycles);
+    JTAG_trace_commit(state->trace, record, NULL, status);
+    return status;
+}
+
+static STATUS wait_cycles(JTAG_Handler* state, unsigned int number_of_cycles)
+{
+    if (sync_tap_state(state) != ST_OK)
+        return ST_ERR;
+
+#ifdef JTAG_LEGACY_DRIVER
     if (state->sw_mode)
     {
         for (unsigned int i = 0; i < number_of_cycles; i++)
@@ -587,33 +1208,112 @@ STATUS JTAG_wait_cycles(JTAG_Handler* state, unsigned int number_of_cycles)
 #else
     struct bitbang_packet bitbang = {NULL, 0};
 
-    if (state == NULL)
-        return ST_ERR;
-
-    if (number_of_cycles > MAX_WAIT_CYCLES)
-        return ST_ERR;
-
     // Execute wait cycles in SW and HW mode
     ASD_log(ASD_LogLevel_Debug, stream, option, "Wait %d cycles",
             number_of_cycles);
 
+    // fused waits run longer than one bitbang packet
     bitbang.data = state->bitbang_data;
-    bitbang.length = number_of_cycles;
-
-    if (ioctl(state->JTAG_driver_handle, JTAG_IOCBITBANG, &bitbang) < 0)
+    while (number_of_cycles)
     {
-        ASD_log(ASD_LogLevel_Error, stream, option,
-                "ioctl JTAG_IOCBITBANG failed");
-        return ST_ERR;
+        bitbang.length = number_of_cycles < MAX_WAIT_CYCLES ? number_of_cycles
+                                                            : MAX_WAIT_CYCLES;
+        if (jtag_ioctl(state, JTAG_IOCBITBANG, &bitbang) < 0)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "ioctl JTAG_IOCBITBANG failed");
+            return ST_ERR;
+        }
+        number_of_cycles -= bitbang.length;
     }
 #endif
     return ST_OK;
 }
 
+//
+// Wait for the requested cycles with TCK held still. Nothing has to be
+// clocked into the TAP, so the time the cycles take at the current TCK
+// frequency is slept on the host instead. Falls back to clocking the
+// cycles when the frequency is not known.
+//
+// Note: Same as JTAG_wait_cycles, the TAP has to be in RTI, PauDR or
+// PauIR.
+//
+STATUS JTAG_wait_idle(JTAG_Handler* state, unsigned int number_of_cycles)
+{
+    JTAG_Trace_Record* record;
+    STATUS status;
+
+    if (state == NULL)
+        return ST_ERR;
+
+    record = JTAG_trace_begin(state->trace, JTAG_Trace_Op_WaitCycles,
+                              (uint8_t)state->active_chain->tap_state,
+                              (uint8_t)state->active_chain->tap_state,
+                              number_of_cycles, 0, NULL, 0);
+    status = wait_idle(state, number_of_cycles);
+    JTAG_trace_commit(state->trace, record, NULL, status);
+    return status;
+}
+
+static STATUS wait_idle(JTAG_Handler* state, unsigned int number_of_cycles)
+{
+#ifdef JTAG_LEGACY_DRIVER
+    return wait_cycles(state, number_of_cycles);
+#else
+    struct timespec duration;
+    uint64_t ns;
+
+    if (state->tck_frequency == 0 &&
+        jtag_ioctl(state, JTAG_GIOCFREQ, &state->tck_frequency) < 0)
+        state->tck_frequency = 0;
+    if (state->tck_frequency == 0)
+        return wait_cycles(state, number_of_cycles);
+
+    // the TAP has to sit in the state the wait was asked for
+    if (sync_tap_state(state) != ST_OK)
+        return ST_ERR;
+
+    ns = (uint64_t)number_of_cycles * 1000000000ULL;
+    ns = (ns + state->tck_frequency - 1) / state->tck_frequency;
+    ASD_log(ASD_LogLevel_Debug, stream, option,
+            "Wait %d cycles, %llu ns with TCK idle", number_of_cycles,
+            (unsigned long long)ns);
+
+    duration.tv_sec = (time_t)(ns / 1000000000ULL);
+    duration.tv_nsec = (long)(ns % 1000000000ULL);
+    while (nanosleep(&duration, &duration) != 0)
+    {
+        if (errno != EINTR)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "nanosleep failed, errno %d", errno);
+            return ST_ERR;
+        }
+    }
+    return ST_OK;
+#endif
+}
+
 STATUS JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck)
 {
+    JTAG_Trace_Record* record;
+    STATUS status;
+
     if (state == NULL)
         return ST_ERR;
+
+    record = JTAG_trace_begin(state->trace, JTAG_Trace_Op_Tck,
+                              (uint8_t)state->active_chain->tap_state,
+                              (uint8_t)state->active_chain->tap_state, tck, 0,
+                              NULL, 0);
+    status = set_jtag_tck(state, tck);
+    JTAG_trace_commit(state->trace, record, NULL, status);
+    return status;
+}
+
+static STATUS set_jtag_tck(JTAG_Handler* state, unsigned int tck)
+{
 #ifdef JTAG_LEGACY_DRIVER
     struct set_tck_param params;
     params.mode = state->sw_mode ? SW_MODE : HW_MODE;
@@ -633,12 +1333,13 @@ STATUS JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck)
     }
     unsigned int frq = APB_FREQ / tck;
 
-    if (ioctl(state->JTAG_driver_handle, JTAG_SIOCFREQ, &frq) < 0)
+    if (jtag_ioctl(state, JTAG_SIOCFREQ, &frq) < 0)
     {
         ASD_log(ASD_LogLevel_Error, stream, option,
                 "ioctl JTAG_SIOCFREQ failed");
         return ST_ERR;
     }
+    state->tck_frequency = frq;
 #endif
     return ST_OK;
 }
@@ -654,6 +1355,8 @@ STATUS JTAG_set_active_chain(JTAG_Handler* state, scanChain chain)
         return ST_ERR;
     }
 
+    if (sync_tap_state(state) != ST_OK)
+        return ST_ERR;
     state->active_chain = &state->chains[chain];
 
     return ST_OK;
@@ -31,6 +31,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdbool.h>
 
 #include "asd_common.h"
+#include "jtag_sim.h"
+#include "jtag_trace.h"
 
 typedef uint8_t __u8;
 typedef uint32_t __u32;
@@ -73,14 +75,18 @@ typedef unsigned long long __u64;
 #define tap_state_param jtag_tap_state
 #endif
 
-#define DRMAXPADSIZE 250
-#define IRMAXPADSIZE 2000
 #define DIV_ROUND_UP(n, d) (((n) + (d)-1) / (d))
 #define BITS_PER_BYTE 8
+#define MAX_SCAN_DESCRIPTORS 128
+// TAP controller states, Test-Logic-Reset through Update-IR
+#define JTAG_TAP_STATES 16
 #ifndef APB_FREQ
 #define APB_FREQ 24740000
 #endif
 
+// next TAP state for TMS low and high, IEEE 1149.1 figure 6-1
+extern const uint8_t JTAG_tap_next[JTAG_TAP_STATES][2];
+
 typedef enum
 {
     JTAGPaddingTypes_IRPre,
@@ -89,6 +95,14 @@ typedef enum
     JTAGPaddingTypes_DRPost
 } JTAGPaddingTypes;
 
+// Where JTAG operations go: the kernel driver or the software TAP-chain
+// model of jtag_sim.h.
+typedef enum
+{
+    JTAG_Backend_Driver = 0,
+    JTAG_Backend_Simulator
+} JTAG_Backend;
+
 typedef enum
 {
     JTAGScanState_Done = 0,
@@ -103,17 +117,57 @@ typedef struct JTAGShiftPadding
     unsigned int irPost;
 } JTAGShiftPadding;
 
+// tap_state is where the client has asked the TAP to be, driver_tap_state
+// where the driver last left it. In software mode moves are deferred while
+// they follow the driver's shortest path, so the two differ until the next
+// operation that clocks the TAP flushes the move. tap_resync is set when a
+// driver request failed and the driver state is no longer known.
 typedef struct JTAG_Chain_State
 {
 #ifdef JTAG_LEGACY_DRIVER
     enum jtag_states tap_state;
+    enum jtag_states driver_tap_state;
 #else
     enum jtag_tapstate tap_state;
+    enum jtag_tapstate driver_tap_state;
 #endif
+    bool tap_resync;
     JTAGShiftPadding shift_padding;
     JTAGScanState scan_state;
 } JTAG_Chain_State;
 
+// TAP state requests against the driver requests they cost, the difference
+// was elided. folded counts TAP_STATE commands merged into a scan end state
+// before they reached the handler.
+typedef struct JTAG_Tap_Stats
+{
+    uint64_t requests;
+    uint64_t ioctls;
+    uint64_t folded;
+} JTAG_Tap_Stats;
+
+// A queued scan. input and output point straight into the caller's
+// message buffers and must stay valid until the program is executed.
+typedef struct JTAG_Scan_Desc
+{
+    unsigned int number_of_bits;
+    unsigned int input_bytes;
+    unsigned char* input;
+    unsigned int output_bytes;
+    unsigned char* output;
+    enum jtag_states end_tap_state;
+} JTAG_Scan_Desc;
+
+// Scans decoded from one message that run back to back in the same shift
+// state. They are submitted to the driver as a single concatenated xfer.
+typedef struct JTAG_Scan_Program
+{
+    JTAG_Scan_Desc scans[MAX_SCAN_DESCRIPTORS];
+    unsigned int count;
+    unsigned int total_bits;
+    unsigned char tdio[MAX_DATA_SIZE];
+} JTAG_Scan_Program;
+
 typedef struct JTAG_Handler
 {
     JTAG_Chain_State chains[MAX_SCAN_CHAINS];
@@ -121,18 +175,39 @@ typedef struct JTAG_Handler
     unsigned char padDataOne[IRMAXPADSIZE / 8];
     unsigned char padDataZero[IRMAXPADSIZE / 8];
     struct tck_bitbang bitbang_data[MAX_WAIT_CYCLES];
+    JTAG_Scan_Program scan_program;
+    // TDI staging for shifts that have no output buffer of their own
+    unsigned char tdio_scratch[MAX_DATA_SIZE];
+    // pre-pad, payload and post-pad of a padded software mode shift
+    unsigned char pad_tdio[DIV_ROUND_UP(JTAG_XFER_MAX_BITS, BITS_PER_BYTE)];
     int JTAG_driver_handle;
+    // N of the /dev/jtagN device the driver backend opens
+    unsigned int controller;
+    // TCK frequency in Hz, 0 until it is set or read back from the driver
+    unsigned int tck_frequency;
     bool sw_mode;
+    JTAG_Backend backend;
+    // chain description handed to the simulator, NULL for its default
+    const char* sim_chain;
+    JTAG_Sim* sim;
+    // operations are recorded here when a trace is attached
+    JTAG_Trace* trace;
+    JTAG_Tap_Stats tap_stats;
 } JTAG_Handler;
 
 JTAG_Handler* JTAGHandler();
 STATUS JTAG_initialize(JTAG_Handler* state, bool sw_mode);
 STATUS JTAG_deinitialize(JTAG_Handler* state);
+STATUS JTAG_set_backend(JTAG_Handler* state, JTAG_Backend backend,
+                        const char* sim_chain);
+STATUS JTAG_set_controller(JTAG_Handler* state, unsigned int controller);
 STATUS JTAG_set_padding(JTAG_Handler* state, JTAGPaddingTypes padding,
                         unsigned int value);
 STATUS JTAG_tap_reset(JTAG_Handler* state);
 STATUS JTAG_set_tap_state(JTAG_Handler* state, enum jtag_states tap_state);
 STATUS JTAG_get_tap_state(JTAG_Handler* state, enum jtag_states* tap_state);
+STATUS JTAG_sync_tap_state(JTAG_Handler* state);
+STATUS JTAG_tap_state_folded(JTAG_Handler* state);
 STATUS JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
                   unsigned int input_bytes, unsigned char* input,
                   unsigned int output_bytes, unsigned char* output,
@@ -141,7 +216,13 @@ STATUS JTAG_shift_hw(JTAG_Handler* state, unsigned int number_of_bits,
                      unsigned int input_bytes, unsigned char* input,
                      unsigned int output_bytes, unsigned char* output,
                      enum jtag_states end_tap_state);
+STATUS JTAG_scan_program_add(JTAG_Handler* state, unsigned int number_of_bits,
+                             unsigned int input_bytes, unsigned char* input,
+                             unsigned int output_bytes, unsigned char* output,
+                             enum jtag_states end_tap_state);
+STATUS JTAG_scan_program_execute(JTAG_Handler* state);
 STATUS JTAG_wait_cycles(JTAG_Handler* state, unsigned int number_of_cycles);
+STATUS JTAG_wait_idle(JTAG_Handler* state, unsigned int number_of_cycles);
 STATUS JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck);
 STATUS JTAG_set_active_chain(JTAG_Handler* state, scanChain chain);
 #endif // _JTAG_HANDLER_H_
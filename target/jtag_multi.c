@@ -0,0 +1,411 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "jtag_multi.h"
+
+#include <signal.h>
+#include <stdlib.h>
+
+#include "logging.h"
+
+static const ASD_LogStream stream = ASD_LogStream_JTAG;
+static const ASD_LogOption option = ASD_LogOption_None;
+
+static STATUS run_op(JTAG_Handler* handler, const JTAG_Multi_Op* op)
+{
+    enum jtag_states end_state;
+
+    // queued scans reach the driver before anything else moves the TAP
+    if (op->type != JTAG_Multi_Op_Scan &&
+        JTAG_scan_program_execute(handler) != ST_OK)
+        return ST_ERR;
+
+    switch (op->type)
+    {
+        case JTAG_Multi_Op_Scan:
+            if (op->end_state == SCAN_END_CURRENT)
+                JTAG_get_tap_state(handler, &end_state);
+            else
+                end_state = (enum jtag_states)op->end_state;
+            return JTAG_scan_program_add(
+                handler, op->number_of_bits, op->input_bytes,
+                (unsigned char*)op->input, op->output_bytes, op->output,
+                end_state);
+        case JTAG_Multi_Op_TapState:
+            return JTAG_set_tap_state(handler, (enum jtag_states)op->value);
+        case JTAG_Multi_Op_TapReset:
+            return JTAG_tap_reset(handler);
+        case JTAG_Multi_Op_WaitCycles:
+            return JTAG_wait_cycles(handler, op->value);
+        case JTAG_Multi_Op_WaitIdle:
+            return JTAG_wait_idle(handler, op->value);
+        case JTAG_Multi_Op_Padding:
+            return JTAG_set_padding(handler, op->padding, op->value);
+        case JTAG_Multi_Op_Tck:
+            return JTAG_set_jtag_tck(handler, op->value);
+        case JTAG_Multi_Op_Sync:
+            return JTAG_sync_tap_state(handler);
+    }
+    return ST_ERR;
+}
+
+static void* controller_worker(void* arg)
+{
+    JTAG_Multi_Controller* controller = (JTAG_Multi_Controller*)arg;
+
+    pthread_mutex_lock(&controller->lock);
+    while (1)
+    {
+        while (controller->running && controller->head == controller->tail)
+            pthread_cond_wait(&controller->queued, &controller->lock);
+        if (controller->head == controller->tail)
+            break;
+
+        // the slot is not reused before tail moves past it
+        const JTAG_Multi_Op* op =
+            &controller->ops[controller->tail % JTAG_MULTI_QUEUE_SIZE];
+        STATUS status = controller->status;
+        pthread_mutex_unlock(&controller->lock);
+
+        if (status == ST_OK)
+        {
+            status = run_op(controller->handler, op);
+            if (status != ST_OK)
+                ASD_log(ASD_LogLevel_Error, stream, option,
+                        "JTAG controller %u failed operation %d",
+                        controller->handler->controller, (int)op->type);
+        }
+
+        pthread_mutex_lock(&controller->lock);
+        controller->status = status;
+        controller->tail++;
+        pthread_cond_broadcast(&controller->done);
+    }
+    pthread_mutex_unlock(&controller->lock);
+    return NULL;
+}
+
+static void controller_close(JTAG_Multi_Controller* controller)
+{
+    pthread_mutex_lock(&controller->lock);
+    controller->running = false;
+    pthread_cond_signal(&controller->queued);
+    pthread_mutex_unlock(&controller->lock);
+    pthread_join(controller->worker, NULL);
+
+    if (controller->owns_handler)
+    {
+        JTAG_deinitialize(controller->handler);
+        free(controller->handler);
+    }
+    pthread_cond_destroy(&controller->done);
+    pthread_cond_destroy(&controller->queued);
+    pthread_mutex_destroy(&controller->lock);
+    free(controller);
+}
+
+static JTAG_Multi_Controller* controller_open(JTAG_Multi* multi,
+                                              unsigned int index,
+                                              bool sw_mode)
+{
+    JTAG_Multi_Controller* controller;
+    sigset_t block;
+    sigset_t previous;
+    int created;
+
+    controller = (JTAG_Multi_Controller*)malloc(sizeof(JTAG_Multi_Controller));
+    if (controller == NULL)
+        return NULL;
+
+    if (index == 0)
+    {
+        controller->handler = multi->primary;
+        controller->owns_handler = false;
+    }
+    else
+    {
+        controller->handler = JTAGHandler();
+        controller->owns_handler = true;
+        if (controller->handler == NULL ||
+            JTAG_set_backend(controller->handler, multi->backend,
+                             multi->sim_chain) != ST_OK ||
+            JTAG_set_controller(controller->handler, index) != ST_OK ||
+            JTAG_initialize(controller->handler, sw_mode) != ST_OK)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "Failed to open JTAG controller %u", index);
+            free(controller->handler);
+            free(controller);
+            return NULL;
+        }
+    }
+
+    controller->head = 0;
+    controller->tail = 0;
+    controller->running = true;
+    controller->status = ST_OK;
+    pthread_mutex_init(&controller->lock, NULL);
+    pthread_cond_init(&controller->queued, NULL);
+    pthread_cond_init(&controller->done, NULL);
+
+    // Signals are for the socket thread, the workers only drive the TAP.
+    sigfillset(&block);
+    pthread_sigmask(SIG_BLOCK, &block, &previous);
+    created = pthread_create(&controller->worker, NULL, controller_worker,
+                             controller);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (created != 0)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Failed to start the worker of JTAG controller %u", index);
+        pthread_cond_destroy(&controller->done);
+        pthread_cond_destroy(&controller->queued);
+        pthread_mutex_destroy(&controller->lock);
+        if (controller->owns_handler)
+        {
+            JTAG_deinitialize(controller->handler);
+            free(controller->handler);
+        }
+        free(controller);
+        return NULL;
+    }
+    ASD_log(ASD_LogLevel_Info, stream, option, "JTAG controller %u opened",
+            index);
+    return controller;
+}
+
+static void controller_push(JTAG_Multi_Controller* controller,
+                            const JTAG_Multi_Op* op)
+{
+    pthread_mutex_lock(&controller->lock);
+    while (controller->head - controller->tail == JTAG_MULTI_QUEUE_SIZE)
+        pthread_cond_wait(&controller->done, &controller->lock);
+    controller->ops[controller->head % JTAG_MULTI_QUEUE_SIZE] = *op;
+    controller->head++;
+    pthread_cond_signal(&controller->queued);
+    pthread_mutex_unlock(&controller->lock);
+}
+
+//
+// Queue op on every selected controller. The n-th selected controller, in
+// controller order, gets its output output_stride * n bytes further on.
+//
+static STATUS queue_op(JTAG_Multi* multi, const JTAG_Multi_Op* op,
+                       unsigned int output_stride)
+{
+    unsigned int slot = 0;
+
+    if (multi == NULL || multi->selected == 0)
+        return ST_ERR;
+
+    for (unsigned int i = 0; i < JTAG_MULTI_MAX_CONTROLLERS; i++)
+    {
+        JTAG_Multi_Op copy;
+
+        if (!(multi->selected & (1U << i)))
+            continue;
+        copy = *op;
+        if (copy.output != NULL)
+            copy.output += slot * output_stride;
+        controller_push(multi->controllers[i], &copy);
+        slot++;
+    }
+    multi->dispatched = true;
+    return ST_OK;
+}
+
+JTAG_Multi* JTAG_multi_create(JTAG_Handler* primary, JTAG_Backend backend,
+                              const char* sim_chain)
+{
+    JTAG_Multi* multi;
+
+    if (primary == NULL)
+        return NULL;
+
+    multi = (JTAG_Multi*)malloc(sizeof(JTAG_Multi));
+    if (multi == NULL)
+        return NULL;
+    multi->primary = primary;
+    multi->backend = backend;
+    multi->sim_chain = sim_chain;
+    for (unsigned int i = 0; i < JTAG_MULTI_MAX_CONTROLLERS; i++)
+        multi->controllers[i] = NULL;
+    multi->selected = 0;
+    multi->dispatched = false;
+    return multi;
+}
+
+void JTAG_multi_destroy(JTAG_Multi* multi)
+{
+    if (multi == NULL)
+        return;
+
+    for (unsigned int i = 0; i < JTAG_MULTI_MAX_CONTROLLERS; i++)
+    {
+        if (multi->controllers[i] != NULL)
+            controller_close(multi->controllers[i]);
+    }
+    free(multi);
+}
+
+//
+// Select the controllers of the chain bitmap, bit 0 of the first byte being
+// chain 0. Controllers are opened the first time they are selected.
+//
+STATUS JTAG_multi_select(JTAG_Multi* multi, const uint8_t* chain_bytes,
+                         unsigned int length, bool sw_mode)
+{
+    uint32_t selected = 0;
+
+    if (multi == NULL || chain_bytes == NULL)
+        return ST_ERR;
+
+    for (unsigned int i = 0; i < length * 8; i++)
+    {
+        if (!(chain_bytes[i / 8] & (1 << (i % 8))))
+            continue;
+        if (i >= JTAG_MULTI_MAX_CONTROLLERS)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "Chain %u has no JTAG controller", i);
+            return ST_ERR;
+        }
+        selected |= 1U << i;
+    }
+
+    for (unsigned int i = 0; i < JTAG_MULTI_MAX_CONTROLLERS; i++)
+    {
+        if ((selected & (1U << i)) && multi->controllers[i] == NULL)
+        {
+            multi->controllers[i] = controller_open(multi, i, sw_mode);
+            if (multi->controllers[i] == NULL)
+                return ST_ERR;
+        }
+    }
+    multi->selected = selected;
+    return ST_OK;
+}
+
+unsigned int JTAG_multi_selected_count(const JTAG_Multi* multi)
+{
+    if (multi == NULL)
+        return 0;
+    return (unsigned int)__builtin_popcount(multi->selected);
+}
+
+STATUS JTAG_multi_scan(JTAG_Multi* multi, unsigned int number_of_bits,
+                       unsigned int input_bytes, const unsigned char* input,
+                       unsigned int output_bytes, unsigned char* output,
+                       unsigned int output_stride, uint8_t end_state)
+{
+    JTAG_Multi_Op op = {.type = JTAG_Multi_Op_Scan};
+    op.number_of_bits = number_of_bits;
+    op.input_bytes = input_bytes;
+    op.input = input;
+    op.output_bytes = output_bytes;
+    op.output = output;
+    op.end_state = end_state;
+    return queue_op(multi, &op, output_stride);
+}
+
+STATUS JTAG_multi_set_tap_state(JTAG_Multi* multi, enum jtag_states tap_state)
+{
+    JTAG_Multi_Op op = {.type = JTAG_Multi_Op_TapState};
+    op.value = (unsigned int)tap_state;
+    return queue_op(multi, &op, 0);
+}
+
+STATUS JTAG_multi_tap_reset(JTAG_Multi* multi)
+{
+    JTAG_Multi_Op op = {.type = JTAG_Multi_Op_TapReset};
+    return queue_op(multi, &op, 0);
+}
+
+STATUS JTAG_multi_wait_cycles(JTAG_Multi* multi, unsigned int number_of_cycles)
+{
+    JTAG_Multi_Op op = {.type = JTAG_Multi_Op_WaitCycles};
+    op.value = number_of_cycles;
+    return queue_op(multi, &op, 0);
+}
+
+STATUS JTAG_multi_wait_idle(JTAG_Multi* multi, unsigned int number_of_cycles)
+{
+    JTAG_Multi_Op op = {.type = JTAG_Multi_Op_WaitIdle};
+    op.value = number_of_cycles;
+    return queue_op(multi, &op, 0);
+}
+
+STATUS JTAG_multi_set_padding(JTAG_Multi* multi, JTAGPaddingTypes padding,
+                              unsigned int value)
+{
+    JTAG_Multi_Op op = {.type = JTAG_Multi_Op_Padding};
+    op.padding = padding;
+    op.value = value;
+    return queue_op(multi, &op, 0);
+}
+
+STATUS JTAG_multi_set_jtag_tck(JTAG_Multi* multi, unsigned int tck)
+{
+    JTAG_Multi_Op op = {.type = JTAG_Multi_Op_Tck};
+    op.value = tck;
+    return queue_op(multi, &op, 0);
+}
+
+//
+// Wait for every controller to run what was queued, deferred TAP moves
+// included. Returns ST_ERR if any operation failed since the last wait.
+//
+STATUS JTAG_multi_wait(JTAG_Multi* multi)
+{
+    JTAG_Multi_Op sync = {.type = JTAG_Multi_Op_Sync};
+    STATUS status = ST_OK;
+
+    if (multi == NULL)
+        return ST_ERR;
+
+    // controllers deselected during the message may still be busy
+    for (unsigned int i = 0; i < JTAG_MULTI_MAX_CONTROLLERS; i++)
+    {
+        if (multi->controllers[i] != NULL)
+            controller_push(multi->controllers[i], &sync);
+    }
+    for (unsigned int i = 0; i < JTAG_MULTI_MAX_CONTROLLERS; i++)
+    {
+        JTAG_Multi_Controller* controller = multi->controllers[i];
+        if (controller == NULL)
+            continue;
+        pthread_mutex_lock(&controller->lock);
+        while (controller->head != controller->tail)
+            pthread_cond_wait(&controller->done, &controller->lock);
+        if (controller->status != ST_OK)
+            status = ST_ERR;
+        controller->status = ST_OK;
+        pthread_mutex_unlock(&controller->lock);
+    }
+    multi->dispatched = false;
+    return status;
+}
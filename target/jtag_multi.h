@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _JTAG_MULTI_H_
+#define _JTAG_MULTI_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asd_common.h"
+#include "jtag_handler.h"
+
+// Multi-chain JTAG: every chain of the multi chain select bitmap is its own
+// /dev/jtagN controller with a worker thread of its own.
+//
+// The message interpreter queues each JTAG operation on every selected
+// controller and goes on decoding, the workers run their queues
+// concurrently. TDO lands in the slot the interpreter reserved for the
+// controller when the scan was queued, so the response keeps message order
+// no matter which controller finishes first. JTAG_multi_wait() is the only
+// point where the interpreter waits for the workers: before commands that
+// touch the target outside JTAG and at the end of the message. Scan buffers
+// have to stay valid until then.
+//
+// Controller 0 is driven through the interpreter's own JTAG handler, which
+// already holds /dev/jtag0.
+
+#define JTAG_MULTI_MAX_CONTROLLERS 8
+#define JTAG_MULTI_QUEUE_SIZE 256
+// scan end state, other than a real jtag_states value: stay in the state
+// the scan leaves the TAP in. The message interpreter resolves scan end
+// states to the same value.
+#define SCAN_END_CURRENT 0xfe
+
+typedef enum
+{
+    JTAG_Multi_Op_Scan = 0,
+    JTAG_Multi_Op_TapState,
+    JTAG_Multi_Op_TapReset,
+    JTAG_Multi_Op_WaitCycles,
+    JTAG_Multi_Op_WaitIdle,
+    JTAG_Multi_Op_Padding,
+    JTAG_Multi_Op_Tck,
+    // flush queued scans and deferred TAP moves, queued by JTAG_multi_wait
+    JTAG_Multi_Op_Sync
+} JTAG_Multi_Op_Type;
+
+typedef struct JTAG_Multi_Op
+{
+    JTAG_Multi_Op_Type type;
+    // TAP state, wait cycles, padding or TCK divisor
+    unsigned int value;
+    JTAGPaddingTypes padding;
+    unsigned int number_of_bits;
+    unsigned int input_bytes;
+    const unsigned char* input;
+    unsigned int output_bytes;
+    unsigned char* output;
+    uint8_t end_state;
+} JTAG_Multi_Op;
+
+typedef struct JTAG_Multi_Controller
+{
+    JTAG_Handler* handler;
+    // false for controller 0, the handler belongs to the interpreter
+    bool owns_handler;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t done;
+    JTAG_Multi_Op ops[JTAG_MULTI_QUEUE_SIZE];
+    // ops are queued at head and taken at tail, under lock
+    unsigned int head;
+    unsigned int tail;
+    bool running;
+    // first failure since the last JTAG_multi_wait, later ops are dropped
+    STATUS status;
+} JTAG_Multi_Controller;
+
+typedef struct JTAG_Multi
+{
+    JTAG_Handler* primary;
+    JTAG_Backend backend;
+    const char* sim_chain;
+    // opened on first selection, kept open until JTAG_multi_destroy
+    JTAG_Multi_Controller* controllers[JTAG_MULTI_MAX_CONTROLLERS];
+    // bit N set: operations go to controller N
+    uint32_t selected;
+    // operations were queued since the last JTAG_multi_wait
+    bool dispatched;
+} JTAG_Multi;
+
+JTAG_Multi* JTAG_multi_create(JTAG_Handler* primary, JTAG_Backend backend,
+                              const char* sim_chain);
+void JTAG_multi_destroy(JTAG_Multi* multi);
+STATUS JTAG_multi_select(JTAG_Multi* multi, const uint8_t* chain_bytes,
+                         unsigned int length, bool sw_mode);
+unsigned int JTAG_multi_selected_count(const JTAG_Multi* multi);
+STATUS JTAG_multi_scan(JTAG_Multi* multi, unsigned int number_of_bits,
+                       unsigned int input_bytes, const unsigned char* input,
+                       unsigned int output_bytes, unsigned char* output,
+                       unsigned int output_stride, uint8_t end_state);
+STATUS JTAG_multi_set_tap_state(JTAG_Multi* multi, enum jtag_states tap_state);
+STATUS JTAG_multi_tap_reset(JTAG_Multi* multi);
+STATUS JTAG_multi_wait_cycles(JTAG_Multi* multi, unsigned int number_of_cycles);
+STATUS JTAG_multi_wait_idle(JTAG_Multi* multi, unsigned int number_of_cycles);
+STATUS JTAG_multi_set_padding(JTAG_Multi* multi, JTAGPaddingTypes padding,
+                              unsigned int value);
+STATUS JTAG_multi_set_jtag_tck(JTAG_Multi* multi, unsigned int tck);
+STATUS JTAG_multi_wait(JTAG_Multi* multi);
+
+#endif // _JTAG_MULTI_H_
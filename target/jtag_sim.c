@@ -0,0 +1,503 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "jtag_sim.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+#include <safe_mem_lib.h>
+// clang-format on
+
+#include "jtag_handler.h"
+#include "logging.h"
+
+#ifndef JTAG_LEGACY_DRIVER
+
+static const ASD_LogStream stream = ASD_LogStream_JTAG;
+static const ASD_LogOption option = ASD_LogOption_None;
+
+#define JTAG_SIM_RESET_CYCLES 5
+#define JTAG_SIM_IDCODE_LENGTH 32
+
+static inline unsigned char get_bit(const unsigned char* buffer,
+                                    unsigned int bit)
+{
+    return (buffer[bit / 8] >> (bit % 8)) & 1;
+}
+
+static inline void set_bit(unsigned char* buffer, unsigned int bit,
+                           unsigned char value)
+{
+    if (value)
+        buffer[bit / 8] |= (unsigned char)(1 << (bit % 8));
+    else
+        buffer[bit / 8] &= (unsigned char)~(1 << (bit % 8));
+}
+
+static bool tap_selects_idcode(const JTAG_Sim_Tap* tap)
+{
+    return tap->idcode != 0 && tap->ir == JTAG_SIM_IDCODE_OPCODE;
+}
+
+static void tap_reset(JTAG_Sim* sim)
+{
+    for (unsigned int i = 0; i < sim->tap_count; i++)
+    {
+        JTAG_Sim_Tap* tap = &sim->taps[i];
+        // BYPASS is all ones, whatever the IR length
+        tap->ir = tap->idcode ? JTAG_SIM_IDCODE_OPCODE
+                              : (uint32_t)((1ULL << tap->ir_length) - 1);
+    }
+}
+
+//
+// Load the register selected by the Capture state into the chain.
+//
+static void tap_capture(JTAG_Sim* sim, bool ir)
+{
+    unsigned int bit = 0;
+
+    explicit_bzero(sim->chain, sizeof(sim->chain));
+    for (unsigned int i = 0; i < sim->tap_count; i++)
+    {
+        const JTAG_Sim_Tap* tap = &sim->taps[i];
+        if (ir)
+        {
+            // IR captures ...01
+            set_bit(sim->chain, bit, 1);
+            bit += tap->ir_length;
+        }
+        else if (tap_selects_idcode(tap))
+        {
+            for (unsigned int j = 0; j < JTAG_SIM_IDCODE_LENGTH; j++)
+                set_bit(sim->chain, bit + j, (tap->idcode >> j) & 1);
+            bit += JTAG_SIM_IDCODE_LENGTH;
+        }
+        else
+        {
+            // BYPASS captures 0
+            bit++;
+        }
+    }
+    sim->chain_bits = bit;
+}
+
+static void tap_update_ir(JTAG_Sim* sim)
+{
+    unsigned int bit = 0;
+
+    for (unsigned int i = 0; i < sim->tap_count; i++)
+    {
+        JTAG_Sim_Tap* tap = &sim->taps[i];
+        tap->ir = 0;
+        for (unsigned int j = 0; j < tap->ir_length; j++)
+            tap->ir |= (uint32_t)get_bit(sim->chain, bit + j) << j;
+        bit += tap->ir_length;
+    }
+}
+
+//
+// Clock the TAP controller into the next state. Shifting is done by the
+// callers, this only applies what the state itself does.
+//
+static void tap_enter(JTAG_Sim* sim, uint8_t next)
+{
+    sim->tap_state = next;
+    sim->tck_cycles++;
+    switch (next)
+    {
+        case jtag_tlr:
+            tap_reset(sim);
+            break;
+        case jtag_cap_dr:
+            tap_capture(sim, false);
+            break;
+        case jtag_cap_ir:
+            tap_capture(sim, true);
+            break;
+        case jtag_upd_ir:
+            tap_update_ir(sim);
+            break;
+        default:
+            // the modelled data registers are read-only, Update-DR is a
+            // no-op
+            break;
+    }
+}
+
+//
+// Walk the shortest TMS path to the requested state.
+//
+static void tap_goto(JTAG_Sim* sim, uint8_t endstate)
+{
+    uint8_t previous[JTAG_TAP_STATES];
+    uint8_t queue[JTAG_TAP_STATES];
+    uint8_t path[JTAG_TAP_STATES];
+    bool seen[JTAG_TAP_STATES] = {false};
+    unsigned int head = 0;
+    unsigned int tail = 0;
+    unsigned int length = 0;
+
+    if (sim->tap_state == endstate)
+        return;
+
+    queue[tail++] = sim->tap_state;
+    seen[sim->tap_state] = true;
+    while (head < tail && !seen[endstate])
+    {
+        uint8_t from = queue[head++];
+        for (int tms = 0; tms < 2; tms++)
+        {
+            uint8_t to = JTAG_tap_next[from][tms];
+            if (!seen[to])
+            {
+                seen[to] = true;
+                previous[to] = from;
+                queue[tail++] = to;
+            }
+        }
+    }
+
+    for (uint8_t s = endstate; s != sim->tap_state; s = previous[s])
+        path[length++] = s;
+    while (length > 0)
+        tap_enter(sim, path[--length]);
+}
+
+//
+// Shift one bit through the chain, used for bit-banged cycles.
+//
+static unsigned char chain_shift_bit(JTAG_Sim* sim, unsigned char tdi)
+{
+    unsigned char tdo;
+
+    if (sim->chain_bits == 0)
+        return tdi;
+    tdo = get_bit(sim->chain, 0);
+    for (unsigned int i = 0; i + 1 < sim->chain_bits; i++)
+        set_bit(sim->chain, i, get_bit(sim->chain, i + 1));
+    set_bit(sim->chain, sim->chain_bits - 1, tdi);
+    return tdo;
+}
+
+static STATUS parse_chain(JTAG_Sim* sim, const char* chain)
+{
+    const char* p = chain;
+
+    sim->tap_count = 0;
+    while (*p != '\0')
+    {
+        JTAG_Sim_Tap* tap;
+        char* end;
+
+        if (sim->tap_count == JTAG_SIM_MAX_TAPS)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "JTAG simulator supports up to %d TAPs",
+                    JTAG_SIM_MAX_TAPS);
+            return ST_ERR;
+        }
+        tap = &sim->taps[sim->tap_count];
+        tap->idcode = (uint32_t)strtoul(p, &end, 16);
+        if (end == p || *end != '-')
+            return ST_ERR;
+        p = end + 1;
+        tap->ir_length = (unsigned int)strtoul(p, &end, 10);
+        if (end == p || (*end != ',' && *end != '\0') ||
+            (*end == ',' && end[1] == '\0'))
+            return ST_ERR;
+        // IEEE 1149.1 IDCODEs always have bit 0 set
+        if (tap->ir_length < 2 || tap->ir_length > JTAG_SIM_MAX_IR_LENGTH ||
+            (tap->idcode != 0 && !(tap->idcode & 1)))
+            return ST_ERR;
+        sim->tap_count++;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return sim->tap_count ? ST_OK : ST_ERR;
+}
+
+//
+// Build a chain from its description, JTAG_SIM_DEFAULT_CHAIN when NULL.
+//
+JTAG_Sim* JTAG_sim_create(const char* chain)
+{
+    JTAG_Sim* sim = (JTAG_Sim*)malloc(sizeof(JTAG_Sim));
+
+    if (sim == NULL)
+        return NULL;
+
+    if (chain == NULL)
+        chain = JTAG_SIM_DEFAULT_CHAIN;
+    if (parse_chain(sim, chain) != ST_OK)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Invalid JTAG simulator chain '%s', expected "
+                "<idcode>-<ir length>[,...]",
+                chain);
+        free(sim);
+        return NULL;
+    }
+
+    sim->sw_mode = true;
+    sim->frequency = APB_FREQ;
+    sim->chain_bits = 0;
+    sim->tck_cycles = 0;
+    sim->tap_state = jtag_tlr;
+    tap_reset(sim);
+
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "Simulating a JTAG chain of %u TAP%s: %s", sim->tap_count,
+            sim->tap_count == 1 ? "" : "s", chain);
+    return sim;
+}
+
+void JTAG_sim_destroy(JTAG_Sim* sim)
+{
+    free(sim);
+}
+
+static int sim_set_state(JTAG_Sim* sim, const struct jtag_tap_state* tap_state)
+{
+    if (tap_state->endstate >= JTAG_TAP_STATES)
+        return -1;
+
+    if (tap_state->reset == JTAG_FORCE_RESET)
+    {
+        sim->tck_cycles += JTAG_SIM_RESET_CYCLES;
+        sim->tap_state = jtag_tlr;
+        tap_reset(sim);
+    }
+    tap_goto(sim, tap_state->endstate);
+    // idle cycles requested along with the state change
+    if (tap_state->endstate == jtag_rti || tap_state->endstate == jtag_pau_dr ||
+        tap_state->endstate == jtag_pau_ir)
+        sim->tck_cycles += tap_state->tck;
+    return 0;
+}
+
+//
+// Shift pre-padding, the xfer bits and post-padding as one stream. The
+// chain register leads the stream out on TDO, anything shifted past it
+// comes back delayed by its length.
+//
+static int sim_xfer(JTAG_Sim* sim, struct jtag_xfer* xfer)
+{
+    unsigned char* tdio = (unsigned char*)(uintptr_t)xfer->tdio;
+    union pad_config padding;
+    unsigned int bytes = DIV_ROUND_UP(xfer->length, BITS_PER_BYTE);
+    unsigned int pre;
+    unsigned int total;
+    unsigned int length = sim->chain_bits;
+    unsigned char chain[JTAG_SIM_CHAIN_BYTES];
+    uint8_t shift_state;
+
+    if (xfer->endstate >= JTAG_TAP_STATES || bytes > sizeof(sim->tdi) ||
+        (tdio == NULL && xfer->length))
+        return -1;
+
+    padding.int_value = xfer->padding;
+    pre = padding.pre_pad_number;
+    total = pre + xfer->length + padding.post_pad_number;
+
+    shift_state = xfer->type == JTAG_SIR_XFER ? jtag_shf_ir : jtag_shf_dr;
+    tap_goto(sim, shift_state);
+    length = sim->chain_bits;
+
+    if (xfer->direction & JTAG_WRITE_XFER)
+    {
+        if (bytes && memcpy_s(sim->tdi, sizeof(sim->tdi), tdio, bytes))
+            return -1;
+    }
+    else if (bytes)
+    {
+        explicit_bzero(sim->tdi, bytes);
+    }
+    if (memcpy_s(chain, sizeof(chain), sim->chain, sizeof(sim->chain)))
+        return -1;
+
+    if (xfer->direction & JTAG_READ_XFER)
+    {
+        for (unsigned int i = 0; i < xfer->length; i++)
+        {
+            unsigned int s = pre + i;
+            unsigned char tdo;
+            if (s < length)
+                tdo = get_bit(chain, s);
+            else if (s - length < pre)
+                tdo = (unsigned char)padding.pad_data;
+            else
+                tdo = get_bit(sim->tdi, s - length - pre);
+            set_bit(tdio, i, tdo);
+        }
+    }
+
+    // whatever is left in the chain is the tail of the stream
+    for (unsigned int j = 0; j < length; j++)
+    {
+        unsigned int s = total + j;
+        unsigned char bit;
+        if (s < length)
+            bit = get_bit(chain, s);
+        else if (s - length < pre ||
+                 s - length >= pre + xfer->length)
+            bit = (unsigned char)padding.pad_data;
+        else
+            bit = get_bit(sim->tdi, s - length - pre);
+        set_bit(sim->chain, j, bit);
+    }
+    sim->tck_cycles += total;
+    sim->xfers++;
+
+    tap_goto(sim, xfer->endstate);
+    return 0;
+}
+
+static int sim_bitbang(JTAG_Sim* sim, struct bitbang_packet* packet)
+{
+    if (packet->data == NULL && packet->length)
+        return -1;
+
+    for (unsigned int i = 0; i < packet->length; i++)
+    {
+        struct tck_bitbang* bitbang = &packet->data[i];
+        if (sim->tap_state == jtag_shf_dr || sim->tap_state == jtag_shf_ir)
+            bitbang->tdo = chain_shift_bit(sim, bitbang->tdi & 1);
+        else
+            bitbang->tdo = 0;
+        tap_enter(sim, JTAG_tap_next[sim->tap_state][bitbang->tms & 1]);
+    }
+    return 0;
+}
+
+//
+// Same contract as ioctl() on /dev/jtag0: 0 on success, -1 and errno set
+// on failure.
+//
+int JTAG_sim_ioctl(JTAG_Sim* sim, unsigned long request, void* arg)
+{
+    int result = -1;
+
+    if (sim == NULL || arg == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (request)
+    {
+        case JTAG_SIOCSTATE:
+            result = sim_set_state(sim, (struct jtag_tap_state*)arg);
+            break;
+        case JTAG_IOCXFER:
+            result = sim_xfer(sim, (struct jtag_xfer*)arg);
+            break;
+        case JTAG_IOCBITBANG:
+            result = sim_bitbang(sim, (struct bitbang_packet*)arg);
+            break;
+        case JTAG_SIOCFREQ:
+            if (*(unsigned int*)arg != 0)
+            {
+                sim->frequency = *(unsigned int*)arg;
+                result = 0;
+            }
+            break;
+        case JTAG_GIOCFREQ:
+            *(unsigned int*)arg = sim->frequency;
+            result = 0;
+            break;
+        case JTAG_GIOCSTATUS:
+            *(enum jtag_tapstate*)arg = (enum jtag_tapstate)sim->tap_state;
+            result = 0;
+            break;
+        case JTAG_SIOCMODE:
+        {
+            struct jtag_mode* mode = (struct jtag_mode*)arg;
+            if (mode->feature == JTAG_XFER_MODE)
+                sim->sw_mode = mode->mode == JTAG_XFER_SW_MODE;
+            result = 0;
+            break;
+        }
+        case JTAG_SIOCTRST:
+            sim->tap_state = jtag_tlr;
+            tap_reset(sim);
+            result = 0;
+            break;
+        default:
+            break;
+    }
+
+    if (result != 0)
+        errno = EINVAL;
+    return result;
+}
+
+//
+// Time the TCK cycles counted so far take at the configured frequency.
+//
+uint64_t JTAG_sim_tck_ns(const JTAG_Sim* sim)
+{
+    if (sim == NULL || sim->frequency == 0)
+        return 0;
+    return (sim->tck_cycles / sim->frequency) * 1000000000ULL +
+           (sim->tck_cycles % sim->frequency) * 1000000000ULL /
+               sim->frequency;
+}
+
+#else
+
+// The simulator speaks the jtag.h interface only.
+JTAG_Sim* JTAG_sim_create(const char* chain)
+{
+    (void)chain;
+    ASD_log(ASD_LogLevel_Error, ASD_LogStream_JTAG, ASD_LogOption_None,
+            "The JTAG simulator is not available with the legacy driver");
+    return NULL;
+}
+
+void JTAG_sim_destroy(JTAG_Sim* sim)
+{
+    free(sim);
+}
+
+int JTAG_sim_ioctl(JTAG_Sim* sim, unsigned long request, void* arg)
+{
+    (void)sim;
+    (void)request;
+    (void)arg;
+    errno = ENOTTY;
+    return -1;
+}
+
+uint64_t JTAG_sim_tck_ns(const JTAG_Sim* sim)
+{
+    (void)sim;
+    return 0;
+}
+
+#endif // JTAG_LEGACY_DRIVER
@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _JTAG_SIM_H_
+#define _JTAG_SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asd_common.h"
+
+// Software model of a JTAG TAP chain, a drop-in for the /dev/jtag0 driver.
+//
+// JTAG_sim_ioctl() takes the same requests and structs as the driver
+// (tests/jtag.h), so the JTAG handler runs unmodified against it. The chain
+// is described by a string of comma separated TAPs, "<idcode>-<ir length>",
+// the first TAP being the one next to TDO. An idcode of 0 makes a TAP that
+// only implements BYPASS. After reset every TAP with an IDCODE register
+// selects it, as IEEE 1149.1 requires.
+//
+// Nothing is clocked for real: the model counts the TCK cycles the chain
+// would have seen, so host-side overhead can be told apart from TCK time.
+
+#define JTAG_SIM_MAX_TAPS 16
+#define JTAG_SIM_MAX_IR_LENGTH 32
+#define JTAG_SIM_IDCODE_OPCODE 0x2
+#define JTAG_SIM_DEFAULT_CHAIN "0x00111113-16,0x00111113-16"
+// longest register the whole chain can select, IR or DR
+#define JTAG_SIM_CHAIN_BYTES (JTAG_SIM_MAX_TAPS * JTAG_SIM_MAX_IR_LENGTH / 8)
+
+typedef struct JTAG_Sim_Tap
+{
+    uint32_t idcode;
+    unsigned int ir_length;
+    uint32_t ir;
+} JTAG_Sim_Tap;
+
+typedef struct JTAG_Sim
+{
+    JTAG_Sim_Tap taps[JTAG_SIM_MAX_TAPS];
+    unsigned int tap_count;
+    uint8_t tap_state;
+    bool sw_mode;
+    unsigned int frequency;
+    // register the chain is shifting, bit 0 drives TDO
+    unsigned char chain[JTAG_SIM_CHAIN_BYTES];
+    unsigned int chain_bits;
+    // TDI of the xfer in flight, the driver shifts its tdio buffer in place.
+    // Padded shifts go out as one xfer, see JTAG_Handler.pad_tdio.
+    unsigned char tdi[JTAG_XFER_MAX_BITS / 8];
+    uint64_t tck_cycles;
+    // shift transfers issued, one per JTAG_IOCXFER
+    uint64_t xfers;
+} JTAG_Sim;
+
+JTAG_Sim* JTAG_sim_create(const char* chain);
+void JTAG_sim_destroy(JTAG_Sim* sim);
+int JTAG_sim_ioctl(JTAG_Sim* sim, unsigned long request, void* arg);
+uint64_t JTAG_sim_tck_ns(const JTAG_Sim* sim);
+
+#endif // _JTAG_SIM_H_
@@ -0,0 +1,339 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "jtag_trace.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+// clang-format off
+#include <safe_mem_lib.h>
+// clang-format on
+
+#include "logging.h"
+
+static const ASD_LogStream stream = ASD_LogStream_JTAG;
+static const ASD_LogOption option = ASD_LogOption_None;
+
+#define TRACE_ROUND_UP(n) \
+    (((n) + JTAG_TRACE_ALIGN - 1) & ~(uint64_t)(JTAG_TRACE_ALIGN - 1))
+
+static uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static JTAG_Trace* trace_mmap(int fd, size_t map_size, bool writable)
+{
+    JTAG_Trace* trace = (JTAG_Trace*)malloc(sizeof(JTAG_Trace));
+    void* map;
+
+    if (trace == NULL)
+        return NULL;
+
+    map = mmap(NULL, map_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        free(trace);
+        return NULL;
+    }
+
+    trace->header = (JTAG_Trace_Header*)map;
+    trace->ring = (unsigned char*)map + sizeof(JTAG_Trace_Header);
+    trace->map_size = map_size;
+    trace->writable = writable;
+    trace->pending_head = 0;
+    trace->cursor = 0;
+    return trace;
+}
+
+//
+// Create (or truncate) the trace file and map it for recording.
+//
+JTAG_Trace* JTAG_trace_open(const char* path, size_t ring_size)
+{
+    JTAG_Trace* trace;
+    size_t map_size;
+    int fd;
+
+    if (path == NULL)
+        return NULL;
+
+    ring_size = (size_t)TRACE_ROUND_UP(ring_size);
+    if (ring_size < 2 * (sizeof(JTAG_Trace_Record) + 2 * MAX_DATA_SIZE))
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "JTAG trace ring of %zu bytes is too small", ring_size);
+        return NULL;
+    }
+    map_size = sizeof(JTAG_Trace_Header) + ring_size;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Can't create JTAG trace file %s", path);
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)map_size) != 0)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Failed to size JTAG trace file %s", path);
+        close(fd);
+        return NULL;
+    }
+
+    trace = trace_mmap(fd, map_size, true);
+    close(fd);
+    if (trace == NULL)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Failed to map JTAG trace file %s", path);
+        return NULL;
+    }
+
+    explicit_bzero(trace->header, sizeof(JTAG_Trace_Header));
+    trace->header->magic = JTAG_TRACE_MAGIC;
+    trace->header->version = JTAG_TRACE_VERSION;
+    trace->header->ring_size = ring_size;
+
+    ASD_log(ASD_LogLevel_Info, stream, option,
+            "Recording JTAG trace to %s (%zu bytes ring)", path, ring_size);
+    return trace;
+}
+
+//
+// Map an existing trace file read-only, to replay it.
+//
+JTAG_Trace* JTAG_trace_map(const char* path)
+{
+    JTAG_Trace_Header header;
+    JTAG_Trace* trace;
+    struct stat st;
+    int fd;
+
+    if (path == NULL)
+        return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Can't open JTAG trace file %s", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) ||
+        read(fd, &header, sizeof(header)) != sizeof(header) ||
+        header.magic != JTAG_TRACE_MAGIC ||
+        header.version != JTAG_TRACE_VERSION ||
+        header.ring_size + sizeof(header) != (uint64_t)st.st_size)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "%s is not a JTAG trace file", path);
+        close(fd);
+        return NULL;
+    }
+
+    trace = trace_mmap(fd, (size_t)st.st_size, false);
+    close(fd);
+    if (trace == NULL)
+    {
+        ASD_log(ASD_LogLevel_Error, stream, option,
+                "Failed to map JTAG trace file %s", path);
+        return NULL;
+    }
+    JTAG_trace_rewind(trace);
+    return trace;
+}
+
+void JTAG_trace_close(JTAG_Trace* trace)
+{
+    if (trace == NULL)
+        return;
+    if (trace->writable)
+        msync(trace->header, trace->map_size, MS_ASYNC);
+    munmap(trace->header, trace->map_size);
+    free(trace);
+}
+
+//
+// Drop the oldest records until everything up to end fits in the ring.
+//
+static void trace_make_room(JTAG_Trace_Header* header,
+                            const unsigned char* ring, uint64_t end)
+{
+    uint64_t tail = header->tail;
+
+    while (end - tail > header->ring_size)
+    {
+        const JTAG_Trace_Record* old =
+            (const JTAG_Trace_Record*)&ring[tail % header->ring_size];
+        tail += old->length;
+        if (old->op != JTAG_Trace_Op_Wrap)
+            header->dropped++;
+    }
+    __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+}
+
+//
+// Start recording an operation: reserve its record, stamp it and copy the
+// TDI, which a shift may overwrite with TDO. Returns NULL when the record
+// does not fit, the operation is then simply not traced.
+//
+JTAG_Trace_Record* JTAG_trace_begin(JTAG_Trace* trace, JTAG_Trace_Op op,
+                                    uint8_t start_state, uint8_t end_state,
+                                    uint32_t value, unsigned int tdi_bytes,
+                                    const unsigned char* tdi,
+                                    unsigned int tdo_bytes)
+{
+    JTAG_Trace_Header* header;
+    JTAG_Trace_Record* record;
+    uint64_t length;
+    uint64_t head;
+    uint64_t pos;
+
+    if (trace == NULL || !trace->writable)
+        return NULL;
+
+    header = trace->header;
+    if (tdi == NULL)
+        tdi_bytes = 0;
+    length = TRACE_ROUND_UP(sizeof(JTAG_Trace_Record) + tdi_bytes + tdo_bytes);
+    if (tdi_bytes > UINT16_MAX || tdo_bytes > UINT16_MAX ||
+        length > header->ring_size)
+        return NULL;
+
+    head = header->head;
+    pos = head % header->ring_size;
+    if (pos + length > header->ring_size)
+    {
+        // Records never straddle the end of the ring, fill the rest of it.
+        uint64_t filler = header->ring_size - pos;
+        trace_make_room(header, trace->ring, head + filler);
+        record = (JTAG_Trace_Record*)&trace->ring[pos];
+        record->length = (uint32_t)filler;
+        record->op = JTAG_Trace_Op_Wrap;
+        head += filler;
+        pos = 0;
+    }
+    trace_make_room(header, trace->ring, head + length);
+
+    record = (JTAG_Trace_Record*)&trace->ring[pos];
+    record->length = (uint32_t)length;
+    record->op = (uint8_t)op;
+    record->start_state = start_state;
+    record->end_state = end_state;
+    record->flags = 0;
+    record->value = value;
+    record->duration_ns = 0;
+    record->tdi_bytes = (uint16_t)tdi_bytes;
+    record->tdo_bytes = (uint16_t)tdo_bytes;
+    record->reserved = 0;
+    if (tdi_bytes)
+    {
+        if (memcpy_s(JTAG_trace_tdi(record), tdi_bytes, tdi, tdi_bytes))
+            return NULL;
+    }
+    trace->pending_head = head + length;
+    record->timestamp_ns = trace_now_ns();
+    return record;
+}
+
+//
+// Finish the record started by JTAG_trace_begin and publish it.
+//
+void JTAG_trace_commit(JTAG_Trace* trace, JTAG_Trace_Record* record,
+                       const unsigned char* tdo, STATUS status)
+{
+    uint64_t elapsed;
+
+    if (trace == NULL || record == NULL)
+        return;
+
+    elapsed = trace_now_ns() - record->timestamp_ns;
+    record->duration_ns =
+        elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    if (status != ST_OK)
+        record->flags |= JTAG_TRACE_FLAG_FAILED;
+    if (record->tdo_bytes)
+    {
+        if (tdo == NULL)
+            explicit_bzero(JTAG_trace_tdo(record), record->tdo_bytes);
+        else if (memcpy_s(JTAG_trace_tdo(record), record->tdo_bytes, tdo,
+                          record->tdo_bytes))
+            return;
+    }
+    __atomic_store_n(&trace->header->head, trace->pending_head,
+                     __ATOMIC_RELEASE);
+}
+
+void JTAG_trace_rewind(JTAG_Trace* trace)
+{
+    if (trace != NULL)
+        trace->cursor = __atomic_load_n(&trace->header->tail,
+                                        __ATOMIC_ACQUIRE);
+}
+
+//
+// Return the next recorded operation, oldest first, or NULL at the end of
+// the trace.
+//
+const JTAG_Trace_Record* JTAG_trace_next(JTAG_Trace* trace)
+{
+    const JTAG_Trace_Record* record;
+    uint64_t head;
+
+    if (trace == NULL)
+        return NULL;
+
+    head = __atomic_load_n(&trace->header->head, __ATOMIC_ACQUIRE);
+    while (trace->cursor < head)
+    {
+        uint64_t pos = trace->cursor % trace->header->ring_size;
+        record = (const JTAG_Trace_Record*)&trace->ring[pos];
+        if (record->length < JTAG_TRACE_ALIGN ||
+            pos + record->length > trace->header->ring_size)
+        {
+            ASD_log(ASD_LogLevel_Error, stream, option,
+                    "Corrupted JTAG trace record at %llu",
+                    (unsigned long long)trace->cursor);
+            trace->cursor = head;
+            return NULL;
+        }
+        trace->cursor += record->length;
+        if (record->op != JTAG_Trace_Op_Wrap)
+            return record;
+    }
+    return NULL;
+}
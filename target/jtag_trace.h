@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _JTAG_TRACE_H_
+#define _JTAG_TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "asd_common.h"
+
+// Binary trace of the JTAG operations executed by the JTAG handler.
+//
+// The trace file is a JTAG_Trace_Header followed by a ring of records. The
+// ring is memory-mapped and only ever written by the thread driving the
+// JTAG handler, so recording takes no lock: a record is filled in place and
+// becomes visible when head is published. Once the ring is full the oldest
+// records are dropped and tail moves past them.
+
+#define JTAG_TRACE_MAGIC 0x4a544143 // "CATJ"
+#define JTAG_TRACE_VERSION 1
+#define JTAG_TRACE_DEFAULT_SIZE (4 * 1024 * 1024)
+#define JTAG_TRACE_ALIGN 8
+
+typedef enum
+{
+    JTAG_Trace_Op_Shift = 0,
+    JTAG_Trace_Op_TapState,
+    JTAG_Trace_Op_WaitCycles,
+    JTAG_Trace_Op_Tck,
+    JTAG_Trace_Op_Count,
+    // filler up to the end of the ring, not an operation
+    JTAG_Trace_Op_Wrap = 0xff
+} JTAG_Trace_Op;
+
+#define JTAG_TRACE_FLAG_FAILED 0x01
+
+typedef struct JTAG_Trace_Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    // bytes ever written and the position of the oldest record still in the
+    // ring, both counted from the start of the capture
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+    uint8_t reserved[24];
+} JTAG_Trace_Header;
+
+// One operation. tdi_bytes of TDI followed by tdo_bytes of TDO are stored
+// right after the record, the whole record is padded to JTAG_TRACE_ALIGN.
+typedef struct JTAG_Trace_Record
+{
+    uint32_t length;
+    uint8_t op;
+    uint8_t start_state;
+    uint8_t end_state;
+    uint8_t flags;
+    // number of bits, wait cycles or tck divisor, depending on op
+    uint32_t value;
+    uint32_t duration_ns;
+    // CLOCK_MONOTONIC, the clock ASD_get_timestamp() logs with
+    uint64_t timestamp_ns;
+    uint16_t tdi_bytes;
+    uint16_t tdo_bytes;
+    uint32_t reserved;
+} JTAG_Trace_Record;
+
+typedef struct JTAG_Trace
+{
+    JTAG_Trace_Header* header;
+    unsigned char* ring;
+    size_t map_size;
+    bool writable;
+    // head once the record between JTAG_trace_begin and commit is published
+    uint64_t pending_head;
+    // read position of JTAG_trace_next
+    uint64_t cursor;
+} JTAG_Trace;
+
+static inline unsigned char* JTAG_trace_tdi(const JTAG_Trace_Record* record)
+{
+    return (unsigned char*)(record + 1);
+}
+
+static inline unsigned char* JTAG_trace_tdo(const JTAG_Trace_Record* record)
+{
+    return JTAG_trace_tdi(record) + record->tdi_bytes;
+}
+
+JTAG_Trace* JTAG_trace_open(const char* path, size_t ring_size);
+JTAG_Trace* JTAG_trace_map(const char* path);
+void JTAG_trace_close(JTAG_Trace* trace);
+JTAG_Trace_Record* JTAG_trace_begin(JTAG_Trace* trace, JTAG_Trace_Op op,
+                                    uint8_t start_state, uint8_t end_state,
+                                    uint32_t value, unsigned int tdi_bytes,
+                                    const unsigned char* tdi,
+                                    unsigned int tdo_bytes);
+void JTAG_trace_commit(JTAG_Trace* trace, JTAG_Trace_Record* record,
+                       const unsigned char* tdo, STATUS status);
+void JTAG_trace_rewind(JTAG_Trace* trace);
+const JTAG_Trace_Record* JTAG_trace_next(JTAG_Trace* trace);
+
+#endif // _JTAG_TRACE_H_
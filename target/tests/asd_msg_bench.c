@@ -0,0 +1,568 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Replays JTAG messages through process_jtag_message() against a mock
+// driver and reports the decode cost per opcode.
+//
+// usage: asd_msg_bench [-n iterations] [-m max_ns_per_opcode] [capture]
+//
+// capture is a file of raw ASD messages (header followed by payload) as
+// they arrive on the socket; without one a built-in IR/DR scan mix is used.
+// With -m the run fails when the average decode cost exceeds the budget.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../asd_msg.h"
+#include "asd_server_interface.h"
+
+#define MAX_BENCH_MESSAGES 256
+#define DEFAULT_ITERATIONS 10000
+
+extern ASD_MSG msg_state;
+
+static struct asd_message messages[MAX_BENCH_MESSAGES];
+static unsigned int num_messages = 0;
+static unsigned long opcodes_per_pass = 0;
+static enum jtag_states mock_tap_state = jtag_tlr;
+static unsigned long responses_sent = 0;
+
+// Logging and the server side are not part of what is being measured.
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+}
+
+void __wrap_ASD_log_buffer(ASD_LogLevel level, ASD_LogStream stream,
+                           ASD_LogOption options, const unsigned char* ptr,
+                           size_t len, const char* prefixPtr)
+{
+}
+
+STATUS asd_api_server_ioctl(void* input, void* output, unsigned int cmd)
+{
+    if (cmd == IOCTL_SERVER_QUEUE_MSG)
+        responses_sent++;
+    return ST_OK;
+}
+
+size_t asd_api_server_read(unsigned char* buffer, size_t length, void* opt)
+{
+    return 0;
+}
+
+// Mock driver: accepts every request and only keeps the TAP state, which
+// the end-state look-ahead depends on.
+STATUS __wrap_JTAG_set_tap_state(JTAG_Handler* state,
+                                 enum jtag_states tap_state)
+{
+    mock_tap_state = tap_state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_get_tap_state(JTAG_Handler* state,
+                                 enum jtag_states* tap_state)
+{
+    *tap_state = mock_tap_state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_scan_program_add(JTAG_Handler* state,
+                                    unsigned int number_of_bits,
+                                    unsigned int input_bytes,
+                                    unsigned char* input,
+                                    unsigned int output_bytes,
+                                    unsigned char* output,
+                                    enum jtag_states end_tap_state)
+{
+    if (output)
+        memset(output, 0xa5, output_bytes);
+    mock_tap_state = end_tap_state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_scan_program_execute(JTAG_Handler* state)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_sync_tap_state(JTAG_Handler* state)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_tap_state_folded(JTAG_Handler* state)
+{
+    return ST_OK;
+}
+
+// The replay runs in single chain mode, multi-chain is never selected.
+JTAG_Multi* __wrap_JTAG_multi_create(JTAG_Handler* primary,
+                                     JTAG_Backend backend,
+                                     const char* sim_chain)
+{
+    return NULL;
+}
+
+void __wrap_JTAG_multi_destroy(JTAG_Multi* multi)
+{
+}
+
+STATUS __wrap_JTAG_multi_select(JTAG_Multi* multi, const uint8_t* chain_bytes,
+                                unsigned int length, bool sw_mode)
+{
+    return ST_ERR;
+}
+
+unsigned int __wrap_JTAG_multi_selected_count(const JTAG_Multi* multi)
+{
+    return 0;
+}
+
+STATUS __wrap_JTAG_multi_scan(JTAG_Multi* multi, unsigned int number_of_bits,
+                              unsigned int input_bytes,
+                              const unsigned char* input,
+                              unsigned int output_bytes, unsigned char* output,
+                              unsigned int output_stride, uint8_t end_state)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_JTAG_multi_set_tap_state(JTAG_Multi* multi,
+                                       enum jtag_states tap_state)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_JTAG_multi_tap_reset(JTAG_Multi* multi)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_JTAG_multi_wait_cycles(JTAG_Multi* multi,
+                                     unsigned int number_of_cycles)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_JTAG_multi_wait_idle(JTAG_Multi* multi,
+                                   unsigned int number_of_cycles)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_JTAG_multi_set_padding(JTAG_Multi* multi,
+                                     JTAGPaddingTypes padding,
+                                     unsigned int value)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_JTAG_multi_set_jtag_tck(JTAG_Multi* multi, unsigned int tck)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_JTAG_multi_wait(JTAG_Multi* multi)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
+                         unsigned int input_bytes, unsigned char* input,
+                         unsigned int output_bytes, unsigned char* output,
+                         enum jtag_states end_tap_state)
+{
+    mock_tap_state = end_tap_state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_wait_cycles(JTAG_Handler* state,
+                               unsigned int number_of_cycles)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_wait_idle(JTAG_Handler* state,
+                             unsigned int number_of_cycles)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_tap_reset(JTAG_Handler* state)
+{
+    mock_tap_state = jtag_tlr;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_set_padding(JTAG_Handler* state, JTAGPaddingTypes padding,
+                               unsigned int value)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_target_write(Target_Control_Handle* state, Pin pin,
+                           bool assert)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_target_read(Target_Control_Handle* state, Pin pin,
+                          bool* asserted)
+{
+    *asserted = false;
+    return ST_OK;
+}
+
+STATUS __wrap_target_write_event_config(Target_Control_Handle* state,
+                                        WriteConfig event_cfg, bool enable)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_target_wait_PRDY(Target_Control_Handle* state,
+                               uint8_t log2time)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_target_wait_sync(Target_Control_Handle* state, uint16_t timeout,
+                               uint16_t delay)
+{
+    return ST_OK;
+}
+
+// Handler setup, event polling and the SPP bus are never reached by the
+// replay, they are only here so the interpreter links.
+JTAG_Handler* __wrap_JTAGHandler()
+{
+    return NULL;
+}
+
+STATUS __wrap_JTAG_initialize(JTAG_Handler* state, bool sw_mode)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_deinitialize(JTAG_Handler* state)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_set_backend(JTAG_Handler* state, JTAG_Backend backend,
+                               const char* sim_chain)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_set_active_chain(JTAG_Handler* state, scanChain chain)
+{
+    return ST_OK;
+}
+
+Target_Control_Handle* __wrap_TargetHandler()
+{
+    return NULL;
+}
+
+STATUS __wrap_target_initialize(Target_Control_Handle* state,
+                                bool xdp_fail_enable)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_target_deinitialize(Target_Control_Handle* state)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_on_power_event(Target_Control_Handle* state, ASD_EVENT* event)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_on_power2_event(Target_Control_Handle* state, ASD_EVENT* event)
+{
+    return ST_OK;
+}
+
+STATUS __wrap_target_get_fds(Target_Control_Handle* state,
+                             target_fdarr_t* fds, int* num_fds)
+{
+    *num_fds = 0;
+    return ST_OK;
+}
+
+STATUS __wrap_target_get_spp_fds(Target_Control_Handle* state,
+                                 struct pollfd* fds, int* num_fds)
+{
+    *num_fds = 0;
+    return ST_OK;
+}
+
+STATUS __wrap_target_event(Target_Control_Handle* state,
+                           struct pollfd poll_fd, ASD_EVENT* event,
+                           ASD_EVENT_DATA* ret_data)
+{
+    *event = ASD_EVENT_NONE;
+    return ST_OK;
+}
+
+STATUS __wrap_spp_bus_get_device_map(SPP_Handler* state,
+                                     uint32_t* device_mask)
+{
+    return ST_ERR;
+}
+
+STATUS __wrap_spp_device_select(SPP_Handler* state, uint8_t device)
+{
+    return ST_ERR;
+}
+
+bool __wrap_check_spp_prdy_event(ASD_EVENT event, ASD_EVENT_DATA event_data)
+{
+    return false;
+}
+
+bool __wrap_check_spp_auto_cmd_event(ASD_EVENT event,
+                                     ASD_EVENT_DATA event_data)
+{
+    return false;
+}
+
+void __wrap_ASD_update_log_settings(ASD_LogLevel level, ASD_LogStream stream)
+{
+}
+
+ASD_LogLevel __wrap_convert_remote_log_level(uint8_t remote_level)
+{
+    return ASD_LogLevel_Off;
+}
+
+bool __wrap_is_auto_sync_remote_logging_enabled(void)
+{
+    return false;
+}
+
+ASD_LogStream __wrap_get_auto_sync_remote_logging_streams(void)
+{
+    return ASD_LogStream_None;
+}
+
+static void add_byte(struct asd_message* msg, int* size, unsigned char value)
+{
+    msg->buffer[(*size)++] = value;
+}
+
+static void finish_message(struct asd_message* msg, int size)
+{
+    msg->header.type = JTAG_TYPE;
+    msg->header.size_lsb = lsb_from_msg_size(size);
+    msg->header.size_msb = msb_from_msg_size(size);
+    num_messages++;
+}
+
+// A register access loop the way a debugger issues it: select the IR,
+// shift the instruction, then a series of 32 and 64 bit DR reads/writes.
+static void build_builtin_messages(void)
+{
+    for (int m = 0; m < 16; m++)
+    {
+        struct asd_message* msg = &messages[num_messages];
+        int size = 0;
+
+        add_byte(msg, &size, IR_PREFIX);
+        add_byte(msg, &size, 0x02);
+        add_byte(msg, &size, 0x00);
+        add_byte(msg, &size, DR_PREFIX);
+        add_byte(msg, &size, 0x01);
+        while (size + 24 < 1024)
+        {
+            add_byte(msg, &size, TAP_STATE_MIN | jtag_shf_ir);
+            add_byte(msg, &size, WRITE_SCAN_MIN | 8);
+            add_byte(msg, &size, 0x02);
+            add_byte(msg, &size, TAP_STATE_MIN | jtag_shf_dr);
+            add_byte(msg, &size, READ_WRITE_SCAN_MIN | 32);
+            for (int i = 0; i < 4; i++)
+                add_byte(msg, &size, (unsigned char)(m + i));
+            // scans of a different type must be separated by a TAP state
+            add_byte(msg, &size, TAP_STATE_MIN | jtag_shf_dr);
+            add_byte(msg, &size, READ_SCAN_MIN); // 64 bits
+            add_byte(msg, &size, TAP_STATE_MIN | jtag_rti);
+            add_byte(msg, &size, WAIT_CYCLES_TCK_ENABLE);
+            add_byte(msg, &size, 4);
+            add_byte(msg, &size, READ_STATUS_MIN);
+            add_byte(msg, &size, 0);
+        }
+        finish_message(msg, size);
+    }
+}
+
+static int load_capture(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (num_messages < MAX_BENCH_MESSAGES)
+    {
+        struct asd_message* msg = &messages[num_messages];
+        if (fread(&msg->header, sizeof(msg->header), 1, fp) != 1)
+            break;
+        int size = get_message_size(msg);
+        if (size < 0 || fread(msg->buffer, 1, (size_t)size, fp) != (size_t)size)
+        {
+            fprintf(stderr, "%s: truncated message %u\n", path, num_messages);
+            fclose(fp);
+            return -1;
+        }
+        // Only JTAG messages go through the byte-code interpreter.
+        if (msg->header.type == JTAG_TYPE)
+            num_messages++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Walks the messages once with the opcode table to know how many opcodes
+// a pass decodes, without calling into any handler.
+static void count_opcodes(void)
+{
+    for (unsigned int m = 0; m < num_messages; m++)
+    {
+        int size = get_message_size(&messages[m]);
+        for (int i = 0; i < size;)
+        {
+            uint8_t cmd = messages[m].buffer[i++];
+            i += jtag_opcodes[cmd].operand_len;
+            opcodes_per_pass++;
+        }
+    }
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    double max_ns_per_opcode = 0;
+    config cfg;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                max_ns_per_opcode = strtod(optarg, NULL);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-n iterations] [-m max_ns_per_opcode] "
+                        "[capture]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc)
+    {
+        if (load_capture(argv[optind]) != 0)
+            return 1;
+    }
+    else
+    {
+        build_builtin_messages();
+    }
+    if (num_messages == 0 || iterations == 0)
+    {
+        fprintf(stderr, "nothing to replay\n");
+        return 1;
+    }
+    count_opcodes();
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.jtag.mode = JTAG_DRIVER_MODE_SOFTWARE;
+    msg_state.asd_cfg = &cfg;
+    msg_state.jtag_handler = (JTAG_Handler*)&cfg;
+    msg_state.target_handler = (Target_Control_Handle*)&cfg;
+
+    unsigned long long start = now_ns();
+    for (unsigned long n = 0; n < iterations; n++)
+    {
+        for (unsigned int m = 0; m < num_messages; m++)
+        {
+            if (process_jtag_message(&messages[m]) != ST_OK)
+            {
+                fprintf(stderr, "message %u failed to decode\n", m);
+                return 1;
+            }
+        }
+    }
+    unsigned long long elapsed = now_ns() - start;
+
+    unsigned long long total_opcodes =
+        (unsigned long long)opcodes_per_pass * iterations;
+    double ns_per_opcode = (double)elapsed / (double)total_opcodes;
+    printf("messages: %u opcodes/pass: %lu iterations: %lu\n", num_messages,
+           opcodes_per_pass, iterations);
+    printf("total: %llu ns  per message: %.1f ns  per opcode: %.2f ns\n",
+           elapsed, (double)elapsed / ((double)num_messages * iterations),
+           ns_per_opcode);
+
+    if (responses_sent != (unsigned long)num_messages * iterations)
+    {
+        fprintf(stderr, "expected %lu responses, got %lu\n",
+                (unsigned long)num_messages * iterations, responses_sent);
+        return 1;
+    }
+    if (max_ns_per_opcode > 0 && ns_per_opcode > max_ns_per_opcode)
+    {
+        fprintf(stderr, "decode cost %.2f ns/opcode exceeds budget %.2f\n",
+                ns_per_opcode, max_ns_per_opcode);
+        return 1;
+    }
+    return 0;
+}
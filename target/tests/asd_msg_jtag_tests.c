@@ -0,0 +1,1273 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// JTAG message interpreter, remote log record and hardware worker tests,
+// run against the msg_state instance asd_msg_init() sets up with every
+// handler mocked.
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../asd_msg.h"
+#include "asd_server_interface.h"
+#include "cmocka.h"
+
+extern ASD_MSG msg_state;
+
+unsigned int stall_warnings = 0;
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    if (strcmp(format, "Still waiting on the message worker") == 0)
+        __atomic_add_fetch(&stall_warnings, 1, __ATOMIC_SEQ_CST);
+}
+
+void __wrap_ASD_log_buffer(ASD_LogLevel level, ASD_LogStream stream,
+                           ASD_LogOption options, const unsigned char* ptr,
+                           size_t len, const char* prefixPtr)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)ptr;
+    (void)len;
+    (void)prefixPtr;
+}
+
+// Every message queued on the server, the last one is kept in msg_sent.
+struct asd_message msg_sent;
+unsigned int msg_sent_count = 0;
+STATUS asd_api_server_ioctl(void* input, void* output, unsigned int cmd)
+{
+    (void)output;
+    if (cmd == IOCTL_SERVER_QUEUE_MSG || cmd == IOCTL_SERVER_QUEUE_EVENT)
+    {
+        asd_msg_iov* msg_iov = (asd_msg_iov*)input;
+        unsigned char* sent = (unsigned char*)&msg_sent;
+        size_t offset = 0;
+
+        memset(&msg_sent, 0, sizeof(msg_sent));
+        for (int i = 0; i < msg_iov->iovcnt; i++)
+        {
+            memcpy(sent + offset, msg_iov->iov[i].iov_base,
+                   msg_iov->iov[i].iov_len);
+            offset += msg_iov->iov[i].iov_len;
+        }
+        msg_sent_count++;
+    }
+    return ST_OK;
+}
+
+size_t asd_api_server_read(unsigned char* buffer, size_t length, void* opt)
+{
+    (void)buffer;
+    (void)length;
+    (void)opt;
+    return 0;
+}
+
+JTAG_Handler* __wrap_JTAGHandler()
+{
+    return (JTAG_Handler*)calloc(1, sizeof(JTAG_Handler));
+}
+
+STATUS __wrap_JTAG_initialize(JTAG_Handler* state, bool sw_mode)
+{
+    (void)state;
+    (void)sw_mode;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_deinitialize(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_set_backend(JTAG_Handler* state, JTAG_Backend backend,
+                               const char* sim_chain)
+{
+    (void)state;
+    (void)backend;
+    (void)sim_chain;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_set_active_chain(JTAG_Handler* state, scanChain chain)
+{
+    (void)state;
+    (void)chain;
+    return ST_OK;
+}
+
+Target_Control_Handle* __wrap_TargetHandler()
+{
+    return (Target_Control_Handle*)calloc(1, sizeof(Target_Control_Handle));
+}
+
+STATUS __wrap_target_initialize(Target_Control_Handle* state,
+                                bool xdp_fail_enable)
+{
+    (void)state;
+    (void)xdp_fail_enable;
+    return ST_OK;
+}
+
+STATUS __wrap_target_deinitialize(Target_Control_Handle* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+I2C_Handler* __wrap_I2CHandler(bus_config* config)
+{
+    (void)config;
+    return (I2C_Handler*)calloc(1, sizeof(I2C_Handler));
+}
+
+STATUS __wrap_i2c_deinitialize(I2C_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+I3C_Handler* __wrap_I3CHandler(bus_config* config)
+{
+    (void)config;
+    return (I3C_Handler*)calloc(1, sizeof(I3C_Handler));
+}
+
+STATUS __wrap_i3c_deinitialize(I3C_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+SPP_Handler* __wrap_SPPHandler(bus_config* config)
+{
+    (void)config;
+    return (SPP_Handler*)calloc(1, sizeof(SPP_Handler));
+}
+
+STATUS __wrap_spp_deinitialize(SPP_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS __wrap_disconnect(SPP_Handler* state)
+{
+    (void)state;
+    return ST_ERR;
+}
+
+vProbe_Handler* __wrap_vProbeHandler()
+{
+    return (vProbe_Handler*)calloc(1, sizeof(vProbe_Handler));
+}
+
+STATUS __wrap_vProbe_deinitialize(vProbe_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS JTAG_SET_TAP_STATE_RESULT = ST_OK;
+STATUS __wrap_JTAG_set_tap_state(JTAG_Handler* state,
+                                 enum jtag_states tap_state)
+{
+    check_expected_ptr(state);
+    check_expected(tap_state);
+    return JTAG_SET_TAP_STATE_RESULT;
+}
+
+STATUS JTAG_GET_TAP_STATE_RESULT = ST_OK;
+enum jtag_states JTAG_STATE = jtag_sel_dr;
+STATUS __wrap_JTAG_get_tap_state(JTAG_Handler* state,
+                                 enum jtag_states* tap_state)
+{
+    check_expected_ptr(state);
+    check_expected_ptr(tap_state);
+    *tap_state = JTAG_STATE;
+    return JTAG_GET_TAP_STATE_RESULT;
+}
+
+// TDO handed out by the next shifts, tdo_bytes per shift.
+STATUS JTAG_SHIFT_RESULT = ST_OK;
+unsigned char tdo[MAX_DATA_SIZE];
+size_t tdo_bytes = 0;
+size_t tdo_index = 0;
+STATUS __wrap_JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
+                         unsigned int input_bytes, unsigned char* input,
+                         unsigned int output_bytes, unsigned char* output,
+                         enum jtag_states end_tap_state)
+{
+    check_expected_ptr(state);
+    check_expected(number_of_bits);
+    check_expected(input_bytes);
+    check_expected_ptr(input);
+    check_expected(output_bytes);
+    check_expected_ptr(output);
+    check_expected(end_tap_state);
+    if (tdo_bytes > 0 && output != NULL)
+    {
+        memcpy(output, tdo + tdo_index, tdo_bytes);
+        tdo_index += tdo_bytes;
+    }
+    return JTAG_SHIFT_RESULT;
+}
+
+// Scans are checked as they get queued, so the JTAG_shift expectations
+// cover the scan program as well.
+STATUS __wrap_JTAG_scan_program_add(JTAG_Handler* state,
+                                    unsigned int number_of_bits,
+                                    unsigned int input_bytes,
+                                    unsigned char* input,
+                                    unsigned int output_bytes,
+                                    unsigned char* output,
+                                    enum jtag_states end_tap_state)
+{
+    return __wrap_JTAG_shift(state, number_of_bits, input_bytes, input,
+                             output_bytes, output, end_tap_state);
+}
+
+STATUS __wrap_JTAG_scan_program_execute(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_sync_tap_state(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_tap_state_folded(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+// With the worker running, wait cycles are the hardware: they are recorded
+// in the order the worker executes them instead of being checked, and the
+// worker is held in them while the gate is closed.
+bool pipeline_test = false;
+pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t gate_changed = PTHREAD_COND_INITIALIZER;
+bool gate_closed = false;
+unsigned int executed[2 * NUM_IN_FLIGHT_BUFFERS_TO_USE];
+unsigned int executed_count = 0;
+
+STATUS JTAG_WAIT_CYCLES_RESULT = ST_OK;
+STATUS __wrap_JTAG_wait_cycles(JTAG_Handler* state,
+                               unsigned int number_of_cycles)
+{
+    if (pipeline_test)
+    {
+        pthread_mutex_lock(&gate_lock);
+        executed[executed_count++] = number_of_cycles;
+        pthread_cond_broadcast(&gate_changed);
+        while (gate_closed)
+            pthread_cond_wait(&gate_changed, &gate_lock);
+        pthread_mutex_unlock(&gate_lock);
+        return ST_OK;
+    }
+    check_expected_ptr(state);
+    check_expected(number_of_cycles);
+    return JTAG_WAIT_CYCLES_RESULT;
+}
+
+STATUS JTAG_WAIT_IDLE_RESULT = ST_OK;
+STATUS __wrap_JTAG_wait_idle(JTAG_Handler* state,
+                             unsigned int number_of_cycles)
+{
+    check_expected_ptr(state);
+    check_expected(number_of_cycles);
+    return JTAG_WAIT_IDLE_RESULT;
+}
+
+STATUS __wrap_JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck)
+{
+    (void)state;
+    (void)tck;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_tap_reset(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_set_padding(JTAG_Handler* state, JTAGPaddingTypes padding,
+                               unsigned int value)
+{
+    (void)state;
+    (void)padding;
+    (void)value;
+    return ST_OK;
+}
+
+// Multi-chain mode stays on the JTAG handler until a test sets a chain count.
+JTAG_Multi FAKE_JTAG_MULTI;
+unsigned int JTAG_MULTI_SELECTED_COUNT = 0;
+JTAG_Multi* __wrap_JTAG_multi_create(JTAG_Handler* primary,
+                                     JTAG_Backend backend,
+                                     const char* sim_chain)
+{
+    (void)primary;
+    (void)backend;
+    (void)sim_chain;
+    return &FAKE_JTAG_MULTI;
+}
+
+void __wrap_JTAG_multi_destroy(JTAG_Multi* multi)
+{
+    (void)multi;
+}
+
+STATUS __wrap_JTAG_multi_select(JTAG_Multi* multi, const uint8_t* chain_bytes,
+                                unsigned int length, bool sw_mode)
+{
+    (void)multi;
+    (void)chain_bytes;
+    (void)length;
+    (void)sw_mode;
+    return ST_OK;
+}
+
+unsigned int __wrap_JTAG_multi_selected_count(const JTAG_Multi* multi)
+{
+    (void)multi;
+    return JTAG_MULTI_SELECTED_COUNT;
+}
+
+STATUS __wrap_JTAG_multi_scan(JTAG_Multi* multi, unsigned int number_of_bits,
+                              unsigned int input_bytes,
+                              const unsigned char* input,
+                              unsigned int output_bytes, unsigned char* output,
+                              unsigned int output_stride, uint8_t end_state)
+{
+    (void)multi;
+    (void)input_bytes;
+    (void)input;
+    check_expected(number_of_bits);
+    check_expected(output_stride);
+    check_expected(end_state);
+    // every chain answers with its own index
+    for (unsigned int i = 0; output && i < JTAG_MULTI_SELECTED_COUNT; i++)
+        memset(output + i * output_stride, (int)i + 1, output_bytes);
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_set_tap_state(JTAG_Multi* multi,
+                                       enum jtag_states tap_state)
+{
+    (void)multi;
+    (void)tap_state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_tap_reset(JTAG_Multi* multi)
+{
+    (void)multi;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_wait_cycles(JTAG_Multi* multi,
+                                     unsigned int number_of_cycles)
+{
+    (void)multi;
+    (void)number_of_cycles;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_wait_idle(JTAG_Multi* multi,
+                                   unsigned int number_of_cycles)
+{
+    (void)multi;
+    (void)number_of_cycles;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_set_padding(JTAG_Multi* multi,
+                                     JTAGPaddingTypes padding,
+                                     unsigned int value)
+{
+    (void)multi;
+    (void)padding;
+    (void)value;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_set_jtag_tck(JTAG_Multi* multi, unsigned int tck)
+{
+    (void)multi;
+    (void)tck;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_wait(JTAG_Multi* multi)
+{
+    (void)multi;
+    return ST_OK;
+}
+
+STATUS __wrap_target_write(Target_Control_Handle* state, Pin pin,
+                           bool assert)
+{
+    (void)state;
+    (void)pin;
+    (void)assert;
+    return ST_OK;
+}
+
+STATUS __wrap_target_read(Target_Control_Handle* state, Pin pin,
+                          bool* asserted)
+{
+    (void)state;
+    (void)pin;
+    *asserted = false;
+    return ST_OK;
+}
+
+STATUS __wrap_target_write_event_config(Target_Control_Handle* state,
+                                        WriteConfig event_cfg, bool enable)
+{
+    (void)state;
+    (void)event_cfg;
+    (void)enable;
+    return ST_OK;
+}
+
+STATUS __wrap_target_wait_PRDY(Target_Control_Handle* state,
+                               uint8_t log2time)
+{
+    (void)state;
+    (void)log2time;
+    return ST_OK;
+}
+
+STATUS __wrap_target_wait_sync(Target_Control_Handle* state, uint16_t timeout,
+                               uint16_t delay)
+{
+    (void)state;
+    (void)timeout;
+    (void)delay;
+    return ST_OK;
+}
+
+STATUS __wrap_target_get_fds(Target_Control_Handle* state,
+                             target_fdarr_t* fds, int* num_fds)
+{
+    (void)state;
+    (void)fds;
+    *num_fds = 0;
+    return ST_OK;
+}
+
+STATUS __wrap_target_get_spp_fds(Target_Control_Handle* state,
+                                 struct pollfd* fds, int* num_fds)
+{
+    (void)state;
+    (void)fds;
+    *num_fds = 0;
+    return ST_OK;
+}
+
+STATUS __wrap_target_event(Target_Control_Handle* state,
+                           struct pollfd poll_fd, ASD_EVENT* event,
+                           ASD_EVENT_DATA* ret_data)
+{
+    (void)state;
+    (void)poll_fd;
+    (void)ret_data;
+    *event = ASD_EVENT_NONE;
+    return ST_OK;
+}
+
+STATUS __wrap_on_power_event(Target_Control_Handle* state, ASD_EVENT* event)
+{
+    (void)state;
+    (void)event;
+    return ST_OK;
+}
+
+STATUS __wrap_on_power2_event(Target_Control_Handle* state, ASD_EVENT* event)
+{
+    (void)state;
+    (void)event;
+    return ST_OK;
+}
+
+void __wrap_ASD_update_log_settings(ASD_LogLevel level, ASD_LogStream stream)
+{
+    (void)level;
+    (void)stream;
+}
+
+ASD_LogLevel __wrap_convert_remote_log_level(uint8_t remote_level)
+{
+    (void)remote_level;
+    return ASD_LogLevel_Off;
+}
+
+bool __wrap_is_auto_sync_remote_logging_enabled(void)
+{
+    return false;
+}
+
+ASD_LogStream __wrap_get_auto_sync_remote_logging_streams(void)
+{
+    return ASD_LogStream_None;
+}
+
+static config asd_config;
+static int setup(void** state)
+{
+    (void)state;
+    memset(&asd_config, 0, sizeof(asd_config));
+    asd_config.jtag.mode = JTAG_DRIVER_MODE_SOFTWARE;
+    assert_int_equal(ST_OK, asd_msg_init(&asd_config));
+    msg_state.handlers_initialized = true;
+    memset(&msg_sent, 0, sizeof(msg_sent));
+    msg_sent_count = 0;
+    tdo_bytes = 0;
+    tdo_index = 0;
+    JTAG_STATE = jtag_sel_dr;
+    JTAG_MULTI_SELECTED_COUNT = 0;
+    return 0;
+}
+
+static int teardown(void** state)
+{
+    (void)state;
+    asd_msg_free();
+    return 0;
+}
+
+// Puts a JTAG message with the given payload in the receive buffer.
+static void set_jtag_message(const unsigned char* data, unsigned int size,
+                             uint8_t cmd_stat)
+{
+    struct asd_message* msg = &msg_state.in_msg.msg;
+
+    memset(msg, 0, sizeof(*msg));
+    msg->header.type = JTAG_TYPE;
+    msg->header.cmd_stat = cmd_stat;
+    msg->header.size_lsb = lsb_from_msg_size(size);
+    msg->header.size_msb = msb_from_msg_size(size);
+    memcpy(msg->buffer, data, size);
+}
+
+void asd_msg_on_msg_recv_wait_cycles_fused_test(void** state)
+{
+    (void)state;
+    unsigned char data[] = {WAIT_CYCLES_TCK_ENABLE,  12,
+                            WAIT_CYCLES_TCK_ENABLE,  0,
+                            WAIT_CYCLES_TCK_DISABLE, 5,
+                            WAIT_CYCLES_TCK_DISABLE, 0,
+                            WAIT_CYCLES_TCK_ENABLE,  1};
+    set_jtag_message(data, sizeof(data), 0);
+
+    // runs of the same kind are one wait, TCK disabled waits sleep
+    expect_any(__wrap_JTAG_wait_cycles, state);
+    expect_value(__wrap_JTAG_wait_cycles, number_of_cycles, 12 + 256);
+    expect_any(__wrap_JTAG_wait_idle, state);
+    expect_value(__wrap_JTAG_wait_idle, number_of_cycles, 5 + 256);
+    expect_any(__wrap_JTAG_wait_cycles, state);
+    expect_value(__wrap_JTAG_wait_cycles, number_of_cycles, 1);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    assert_int_equal(1, msg_sent_count);
+    assert_int_equal(ASD_SUCCESS, msg_sent.header.cmd_stat);
+}
+
+void asd_msg_on_msg_recv_read_scan_multichain_test(void** state)
+{
+    (void)state;
+    unsigned char expected_num_bits = 12;
+    unsigned char data[] = {(unsigned char)(READ_SCAN_MIN + expected_num_bits)};
+    set_jtag_message(data, sizeof(data), 0);
+    msg_state.jtag_chain_mode = JTAG_CHAIN_SELECT_MODE_MULTI;
+    msg_state.jtag_multi = &FAKE_JTAG_MULTI;
+    JTAG_MULTI_SELECTED_COUNT = 2;
+
+    expect_value(__wrap_JTAG_multi_scan, number_of_bits, expected_num_bits);
+    expect_value(__wrap_JTAG_multi_scan, output_stride, 3);
+    expect_value(__wrap_JTAG_multi_scan, end_state, SCAN_END_CURRENT);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    // one [cmd][TDO] record per chain, in chain order
+    assert_int_equal(ASD_SUCCESS, msg_sent.header.cmd_stat);
+    assert_int_equal(6, msg_sent.header.size_lsb);
+    assert_int_equal((unsigned char)(READ_SCAN_MIN + expected_num_bits),
+                     msg_sent.buffer[0]);
+    assert_int_equal(1, msg_sent.buffer[1]);
+    assert_int_equal(1, msg_sent.buffer[2]);
+    assert_int_equal((unsigned char)(READ_SCAN_MIN + expected_num_bits),
+                     msg_sent.buffer[3]);
+    assert_int_equal(2, msg_sent.buffer[4]);
+    assert_int_equal(2, msg_sent.buffer[5]);
+}
+
+void asd_msg_on_msg_recv_ext_read_write_scan_test(void** state)
+{
+    (void)state;
+    unsigned char data[] = {EXT_READ_WRITE_SCAN, 16, 0, 0, 0, 0x12, 0x34,
+                            TAP_STATE_MIN + jtag_rti};
+    set_jtag_message(data, sizeof(data), 0);
+
+    tdo_bytes = 2;
+    tdo[0] = 0xab;
+    tdo[1] = 0xcd;
+    // the whole scan is one shift and ends in the TAP state after it
+    expect_any(__wrap_JTAG_shift, state);
+    expect_value(__wrap_JTAG_shift, number_of_bits, 16);
+    expect_value(__wrap_JTAG_shift, input_bytes, 2);
+    expect_any(__wrap_JTAG_shift, input);
+    expect_any(__wrap_JTAG_shift, output_bytes);
+    expect_any(__wrap_JTAG_shift, output);
+    expect_value(__wrap_JTAG_shift, end_tap_state, jtag_rti);
+
+    expect_any(__wrap_JTAG_set_tap_state, state);
+    expect_value(__wrap_JTAG_set_tap_state, tap_state, jtag_rti);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    assert_int_equal(ASD_SUCCESS, msg_sent.header.cmd_stat);
+    assert_int_equal(3, msg_sent.header.size_lsb);
+    assert_int_equal(EXT_READ_WRITE_SCAN, msg_sent.buffer[0]);
+    assert_int_equal(0xab, msg_sent.buffer[1]);
+    assert_int_equal(0xcd, msg_sent.buffer[2]);
+}
+
+void asd_msg_on_msg_recv_ext_write_scan_continuation_test(void** state)
+{
+    (void)state;
+    // 24 bits of TDI, the first two bytes come with the opcode
+    unsigned char first[] = {EXT_WRITE_SCAN, 24, 0, 0, 0, 0x11, 0x22};
+    unsigned char rest[] = {0x33};
+    set_jtag_message(first, sizeof(first), ASD_PACKET_CONTINUATION);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    // acked, the scan has not run yet
+    assert_int_equal(1, msg_sent_count);
+    assert_int_equal(ASD_SUCCESS | ASD_PACKET_CONTINUATION,
+                     msg_sent.header.cmd_stat);
+    assert_int_equal(0, msg_sent.header.size_lsb);
+    assert_true(msg_state.ext_scan.pending);
+
+    set_jtag_message(rest, sizeof(rest), 0);
+    JTAG_STATE = jtag_shf_dr;
+    expect_any(__wrap_JTAG_get_tap_state, state);
+    expect_any(__wrap_JTAG_get_tap_state, tap_state);
+
+    expect_any(__wrap_JTAG_shift, state);
+    expect_value(__wrap_JTAG_shift, number_of_bits, 24);
+    expect_value(__wrap_JTAG_shift, input_bytes, 3);
+    expect_any(__wrap_JTAG_shift, input);
+    expect_any(__wrap_JTAG_shift, output_bytes);
+    expect_any(__wrap_JTAG_shift, output);
+    expect_value(__wrap_JTAG_shift, end_tap_state, jtag_shf_dr);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    assert_false(msg_state.ext_scan.pending);
+    assert_int_equal(ASD_SUCCESS, msg_sent.header.cmd_stat);
+    assert_int_equal(0, msg_sent.header.size_lsb);
+    assert_int_equal(0x11, msg_state.ext_scan.tdio[0]);
+    assert_int_equal(0x22, msg_state.ext_scan.tdio[1]);
+    assert_int_equal(0x33, msg_state.ext_scan.tdio[2]);
+}
+
+void asd_msg_on_msg_recv_ext_scan_continuation_end_state_test(void** state)
+{
+    (void)state;
+    unsigned char first[] = {EXT_WRITE_SCAN, 24, 0, 0, 0, 0x11, 0x22};
+    unsigned char rest[] = {0x33, TAP_STATE_MIN + jtag_ex1_dr,
+                            TAP_STATE_MIN + jtag_pau_dr};
+    asd_config.jtag.mode = JTAG_DRIVER_MODE_HARDWARE;
+    set_jtag_message(first, sizeof(first), ASD_PACKET_CONTINUATION);
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+
+    // the commands after the rest of the TDI decide where the scan ends
+    set_jtag_message(rest, sizeof(rest), 0);
+    expect_any(__wrap_JTAG_shift, state);
+    expect_value(__wrap_JTAG_shift, number_of_bits, 24);
+    expect_value(__wrap_JTAG_shift, input_bytes, 3);
+    expect_any(__wrap_JTAG_shift, input);
+    expect_any(__wrap_JTAG_shift, output_bytes);
+    expect_any(__wrap_JTAG_shift, output);
+    expect_value(__wrap_JTAG_shift, end_tap_state, jtag_pau_dr);
+    expect_any_count(__wrap_JTAG_set_tap_state, state, 2);
+    expect_value(__wrap_JTAG_set_tap_state, tap_state, jtag_ex1_dr);
+    expect_value(__wrap_JTAG_set_tap_state, tap_state, jtag_pau_dr);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    assert_int_equal(2, msg_sent_count);
+    assert_int_equal(ASD_SUCCESS, msg_sent.header.cmd_stat);
+}
+
+void asd_msg_on_msg_recv_scan_then_ext_scan_test(void** state)
+{
+    (void)state;
+    unsigned char data[] = {WRITE_SCAN_MIN + 8, 0xa5, EXT_WRITE_SCAN, 16, 0,
+                            0,  0, 0x12, 0x34};
+    set_jtag_message(data, sizeof(data), 0);
+
+    // neither scan is followed by a TAP_STATE, both stay where they end
+    JTAG_STATE = jtag_shf_dr;
+    expect_any_count(__wrap_JTAG_get_tap_state, state, 2);
+    expect_any_count(__wrap_JTAG_get_tap_state, tap_state, 2);
+    expect_any_count(__wrap_JTAG_shift, state, 2);
+    expect_value(__wrap_JTAG_shift, number_of_bits, 8);
+    expect_value(__wrap_JTAG_shift, number_of_bits, 16);
+    expect_any_count(__wrap_JTAG_shift, input_bytes, 2);
+    expect_any_count(__wrap_JTAG_shift, input, 2);
+    expect_any_count(__wrap_JTAG_shift, output_bytes, 2);
+    expect_any_count(__wrap_JTAG_shift, output, 2);
+    expect_value_count(__wrap_JTAG_shift, end_tap_state, jtag_shf_dr, 2);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    assert_int_equal(ASD_SUCCESS, msg_sent.header.cmd_stat);
+}
+
+void asd_msg_on_msg_recv_ext_scan_missing_tdi_test(void** state)
+{
+    (void)state;
+    unsigned char data[] = {EXT_WRITE_SCAN, 24, 0, 0, 0, 0x11};
+    set_jtag_message(data, sizeof(data), 0);
+
+    assert_int_equal(ST_OK, asd_msg_on_msg_recv());
+    assert_int_equal(ASD_FAILURE_PROCESS_JTAG_MSG, msg_sent.header.cmd_stat);
+    assert_false(msg_state.ext_scan.pending);
+}
+
+void send_remote_log_record_test(void** state)
+{
+    (void)state;
+    unsigned char record[] = {LOG_RECORD_MESSAGE, 0x78, 0x56, 0x34, 0x12,
+                              LOG_ARG_INT32,      7,    0,    0,    0};
+    asd_config.remote_logging.logging_level = IPC_LogType_Error;
+    asd_config.ipc_asd_log_map[ASD_LogLevel_Error] = IPC_LogType_Error;
+
+    send_remote_log_record(ASD_LogLevel_Error, ASD_LogStream_All, record,
+                           sizeof(record));
+
+    assert_int_equal(HARDWARE_LOG_EVENT, msg_sent.header.type);
+    assert_int_equal(AGENT_CONFIGURATION_CMD, msg_sent.buffer[0]);
+    // level 4 with the binary bit
+    assert_int_equal(0x44, msg_sent.buffer[1]);
+    assert_memory_equal(&msg_sent.buffer[2], record, sizeof(record));
+    assert_int_equal(2 + sizeof(record), msg_sent.header.size_lsb);
+    assert_int_equal(0, msg_sent.header.size_msb);
+}
+
+void annotate_scan_end_states_end_of_packet_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[2] = {READ_SCAN_MIN + 1, READ_SCAN_MIN + 1};
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    // a scan followed by the same scan type or by nothing stays put
+    assert_int_equal(SCAN_END_CURRENT, interp.scan_end_state[0]);
+    assert_int_equal(SCAN_END_CURRENT, interp.scan_end_state[1]);
+}
+
+void annotate_scan_end_states_next_is_tap_state_cmd_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[4] = {WRITE_SCAN_MIN + 8, 0xa5,
+                                  TAP_STATE_MIN + jtag_pau_dr,
+                                  TAP_STATE_MIN + jtag_rti};
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    // only hardware mode looks past the first TAP state
+    assert_int_equal(jtag_pau_dr, interp.scan_end_state[0]);
+}
+
+void annotate_scan_end_states_sw_mode_folds_update_rti_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    // commands that do not clock the TAP keep the fold going
+    unsigned char test_data[7] = {READ_SCAN_MIN + 1,
+                                  TAP_STATE_MIN + jtag_ex1_dr,
+                                  TAP_STATE_MIN + jtag_upd_dr,
+                                  DR_PREFIX,
+                                  0x01,
+                                  TAP_STATE_MIN + jtag_rti,
+                                  TAP_STATE_MIN + jtag_sel_dr};
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(jtag_rti, interp.scan_end_state[0]);
+    assert_int_equal(SCAN_END_FOLDED, interp.scan_end_state[1]);
+    assert_int_equal(SCAN_END_FOLDED, interp.scan_end_state[2]);
+    // already reached by the scan, the handler elides it
+    assert_int_equal(SCAN_END_CURRENT, interp.scan_end_state[5]);
+    assert_int_equal(SCAN_END_CURRENT, interp.scan_end_state[6]);
+}
+
+void annotate_scan_end_states_sw_mode_wait_cycles_stop_fold_test(
+    void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    // wait cycles clock the TAP in Exit1-IR, nothing may be folded past it
+    unsigned char test_data[5] = {READ_SCAN_MIN + 1,
+                                  TAP_STATE_MIN + jtag_ex1_ir,
+                                  WAIT_CYCLES_TCK_ENABLE, 4,
+                                  TAP_STATE_MIN + jtag_pau_ir};
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(jtag_ex1_ir, interp.scan_end_state[0]);
+    assert_int_equal(SCAN_END_CURRENT, interp.scan_end_state[1]);
+    assert_int_equal(SCAN_END_CURRENT, interp.scan_end_state[4]);
+}
+
+void annotate_scan_end_states_hw_mode_jtag_pau_dr_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[3] = {READ_SCAN_MIN + 1, TAP_STATE_MIN + jtag_ex1_dr,
+                                  TAP_STATE_MIN + jtag_pau_dr};
+    asd_config.jtag.mode = JTAG_DRIVER_MODE_HARDWARE;
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(jtag_pau_dr, interp.scan_end_state[0]);
+}
+
+void annotate_scan_end_states_hw_mode_jtag_pau_ir_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    // commands that keep the TAP state do not end the look ahead
+    unsigned char test_data[8] = {READ_SCAN_MIN + 1,
+                                  TAP_STATE_MIN + jtag_ex1_ir,
+                                  WAIT_CYCLES_TCK_ENABLE,
+                                  4,
+                                  IR_PREFIX,
+                                  0x01,
+                                  0x00,
+                                  TAP_STATE_MIN + jtag_pau_ir};
+    asd_config.jtag.mode = JTAG_DRIVER_MODE_HARDWARE;
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(jtag_pau_ir, interp.scan_end_state[0]);
+}
+
+void annotate_scan_end_states_hw_mode_other_cmd_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[4] = {READ_SCAN_MIN + 1,
+                                  TAP_STATE_MIN + jtag_ex1_dr, TAP_RESET,
+                                  TAP_STATE_MIN + jtag_pau_dr};
+    asd_config.jtag.mode = JTAG_DRIVER_MODE_HARDWARE;
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(jtag_ex1_dr, interp.scan_end_state[0]);
+}
+
+void annotate_scan_end_states_hw_mode_ext_scan_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[10] = {READ_SCAN_MIN + 1,
+                                   EXT_READ_SCAN,
+                                   32,
+                                   0,
+                                   0,
+                                   0,
+                                   TAP_STATE_MIN + jtag_ex1_dr,
+                                   WAIT_CYCLES_TCK_ENABLE,
+                                   4,
+                                   TAP_STATE_MIN + jtag_rti};
+    asd_config.jtag.mode = JTAG_DRIVER_MODE_HARDWARE;
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    // an extended scan follows a short one of its type and looks ahead
+    assert_int_equal(SCAN_END_CURRENT, interp.scan_end_state[0]);
+    assert_int_equal(jtag_rti, interp.scan_end_state[1]);
+}
+
+void annotate_scan_end_states_ext_scan_continuation_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[2] = {TAP_STATE_MIN + jtag_ex1_dr,
+                                  TAP_STATE_MIN + jtag_pau_dr};
+    msg_state.ext_scan.pending = true;
+    msg_state.ext_scan.cmd = EXT_WRITE_SCAN;
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+    msg_state.ext_scan.pending = false;
+
+    // the scan whose TDI opened the message folds the moves behind it
+    assert_int_equal(jtag_pau_dr, interp.ext_end_state);
+    assert_int_equal(SCAN_END_FOLDED, interp.scan_end_state[0]);
+}
+
+void annotate_scan_end_states_many_scans_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[MAX_DATA_SIZE];
+    unsigned int size = 0;
+
+    while (size + 4 <= sizeof(test_data))
+    {
+        test_data[size++] = READ_WRITE_SCAN_MIN + 16;
+        test_data[size++] = 0x12;
+        test_data[size++] = 0x34;
+        test_data[size++] = TAP_STATE_MIN + jtag_pau_dr;
+    }
+
+    annotate_scan_end_states(&interp, test_data, size);
+
+    for (unsigned int i = 0; i < size; i += 4)
+        assert_int_equal(jtag_pau_dr, interp.scan_end_state[i]);
+}
+
+void annotate_scan_end_states_next_is_not_read_scan_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[2] = {READ_SCAN_MIN + 1,
+                                  (READ_SCAN_MAX + 1)}; // not a read scan
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(SCAN_END_INVALID, interp.scan_end_state[0]);
+}
+
+void annotate_scan_end_states_next_is_not_write_scan_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[3] = {WRITE_SCAN_MIN + 1, 0x01,
+                                  (WRITE_SCAN_MAX + 1)}; // not a write scan
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(SCAN_END_INVALID, interp.scan_end_state[0]);
+}
+
+void annotate_scan_end_states_next_is_not_readwrite_scan_test(void** state)
+{
+    (void)state;
+    jtag_interp interp;
+    unsigned char test_data[3] = {
+        READ_WRITE_SCAN_MIN + 1, 0x01,
+        (READ_WRITE_SCAN_MIN - 1)}; // not a read write scan
+
+    annotate_scan_end_states(&interp, test_data, sizeof(test_data));
+
+    assert_int_equal(SCAN_END_INVALID, interp.scan_end_state[0]);
+}
+
+static void set_gate(bool closed)
+{
+    pthread_mutex_lock(&gate_lock);
+    gate_closed = closed;
+    pthread_cond_broadcast(&gate_changed);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+// Starts the worker with the gate closed, so that it stops in the first
+// message it gets.
+static int pipeline_setup(void** state)
+{
+    setup(state);
+    pipeline_test = true;
+    gate_closed = true;
+    executed_count = 0;
+    stall_warnings = 0;
+    return msg_pipeline_start() == ST_OK ? 0 : -1;
+}
+
+static int pipeline_teardown(void** state)
+{
+    set_gate(false);
+    msg_pipeline_stop();
+    pipeline_test = false;
+    return teardown(state);
+}
+
+// Waits until the worker reached the count-th wait cycles message.
+static void wait_executed(unsigned int count)
+{
+    pthread_mutex_lock(&gate_lock);
+    while (executed_count < count)
+        pthread_cond_wait(&gate_changed, &gate_lock);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+static bool pipeline_drained(void)
+{
+    for (int i = 0; i < 5000; i++)
+    {
+        if (__atomic_load_n(&msg_state.pipeline.tail, __ATOMIC_SEQ_CST) ==
+            __atomic_load_n(&msg_state.pipeline.head, __ATOMIC_SEQ_CST))
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+static STATUS push_wait_cycles(unsigned char cycles)
+{
+    struct asd_message msg;
+    unsigned char data[] = {WAIT_CYCLES_TCK_ENABLE, cycles};
+
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = JTAG_TYPE;
+    msg.header.size_lsb = sizeof(data);
+    memcpy(msg.buffer, data, sizeof(data));
+    return msg_pipeline_push(&msg);
+}
+
+// What the socket thread does while the test thread watches it.
+typedef struct socket_thread
+{
+    pthread_t thread;
+    bool done;
+    STATUS result;
+} socket_thread;
+
+static void* push_one_more(void* arg)
+{
+    socket_thread* socket = (socket_thread*)arg;
+
+    socket->result = push_wait_cycles(NUM_IN_FLIGHT_BUFFERS_TO_USE + 1);
+    __atomic_store_n(&socket->done, true, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void* stop_pipeline(void* arg)
+{
+    socket_thread* socket = (socket_thread*)arg;
+
+    msg_pipeline_stop();
+    __atomic_store_n(&socket->done, true, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void* service_pin_event(void* arg)
+{
+    socket_thread* socket = (socket_thread*)arg;
+    struct pollfd poll_fd = {0};
+
+    socket->result = asd_msg_event(poll_fd);
+    __atomic_store_n(&socket->done, true, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+void msg_pipeline_full_ring_runs_in_order_test(void** state)
+{
+    (void)state;
+    socket_thread socket = {.done = false, .result = ST_ERR};
+
+    assert_int_equal(ST_OK, push_wait_cycles(1));
+    wait_executed(1);
+    // the first message is still running, so this fills every slot
+    for (int i = 2; i <= NUM_IN_FLIGHT_BUFFERS_TO_USE; i++)
+        assert_int_equal(ST_OK, push_wait_cycles((unsigned char)i));
+
+    // one more than the client may have in flight has to wait for a slot
+    assert_int_equal(0, pthread_create(&socket.thread, NULL, push_one_more,
+                                       &socket));
+    usleep((WORKER_STALL_WARN_S * 1000 + 500) * 1000);
+    assert_false(__atomic_load_n(&socket.done, __ATOMIC_SEQ_CST));
+    assert_true(__atomic_load_n(&stall_warnings, __ATOMIC_SEQ_CST) > 0);
+
+    set_gate(false);
+    pthread_join(socket.thread, NULL);
+    assert_int_equal(ST_OK, socket.result);
+    assert_true(pipeline_drained());
+
+    assert_int_equal(NUM_IN_FLIGHT_BUFFERS_TO_USE + 1, executed_count);
+    for (unsigned int i = 0; i < executed_count; i++)
+        assert_int_equal(i + 1, executed[i]);
+    assert_int_equal(NUM_IN_FLIGHT_BUFFERS_TO_USE + 1, msg_sent_count);
+    assert_int_equal(ST_OK, msg_state.pipeline.worker_status);
+}
+
+void msg_pipeline_worker_failure_fails_next_read_test(void** state)
+{
+    (void)state;
+    struct asd_message msg;
+
+    set_gate(false);
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = JTAG_TYPE;
+    // the worker refuses encrypted messages
+    msg.header.enc_bit = 1;
+    assert_int_equal(ST_OK, msg_pipeline_push(&msg));
+    assert_true(pipeline_drained());
+
+    assert_int_equal(ST_ERR, msg_state.pipeline.worker_status);
+    assert_int_equal(ST_ERR, asd_msg_read());
+}
+
+void msg_pipeline_stop_drops_queued_messages_test(void** state)
+{
+    (void)state;
+    socket_thread socket = {.done = false, .result = ST_OK};
+
+    assert_int_equal(ST_OK, push_wait_cycles(1));
+    wait_executed(1);
+    for (int i = 2; i <= 5; i++)
+        assert_int_equal(ST_OK, push_wait_cycles((unsigned char)i));
+
+    assert_int_equal(0, pthread_create(&socket.thread, NULL, stop_pipeline,
+                                       &socket));
+    while (__atomic_load_n(&msg_state.pipeline.running, __ATOMIC_SEQ_CST))
+        usleep(1000);
+    // the message being executed completes, the rest is dropped
+    assert_false(__atomic_load_n(&socket.done, __ATOMIC_SEQ_CST));
+    set_gate(false);
+    pthread_join(socket.thread, NULL);
+
+    assert_true(msg_state.pipeline.exited);
+    assert_int_equal(1, executed_count);
+}
+
+void msg_pipeline_pin_event_waits_for_worker_test(void** state)
+{
+    (void)state;
+    socket_thread socket = {.done = false, .result = ST_ERR};
+
+    msg_state.target_handler->initialized = true;
+    assert_int_equal(ST_OK, push_wait_cycles(1));
+    wait_executed(1);
+
+    // the pin event path touches the target handler, it takes hw_lock
+    assert_int_equal(0, pthread_create(&socket.thread, NULL,
+                                       service_pin_event, &socket));
+    usleep(100 * 1000);
+    assert_false(__atomic_load_n(&socket.done, __ATOMIC_SEQ_CST));
+
+    set_gate(false);
+    pthread_join(socket.thread, NULL);
+    assert_int_equal(ST_OK, socket.result);
+    assert_false(msg_state.pipeline.hw_busy);
+}
+
+int main()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(
+            asd_msg_on_msg_recv_wait_cycles_fused_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            asd_msg_on_msg_recv_read_scan_multichain_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            asd_msg_on_msg_recv_ext_read_write_scan_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            asd_msg_on_msg_recv_ext_write_scan_continuation_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            asd_msg_on_msg_recv_ext_scan_continuation_end_state_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            asd_msg_on_msg_recv_scan_then_ext_scan_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            asd_msg_on_msg_recv_ext_scan_missing_tdi_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(send_remote_log_record_test, setup,
+                                        teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_end_of_packet_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_next_is_tap_state_cmd_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_sw_mode_folds_update_rti_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_sw_mode_wait_cycles_stop_fold_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_hw_mode_jtag_pau_dr_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_hw_mode_jtag_pau_ir_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_hw_mode_other_cmd_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_hw_mode_ext_scan_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_ext_scan_continuation_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_many_scans_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_next_is_not_read_scan_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_next_is_not_write_scan_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            annotate_scan_end_states_next_is_not_readwrite_scan_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            msg_pipeline_full_ring_runs_in_order_test, pipeline_setup,
+            pipeline_teardown),
+        cmocka_unit_test_setup_teardown(
+            msg_pipeline_worker_failure_fails_next_read_test, pipeline_setup,
+            pipeline_teardown),
+        cmocka_unit_test_setup_teardown(
+            msg_pipeline_stop_drops_queued_messages_test, pipeline_setup,
+            pipeline_teardown),
+        cmocka_unit_test_setup_teardown(
+            msg_pipeline_pin_event_waits_for_worker_test, pipeline_setup,
+            pipeline_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
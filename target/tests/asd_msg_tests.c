@@ -149,6 +149,15 @@ void expect_default_bmc_version()
     MEMCPY_SAFE_RESULT = 0;
 }
 
+STATUS __wrap_JTAG_set_backend(JTAG_Handler* state, JTAG_Backend backend,
+                               const char* sim_chain)
+{
+    (void)state;
+    (void)backend;
+    (void)sim_chain;
+    return ST_OK;
+}
+
 STATUS __wrap_JTAG_deinitialize(JTAG_Handler* state)
 {
     check_expected_ptr(state);
@@ -196,6 +205,143 @@ STATUS __wrap_JTAG_shift(JTAG_Handler* state, unsigned int number_of_bits,
     return JTAG_SHIFT_RESULT;
 }
 
+// Scans are checked as they get queued, so the existing JTAG_shift
+// expectations cover the scan program as well.
+STATUS __wrap_JTAG_scan_program_add(JTAG_Handler* state,
+                                    unsigned int number_of_bits,
+                                    unsigned int input_bytes,
+                                    unsigned char* input,
+                                    unsigned int output_bytes,
+                                    unsigned char* output,
+                                    enum jtag_states end_tap_state)
+{
+    return __wrap_JTAG_shift(state, number_of_bits, input_bytes, input,
+                             output_bytes, output, end_tap_state);
+}
+
+STATUS __wrap_JTAG_scan_program_execute(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_sync_tap_state(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_tap_state_folded(JTAG_Handler* state)
+{
+    (void)state;
+    return ST_OK;
+}
+
+// Multi-chain mode stays on the JTAG handler until a test sets a chain count.
+JTAG_Multi FAKE_JTAG_MULTI;
+unsigned int JTAG_MULTI_SELECTED_COUNT = 0;
+JTAG_Multi* __wrap_JTAG_multi_create(JTAG_Handler* primary,
+                                     JTAG_Backend backend,
+                                     const char* sim_chain)
+{
+    (void)primary;
+    (void)backend;
+    (void)sim_chain;
+    return &FAKE_JTAG_MULTI;
+}
+
+void __wrap_JTAG_multi_destroy(JTAG_Multi* multi)
+{
+    (void)multi;
+}
+
+STATUS __wrap_JTAG_multi_select(JTAG_Multi* multi, const uint8_t* chain_bytes,
+                                unsigned int length, bool sw_mode)
+{
+    (void)multi;
+    (void)chain_bytes;
+    (void)length;
+    (void)sw_mode;
+    return ST_OK;
+}
+
+unsigned int __wrap_JTAG_multi_selected_count(const JTAG_Multi* multi)
+{
+    (void)multi;
+    return JTAG_MULTI_SELECTED_COUNT;
+}
+
+STATUS __wrap_JTAG_multi_scan(JTAG_Multi* multi, unsigned int number_of_bits,
+                              unsigned int input_bytes,
+                              const unsigned char* input,
+                              unsigned int output_bytes, unsigned char* output,
+                              unsigned int output_stride, uint8_t end_state)
+{
+    (void)multi;
+    (void)input_bytes;
+    (void)input;
+    check_expected(number_of_bits);
+    check_expected(output_stride);
+    check_expected(end_state);
+    // every chain answers with its own index
+    for (unsigned int i = 0; output && i < JTAG_MULTI_SELECTED_COUNT; i++)
+        memset(output + i * output_stride, (int)i + 1, output_bytes);
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_set_tap_state(JTAG_Multi* multi,
+                                       enum jtag_states tap_state)
+{
+    (void)multi;
+    (void)tap_state;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_tap_reset(JTAG_Multi* multi)
+{
+    (void)multi;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_wait_cycles(JTAG_Multi* multi,
+                                     unsigned int number_of_cycles)
+{
+    (void)multi;
+    (void)number_of_cycles;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_wait_idle(JTAG_Multi* multi,
+                                   unsigned int number_of_cycles)
+{
+    (void)multi;
+    (void)number_of_cycles;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_set_padding(JTAG_Multi* multi,
+                                     JTAGPaddingTypes padding,
+                                     unsigned int value)
+{
+    (void)multi;
+    (void)padding;
+    (void)value;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_set_jtag_tck(JTAG_Multi* multi, unsigned int tck)
+{
+    (void)multi;
+    (void)tck;
+    return ST_OK;
+}
+
+STATUS __wrap_JTAG_multi_wait(JTAG_Multi* multi)
+{
+    (void)multi;
+    return ST_OK;
+}
+
 STATUS JTAG_SET_JTAG_TCK_RESULT;
 STATUS __wrap_JTAG_set_jtag_tck(JTAG_Handler* state, unsigned int tck)
 {
@@ -213,6 +359,15 @@ STATUS __wrap_JTAG_wait_cycles(JTAG_Handler* state,
     return JTAG_WAIT_CYCLES_RESULT;
 }
 
+STATUS JTAG_WAIT_IDLE_RESULT;
+STATUS __wrap_JTAG_wait_idle(JTAG_Handler* state,
+                             unsigned int number_of_cycles)
+{
+    check_expected_ptr(state);
+    check_expected(number_of_cycles);
+    return JTAG_WAIT_IDLE_RESULT;
+}
+
 STATUS JTAG_TAP_RESET_RESULT;
 STATUS __wrap_JTAG_tap_reset(JTAG_Handler* state)
 {
@@ -2640,205 +2795,6 @@ void send_remote_log_message_concatenated_test(void** state)
     assert_int_equal(msg_sent.header.cmd_stat, ASD_SUCCESS);
 }
 
-void determine_shift_end_state_invalid_param_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    struct packet_data data;
-    enum jtag_states end_state;
-
-    assert_int_equal(ST_ERR,
-                     determine_shift_end_state(NULL, 0, &data, &end_state));
-    assert_int_equal(ST_ERR,
-                     determine_shift_end_state(sdk, 0, NULL, &end_state));
-    assert_int_equal(ST_ERR, determine_shift_end_state(sdk, 0, &data, NULL));
-}
-
-void determine_shift_end_state_get_jtag_state_failed_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    struct packet_data data;
-    enum jtag_states end_state;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_ERR;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    assert_int_equal(ST_ERR,
-                     determine_shift_end_state(sdk, 0, &data, &end_state));
-}
-
-void determine_shift_end_state_end_of_packet_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    sdk->asd_cfg->jtag.mode = JTAG_DRIVER_MODE_SOFTWARE;
-    struct packet_data data;
-    enum jtag_states end_state = jtag_sel_dr;
-    enum jtag_states expected_state = jtag_sel_ir;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_OK;
-    JTAG_STATE = expected_state;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    assert_int_equal(ST_OK,
-                     determine_shift_end_state(sdk, 0, &data, &end_state));
-    assert_int_equal(expected_state, end_state);
-}
-
-void determine_shift_end_state_hw_mode_jtag_pau_dr_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    sdk->asd_cfg->jtag.mode = JTAG_DRIVER_MODE_HARDWARE;
-    struct packet_data data;
-    enum jtag_states end_state = jtag_shf_dr;
-    enum jtag_states expected_state = jtag_pau_dr;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_OK;
-    JTAG_STATE = expected_state;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    unsigned char test_data[2] = {TAP_STATE_MIN + jtag_pau_ir,
-                                  TAP_STATE_MIN + expected_state};
-    data.next_data = (unsigned char*)&test_data;
-    data.total = 2;
-    data.used = 0;
-
-    assert_int_equal(ST_OK,
-                     determine_shift_end_state(sdk, 0, &data, &end_state));
-    assert_int_equal(expected_state, end_state);
-    // ensure data struct is untouched
-    assert_int_equal(2, data.total);
-    assert_int_equal(0, data.used);
-}
-
-void determine_shift_end_state_hw_mode_jtag_pau_ir_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    sdk->asd_cfg->jtag.mode = JTAG_DRIVER_MODE_HARDWARE;
-    struct packet_data data;
-    enum jtag_states end_state = jtag_shf_dr;
-    enum jtag_states expected_state = jtag_pau_ir;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_OK;
-    JTAG_STATE = expected_state;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    unsigned char test_data[2] = {TAP_STATE_MIN + jtag_pau_ir,
-                                  TAP_STATE_MIN + expected_state};
-    data.next_data = (unsigned char*)&test_data;
-    data.total = 2;
-    data.used = 0;
-
-    assert_int_equal(ST_OK,
-                     determine_shift_end_state(sdk, 0, &data, &end_state));
-    assert_int_equal(expected_state, end_state);
-    // ensure data struct is untouched
-    assert_int_equal(2, data.total);
-    assert_int_equal(0, data.used);
-}
-
-void determine_shift_end_state_next_is_tap_state_cmd_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    struct packet_data data;
-    enum jtag_states end_state = jtag_shf_dr;
-    enum jtag_states expected_state = jtag_pau_dr;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_OK;
-    JTAG_STATE = expected_state;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    unsigned char test_data[1] = {TAP_STATE_MIN + jtag_pau_dr};
-    data.next_data = (unsigned char*)&test_data;
-    data.total = 1;
-    data.used = 0;
-
-    assert_int_equal(ST_OK,
-                     determine_shift_end_state(sdk, 0, &data, &end_state));
-    assert_int_equal(expected_state, end_state);
-    // ensure data struct is untouched
-    assert_int_equal(1, data.total);
-    assert_int_equal(0, data.used);
-}
-
-void determine_shift_end_state_next_is_not_read_scan_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    struct packet_data data;
-    enum jtag_states end_state = jtag_shf_dr;
-    enum jtag_states expected_state = jtag_pau_dr;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_OK;
-    JTAG_STATE = expected_state;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    unsigned char test_data[1] = {(READ_SCAN_MAX + 1)}; // not a read scan
-    data.next_data = (unsigned char*)&test_data;
-    data.total = 1;
-    data.used = 0;
-
-    assert_int_equal(ST_ERR, determine_shift_end_state(sdk, ScanType_Read,
-                                                       &data, &end_state));
-
-    // ensure data struct is untouched
-    assert_int_equal(1, data.total);
-    assert_int_equal(0, data.used);
-}
-
-void determine_shift_end_state_next_is_not_write_scan_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    struct packet_data data;
-    enum jtag_states end_state = jtag_shf_dr;
-    enum jtag_states expected_state = jtag_pau_dr;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_OK;
-    JTAG_STATE = expected_state;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    unsigned char test_data[1] = {(WRITE_SCAN_MAX + 1)}; // not a read scan
-    data.next_data = (unsigned char*)&test_data;
-    data.total = 1;
-    data.used = 0;
-
-    assert_int_equal(ST_ERR, determine_shift_end_state(sdk, ScanType_Write,
-                                                       &data, &end_state));
-
-    // ensure data struct is untouched
-    assert_int_equal(1, data.total);
-    assert_int_equal(0, data.used);
-}
-
-void determine_shift_end_state_next_is_not_readwrite_scan_test(void** state)
-{
-    ASD_MSG* sdk = *state;
-    struct packet_data data;
-    enum jtag_states end_state = jtag_shf_dr;
-    enum jtag_states expected_state = jtag_pau_dr;
-
-    JTAG_GET_TAP_STATE_RESULT = ST_OK;
-    JTAG_STATE = expected_state;
-    expect_any(__wrap_JTAG_get_tap_state, state);
-    expect_any(__wrap_JTAG_get_tap_state, tap_state);
-
-    unsigned char test_data[1] = {(READ_WRITE_SCAN_MIN - 1)}; // not a read scan
-    data.next_data = (unsigned char*)&test_data;
-    data.total = 1;
-    data.used = 0;
-
-    assert_int_equal(ST_ERR, determine_shift_end_state(sdk, ScanType_ReadWrite,
-                                                       &data, &end_state));
-
-    // ensure data struct is untouched
-    assert_int_equal(1, data.total);
-    assert_int_equal(0, data.used);
-}
-
 void asd_msg_read_invalid_params_test(void** state)
 {
     ASD_MSG* sdk = *state;
@@ -4065,31 +4021,6 @@ int main()
                                         teardown),
         cmocka_unit_test_setup_teardown(
             send_remote_log_message_concatenated_test, setup, teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_invalid_param_test, setup, teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_get_jtag_state_failed_test, setup,
-            teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_end_of_packet_test, setup, teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_hw_mode_jtag_pau_dr_test, setup,
-            teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_hw_mode_jtag_pau_ir_test, setup,
-            teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_next_is_tap_state_cmd_test, setup,
-            teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_next_is_not_read_scan_test, setup,
-            teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_next_is_not_write_scan_test, setup,
-            teardown),
-        cmocka_unit_test_setup_teardown(
-            determine_shift_end_state_next_is_not_readwrite_scan_test, setup,
-            teardown),
         cmocka_unit_test_setup_teardown(asd_msg_read_invalid_params_test, setup,
                                         teardown),
         cmocka_unit_test_setup_teardown(asd_msg_read_header_read_failure_test,
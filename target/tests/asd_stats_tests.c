@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asd_common.h"
+#include "asd_stats.h"
+#include "logging.h"
+#include "cmocka.h"
+
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)format;
+}
+
+static int setup(void** state)
+{
+    (void)state;
+    memset(asd_stats, 0, sizeof(asd_stats));
+    return 0;
+}
+
+static uint64_t get_le(const unsigned char* buffer, size_t bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++)
+        value |= (uint64_t)buffer[i] << (8 * i);
+    return value;
+}
+
+void ASD_stats_bucket_small_values_are_exact_test(void** state)
+{
+    (void)state;
+    for (uint64_t ns = 0; ns < (1ULL << ASD_STATS_SUB_BITS); ns++)
+    {
+        assert_int_equal(ns, ASD_stats_bucket(ns));
+        assert_int_equal(ns, ASD_stats_bucket_floor((unsigned int)ns));
+    }
+}
+
+void ASD_stats_bucket_floor_is_inverse_test(void** state)
+{
+    (void)state;
+    for (unsigned int bucket = 0; bucket < ASD_STATS_BUCKETS; bucket++)
+    {
+        uint64_t floor = ASD_stats_bucket_floor(bucket);
+        assert_int_equal(bucket, ASD_stats_bucket(floor));
+        if (bucket + 1 < ASD_STATS_BUCKETS)
+            assert_int_equal(bucket,
+                             ASD_stats_bucket(
+                                 ASD_stats_bucket_floor(bucket + 1) - 1));
+    }
+    assert_int_equal(ASD_STATS_BUCKETS - 1, ASD_stats_bucket(UINT64_MAX));
+}
+
+void ASD_stats_bucket_relative_error_test(void** state)
+{
+    (void)state;
+    for (uint64_t ns = 1000; ns < 100000000ULL; ns = ns * 3 + 7)
+    {
+        uint64_t floor = ASD_stats_bucket_floor(ASD_stats_bucket(ns));
+        assert_true(floor <= ns);
+        assert_true(ns - floor <= ns >> ASD_STATS_SUB_BITS);
+    }
+}
+
+void ASD_stats_record_counts_sample_test(void** state)
+{
+    ASD_Histogram snapshot;
+    uint64_t start = ASD_stats_now() - 1000000;
+    (void)state;
+
+    ASD_stats_record(ASD_Stage_JtagXfer, start);
+    ASD_stats_snapshot(ASD_Stage_JtagXfer, &snapshot, false);
+    assert_int_equal(1, snapshot.count);
+    assert_true(snapshot.sum_ns >= 1000000);
+    assert_int_equal(snapshot.sum_ns, snapshot.max_ns);
+    assert_int_equal(1, snapshot.buckets[ASD_stats_bucket(snapshot.max_ns)]);
+
+    ASD_stats_snapshot(ASD_Stage_JtagBitbang, &snapshot, false);
+    assert_int_equal(0, snapshot.count);
+}
+
+void ASD_stats_snapshot_reset_test(void** state)
+{
+    ASD_Histogram snapshot;
+    (void)state;
+
+    ASD_stats_record(ASD_Stage_PrdyWait, ASD_stats_now());
+    ASD_stats_record(ASD_Stage_PrdyWait, ASD_stats_now());
+    ASD_stats_snapshot(ASD_Stage_PrdyWait, &snapshot, true);
+    assert_int_equal(2, snapshot.count);
+
+    ASD_stats_snapshot(ASD_Stage_PrdyWait, &snapshot, false);
+    assert_int_equal(0, snapshot.count);
+    assert_int_equal(0, snapshot.max_ns);
+    for (unsigned int i = 0; i < ASD_STATS_BUCKETS; i++)
+        assert_int_equal(0, snapshot.buckets[i]);
+}
+
+void ASD_stats_percentile_test(void** state)
+{
+    ASD_Histogram histogram;
+    (void)state;
+
+    memset(&histogram, 0, sizeof(histogram));
+    assert_int_equal(0, ASD_stats_percentile(&histogram, 5000));
+
+    // 90 samples at 1us, 9 at 100us and one at 10ms
+    histogram.buckets[ASD_stats_bucket(1000)] = 90;
+    histogram.buckets[ASD_stats_bucket(100000)] = 9;
+    histogram.buckets[ASD_stats_bucket(10000000)] = 1;
+    histogram.count = 100;
+    histogram.max_ns = 10000000;
+
+    assert_int_equal(ASD_stats_bucket(1000),
+                     ASD_stats_bucket(ASD_stats_percentile(&histogram, 5000)));
+    assert_int_equal(ASD_stats_bucket(100000),
+                     ASD_stats_bucket(ASD_stats_percentile(&histogram, 9900)));
+    assert_int_equal(10000000, ASD_stats_percentile(&histogram, 10000));
+}
+
+void ASD_stats_encode_description_test(void** state)
+{
+    unsigned char buffer[MAX_DATA_SIZE];
+    (void)state;
+
+    assert_int_equal(3, ASD_stats_encode(NULL, 0, buffer, sizeof(buffer)));
+    assert_int_equal(ASD_Stage_Count, buffer[0]);
+    assert_int_equal(ASD_STATS_SUB_BITS, buffer[1]);
+    assert_int_equal(ASD_STATS_MAX_BITS, buffer[2]);
+}
+
+void ASD_stats_encode_stage_test(void** state)
+{
+    unsigned char request[2] = {ASD_Stage_I2cRdwr, ASD_STATS_RESET};
+    unsigned char buffer[MAX_DATA_SIZE];
+    ASD_Histogram snapshot;
+    int size;
+    (void)state;
+
+    asd_stats[ASD_Stage_I2cRdwr].count = 3;
+    asd_stats[ASD_Stage_I2cRdwr].sum_ns = 6000;
+    asd_stats[ASD_Stage_I2cRdwr].max_ns = 3000;
+    asd_stats[ASD_Stage_I2cRdwr].buckets[ASD_stats_bucket(1000)] = 1;
+    asd_stats[ASD_Stage_I2cRdwr].buckets[ASD_stats_bucket(2000)] = 1;
+    asd_stats[ASD_Stage_I2cRdwr].buckets[ASD_stats_bucket(3000)] = 1;
+
+    size = ASD_stats_encode(request, sizeof(request), buffer, sizeof(buffer));
+    assert_int_equal(1 + 3 * 8 + 2 + 3 * 6, size);
+    assert_int_equal(ASD_Stage_I2cRdwr, buffer[0]);
+    assert_int_equal(3, get_le(&buffer[1], 8));
+    assert_int_equal(6000, get_le(&buffer[9], 8));
+    assert_int_equal(3000, get_le(&buffer[17], 8));
+    assert_int_equal(3, get_le(&buffer[25], 2));
+    assert_int_equal(ASD_stats_bucket(1000), get_le(&buffer[27], 2));
+    assert_int_equal(1, get_le(&buffer[29], 4));
+    assert_int_equal(ASD_stats_bucket(3000), get_le(&buffer[39], 2));
+
+    // the reset flag cleared the stage
+    ASD_stats_snapshot(ASD_Stage_I2cRdwr, &snapshot, false);
+    assert_int_equal(0, snapshot.count);
+}
+
+void ASD_stats_encode_invalid_params_test(void** state)
+{
+    unsigned char request[1] = {ASD_Stage_Count};
+    unsigned char buffer[MAX_DATA_SIZE];
+    (void)state;
+
+    assert_int_equal(-1, ASD_stats_encode(request, sizeof(request), buffer,
+                                          sizeof(buffer)));
+    request[0] = ASD_Stage_SocketRead;
+    assert_int_equal(-1, ASD_stats_encode(request, sizeof(request), buffer,
+                                          64));
+    assert_int_equal(-1, ASD_stats_encode(NULL, 0, buffer, 2));
+}
+
+int main()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(ASD_stats_bucket_small_values_are_exact_test),
+        cmocka_unit_test(ASD_stats_bucket_floor_is_inverse_test),
+        cmocka_unit_test(ASD_stats_bucket_relative_error_test),
+        cmocka_unit_test_setup(ASD_stats_record_counts_sample_test, setup),
+        cmocka_unit_test_setup(ASD_stats_snapshot_reset_test, setup),
+        cmocka_unit_test(ASD_stats_percentile_test),
+        cmocka_unit_test(ASD_stats_encode_description_test),
+        cmocka_unit_test_setup(ASD_stats_encode_stage_test, setup),
+        cmocka_unit_test(ASD_stats_encode_invalid_params_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
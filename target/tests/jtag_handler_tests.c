@@ -125,6 +125,9 @@ struct controller_mode_param* ioctl_arg_controller_mode_param;
 struct tap_state_param* ioctl_arg_tap_state_param;
 struct set_tck_param* ioctl_arg_set_tck_param;
 struct tck_bitbang* ioctl_arg_tck_bitbang;
+#ifndef JTAG_LEGACY_DRIVER
+static struct jtag_xfer last_xfer;
+#endif
 typedef enum
 {
     IoctlArgType_UInt = 0,
@@ -139,6 +142,9 @@ static IoctlArgType ioctl_arg_types[MAX_IOCTLS] = {IoctlArgType_UInt};
 static int FAKE_IOCTL_RESULT[MAX_IOCTLS];
 static int ioctl_arg_index = 0;
 static int test_ioctl_index = 0;
+#ifndef JTAG_LEGACY_DRIVER
+static __u32 bitbang_length[MAX_IOCTLS];
+#endif
 int __wrap_ioctl(int fd, unsigned long request, ...)
 {
     int index = ioctl_arg_index;
@@ -156,6 +162,9 @@ int __wrap_ioctl(int fd, unsigned long request, ...)
     {
         ioctl_arg_scan_xfr = va_arg(args, struct scan_xfer*);
         check_expected_ptr(ioctl_arg_scan_xfr);
+#ifndef JTAG_LEGACY_DRIVER
+        memcpy(&last_xfer, ioctl_arg_scan_xfr, sizeof(last_xfer));
+#endif
     }
     else if (ioctl_arg_types[index] == IoctlArgType_controller_mode_param)
     {
@@ -177,6 +186,10 @@ int __wrap_ioctl(int fd, unsigned long request, ...)
     {
         ioctl_arg_tck_bitbang = va_arg(args, struct tck_bitbang*);
         check_expected_ptr(ioctl_arg_tck_bitbang);
+#ifndef JTAG_LEGACY_DRIVER
+        bitbang_length[index] =
+            ((struct bitbang_packet*)ioctl_arg_tck_bitbang)->length;
+#endif
     }
     ioctl_arg_index++;
 
@@ -295,6 +308,18 @@ void JTAG_initialize_driver_open_failure(void** state)
     assert_int_equal(ST_ERR, JTAG_initialize(handler, false));
 }
 
+void JTAG_initialize_opens_selected_controller(void** state)
+{
+    JTAG_Handler* handler = *state;
+    assert_int_equal(ST_ERR, JTAG_set_controller(NULL, 2));
+    assert_int_equal(ST_OK, JTAG_set_controller(handler, 2));
+    expect_string(__wrap_open, pathname, "/dev/jtag2");
+    expect_value(__wrap_open, flags, O_RDWR);
+    expect_any(__wrap_open, mode);
+    FAKE_DRIVER_HANDLE = -1;
+    assert_int_equal(ST_ERR, JTAG_initialize(handler, false));
+}
+
 #ifndef JTAG_LEGACY_DRIVER
 void JTAG_initialize_sets_JTAG_set_mode_failure(void** state)
 {
@@ -531,12 +556,28 @@ void JTAG_set_tap_state_sets_tap_state_correctly(void** state)
     JTAG_Handler* handler = *state;
     enum jtag_states expected = jtag_pau_ir;
     handler->active_chain->tap_state = jtag_tlr;
+    // the move is deferred until it is synced
+    assert_int_equal(JTAG_set_tap_state(handler, expected), ST_OK);
+    assert_int_equal(handler->active_chain->tap_state, expected);
+    assert_int_equal(handler->active_chain->driver_tap_state, jtag_tlr);
+
     ioctl_arg_types[test_ioctl_index] = IoctlArgType_tap_state_param;
     expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
     expect_value(__wrap_ioctl, request, AST_JTAG_SET_TAPSTATE);
     expect_any(__wrap_ioctl, ioctl_arg_tap_state_param);
-    assert_int_equal(JTAG_set_tap_state(handler, expected), ST_OK);
-    assert_int_equal(handler->active_chain->tap_state, expected);
+    assert_int_equal(JTAG_sync_tap_state(handler), ST_OK);
+    assert_int_equal(handler->active_chain->driver_tap_state, expected);
+}
+
+void JTAG_set_tap_state_skips_current_state(void** state)
+{
+    JTAG_Handler* handler = *state;
+    handler->active_chain->tap_state = jtag_rti;
+    handler->active_chain->driver_tap_state = jtag_rti;
+    assert_int_equal(JTAG_set_tap_state(handler, jtag_rti), ST_OK);
+    assert_int_equal(JTAG_sync_tap_state(handler), ST_OK);
+    assert_int_equal(handler->tap_stats.requests, 1);
+    assert_int_equal(handler->tap_stats.ioctls, 0);
 }
 
 void JTAG_set_tap_state_jtag_rti_wait_cycles_failed(void** state)
@@ -626,13 +667,16 @@ void JTAG_set_tap_state_ioctl_failure(void** state)
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->JTAG_driver_handle = 2;
     handler->sw_mode = true;
-    // expectations for set tap state
+    // expectations for syncing the deferred tap state
     ioctl_arg_types[test_ioctl_index] = IoctlArgType_tap_state_param;
     expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
     expect_value(__wrap_ioctl, request, AST_JTAG_SET_TAPSTATE);
     expect_any(__wrap_ioctl, ioctl_arg_tap_state_param);
     FAKE_IOCTL_RESULT[test_ioctl_index] = -1;
-    assert_int_equal(JTAG_set_tap_state(handler, expected_state), ST_ERR);
+    assert_int_equal(JTAG_set_tap_state(handler, expected_state), ST_OK);
+    assert_int_equal(JTAG_sync_tap_state(handler), ST_ERR);
+    // the driver state is unknown until the next request succeeds
+    assert_true(handler->active_chain->tap_resync);
 }
 
 void JTAG_get_tap_state_NULL_state_check(void** state)
@@ -680,6 +724,7 @@ void JTAG_shift_Shift_IR_sets_correct_scan_state(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_ir;
+    handler->active_chain->driver_tap_state = jtag_shf_ir;
     handler->active_chain->shift_padding.irPre = 0;
     handler->active_chain->shift_padding.irPost = 0;
     memset(handler->padDataOne, ~0, sizeof(handler->padDataOne));
@@ -710,24 +755,13 @@ void JTAG_shift_Shift_IR_uses_correct_padding(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_ir;
+    handler->active_chain->driver_tap_state = jtag_shf_ir;
     handler->active_chain->shift_padding.irPre = expected_pre;
     handler->active_chain->shift_padding.irPost = expected_post;
     memset(handler->padDataOne, ~0, sizeof(handler->padDataOne));
     handler->active_chain->scan_state = JTAGScanState_Done;
 
-    // expectations for prefix shift
-    ioctl_arg_types[test_ioctl_index++] = IoctlArgType_scan_xfer;
-    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
-    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
-    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
-
-    // expectations for main shift
-    ioctl_arg_types[test_ioctl_index++] = IoctlArgType_scan_xfer;
-    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
-    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
-    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
-
-    // expectations for postfix shift
+    // prefix, main and postfix shift go out as a single transfer
     ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
     expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
     expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
@@ -737,6 +771,9 @@ void JTAG_shift_Shift_IR_uses_correct_padding(void** state)
                                 (unsigned char*)&input, output_bytes,
                                 (unsigned char*)&output, jtag_upd_dr),
                      ST_OK);
+#ifndef JTAG_LEGACY_DRIVER
+    assert_int_equal(last_xfer.length, expected_pre + 38 + expected_post);
+#endif
 }
 
 void JTAG_shift_Shift_DR_uses_correct_padding(void** state)
@@ -752,24 +789,13 @@ void JTAG_shift_Shift_DR_uses_correct_padding(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_dr;
+    handler->active_chain->driver_tap_state = jtag_shf_dr;
     handler->active_chain->shift_padding.drPre = expected_pre;
     handler->active_chain->shift_padding.drPost = expected_post;
     memset(handler->padDataOne, expected_pad_data, sizeof(handler->padDataOne));
     handler->active_chain->scan_state = JTAGScanState_Done;
 
-    // expectations for prefix shift
-    ioctl_arg_types[test_ioctl_index++] = IoctlArgType_scan_xfer;
-    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
-    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
-    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
-
-    // expectations for main shift
-    ioctl_arg_types[test_ioctl_index++] = IoctlArgType_scan_xfer;
-    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
-    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
-    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
-
-    // expectations for postfix shift
+    // prefix, main and postfix shift go out as a single transfer
     ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
     expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
     expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
@@ -779,6 +805,9 @@ void JTAG_shift_Shift_DR_uses_correct_padding(void** state)
                                 (unsigned char*)&input, output_bytes,
                                 (unsigned char*)&output, jtag_upd_dr),
                      ST_OK);
+#ifndef JTAG_LEGACY_DRIVER
+    assert_int_equal(last_xfer.length, expected_pre + 38 + expected_post);
+#endif
 }
 
 void JTAG_shift_handles_incorrect_state(void** state)
@@ -799,7 +828,7 @@ void JTAG_shift_handles_prefix_ioctl_errors(void** state)
 {
     JTAG_Handler* handler = *state;
     unsigned int expected_pre = 3;
-    unsigned int expected_post = 7;
+    unsigned int expected_post = 0;
     unsigned int input_bytes = TEST_BUFFER_SIZE;
     unsigned char input[input_bytes];
     unsigned int output_bytes = TEST_BUFFER_SIZE;
@@ -807,12 +836,13 @@ void JTAG_shift_handles_prefix_ioctl_errors(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_ir;
+    handler->active_chain->driver_tap_state = jtag_shf_ir;
     handler->active_chain->shift_padding.irPre = expected_pre;
     handler->active_chain->shift_padding.irPost = expected_post;
     memset(handler->padDataOne, ~0, sizeof(handler->padDataOne));
     handler->active_chain->scan_state = JTAGScanState_Done;
 
-    // expectations for prefix shift
+    // the prefix goes out in the same transfer as the payload
     ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
     expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
     expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
@@ -837,19 +867,13 @@ void JTAG_shift_handles_shift_ioctl_errors(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_ir;
+    handler->active_chain->driver_tap_state = jtag_shf_ir;
     handler->active_chain->shift_padding.irPre = expected_pre;
     handler->active_chain->shift_padding.irPost = expected_post;
     memset(handler->padDataOne, ~0, sizeof(handler->padDataOne));
     handler->active_chain->scan_state = JTAGScanState_Done;
 
-    // expectations for prefix shift
-    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
-    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
-    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
-    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
-    FAKE_IOCTL_RESULT[test_ioctl_index++] = 0;
-
-    // expectations for main shift
+    // prefix, main and postfix shift go out as a single transfer
     ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
     expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
     expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
@@ -865,7 +889,7 @@ void JTAG_shift_handles_shift_ioctl_errors(void** state)
 void JTAG_shift_handles_postfix_ioctl_errors(void** state)
 {
     JTAG_Handler* handler = *state;
-    unsigned int expected_pre = 3;
+    unsigned int expected_pre = 0;
     unsigned int expected_post = 7;
     unsigned int input_bytes = TEST_BUFFER_SIZE;
     unsigned char input[input_bytes];
@@ -874,26 +898,13 @@ void JTAG_shift_handles_postfix_ioctl_errors(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_ir;
+    handler->active_chain->driver_tap_state = jtag_shf_ir;
     handler->active_chain->shift_padding.irPre = expected_pre;
     handler->active_chain->shift_padding.irPost = expected_post;
     memset(handler->padDataOne, ~0, sizeof(handler->padDataOne));
     handler->active_chain->scan_state = JTAGScanState_Done;
 
-    // expectations for prefix shift
-    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
-    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
-    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
-    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
-    FAKE_IOCTL_RESULT[test_ioctl_index++] = 0;
-
-    // expectations for main shift
-    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
-    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
-    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
-    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
-    FAKE_IOCTL_RESULT[test_ioctl_index++] = 0;
-
-    // expectations for postfix shift
+    // the postfix goes out in the same transfer as the payload
     ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
     expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
     expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
@@ -916,6 +927,7 @@ void JTAG_shift_with_no_padding_handles_shift_ioctl_errors(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_ir;
+    handler->active_chain->driver_tap_state = jtag_shf_ir;
     handler->active_chain->shift_padding.irPre = 0;
     handler->active_chain->shift_padding.irPost = 0;
     memset(handler->padDataOne, ~0, sizeof(handler->padDataOne));
@@ -934,6 +946,230 @@ void JTAG_shift_with_no_padding_handles_shift_ioctl_errors(void** state)
                      ST_ERR);
 }
 
+void JTAG_scan_program_add_NULL_state_check(void** state)
+{
+    (void)state; /* unused */
+    unsigned char input[1] = {0};
+    assert_int_equal(JTAG_scan_program_add(NULL, 8, sizeof(input), input, 0,
+                                           NULL, jtag_shf_dr),
+                     ST_ERR);
+}
+
+void JTAG_scan_program_execute_NULL_state_check(void** state)
+{
+    (void)state; /* unused */
+    assert_int_equal(JTAG_scan_program_execute(NULL), ST_ERR);
+}
+
+void JTAG_scan_program_add_queues_scans_in_shift_state(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char input[2] = {0xa5, 0x5a};
+    handler->JTAG_driver_handle = 2;
+    handler->active_chain->tap_state = jtag_shf_dr;
+    handler->active_chain->driver_tap_state = jtag_shf_dr;
+
+    assert_int_equal(JTAG_scan_program_add(handler, 8, 1, &input[0], 0, NULL,
+                                           jtag_shf_dr),
+                     ST_OK);
+    assert_int_equal(JTAG_scan_program_add(handler, 8, 1, &input[1], 0, NULL,
+                                           jtag_shf_dr),
+                     ST_OK);
+    assert_int_equal(handler->scan_program.count, 2);
+    assert_int_equal(handler->scan_program.total_bits, 16);
+}
+
+void JTAG_scan_program_add_executes_when_leaving_shift_state(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char input[1] = {0xa5};
+    handler->JTAG_driver_handle = 2;
+    handler->active_chain->tap_state = jtag_shf_dr;
+    handler->active_chain->driver_tap_state = jtag_shf_dr;
+
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
+    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
+    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
+    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
+
+    assert_int_equal(JTAG_scan_program_add(handler, 8, sizeof(input), input, 0,
+                                           NULL, jtag_rti),
+                     ST_OK);
+    assert_int_equal(handler->scan_program.count, 0);
+    assert_int_equal(handler->active_chain->tap_state, jtag_rti);
+}
+
+void JTAG_scan_program_add_rejects_non_shift_state(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char input[1] = {0xa5};
+    handler->JTAG_driver_handle = 2;
+    handler->active_chain->tap_state = jtag_rti;
+
+    assert_int_equal(JTAG_scan_program_add(handler, 8, sizeof(input), input, 0,
+                                           NULL, jtag_rti),
+                     ST_ERR);
+    assert_int_equal(handler->scan_program.count, 0);
+    assert_int_equal(handler->scan_program.total_bits, 0);
+}
+
+void JTAG_scan_program_execute_issues_single_xfer(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char write_input[1] = {0x0a};
+    unsigned char read_write_input[1] = {0xa5};
+    unsigned char read_write_output[1] = {0};
+    unsigned char read_output[2] = {0xff, 0xff};
+    handler->JTAG_driver_handle = 2;
+    handler->active_chain->tap_state = jtag_shf_dr;
+    handler->active_chain->driver_tap_state = jtag_shf_dr;
+    handler->active_chain->scan_state = JTAGScanState_Done;
+
+    assert_int_equal(JTAG_scan_program_add(handler, 4, 1, write_input, 0,
+                                           NULL, jtag_shf_dr),
+                     ST_OK);
+    assert_int_equal(JTAG_scan_program_add(handler, 8, 1, read_write_input,
+                                           sizeof(read_write_output),
+                                           read_write_output, jtag_shf_dr),
+                     ST_OK);
+    assert_int_equal(JTAG_scan_program_add(handler, 12, 0, NULL,
+                                           sizeof(read_output), read_output,
+                                           jtag_shf_dr),
+                     ST_OK);
+
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
+    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
+    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
+    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
+
+    // The fake driver loops TDI back as TDO, the read-write scan straddles
+    // a byte boundary in both directions.
+    assert_int_equal(JTAG_scan_program_execute(handler), ST_OK);
+    assert_int_equal(handler->scan_program.tdio[0], 0x5a);
+    assert_int_equal(handler->scan_program.tdio[1], 0x0a);
+    assert_int_equal(handler->scan_program.tdio[2], 0x00);
+    assert_int_equal(read_write_output[0], 0xa5);
+    assert_int_equal(read_output[0], 0x00);
+    assert_int_equal(read_output[1], 0xf0);
+    assert_int_equal(handler->scan_program.count, 0);
+    assert_int_equal(handler->scan_program.total_bits, 0);
+#ifndef JTAG_LEGACY_DRIVER
+    assert_int_equal(last_xfer.length, 24);
+    assert_true(last_xfer.tdio == (__u64)handler->scan_program.tdio);
+#endif
+}
+
+void JTAG_scan_program_execute_handles_ioctl_failure(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char input[2] = {0xa5, 0x5a};
+    handler->JTAG_driver_handle = 2;
+    handler->active_chain->tap_state = jtag_shf_dr;
+    handler->active_chain->driver_tap_state = jtag_shf_dr;
+
+    assert_int_equal(JTAG_scan_program_add(handler, 8, 1, &input[0], 0, NULL,
+                                           jtag_shf_dr),
+                     ST_OK);
+    assert_int_equal(JTAG_scan_program_add(handler, 8, 1, &input[1], 0, NULL,
+                                           jtag_shf_dr),
+                     ST_OK);
+
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
+    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
+    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
+    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
+    FAKE_IOCTL_RESULT[test_ioctl_index] = -1;
+
+    assert_int_equal(JTAG_scan_program_execute(handler), ST_ERR);
+    assert_int_equal(handler->scan_program.count, 0);
+}
+
+#ifndef JTAG_LEGACY_DRIVER
+void JTAG_shift_hw_in_place_shift_does_not_copy(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char buffer[TEST_BUFFER_SIZE];
+    unsigned char expected[TEST_BUFFER_SIZE];
+    handler->JTAG_driver_handle = 2;
+    handler->sw_mode = false;
+    handler->active_chain->tap_state = jtag_shf_dr;
+    for (int i = 0; i < TEST_BUFFER_SIZE; i++)
+        buffer[i] = expected[i] = (unsigned char)i;
+
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
+    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
+    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
+    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
+
+    assert_int_equal(JTAG_shift(handler, 38, sizeof(buffer), buffer,
+                                sizeof(buffer), buffer, jtag_shf_dr),
+                     ST_OK);
+    assert_true(last_xfer.tdio == (__u64)buffer);
+    assert_int_equal(last_xfer.length, 38);
+    assert_memory_equal(buffer, expected, sizeof(buffer));
+}
+
+void JTAG_shift_hw_read_shifts_zeros_into_output(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char output[TEST_BUFFER_SIZE];
+    unsigned char expected[TEST_BUFFER_SIZE];
+    handler->JTAG_driver_handle = 2;
+    handler->sw_mode = false;
+    handler->active_chain->tap_state = jtag_shf_dr;
+    memset(output, 0xff, sizeof(output));
+    memset(expected, 0xff, sizeof(expected));
+    memset(expected, 0, 5);
+
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
+    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
+    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
+    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
+
+    assert_int_equal(JTAG_shift(handler, 38, 0, NULL, sizeof(output), output,
+                                jtag_shf_dr),
+                     ST_OK);
+    assert_true(last_xfer.tdio == (__u64)output);
+    assert_memory_equal(output, expected, sizeof(output));
+}
+
+void JTAG_shift_hw_write_stages_tdi_in_scratch(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char input[TEST_BUFFER_SIZE];
+    unsigned char expected[TEST_BUFFER_SIZE];
+    handler->JTAG_driver_handle = 2;
+    handler->sw_mode = false;
+    handler->active_chain->tap_state = jtag_shf_dr;
+    memset(input, 0xa5, sizeof(input));
+    memset(expected, 0xa5, sizeof(expected));
+
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_scan_xfer;
+    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
+    expect_value(__wrap_ioctl, request, AST_JTAG_READWRITESCAN);
+    expect_any(__wrap_ioctl, ioctl_arg_scan_xfr);
+
+    assert_int_equal(JTAG_shift(handler, 38, sizeof(input), input, 0, NULL,
+                                jtag_shf_dr),
+                     ST_OK);
+    assert_true(last_xfer.tdio == (__u64)handler->tdio_scratch);
+    assert_memory_equal(input, expected, sizeof(input));
+}
+
+void JTAG_shift_hw_output_too_small_failure(void** state)
+{
+    JTAG_Handler* handler = *state;
+    unsigned char output[4];
+    handler->JTAG_driver_handle = 2;
+    handler->sw_mode = false;
+    handler->active_chain->tap_state = jtag_shf_dr;
+
+    assert_int_equal(JTAG_shift(handler, 38, 0, NULL, sizeof(output), output,
+                                jtag_shf_dr),
+                     ST_ERR);
+}
+#endif
+
 void JTAG_wait_cycles_NULL_state_check(void** state)
 {
     (void)state; /* unused */
@@ -976,13 +1212,38 @@ void JTAG_wait_cycles_ioctl_failed(void** state)
     assert_int_equal(JTAG_wait_cycles(handler, 1), ST_ERR);
 }
 
-void JTAG_wait_cycles_request_bigger_than_MAX_WAIT_CYCLES_failed(void** state)
+#ifndef JTAG_LEGACY_DRIVER
+void JTAG_wait_cycles_request_bigger_than_MAX_WAIT_CYCLES_is_chunked(
+    void** state)
+{
+    JTAG_Handler* handler = *state;
+    handler->JTAG_driver_handle = 2;
+    handler->sw_mode = true;
+    // one full bitbang packet, then the remainder
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_tck_bitbang;
+    ioctl_arg_types[test_ioctl_index + 1] = IoctlArgType_tck_bitbang;
+    expect_value_count(__wrap_ioctl, fd, handler->JTAG_driver_handle, 2);
+    expect_value_count(__wrap_ioctl, request, AST_JTAG_BITBANG, 2);
+    expect_any_count(__wrap_ioctl, ioctl_arg_tck_bitbang, 2);
+    assert_int_equal(JTAG_wait_cycles(handler, MAX_WAIT_CYCLES + 44), ST_OK);
+    assert_int_equal(bitbang_length[test_ioctl_index], MAX_WAIT_CYCLES);
+    assert_int_equal(bitbang_length[test_ioctl_index + 1], 44);
+}
+
+void JTAG_wait_cycles_chunk_ioctl_failed(void** state)
 {
     JTAG_Handler* handler = *state;
     handler->JTAG_driver_handle = 2;
     handler->sw_mode = true;
-    assert_int_equal(JTAG_wait_cycles(handler, 300), ST_ERR);
+    // the remainder is not clocked once a packet fails
+    ioctl_arg_types[test_ioctl_index] = IoctlArgType_tck_bitbang;
+    expect_value(__wrap_ioctl, fd, handler->JTAG_driver_handle);
+    expect_value(__wrap_ioctl, request, AST_JTAG_BITBANG);
+    expect_any(__wrap_ioctl, ioctl_arg_tck_bitbang);
+    FAKE_IOCTL_RESULT[test_ioctl_index] = -1;
+    assert_int_equal(JTAG_wait_cycles(handler, MAX_WAIT_CYCLES + 44), ST_ERR);
 }
+#endif
 
 void JTAG_set_jtag_tck_NULL_state_check(void** state)
 {
@@ -1067,6 +1328,7 @@ void JTAG_shift_Shift_IR_memcpy_error(void** state)
     handler->JTAG_driver_handle = 2;
     handler->active_chain = &handler->chains[SCAN_CHAIN_0];
     handler->active_chain->tap_state = jtag_shf_ir;
+    handler->active_chain->driver_tap_state = jtag_shf_ir;
     handler->active_chain->shift_padding.irPre = 0;
     handler->active_chain->shift_padding.irPost = 0;
     memset(handler->padDataOne, ~0, sizeof(handler->padDataOne));
@@ -1103,6 +1365,8 @@ int main()
 #ifndef JTAG_LEGACY_DRIVER
         cmocka_unit_test_setup_teardown(
             JTAG_initialize_sets_JTAG_set_mode_failure, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_initialize_opens_selected_controller, setup, teardown),
 #endif
         cmocka_unit_test_setup_teardown(
             JTAG_initialize_sets_JTAG_set_tap_state_to_TLR, setup, teardown),
@@ -1138,6 +1402,8 @@ int main()
             teardown),
         cmocka_unit_test_setup_teardown(
             JTAG_set_tap_state_sets_tap_state_correctly, setup, teardown),
+        cmocka_unit_test_setup_teardown(JTAG_set_tap_state_skips_current_state,
+                                        setup, teardown),
         cmocka_unit_test_setup_teardown(
             JTAG_set_tap_state_jtag_rti_wait_cycles_failed, setup, teardown),
         cmocka_unit_test_setup_teardown(
@@ -1171,15 +1437,43 @@ int main()
         cmocka_unit_test_setup_teardown(
             JTAG_shift_with_no_padding_handles_shift_ioctl_errors, setup,
             teardown),
+#ifndef JTAG_LEGACY_DRIVER
+        cmocka_unit_test_setup_teardown(
+            JTAG_shift_hw_in_place_shift_does_not_copy, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_shift_hw_read_shifts_zeros_into_output, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_shift_hw_write_stages_tdi_in_scratch, setup, teardown),
+        cmocka_unit_test_setup_teardown(JTAG_shift_hw_output_too_small_failure,
+                                        setup, teardown),
+#endif
+        cmocka_unit_test(JTAG_scan_program_add_NULL_state_check),
+        cmocka_unit_test(JTAG_scan_program_execute_NULL_state_check),
+        cmocka_unit_test_setup_teardown(
+            JTAG_scan_program_add_queues_scans_in_shift_state, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_scan_program_add_executes_when_leaving_shift_state, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_scan_program_add_rejects_non_shift_state, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_scan_program_execute_issues_single_xfer, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_scan_program_execute_handles_ioctl_failure, setup, teardown),
         cmocka_unit_test(JTAG_wait_cycles_NULL_state_check),
         cmocka_unit_test_setup_teardown(
             JTAG_wait_cycles_calls_correct_ioctl_correct_number_of_times, setup,
             teardown),
         cmocka_unit_test_setup_teardown(JTAG_wait_cycles_ioctl_failed, setup,
                                         teardown),
+#ifndef JTAG_LEGACY_DRIVER
         cmocka_unit_test_setup_teardown(
-            JTAG_wait_cycles_request_bigger_than_MAX_WAIT_CYCLES_failed, setup,
-            teardown),
+            JTAG_wait_cycles_request_bigger_than_MAX_WAIT_CYCLES_is_chunked,
+            setup, teardown),
+        cmocka_unit_test_setup_teardown(JTAG_wait_cycles_chunk_ioctl_failed,
+                                        setup, teardown),
+#endif
         cmocka_unit_test(JTAG_set_jtag_tck_NULL_state_check),
         cmocka_unit_test_setup_teardown(JTAG_set_jtag_tck_correctly_calls_ioctl,
                                         setup, teardown),
@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../jtag_handler.h"
+#include "../jtag_multi.h"
+#include "logging.h"
+#include "cmocka.h"
+
+#define TEST_IDCODE_0 0x0e7bb013
+#define TEST_IDCODE_1 0x00111113
+#define TEST_CHAIN "0x0e7bb013-14,0x00111113-16"
+
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)format;
+}
+
+void __wrap_ASD_log_shift(ASD_LogLevel level, ASD_LogStream stream,
+                          ASD_LogOption options, unsigned int number_of_bits,
+                          unsigned int size_bytes, unsigned char* buffer,
+                          const char* prefixPtr)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)number_of_bits;
+    (void)size_bytes;
+    (void)buffer;
+    (void)prefixPtr;
+}
+
+static uint32_t get32(const unsigned char* buffer)
+{
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static int setup(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    assert_non_null(jtag);
+    assert_int_equal(ST_OK,
+                     JTAG_set_backend(jtag, JTAG_Backend_Simulator, TEST_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, true));
+    *state = jtag;
+    return 0;
+}
+
+static int teardown(void** state)
+{
+    JTAG_Handler* jtag = (JTAG_Handler*)*state;
+    JTAG_deinitialize(jtag);
+    free(jtag);
+    return 0;
+}
+
+void JTAG_multi_scans_every_selected_controller_test(void** state)
+{
+    JTAG_Handler* jtag = (JTAG_Handler*)*state;
+    JTAG_Multi* multi =
+        JTAG_multi_create(jtag, JTAG_Backend_Simulator, TEST_CHAIN);
+    uint8_t chains[] = {0x05};
+    unsigned char tdo[2 * 9];
+    assert_non_null(multi);
+
+    assert_int_equal(ST_OK, JTAG_multi_select(multi, chains, 1, true));
+    assert_int_equal(2, JTAG_multi_selected_count(multi));
+    // controller 0 is the handler it was created with
+    assert_ptr_equal(jtag, multi->controllers[0]->handler);
+    assert_null(multi->controllers[1]);
+    assert_int_equal(2, multi->controllers[2]->handler->controller);
+
+    memset(tdo, 0xaa, sizeof(tdo));
+    assert_int_equal(ST_OK, JTAG_multi_tap_reset(multi));
+    assert_int_equal(ST_OK, JTAG_multi_set_tap_state(multi, jtag_rti));
+    assert_int_equal(ST_OK, JTAG_multi_set_tap_state(multi, jtag_shf_dr));
+    assert_int_equal(ST_OK, JTAG_multi_scan(multi, 64, 0, NULL, 8, tdo, 9,
+                                            jtag_rti));
+    assert_int_equal(ST_OK, JTAG_multi_wait_cycles(multi, 5));
+    assert_true(multi->dispatched);
+    assert_int_equal(ST_OK, JTAG_multi_wait(multi));
+    assert_false(multi->dispatched);
+
+    // each controller fills its own slot and leaves the gaps alone
+    assert_int_equal(TEST_IDCODE_0, get32(&tdo[0]));
+    assert_int_equal(TEST_IDCODE_1, get32(&tdo[4]));
+    assert_int_equal(0xaa, tdo[8]);
+    assert_int_equal(TEST_IDCODE_0, get32(&tdo[9]));
+    assert_int_equal(TEST_IDCODE_1, get32(&tdo[13]));
+    assert_int_equal(0xaa, tdo[17]);
+    assert_int_equal(jtag_rti, jtag->sim->tap_state);
+    assert_int_equal(jtag_rti, multi->controllers[2]->handler->sim->tap_state);
+
+    JTAG_multi_destroy(multi);
+}
+
+void JTAG_multi_rejects_chains_without_controller_test(void** state)
+{
+    JTAG_Handler* jtag = (JTAG_Handler*)*state;
+    JTAG_Multi* multi =
+        JTAG_multi_create(jtag, JTAG_Backend_Simulator, TEST_CHAIN);
+    uint8_t chains[] = {0x01, 0x01};
+    assert_non_null(multi);
+
+    assert_int_equal(ST_ERR, JTAG_multi_select(multi, chains, 2, true));
+    assert_int_equal(0, JTAG_multi_selected_count(multi));
+    // nothing to queue on without a selection
+    assert_int_equal(ST_ERR, JTAG_multi_tap_reset(multi));
+    assert_int_equal(ST_OK, JTAG_multi_wait(multi));
+
+    JTAG_multi_destroy(multi);
+}
+
+void JTAG_multi_reports_failures_at_wait_test(void** state)
+{
+    JTAG_Handler* jtag = (JTAG_Handler*)*state;
+    JTAG_Multi* multi =
+        JTAG_multi_create(jtag, JTAG_Backend_Simulator, TEST_CHAIN);
+    uint8_t chains[] = {0x02};
+    assert_non_null(multi);
+
+    assert_int_equal(ST_OK, JTAG_multi_select(multi, chains, 1, true));
+    // the padding is only checked when the worker gets to it
+    assert_int_equal(ST_OK, JTAG_multi_set_padding(multi, JTAGPaddingTypes_DRPre,
+                                                   DRMAXPADSIZE + 1));
+    assert_int_equal(ST_OK, JTAG_multi_set_tap_state(multi, jtag_rti));
+    assert_int_equal(ST_ERR, JTAG_multi_wait(multi));
+    // operations behind the failure were dropped
+    assert_int_equal(jtag_tlr, multi->controllers[1]->handler->sim->tap_state);
+
+    assert_int_equal(ST_OK, JTAG_multi_set_tap_state(multi, jtag_rti));
+    assert_int_equal(ST_OK, JTAG_multi_wait(multi));
+    assert_int_equal(jtag_rti, multi->controllers[1]->handler->sim->tap_state);
+
+    JTAG_multi_destroy(multi);
+}
+
+int main()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(
+            JTAG_multi_scans_every_selected_controller_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_multi_rejects_chains_without_controller_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_multi_reports_failures_at_wait_test, setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,534 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../jtag_handler.h"
+#include "../jtag_sim.h"
+#include "logging.h"
+#include "cmocka.h"
+
+#define TEST_IDCODE_0 0x0e7bb013
+#define TEST_IDCODE_1 0x00111113
+#define TEST_CHAIN "0x0e7bb013-14,0x00111113-16"
+
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)format;
+}
+
+void __wrap_ASD_log_shift(ASD_LogLevel level, ASD_LogStream stream,
+                          ASD_LogOption options, unsigned int number_of_bits,
+                          unsigned int size_bytes, unsigned char* buffer,
+                          const char* prefixPtr)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)number_of_bits;
+    (void)size_bytes;
+    (void)buffer;
+    (void)prefixPtr;
+}
+
+static void goto_state(JTAG_Sim* sim, uint8_t reset, uint8_t endstate)
+{
+    struct jtag_tap_state tap_state;
+    tap_state.reset = reset;
+    tap_state.from = JTAG_STATE_CURRENT;
+    tap_state.endstate = endstate;
+    tap_state.tck = 0;
+    assert_int_equal(0, JTAG_sim_ioctl(sim, JTAG_SIOCSTATE, &tap_state));
+}
+
+static void xfer(JTAG_Sim* sim, uint8_t type, uint32_t padding,
+                 uint32_t length, unsigned char* tdio, uint8_t endstate)
+{
+    struct jtag_xfer xfer;
+    xfer.type = type;
+    xfer.direction = JTAG_READ_WRITE_XFER;
+    xfer.from = JTAG_STATE_CURRENT;
+    xfer.endstate = endstate;
+    xfer.padding = padding;
+    xfer.length = length;
+    xfer.tdio = (__u64)(uintptr_t)tdio;
+    assert_int_equal(0, JTAG_sim_ioctl(sim, JTAG_IOCXFER, &xfer));
+}
+
+static uint32_t get32(const unsigned char* buffer)
+{
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+void JTAG_sim_create_rejects_invalid_chains_test(void** state)
+{
+    (void)state;
+    assert_null(JTAG_sim_create(""));
+    assert_null(JTAG_sim_create("0x00111113"));
+    assert_null(JTAG_sim_create("0x00111113-1"));
+    assert_null(JTAG_sim_create("0x00111113-33"));
+    assert_null(JTAG_sim_create("0x00111112-16"));
+    assert_null(JTAG_sim_create("0x00111113-16,"));
+    assert_null(JTAG_sim_create("0x00111113-16,x-8"));
+    assert_null(JTAG_sim_create(
+        "0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2,0-2"));
+}
+
+void JTAG_sim_create_default_chain_test(void** state)
+{
+    JTAG_Sim* sim = JTAG_sim_create(NULL);
+    (void)state;
+    assert_non_null(sim);
+    assert_int_equal(2, sim->tap_count);
+    assert_int_equal(jtag_tlr, sim->tap_state);
+    JTAG_sim_destroy(sim);
+}
+
+void JTAG_sim_reset_selects_idcodes_test(void** state)
+{
+    JTAG_Sim* sim = JTAG_sim_create(TEST_CHAIN);
+    unsigned char tdio[12];
+    (void)state;
+    assert_non_null(sim);
+
+    goto_state(sim, JTAG_FORCE_RESET, jtag_shf_dr);
+    memset(tdio, 0, sizeof(tdio));
+    tdio[8] = 0xa5;
+    tdio[9] = 0x5a;
+    xfer(sim, JTAG_SDR_XFER, 0, 96, tdio, jtag_rti);
+
+    // the TAP next to TDO comes out first, then TDI delayed by 64 bits
+    assert_int_equal(TEST_IDCODE_0, get32(&tdio[0]));
+    assert_int_equal(TEST_IDCODE_1, get32(&tdio[4]));
+    assert_int_equal(0, get32(&tdio[8]));
+    assert_int_equal(jtag_rti, sim->tap_state);
+    JTAG_sim_destroy(sim);
+}
+
+void JTAG_sim_ir_capture_and_bypass_test(void** state)
+{
+    JTAG_Sim* sim = JTAG_sim_create(TEST_CHAIN);
+    unsigned char tdio[8];
+    (void)state;
+    assert_non_null(sim);
+
+    // IR captures ...01 in every TAP, the chain is 14 + 16 bits long
+    goto_state(sim, JTAG_FORCE_RESET, jtag_shf_ir);
+    memset(tdio, 0xff, sizeof(tdio));
+    xfer(sim, JTAG_SIR_XFER, 0, 30, tdio, jtag_rti);
+    assert_int_equal(1 | (1 << 14), get32(tdio) & 0x3fffffff);
+    assert_int_equal(0x3fff, sim->taps[0].ir);
+    assert_int_equal(0xffff, sim->taps[1].ir);
+
+    // both TAPs in BYPASS: DR is two bits of 0, TDI comes back 2 bits later
+    goto_state(sim, JTAG_NO_RESET, jtag_shf_dr);
+    tdio[0] = 0xb5;
+    tdio[1] = 0x00;
+    xfer(sim, JTAG_SDR_XFER, 0, 16, tdio, jtag_rti);
+    assert_int_equal((0xb5 << 2) & 0xff, tdio[0]);
+    assert_int_equal(0xb5 >> 6, tdio[1]);
+    JTAG_sim_destroy(sim);
+}
+
+void JTAG_sim_padding_wraps_the_payload_test(void** state)
+{
+    JTAG_Sim* sim = JTAG_sim_create("0x00111113-16,0x00111113-16");
+    union pad_config padding;
+    unsigned char tdio[4];
+    (void)state;
+    assert_non_null(sim);
+
+    // IDCODE on TAP 1 selected, TAP 0 pushed into BYPASS by padding ones
+    // in front of the payload: the payload lands in the TAP next to TDI
+    goto_state(sim, JTAG_FORCE_RESET, jtag_shf_ir);
+    padding.int_value = 0;
+    padding.pre_pad_number = 16;
+    padding.pad_data = 1;
+    tdio[0] = JTAG_SIM_IDCODE_OPCODE;
+    tdio[1] = 0;
+    xfer(sim, JTAG_SIR_XFER, padding.int_value, 16, tdio, jtag_rti);
+    assert_int_equal(0xffff, sim->taps[0].ir);
+    assert_int_equal(JTAG_SIM_IDCODE_OPCODE, sim->taps[1].ir);
+
+    // DR is now 1 bypass bit + 32 bit IDCODE, skip the bypass bit with a
+    // pre pad
+    goto_state(sim, JTAG_NO_RESET, jtag_shf_dr);
+    padding.int_value = 0;
+    padding.pre_pad_number = 1;
+    padding.post_pad_number = 3;
+    memset(tdio, 0, sizeof(tdio));
+    xfer(sim, JTAG_SDR_XFER, padding.int_value, 32, tdio, jtag_rti);
+    assert_int_equal(TEST_IDCODE_1, get32(tdio));
+    JTAG_sim_destroy(sim);
+}
+
+void JTAG_sim_scan_continues_across_xfers_test(void** state)
+{
+    JTAG_Sim* sim = JTAG_sim_create(TEST_CHAIN);
+    unsigned char tdio[4];
+    (void)state;
+    assert_non_null(sim);
+
+    // staying in ShfDR between xfers must not capture again
+    goto_state(sim, JTAG_FORCE_RESET, jtag_shf_dr);
+    memset(tdio, 0, sizeof(tdio));
+    xfer(sim, JTAG_SDR_XFER, 0, 32, tdio, jtag_shf_dr);
+    assert_int_equal(TEST_IDCODE_0, get32(tdio));
+    memset(tdio, 0, sizeof(tdio));
+    xfer(sim, JTAG_SDR_XFER, 0, 32, tdio, jtag_pau_dr);
+    assert_int_equal(TEST_IDCODE_1, get32(tdio));
+    JTAG_sim_destroy(sim);
+}
+
+void JTAG_sim_bitbang_follows_tms_test(void** state)
+{
+    JTAG_Sim* sim = JTAG_sim_create(TEST_CHAIN);
+    struct tck_bitbang bits[6];
+    struct bitbang_packet packet = {bits, 6};
+    uint64_t cycles;
+    (void)state;
+    assert_non_null(sim);
+
+    goto_state(sim, JTAG_FORCE_RESET, jtag_rti);
+    cycles = sim->tck_cycles;
+    // RTI -> SelDR -> CapDR -> ShfDR, then two shifts
+    memset(bits, 0, sizeof(bits));
+    bits[0].tms = 1;
+    bits[5].tms = 1;
+    assert_int_equal(0, JTAG_sim_ioctl(sim, JTAG_IOCBITBANG, &packet));
+    assert_int_equal(jtag_ex1_dr, sim->tap_state);
+    assert_int_equal(cycles + 6, sim->tck_cycles);
+    // IDCODE 0 starts with 1, 1, 0 from its LSB
+    assert_int_equal(1, bits[3].tdo);
+    assert_int_equal(1, bits[4].tdo);
+    assert_int_equal(0, bits[5].tdo);
+    JTAG_sim_destroy(sim);
+}
+
+void JTAG_sim_counts_tck_time_test(void** state)
+{
+    JTAG_Sim* sim = JTAG_sim_create(TEST_CHAIN);
+    unsigned int frequency = 1000000;
+    unsigned char tdio[125];
+    (void)state;
+    assert_non_null(sim);
+
+    assert_int_equal(0, JTAG_sim_ioctl(sim, JTAG_SIOCFREQ, &frequency));
+    goto_state(sim, JTAG_FORCE_RESET, jtag_shf_dr);
+    memset(tdio, 0, sizeof(tdio));
+    sim->tck_cycles = 0;
+    xfer(sim, JTAG_SDR_XFER, 0, 1000, tdio, jtag_shf_dr);
+    assert_int_equal(1000, sim->tck_cycles);
+    assert_int_equal(1000000, JTAG_sim_tck_ns(sim));
+
+    frequency = 0;
+    assert_int_equal(-1, JTAG_sim_ioctl(sim, JTAG_SIOCFREQ, &frequency));
+    assert_int_equal(-1, JTAG_sim_ioctl(sim, 0, &frequency));
+    JTAG_sim_destroy(sim);
+}
+
+void JTAG_handler_runs_on_simulator_test(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    unsigned char tdo[8];
+    (void)state;
+    assert_non_null(jtag);
+
+    assert_int_equal(ST_OK,
+                     JTAG_set_backend(jtag, JTAG_Backend_Simulator, TEST_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, true));
+    assert_non_null(jtag->sim);
+    // the backend can't change under an open handle
+    assert_int_equal(ST_ERR,
+                     JTAG_set_backend(jtag, JTAG_Backend_Driver, NULL));
+
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_rti));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_shf_dr));
+    assert_int_equal(ST_OK, JTAG_shift(jtag, 64, 0, NULL, sizeof(tdo), tdo,
+                                       jtag_rti));
+    assert_int_equal(TEST_IDCODE_0, get32(&tdo[0]));
+    assert_int_equal(TEST_IDCODE_1, get32(&tdo[4]));
+
+    assert_int_equal(ST_OK, JTAG_deinitialize(jtag));
+    assert_null(jtag->sim);
+    free(jtag);
+}
+
+void JTAG_handler_shifts_extended_scan_test(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    static unsigned char tdio[EXT_SCAN_MAX_BITS / 8];
+    unsigned int bits = EXT_SCAN_MAX_BITS;
+    (void)state;
+    assert_non_null(jtag);
+
+    assert_int_equal(ST_OK,
+                     JTAG_set_backend(jtag, JTAG_Backend_Simulator, TEST_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, false));
+    for (unsigned int i = 0; i < sizeof(tdio); i++)
+        tdio[i] = (unsigned char)i;
+
+    // far beyond MAX_DATA_SIZE, still one xfer with TDI and TDO in place
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_shf_dr));
+    assert_int_equal(ST_OK, JTAG_shift(jtag, bits, sizeof(tdio), tdio,
+                                       sizeof(tdio), tdio, jtag_rti));
+    assert_int_equal(TEST_IDCODE_0, get32(&tdio[0]));
+    assert_int_equal(TEST_IDCODE_1, get32(&tdio[4]));
+    // TDI comes back behind the two 32 bit DRs
+    for (unsigned int i = 8; i < sizeof(tdio); i++)
+        assert_int_equal((unsigned char)(i - 8), tdio[i]);
+    assert_int_equal(jtag_rti, jtag->sim->tap_state);
+
+    assert_int_equal(ST_OK, JTAG_deinitialize(jtag));
+    free(jtag);
+}
+
+void JTAG_handler_pads_software_scan_in_one_xfer_test(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    unsigned char tdio[5];
+    uint64_t xfers;
+    (void)state;
+    assert_non_null(jtag);
+
+    assert_int_equal(ST_OK, JTAG_set_backend(jtag, JTAG_Backend_Simulator,
+                                             JTAG_SIM_DEFAULT_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, true));
+
+    // TAP 0 goes to BYPASS through the IR pre pad, TAP 1 selects IDCODE
+    assert_int_equal(ST_OK, JTAG_set_padding(jtag, JTAGPaddingTypes_IRPre, 16));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_shf_ir));
+    tdio[0] = JTAG_SIM_IDCODE_OPCODE;
+    tdio[1] = 0;
+    xfers = jtag->sim->xfers;
+    assert_int_equal(ST_OK,
+                     JTAG_shift(jtag, 16, 2, tdio, 0, NULL, jtag_rti));
+    assert_int_equal(xfers + 1, jtag->sim->xfers);
+    assert_int_equal(0xffff, jtag->sim->taps[0].ir);
+    assert_int_equal(JTAG_SIM_IDCODE_OPCODE, jtag->sim->taps[1].ir);
+
+    // 1 bypass bit in front, a post pad behind, IDCODE comes out unshifted
+    // and the bytes past the payload are left alone
+    assert_int_equal(ST_OK, JTAG_set_padding(jtag, JTAGPaddingTypes_DRPre, 1));
+    assert_int_equal(ST_OK,
+                     JTAG_set_padding(jtag, JTAGPaddingTypes_DRPost, 3));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_shf_dr));
+    memset(tdio, 0xa5, sizeof(tdio));
+    xfers = jtag->sim->xfers;
+    assert_int_equal(ST_OK, JTAG_shift(jtag, 32, 4, tdio, sizeof(tdio), tdio,
+                                       jtag_rti));
+    assert_int_equal(xfers + 1, jtag->sim->xfers);
+    assert_int_equal(TEST_IDCODE_1, get32(tdio));
+    assert_int_equal(0xa5, tdio[4]);
+    assert_int_equal(jtag_rti, jtag->sim->tap_state);
+
+    assert_int_equal(ST_OK, JTAG_deinitialize(jtag));
+    free(jtag);
+}
+
+void JTAG_handler_pads_longest_scan_in_one_xfer_test(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    static unsigned char tdio[EXT_SCAN_MAX_BITS / 8];
+    unsigned int bits = EXT_SCAN_MAX_BITS;
+    uint64_t xfers;
+    (void)state;
+    assert_non_null(jtag);
+
+    assert_int_equal(ST_OK, JTAG_set_backend(jtag, JTAG_Backend_Simulator,
+                                             JTAG_SIM_DEFAULT_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, true));
+    for (unsigned int i = 0; i < sizeof(tdio); i++)
+        tdio[i] = (unsigned char)i;
+
+    // the longest padding on both sides of the longest scan
+    assert_int_equal(ST_OK, JTAG_set_padding(jtag, JTAGPaddingTypes_IRPre,
+                                             IRMAXPADSIZE));
+    assert_int_equal(ST_OK, JTAG_set_padding(jtag, JTAGPaddingTypes_IRPost,
+                                             IRMAXPADSIZE));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_shf_ir));
+    xfers = jtag->sim->xfers;
+    assert_int_equal(ST_OK, JTAG_shift(jtag, bits, sizeof(tdio), tdio,
+                                       sizeof(tdio), tdio, jtag_rti));
+    assert_int_equal(xfers + 1, jtag->sim->xfers);
+
+    // the two 16 bit IRs come out first, the pre pad delays TDI behind them
+    for (unsigned int i = 0; i < 4; i++)
+        assert_int_equal(0xff, tdio[i]);
+    for (unsigned int i = 4; i < sizeof(tdio); i++)
+        assert_int_equal((unsigned char)(i - 4), tdio[i]);
+    // the post pad is what is left in the IRs
+    assert_int_equal(0xffff, jtag->sim->taps[0].ir);
+    assert_int_equal(0xffff, jtag->sim->taps[1].ir);
+    assert_int_equal(jtag_rti, jtag->sim->tap_state);
+
+    assert_int_equal(ST_OK, JTAG_deinitialize(jtag));
+    free(jtag);
+}
+
+void JTAG_handler_waits_with_and_without_tck_test(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    uint64_t cycles;
+    (void)state;
+    assert_non_null(jtag);
+
+    assert_int_equal(ST_OK,
+                     JTAG_set_backend(jtag, JTAG_Backend_Simulator, TEST_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, true));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_rti));
+
+    // a fused wait is clocked in as many bitbang packets as it takes
+    assert_int_equal(ST_OK, JTAG_sync_tap_state(jtag));
+    cycles = jtag->sim->tck_cycles;
+    assert_int_equal(ST_OK, JTAG_wait_cycles(jtag, 3 * MAX_WAIT_CYCLES + 5));
+    assert_int_equal(cycles + 3 * MAX_WAIT_CYCLES + 5, jtag->sim->tck_cycles);
+
+    // with TCK idle the wait is slept, the TAP is moved there first
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_pau_dr));
+    assert_int_equal(ST_OK, JTAG_wait_idle(jtag, 1000));
+    assert_int_equal(APB_FREQ, jtag->tck_frequency);
+    assert_int_equal(jtag_pau_dr, jtag->sim->tap_state);
+    cycles = jtag->sim->tck_cycles;
+    assert_int_equal(ST_OK, JTAG_wait_idle(jtag, 1000));
+    assert_int_equal(cycles, jtag->sim->tck_cycles);
+
+    assert_int_equal(ST_OK, JTAG_deinitialize(jtag));
+    free(jtag);
+}
+
+void JTAG_handler_elides_redundant_tap_states_test(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    (void)state;
+    assert_non_null(jtag);
+
+    assert_int_equal(ST_OK,
+                     JTAG_set_backend(jtag, JTAG_Backend_Simulator, TEST_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, true));
+    assert_int_equal(1, jtag->tap_stats.ioctls);
+
+    // RTI->SelDR->CapDR->Ex1DR->UpdDR->RTI without a scan, plus a no-op
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_rti));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_rti));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_sel_dr));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_cap_dr));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_ex1_dr));
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_upd_dr));
+    assert_int_equal(1, jtag->tap_stats.ioctls);
+    // leaving the path flushes the move to Update-DR
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_rti));
+    assert_int_equal(1 + 1, jtag->tap_stats.ioctls);
+    assert_int_equal(jtag_upd_dr, jtag->sim->tap_state);
+    assert_int_equal(jtag_rti, jtag->active_chain->tap_state);
+    assert_int_equal(jtag_upd_dr, jtag->active_chain->driver_tap_state);
+
+    assert_int_equal(ST_OK, JTAG_sync_tap_state(jtag));
+    assert_int_equal(ST_OK, JTAG_sync_tap_state(jtag));
+    assert_int_equal(8, jtag->tap_stats.requests);
+    assert_int_equal(1 + 2, jtag->tap_stats.ioctls);
+    assert_int_equal(jtag_rti, jtag->sim->tap_state);
+    // the TAP saw every state it was asked for: 5 reset cycles and 6 moves
+    assert_int_equal(5 + 6, jtag->sim->tck_cycles);
+
+    assert_int_equal(ST_OK, JTAG_deinitialize(jtag));
+    free(jtag);
+}
+
+void JTAG_handler_resyncs_tap_state_test(void** state)
+{
+    JTAG_Handler* jtag = JTAGHandler();
+    JTAG_Sim* sim;
+    unsigned char tdo[8];
+    (void)state;
+    assert_non_null(jtag);
+
+    assert_int_equal(ST_OK,
+                     JTAG_set_backend(jtag, JTAG_Backend_Simulator, TEST_CHAIN));
+    assert_int_equal(ST_OK, JTAG_initialize(jtag, true));
+    sim = jtag->sim;
+
+    // the deferred move fails on a dead driver handle
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_shf_dr));
+    jtag->sim = NULL;
+    assert_int_equal(ST_ERR, JTAG_sync_tap_state(jtag));
+    assert_true(jtag->active_chain->tap_resync);
+    jtag->sim = sim;
+
+    // the same state is not elided until the driver confirmed it
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_shf_dr));
+    assert_int_equal(ST_OK, JTAG_shift(jtag, 64, 0, NULL, sizeof(tdo), tdo,
+                                       jtag_ex1_dr));
+    assert_false(jtag->active_chain->tap_resync);
+    assert_int_equal(TEST_IDCODE_0, get32(&tdo[0]));
+
+    // a reset always reaches the driver and brings both states back to TLR
+    assert_int_equal(ST_OK, JTAG_set_tap_state(jtag, jtag_pau_dr));
+    assert_int_equal(ST_OK, JTAG_tap_reset(jtag));
+    assert_int_equal(jtag_tlr, jtag->active_chain->tap_state);
+    assert_int_equal(jtag_tlr, jtag->active_chain->driver_tap_state);
+    assert_int_equal(jtag_tlr, jtag->sim->tap_state);
+
+    assert_int_equal(ST_OK, JTAG_deinitialize(jtag));
+    free(jtag);
+}
+
+int main()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(JTAG_sim_create_rejects_invalid_chains_test),
+        cmocka_unit_test(JTAG_sim_create_default_chain_test),
+        cmocka_unit_test(JTAG_sim_reset_selects_idcodes_test),
+        cmocka_unit_test(JTAG_sim_ir_capture_and_bypass_test),
+        cmocka_unit_test(JTAG_sim_padding_wraps_the_payload_test),
+        cmocka_unit_test(JTAG_sim_scan_continues_across_xfers_test),
+        cmocka_unit_test(JTAG_sim_bitbang_follows_tms_test),
+        cmocka_unit_test(JTAG_sim_counts_tck_time_test),
+        cmocka_unit_test(JTAG_handler_runs_on_simulator_test),
+        cmocka_unit_test(JTAG_handler_shifts_extended_scan_test),
+        cmocka_unit_test(JTAG_handler_pads_software_scan_in_one_xfer_test),
+        cmocka_unit_test(JTAG_handler_pads_longest_scan_in_one_xfer_test),
+        cmocka_unit_test(JTAG_handler_waits_with_and_without_tck_test),
+        cmocka_unit_test(JTAG_handler_elides_redundant_tap_states_test),
+        cmocka_unit_test(JTAG_handler_resyncs_tap_state_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
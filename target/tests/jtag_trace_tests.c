@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2023, Intel Corporation
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Intel Corporation nor the names of its contributors
+      may be used to endorse or promote products derived from this software
+      without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../jtag_trace.h"
+#include "logging.h"
+#include "cmocka.h"
+
+#define SMALL_RING_SIZE (2 * (sizeof(JTAG_Trace_Record) + 2 * MAX_DATA_SIZE))
+
+static char trace_path[] = "/tmp/jtag_trace_testXXXXXX";
+
+void __wrap_ASD_log(ASD_LogLevel level, ASD_LogStream stream,
+                    ASD_LogOption options, const char* format, ...)
+{
+    (void)level;
+    (void)stream;
+    (void)options;
+    (void)format;
+}
+
+static int setup(void** state)
+{
+    int fd;
+    (void)state;
+    strcpy(trace_path, "/tmp/jtag_trace_testXXXXXX");
+    fd = mkstemp(trace_path);
+    assert_true(fd != -1);
+    close(fd);
+    return 0;
+}
+
+static int teardown(void** state)
+{
+    (void)state;
+    unlink(trace_path);
+    return 0;
+}
+
+static void record_shift(JTAG_Trace* trace, uint32_t bits, uint8_t fill)
+{
+    unsigned char tdi[64];
+    unsigned char tdo[64];
+    unsigned int bytes = (bits + 7) / 8;
+    JTAG_Trace_Record* record;
+
+    memset(tdi, fill, sizeof(tdi));
+    memset(tdo, (uint8_t)~fill, sizeof(tdo));
+    record = JTAG_trace_begin(trace, JTAG_Trace_Op_Shift, 4, 6, bits, bytes,
+                              tdi, bytes);
+    assert_non_null(record);
+    JTAG_trace_commit(trace, record, tdo, ST_OK);
+}
+
+void JTAG_trace_open_invalid_params_test(void** state)
+{
+    (void)state;
+    assert_null(JTAG_trace_open(NULL, JTAG_TRACE_DEFAULT_SIZE));
+    assert_null(JTAG_trace_open(trace_path, 64));
+}
+
+void JTAG_trace_map_rejects_other_files_test(void** state)
+{
+    FILE* fp = fopen(trace_path, "w");
+    (void)state;
+    assert_non_null(fp);
+    fputs("not a trace", fp);
+    fclose(fp);
+
+    assert_null(JTAG_trace_map(trace_path));
+}
+
+void JTAG_trace_records_read_back_in_order_test(void** state)
+{
+    JTAG_Trace* writer = JTAG_trace_open(trace_path, SMALL_RING_SIZE);
+    JTAG_Trace* reader;
+    JTAG_Trace_Record* record;
+    const JTAG_Trace_Record* read;
+    (void)state;
+    assert_non_null(writer);
+
+    record_shift(writer, 12, 0x5a);
+    record = JTAG_trace_begin(writer, JTAG_Trace_Op_TapState, 4, 1, 0, 0, NULL,
+                              0);
+    assert_non_null(record);
+    JTAG_trace_commit(writer, record, NULL, ST_ERR);
+
+    reader = JTAG_trace_map(trace_path);
+    assert_non_null(reader);
+
+    read = JTAG_trace_next(reader);
+    assert_non_null(read);
+    assert_int_equal(JTAG_Trace_Op_Shift, read->op);
+    assert_int_equal(12, read->value);
+    assert_int_equal(4, read->start_state);
+    assert_int_equal(6, read->end_state);
+    assert_int_equal(0, read->flags);
+    assert_int_equal(2, read->tdi_bytes);
+    assert_int_equal(2, read->tdo_bytes);
+    assert_int_equal(0x5a, JTAG_trace_tdi(read)[1]);
+    assert_int_equal(0xa5, JTAG_trace_tdo(read)[1]);
+
+    read = JTAG_trace_next(reader);
+    assert_non_null(read);
+    assert_int_equal(JTAG_Trace_Op_TapState, read->op);
+    assert_int_equal(JTAG_TRACE_FLAG_FAILED, read->flags);
+
+    assert_null(JTAG_trace_next(reader));
+
+    JTAG_trace_close(reader);
+    JTAG_trace_close(writer);
+}
+
+void JTAG_trace_uncommitted_record_is_not_visible_test(void** state)
+{
+    JTAG_Trace* writer = JTAG_trace_open(trace_path, SMALL_RING_SIZE);
+    JTAG_Trace* reader;
+    unsigned char tdi = 1;
+    (void)state;
+    assert_non_null(writer);
+
+    assert_non_null(JTAG_trace_begin(writer, JTAG_Trace_Op_Shift, 4, 4, 8, 1,
+                                     &tdi, 1));
+
+    reader = JTAG_trace_map(trace_path);
+    assert_non_null(reader);
+    assert_null(JTAG_trace_next(reader));
+
+    JTAG_trace_close(reader);
+    JTAG_trace_close(writer);
+}
+
+void JTAG_trace_full_ring_drops_oldest_test(void** state)
+{
+    JTAG_Trace* writer = JTAG_trace_open(trace_path, SMALL_RING_SIZE);
+    JTAG_Trace* reader;
+    const JTAG_Trace_Record* read;
+    uint32_t expected;
+    uint32_t count = 0;
+    (void)state;
+    assert_non_null(writer);
+
+    // bit counts double as sequence numbers, enough to wrap several times
+    for (uint32_t i = 1; i <= 2000; i++)
+        record_shift(writer, (i % 500) + 1, (uint8_t)i);
+
+    reader = JTAG_trace_map(trace_path);
+    assert_non_null(reader);
+    assert_true(reader->header->dropped > 0);
+
+    read = JTAG_trace_next(reader);
+    assert_non_null(read);
+    expected = read->value;
+    while (read != NULL)
+    {
+        assert_int_equal(expected, read->value);
+        expected = (expected % 500) + 1;
+        count++;
+        read = JTAG_trace_next(reader);
+    }
+    assert_int_equal(2000, count + reader->header->dropped);
+    // the newest record is the last one read
+    assert_int_equal((2000 % 500) + 2, expected);
+
+    JTAG_trace_close(reader);
+    JTAG_trace_close(writer);
+}
+
+int main()
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(JTAG_trace_open_invalid_params_test,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_trace_map_rejects_other_files_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_trace_records_read_back_in_order_test, setup, teardown),
+        cmocka_unit_test_setup_teardown(
+            JTAG_trace_uncommitted_record_is_not_visible_test, setup,
+            teardown),
+        cmocka_unit_test_setup_teardown(JTAG_trace_full_ring_drops_oldest_test,
+                                        setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}